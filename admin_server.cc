@@ -0,0 +1,501 @@
+#include "admin_server.h"
+#include "circuit_breaker.h"
+#include "registry.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+namespace cppbreaker
+{
+
+    namespace
+    {
+        const uint64_t kListenTag = 0;
+        const uint64_t kEventTag = ~uint64_t(0);
+
+        void appendJsonString(std::string* out, const std::string& v)
+        {
+            out->push_back('"');
+            for (char c : v)
+            {
+                if (c == '"' || c == '\\')
+                {
+                    out->push_back('\\');
+                    out->push_back(c);
+                }
+                else if ((unsigned char)c < 0x20)
+                {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    out->append(buf);
+                }
+                else
+                {
+                    out->push_back(c);
+                }
+            }
+            out->push_back('"');
+        }
+
+        void appendField(std::string* out, const char* key, uint64_t v)
+        {
+            out->append(",\"");
+            out->append(key);
+            out->append("\":");
+            out->append(std::to_string(v));
+        }
+
+        void appendField(std::string* out, const char* key, const std::string& v)
+        {
+            out->append(",\"");
+            out->append(key);
+            out->append("\":");
+            appendJsonString(out, v);
+        }
+
+        // appendCodes appends codes as an array of {"code","count","error"}
+        void appendCodes(std::string* out, const char* key, const std::vector<CodeCount>& codes)
+        {
+            out->append(",\"");
+            out->append(key);
+            out->append("\":[");
+            for (size_t i = 0; i < codes.size(); i++)
+            {
+                if (i != 0)
+                    out->push_back(',');
+                out->append("{\"code\":");
+                out->append(std::to_string(codes[i].code));
+                appendField(out, "count", codes[i].count);
+                appendField(out, "error", codes[i].error);
+                out->push_back('}');
+            }
+            out->push_back(']');
+        }
+
+        void appendError(std::string* out, const std::string& msg)
+        {
+            out->append("{\"error\":");
+            appendJsonString(out, msg);
+            out->append("}\n");
+        }
+
+        // Word is a word of a command, in place in the input buffer
+        struct Word
+        {
+            const char* p;
+            size_t n;
+
+            bool Is(const char* s) const
+            {
+                return strlen(s) == n && memcmp(p, s, n) == 0;
+            }
+            bool Prefixes(const std::string& name) const
+            {
+                return (n == 1 && p[0] == '*') || (name.size() >= n && memcmp(name.data(), p, n) == 0);
+            }
+            bool Names(const std::string& name) const
+            {
+                return name.size() == n && memcmp(name.data(), p, n) == 0;
+            }
+        };
+
+        const size_t kMaxWords = 3;
+
+        // splitWords fills words with the first kMaxWords words of line and returns how many words it has
+        size_t splitWords(const char* line, size_t len, Word* words)
+        {
+            size_t count = 0;
+            size_t i = 0;
+            while (i < len)
+            {
+                while (i < len && (line[i] == ' ' || line[i] == '\t' || line[i] == '\r'))
+                    i++;
+                size_t j = i;
+                while (j < len && line[j] != ' ' && line[j] != '\t' && line[j] != '\r')
+                    j++;
+                if (j > i)
+                {
+                    if (count < kMaxWords)
+                        words[count] = Word{line + i, j - i};
+                    count++;
+                }
+                i = j;
+            }
+            return count;
+        }
+    }
+
+    AdminServer::~AdminServer()
+    {
+        Stop();
+    }
+
+    bool AdminServer::Start(const std::string& path)
+    {
+        return Start(path, Registry::Instance());
+    }
+
+    bool AdminServer::Start(const std::string& path, Registry& registry)
+    {
+        if (thread_.joinable())
+            return false;
+
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(addr.sun_path))
+            return false;
+        memcpy(addr.sun_path, path.data(), path.size());
+
+        listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (listen_fd_ < 0 || epoll_fd_ < 0 || event_fd_ < 0)
+        {
+            Stop();
+            return false;
+        }
+
+        unlink(path.c_str());
+        if (bind(listen_fd_, (sockaddr*)&addr, sizeof(addr)) != 0 ||
+            listen(listen_fd_, kMaxConnections) != 0)
+        {
+            Stop();
+            return false;
+        }
+        path_ = path;
+
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u64 = kListenTag;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev);
+        ev.data.u64 = kEventTag;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, event_fd_, &ev);
+
+        registry_ = &registry;
+        connections_.resize(kMaxConnections);
+        thread_ = std::thread(&AdminServer::run, this);
+        return true;
+    }
+
+    void AdminServer::Stop()
+    {
+        if (thread_.joinable())
+        {
+            uint64_t one = 1;
+            ssize_t n = write(event_fd_, &one, sizeof(one));
+            (void)n;
+            thread_.join();
+        }
+        for (auto& conn : connections_)
+            closeConnection(&conn);
+
+        if (listen_fd_ >= 0)
+            close(listen_fd_);
+        if (epoll_fd_ >= 0)
+            close(epoll_fd_);
+        if (event_fd_ >= 0)
+            close(event_fd_);
+        listen_fd_ = epoll_fd_ = event_fd_ = -1;
+
+        if (!path_.empty())
+            unlink(path_.c_str());
+        path_.clear();
+    }
+
+    void AdminServer::run()
+    {
+        epoll_event events[kMaxConnections + 2];
+        for (;;)
+        {
+            int n = epoll_wait(epoll_fd_, events, kMaxConnections + 2, -1);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return;
+            }
+
+            for (int i = 0; i < n; i++)
+            {
+                uint64_t tag = events[i].data.u64;
+                if (tag == kEventTag)
+                    return;
+
+                if (tag == kListenTag)
+                {
+                    int fd;
+                    while ((fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+                    {
+                        Connection* conn = nullptr;
+                        int idx = 0;
+                        for (; idx < kMaxConnections; idx++)
+                        {
+                            if (connections_[idx].fd < 0)
+                            {
+                                conn = &connections_[idx];
+                                break;
+                            }
+                        }
+                        if (conn == nullptr)
+                        {
+                            close(fd);
+                            continue;
+                        }
+                        conn->fd = fd;
+                        conn->in_len = 0;
+                        conn->out.clear();
+                        conn->out_pos = 0;
+
+                        epoll_event ev;
+                        ev.events = EPOLLIN | EPOLLRDHUP;
+                        ev.data.u64 = uint64_t(idx) + 1;
+                        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev);
+                    }
+                    continue;
+                }
+
+                Connection* conn = &connections_[tag - 1];
+                if (conn->fd < 0)
+                    continue;
+                if (events[i].events & (EPOLLERR | EPOLLHUP))
+                {
+                    closeConnection(conn);
+                    continue;
+                }
+                if (events[i].events & EPOLLOUT)
+                {
+                    if (!flush(conn))
+                        continue;
+                }
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP))
+                    onReadable(conn);
+            }
+        }
+    }
+
+    void AdminServer::closeConnection(Connection* conn)
+    {
+        if (conn->fd < 0)
+            return;
+        if (epoll_fd_ >= 0)
+            epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, conn->fd, nullptr);
+        close(conn->fd);
+        conn->fd = -1;
+        conn->in_len = 0;
+        conn->out.clear();
+        conn->out_pos = 0;
+    }
+
+    void AdminServer::onReadable(Connection* conn)
+    {
+        // do not read further commands while an answer is pending
+        if (conn->out_pos < conn->out.size())
+            return;
+
+        for (;;)
+        {
+            ssize_t n = read(conn->fd, conn->in + conn->in_len, kLineSize - conn->in_len);
+            if (n == 0)
+            {
+                closeConnection(conn);
+                return;
+            }
+            if (n < 0)
+            {
+                if (errno != EAGAIN && errno != EINTR)
+                    closeConnection(conn);
+                return;
+            }
+            conn->in_len += size_t(n);
+
+            size_t start = 0;
+            for (size_t i = 0; i < conn->in_len; i++)
+            {
+                if (conn->in[i] != '\n')
+                    continue;
+                Handle(conn->in + start, i - start, &conn->out);
+                start = i + 1;
+            }
+            if (start == 0 && conn->in_len == kLineSize)
+            {
+                appendError(&conn->out, "command too long");
+                conn->in_len = 0;
+            }
+            else if (start > 0)
+            {
+                memmove(conn->in, conn->in + start, conn->in_len - start);
+                conn->in_len -= start;
+            }
+
+            if (!conn->out.empty() && !flush(conn))
+                return;
+            if (conn->out_pos < conn->out.size())
+                return;
+        }
+    }
+
+    bool AdminServer::flush(Connection* conn)
+    {
+        while (conn->out_pos < conn->out.size())
+        {
+            ssize_t n = send(conn->fd, conn->out.data() + conn->out_pos, conn->out.size() - conn->out_pos,
+                MSG_NOSIGNAL);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (errno != EAGAIN)
+                {
+                    closeConnection(conn);
+                    return false;
+                }
+                // input is left unread until the answer is out, level triggered EPOLLIN would spin
+                epoll_event ev;
+                ev.events = EPOLLOUT;
+                ev.data.u64 = uint64_t(conn - &connections_[0]) + 1;
+                epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, conn->fd, &ev);
+                return true;
+            }
+            conn->out_pos += size_t(n);
+        }
+
+        // keep the capacity of out for the next answer
+        conn->out.clear();
+        conn->out_pos = 0;
+        epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.u64 = uint64_t(conn - &connections_[0]) + 1;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, conn->fd, &ev);
+        return true;
+    }
+
+    void AdminServer::Handle(const std::string& line, std::string* out)
+    {
+        Handle(line.data(), line.size(), out);
+    }
+
+    void AdminServer::Handle(const char* line, size_t len, std::string* out)
+    {
+        Word words[kMaxWords];
+        size_t count = splitWords(line, len, words);
+        if (count == 0)
+        {
+            appendError(out, "empty command");
+            return;
+        }
+
+        const Word& cmd = words[0];
+        if (cmd.Is("list") && count == 1)
+        {
+            out->push_back('[');
+            bool first = true;
+            registry_->ForEach([&](CircuitBreaker* cb) {
+                const BreakerMetrics& m = cb->Metrics();
+                if (!first)
+                    out->push_back(',');
+                first = false;
+                out->append("{\"id\":");
+                out->append(std::to_string(cb->GetId()));
+                appendField(out, "name", cb->GetName());
+                appendField(out, "state",
+                    CircuitBreaker::StateString(State(m.state.load(std::memory_order_relaxed))));
+                appendField(out, "requests", m.requests.Load());
+                appendField(out, "successes", m.successes.Load());
+                appendField(out, "failures", m.failures.Load());
+                appendField(out, "rejected_open", m.rejected_open.Load());
+                appendField(out, "rejected_too_many", m.rejected_too_many.Load());
+                appendField(out, "transitions", m.transitions.Load());
+                out->push_back('}');
+            });
+            out->append("]\n");
+        }
+        else if (cmd.Is("snapshot") && count == 2)
+        {
+            // GetSnapshot may run on_state_change, the registry is locked only to find the breakers
+            matched_.clear();
+            registry_->ForEachId([&](uint32_t id, CircuitBreaker* cb) {
+                if (words[1].Names(cb->GetName()))
+                    matched_.push_back(id);
+            });
+            out->push_back('[');
+            bool first = true;
+            for (uint32_t id : matched_)
+            {
+                registry_->With(id, [&](CircuitBreaker* cb) {
+                    if (!words[1].Names(cb->GetName()))
+                        return;
+                    Snapshot snap = cb->GetSnapshot();
+                    if (!first)
+                        out->push_back(',');
+                    first = false;
+                    out->append("{\"id\":");
+                    out->append(std::to_string(cb->GetId()));
+                    appendField(out, "name", cb->GetName());
+                    appendField(out, "state", CircuitBreaker::StateString(snap.state));
+                    appendField(out, "override", CircuitBreaker::OverrideString(snap.override));
+                    appendField(out, "generation", snap.generation);
+                    appendField(out, "requests", snap.counts.requests);
+                    appendField(out, "total_successes", snap.counts.total_successes);
+                    appendField(out, "total_failures", snap.counts.total_failures);
+                    appendField(out, "consecutive_successes", snap.counts.consecutive_successes);
+                    appendField(out, "consecutive_failures", snap.counts.consecutive_failures);
+                    auto expiry = std::chrono::duration_cast<std::chrono::milliseconds>(snap.expiry.time_since_epoch());
+                    appendField(out, "expiry_ms", uint64_t(expiry.count() < 0 ? 0 : expiry.count()));
+                    appendCodes(out, "top_codes", snap.top_codes);
+                    appendCodes(out, "window_codes", snap.window_codes);
+                    out->push_back('}');
+                });
+            }
+            out->append("]\n");
+        }
+        else if (cmd.Is("force") && count == 3)
+        {
+            const Word& prefix = words[1];
+            const Word& mode = words[2];
+            if (!mode.Is("open") && !mode.Is("closed") && !mode.Is("disabled") && !mode.Is("none"))
+            {
+                appendError(out, "unknown mode " + std::string(mode.p, mode.n));
+                return;
+            }
+
+            // the registry is locked only to find the breakers, their callbacks run without it
+            matched_.clear();
+            registry_->ForEachId([&](uint32_t id, CircuitBreaker* cb) {
+                if (prefix.Prefixes(cb->GetName()))
+                    matched_.push_back(id);
+            });
+            uint64_t matched = 0;
+            for (uint32_t id : matched_)
+            {
+                registry_->With(id, [&](CircuitBreaker* cb) {
+                    // the id may belong to another breaker by now
+                    if (!prefix.Prefixes(cb->GetName()))
+                        return;
+                    matched++;
+                    if (mode.Is("open"))
+                        cb->SetOverride(OVERRIDE_FORCE_OPEN);
+                    else if (mode.Is("disabled"))
+                        cb->SetOverride(OVERRIDE_DISABLED);
+                    else if (mode.Is("closed"))
+                        cb->Reset();
+                    else
+                        cb->SetOverride(OVERRIDE_NONE);
+                });
+            }
+            out->append("{\"matched\":");
+            out->append(std::to_string(matched));
+            out->append("}\n");
+        }
+        else
+        {
+            appendError(out, "unknown command " + std::string(line, len));
+        }
+    }
+}
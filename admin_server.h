@@ -0,0 +1,72 @@
+#pragma once
+
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace cppbreaker
+{
+    class Registry;
+
+    // AdminServer serves live introspection and overrides of the registered breakers
+    // on a Unix domain socket, from a single epoll thread.
+    //
+    // The protocol is line based, every command is answered with one line of JSON:
+    //   list                         all breakers with their state and cumulative counters
+    //   snapshot <name>              state, override, generation and Counts of the breakers called name
+    //   force <prefix> open          pin every breaker whose name starts with prefix open
+    //   force <prefix> disabled      pin them closed, they never trip
+    //   force <prefix> closed        reset them to closed, they may trip again
+    //   force <prefix> none          release the pin
+    // A prefix of * matches every breaker.
+    class AdminServer
+    {
+    public:
+        // kMaxConnections clients are served at once, further ones are closed immediately.
+        static const int kMaxConnections = 16;
+        // kLineSize is the longest accepted command
+        static const size_t kLineSize = 1024;
+
+        AdminServer() {}
+        ~AdminServer();
+
+        AdminServer(const AdminServer&) = delete;
+        AdminServer& operator=(const AdminServer&) = delete;
+
+        // Start binds path, replacing a stale socket file, and starts the server thread.
+        bool Start(const std::string& path);
+        bool Start(const std::string& path, Registry& registry);
+        void Stop();
+
+        // Handle runs one command and writes its JSON answer into out, it is used by the server thread.
+        // Snapshots are taken and overrides applied after the registry is walked, with only the breaker
+        // pinned, so that on_state_change may construct or destroy breakers.
+        void Handle(const std::string& line, std::string* out);
+        void Handle(const char* line, size_t len, std::string* out);
+
+    private:
+        struct Connection
+        {
+            int fd = -1;
+            size_t in_len = 0;
+            char in[kLineSize];
+            std::string out;
+            size_t out_pos = 0;
+        };
+
+        void run();
+        void closeConnection(Connection* conn);
+        void onReadable(Connection* conn);
+        bool flush(Connection* conn);
+
+        Registry* registry_ = nullptr;
+        std::string path_;
+        int listen_fd_ = -1;
+        int epoll_fd_ = -1;
+        int event_fd_ = -1;
+        std::vector<Connection> connections_;
+        // ids of the breakers matched by a snapshot or force command, reused between commands
+        std::vector<uint32_t> matched_;
+        std::thread thread_;
+    };
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace cppbreaker
+{
+    // Word128 is two 64-bit words swapped together by CompareExchange128. It must be 16-byte aligned.
+    struct alignas(16) Word128
+    {
+        uint64_t lo;
+        uint64_t hi;
+    };
+
+    // SpinLock128 returns the spin lock of word for CompareExchange128 without cmpxchg16b,
+    // locks are striped by address
+    std::atomic_flag* SpinLock128(const void* word);
+
+    // CompareExchange128 replaces *word with desired if it equals *expected, else loads it into *expected.
+    // It is a lock cmpxchg16b on x86-64 and takes a striped spin lock elsewhere.
+    inline bool CompareExchange128(Word128* word, Word128* expected, Word128 desired)
+    {
+#if defined(__x86_64__)
+        bool ok;
+        __asm__ __volatile__ (
+            "lock cmpxchg16b %1"
+            : "=@ccz" (ok), "+m" (*word), "+a" (expected->lo), "+d" (expected->hi)
+            : "b" (desired.lo), "c" (desired.hi)
+            : "memory");
+        return ok;
+#else
+        std::atomic_flag* lock = SpinLock128(word);
+        while (lock->test_and_set(std::memory_order_acquire))
+            ;
+        bool ok = word->lo == expected->lo && word->hi == expected->hi;
+        if (ok)
+            *word = desired;
+        else
+            *expected = *word;
+        lock->clear(std::memory_order_release);
+        return ok;
+#endif
+    }
+
+    // Peek128 reads the halves of *word separately, possibly torn, as the first guess of a swap
+    inline Word128 Peek128(const Word128* word)
+    {
+        return Word128{__atomic_load_n(&word->lo, __ATOMIC_RELAXED), __atomic_load_n(&word->hi, __ATOMIC_RELAXED)};
+    }
+
+    // Load128 reads *word at once, by swapping it for itself. The swap takes the cache line exclusive,
+    // observers that do not decide anything with the value use Read128.
+    inline Word128 Load128(Word128* word)
+    {
+        Word128 cur = Peek128(word);
+        CompareExchange128(word, &cur, cur);
+        return cur;
+    }
+
+    // Read128 reads *word with plain loads until two readings agree, leaving its cache line shared.
+    // A value changed and changed back between the readings may pass, which is harmless for values
+    // that are only displayed.
+    inline Word128 Read128(const Word128* word)
+    {
+        Word128 cur = Peek128(word);
+        for (;;)
+        {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            Word128 again = Peek128(word);
+            if (again.lo == cur.lo && again.hi == cur.hi)
+                return cur;
+            cur = again;
+        }
+    }
+
+    // Store128 replaces *word at once
+    inline void Store128(Word128* word, Word128 desired)
+    {
+        Word128 cur = Peek128(word);
+        while (!CompareExchange128(word, &cur, desired))
+            ;
+    }
+
+    // Update128 swaps *word for fn(*word), retried until no other thread got in between, and returns
+    // the value it stored. fn must not have side effects, it may run several times.
+    template<typename Function_>
+    Word128 Update128(Word128* word, Function_ fn)
+    {
+        Word128 cur = Peek128(word);
+        for (;;)
+        {
+            Word128 next = fn(cur);
+            if (CompareExchange128(word, &cur, next))
+                return next;
+        }
+    }
+
+    // LockFree128 returns whether CompareExchange128 is lock free
+    inline bool LockFree128()
+    {
+#if defined(__x86_64__)
+        return true;
+#else
+        return false;
+#endif
+    }
+}
@@ -0,0 +1,363 @@
+#include "breaker_set.h"
+#include "numa.h"
+#include "registry.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <sys/mman.h>
+#include <thread>
+
+
+namespace cppbreaker
+{
+
+    namespace
+    {
+        // breakers built by one thread at least, fewer are not worth a thread
+        const size_t kMinChunk = 4096;
+
+        bool parseDuration(const std::string& v, std::chrono::nanoseconds* d)
+        {
+            char* end = nullptr;
+            double n = strtod(v.c_str(), &end);
+            if (end == v.c_str() || n < 0)
+                return false;
+            std::string unit(end);
+            double ns;
+            if (unit == "ms")
+                ns = n * 1e6;
+            else if (unit == "s")
+                ns = n * 1e9;
+            else if (unit == "m")
+                ns = n * 60e9;
+            else
+                return false;
+            *d = std::chrono::nanoseconds(int64_t(ns));
+            return true;
+        }
+
+        bool parseCount(const std::string& v, uint32_t* n)
+        {
+            if (v.empty() || v[0] < '0' || v[0] > '9')
+                return false;
+            char* end = nullptr;
+            errno = 0;
+            unsigned long x = strtoul(v.c_str(), &end, 10);
+            if (*end != '\0' || errno == ERANGE || x > UINT32_MAX)
+                return false;
+            *n = uint32_t(x);
+            return true;
+        }
+
+        bool isSpace(char c)
+        {
+            return c == ' ' || c == '\t' || c == '\r';
+        }
+
+        // FNV-1a
+        uint64_t hashName(const char* name, size_t len)
+        {
+            uint64_t h = 14695981039346656037ULL;
+            for (size_t i = 0; i < len; i++)
+            {
+                h ^= uint8_t(name[i]);
+                h *= 1099511628211ULL;
+            }
+            return h;
+        }
+    }
+
+    BreakerSet::~BreakerSet()
+    {
+        for (size_t i = 0; i < size_; i++)
+            At(i)->~CircuitBreaker();
+        Numa::Free(storage_, storage_size_);
+    }
+
+    bool BreakerSet::DefineClass(const std::string& name, const Settings& settings)
+    {
+        if (findClass(name.data(), name.size()) >= 0)
+            return false;
+        classes_.push_back(Class{ name, settings });
+        CircuitBreaker::applyDefaults(&classes_.back().settings);
+        return true;
+    }
+
+    const Settings* BreakerSet::GetClass(const std::string& name) const
+    {
+        for (auto& c : classes_)
+        {
+            if (c.name == name)
+                return &c.settings;
+        }
+        return nullptr;
+    }
+
+    int BreakerSet::findClass(const char* name, size_t len) const
+    {
+        for (size_t i = 0; i < classes_.size(); i++)
+        {
+            const std::string& c = classes_[i].name;
+            if (c.size() == len && memcmp(c.data(), name, len) == 0)
+                return int(i);
+        }
+        return -1;
+    }
+
+    bool BreakerSet::Load(const std::string& path, std::string* error, unsigned threads)
+    {
+        std::ifstream in(path, std::ios::binary);
+        if (!in)
+        {
+            *error = "cannot read " + path;
+            return false;
+        }
+        std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        return Parse(data.data(), data.size(), error, threads);
+    }
+
+    bool BreakerSet::parseClass(const std::string& line, std::string* error)
+    {
+        std::istringstream in(line);
+        std::string word, name;
+        in >> word >> name;
+        if (name.empty())
+        {
+            *error = "class without a name";
+            return false;
+        }
+        if (findClass(name.data(), name.size()) >= 0)
+        {
+            *error = "class " + name + " defined twice";
+            return false;
+        }
+
+        Settings st;
+        std::string kv;
+        while (in >> kv)
+        {
+            auto eq = kv.find('=');
+            std::string key = kv.substr(0, eq);
+            std::string value = eq == std::string::npos ? "" : kv.substr(eq + 1);
+            bool ok = eq != std::string::npos;
+            if (key == "trip")
+            {
+                // the expression is the rest of the line
+                std::string rest;
+                std::getline(in, rest);
+                std::string err;
+                st.trip_expression = TripExpression::Compile(value + rest, &err);
+                if (st.trip_expression == nullptr)
+                {
+                    *error = "class " + name + ": " + err;
+                    return false;
+                }
+            }
+            else if (key == "timeout")
+                ok = ok && parseDuration(value, &st.timeout);
+            else if (key == "interval")
+                ok = ok && parseDuration(value, &st.interval);
+            else if (key == "max_requests")
+                ok = ok && parseCount(value, &st.max_requests);
+            else
+                ok = false;
+            if (!ok)
+            {
+                *error = "class " + name + ": bad setting " + kv;
+                return false;
+            }
+        }
+        return DefineClass(name, st);
+    }
+
+    bool BreakerSet::Parse(const char* data, size_t size, std::string* error, unsigned threads)
+    {
+        if (loaded_)
+        {
+            *error = "already loaded";
+            return false;
+        }
+
+        // one name per line at most, the table is at most half full
+        size_t lines = size_t(std::count(data, data + size, '\n')) + 1;
+        name_arena_.reserve(size);
+        name_offsets_.reserve(lines + 1);
+        name_offsets_.push_back(0);
+        name_class_.reserve(lines);
+        size_t slots = 16;
+        while (slots < 2 * lines)
+            slots <<= 1;
+        name_table_.assign(slots, 0);
+        size_t classes = classes_.size();
+
+        int last = -1;
+        int lineno = 0;
+        const char* end = data + size;
+        for (const char* p = data; p < end;)
+        {
+            const char* eol = (const char*)memchr(p, '\n', size_t(end - p));
+            if (eol == nullptr)
+                eol = end;
+            lineno++;
+            const char* s = p;
+            p = eol + 1;
+
+            while (s < eol && isSpace(*s))
+                s++;
+            const char* e = eol;
+            while (e > s && isSpace(e[-1]))
+                e--;
+            if (s == e || *s == '#')
+                continue;
+
+            const char* w = s;
+            while (w < e && !isSpace(*w))
+                w++;
+            if (w - s == 5 && memcmp(s, "class", 5) == 0)
+            {
+                if (!parseClass(std::string(s, e), error))
+                {
+                    *error = "line " + std::to_string(lineno) + ": " + *error;
+                    return fail(classes);
+                }
+                continue;
+            }
+
+            // lines are usually grouped by class
+            if (last < 0 || classes_[size_t(last)].name.size() != size_t(w - s) ||
+                memcmp(classes_[size_t(last)].name.data(), s, size_t(w - s)) != 0)
+                last = findClass(s, size_t(w - s));
+            const char* n = w;
+            while (n < e && isSpace(*n))
+                n++;
+            const char* ne = n;
+            while (ne < e && !isSpace(*ne))
+                ne++;
+            if (last < 0 || n == e || ne != e)
+            {
+                *error = "line " + std::to_string(lineno) + ": " +
+                    (last < 0 ? "unknown class " + std::string(s, w) : "expected <class> <name>");
+                return fail(classes);
+            }
+            if (!addName(n, size_t(ne - n), uint32_t(last)))
+            {
+                *error = "line " + std::to_string(lineno) + ": " + std::string(n, ne) + " listed twice";
+                return fail(classes);
+            }
+        }
+
+        if (!build(threads))
+        {
+            *error = "out of memory";
+            return fail(classes);
+        }
+        loaded_ = true;
+        return true;
+    }
+
+    bool BreakerSet::fail(size_t classes)
+    {
+        while (classes_.size() > classes)
+            classes_.pop_back();
+        std::string().swap(name_arena_);
+        std::vector<size_t>().swap(name_offsets_);
+        std::vector<uint32_t>().swap(name_class_);
+        std::vector<uint32_t>().swap(name_table_);
+        names_.reset();
+        return false;
+    }
+
+    size_t BreakerSet::findName(const char* name, size_t len) const
+    {
+        size_t mask = name_table_.size() - 1;
+        for (size_t slot = size_t(hashName(name, len)) & mask;; slot = (slot + 1) & mask)
+        {
+            uint32_t b = name_table_[slot];
+            if (b == 0)
+                return slot;
+            size_t off = name_offsets_[b - 1];
+            if (name_offsets_[b] - off == len && memcmp(name_arena_.data() + off, name, len) == 0)
+                return slot;
+        }
+    }
+
+    bool BreakerSet::addName(const char* name, size_t len, uint32_t c)
+    {
+        size_t slot = findName(name, len);
+        if (name_table_[slot] != 0)
+            return false;
+        name_arena_.append(name, len);
+        name_offsets_.push_back(name_arena_.size());
+        name_class_.push_back(c);
+        name_table_[slot] = uint32_t(name_class_.size());
+        return true;
+    }
+
+    bool BreakerSet::build(unsigned threads)
+    {
+        size_t n = name_class_.size();
+        if (n == 0)
+            return true;
+        names_.reset(new (std::nothrow) std::string[n]);
+        if (names_ == nullptr)
+            return false;
+        // most of the time of building is faulting the block in, huge pages take far fewer faults
+        size_t bytes = n * sizeof(CircuitBreaker);
+        void* mem = Numa::Allocate(bytes, node_);
+        if (mem == nullptr)
+            return false;
+        madvise(mem, bytes, MADV_HUGEPAGE);
+        storage_ = (char*)mem;
+        storage_size_ = bytes;
+
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        threads = unsigned(std::min<size_t>(threads, (n + kMinChunk - 1) / kMinChunk));
+
+        Registry& registry = Registry::Instance();
+        uint32_t first = registry.Reserve(n);
+        std::vector<CircuitBreaker*> breakers(n);
+        // one reading of each clock serves every breaker
+        std::vector<std::chrono::system_clock::time_point> now(classes_.size());
+        for (size_t c = 0; c < classes_.size(); c++)
+        {
+            Clock* clock = classes_[c].settings.clock;
+            now[c] = clock == nullptr ? std::chrono::system_clock::now() : clock->Now();
+        }
+        auto construct = [&](size_t from, size_t to) {
+            for (size_t i = from; i < to; i++)
+            {
+                uint32_t c = name_class_[i];
+                names_[i].assign(name_arena_, name_offsets_[i], name_offsets_[i + 1] - name_offsets_[i]);
+                breakers[i] = new (storage_ + i * sizeof(CircuitBreaker))
+                    CircuitBreaker(&classes_[c].settings, &names_[i], first + uint32_t(i), now[c]);
+            }
+        };
+
+        std::vector<std::thread> workers;
+        size_t chunk = (n + threads - 1) / threads;
+        for (unsigned t = 1; t < threads; t++)
+            workers.emplace_back(construct, std::min(n, t * chunk), std::min(n, (t + 1) * chunk));
+        construct(0, std::min(n, chunk));
+        for (auto& w : workers)
+            w.join();
+
+        size_ = n;
+        registry.AddReserved(first, breakers.data(), n);
+        return true;
+    }
+
+    CircuitBreaker* BreakerSet::Find(const std::string& name) const
+    {
+        if (size_ == 0)
+            return nullptr;
+        uint32_t b = name_table_[findName(name.data(), name.size())];
+        return b == 0 ? nullptr : At(b - 1);
+    }
+}
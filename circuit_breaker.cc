@@ -1,34 +1,286 @@
 #include "circuit_breaker.h"
+#include "journal.h"
+#include "outcome_trace.h"
+#include "probes.h"
+#include "registry.h"
 
+#include <cstdlib>
+#include <new>
 
 
+CPPBREAKER_DEFINE_SEMAPHORE(reject);
+CPPBREAKER_DEFINE_SEMAPHORE(outcome);
+CPPBREAKER_DEFINE_SEMAPHORE(transition);
 
 namespace cppbreaker
 {
 
+    namespace
+    {
+        // set in the generation handed out by an admission that is sampled for profiling,
+        // so that afterRequest samples the same request
+        const uint64_t kSampledGeneration = uint64_t(1) << 63;
+
+        // ProfileScope times one call of a breaker site, if the call is sampled
+        class ProfileScope
+        {
+        public:
+            ProfileScope(ProfileMetrics* prof, bool sampled, ProfileSite site)
+            {
+                if (sampled)
+                {
+                    prof_ = prof;
+                    site_ = site;
+                    start_ = std::chrono::steady_clock::now();
+                }
+            }
+            ~ProfileScope()
+            {
+                if (prof_ != nullptr)
+                    prof_->sites[site_].Observe(std::chrono::steady_clock::now() - start_);
+            }
+
+        private:
+            ProfileMetrics* prof_ = nullptr;
+            ProfileSite site_ = PROFILE_BEFORE_REQUEST;
+            std::chrono::steady_clock::time_point start_;
+        };
+
+        std::atomic<uint64_t> breaker_serials{0};
+
+        int64_t nanosOf(std::chrono::system_clock::time_point tp)
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(tp.time_since_epoch()).count();
+        }
+    }
+
+    // LeaseTable holds the open leases of one thread, see Settings::open_lease.
+    // A breaker has one of kWays slots of the set of its id modulo kSets, a lease that is pushed out
+    // takes the least recently used slot.
+    class LeaseTable
+    {
+    public:
+        static const uint32_t kSets = 16;
+        static const uint32_t kWays = 4;
+        // rejections counted by a lease before they are added to the metrics of the breaker
+        static const uint32_t kFlushEvery = 256;
+        // leases pushed out with rejections kept before they are added through the registry
+        static const size_t kMaxDeferred = 1024;
+
+        ~LeaseTable()
+        {
+            for (auto& l : slots_)
+                defer(&l);
+            flushDeferred();
+        }
+
+        // Reject returns true, with the generation of the open state, if this thread holds a lease
+        // on cb that is not revoked and not past the expiry of the open state
+        bool Reject(CircuitBreaker* cb, uint64_t* gen)
+        {
+            Lease* l = find(cb);
+            if (l == nullptr)
+                return false;
+            if (l->epoch != cb->lease_epoch_.load(std::memory_order_acquire) || l->until < cb->now())
+            {
+                flush(cb, l);
+                l->cb = nullptr;
+                return false;
+            }
+            *gen = l->generation;
+            l->used = ++tick_;
+            if (++l->pending == kFlushEvery)
+                flush(cb, l);
+            return true;
+        }
+
+        // Grant gives this thread a lease on cb, read under the lock of cb and taken without it
+        void Grant(CircuitBreaker* cb, uint64_t epoch, uint64_t gen, std::chrono::system_clock::time_point until)
+        {
+            Lease* l = find(cb);
+            if (l != nullptr)
+            {
+                flush(cb, l);
+            }
+            else
+            {
+                Lease* set = slots_ + (cb->id_ % kSets) * kWays;
+                l = set;
+                for (uint32_t w = 1; w < kWays && l->cb != nullptr; w++)
+                {
+                    if (set[w].cb == nullptr || set[w].used < l->used)
+                        l = &set[w];
+                }
+                defer(l);
+                // the rejections of an earlier lease of cb that was pushed out
+                for (size_t i = 0; i < deferred_.size(); i++)
+                {
+                    if (deferred_[i].cb == cb && deferred_[i].serial == cb->serial_)
+                    {
+                        flush(cb, &deferred_[i]);
+                        deferred_[i] = deferred_.back();
+                        deferred_.pop_back();
+                        break;
+                    }
+                }
+            }
+            l->cb = cb;
+            l->serial = cb->serial_;
+            l->id = cb->id_;
+            l->epoch = epoch;
+            l->generation = gen;
+            l->until = until;
+            l->used = ++tick_;
+        }
+
+    private:
+        struct Lease
+        {
+            CircuitBreaker* cb = nullptr;
+            uint64_t serial = 0;
+            uint64_t epoch = 0;
+            uint64_t generation = 0;
+            std::chrono::system_clock::time_point until;
+            uint64_t used = 0;
+            uint32_t id = 0;
+            uint32_t pending = 0;
+        };
+
+        Lease* find(CircuitBreaker* cb)
+        {
+            Lease* set = slots_ + (cb->id_ % kSets) * kWays;
+            for (uint32_t w = 0; w < kWays; w++)
+            {
+                if (set[w].cb == cb && set[w].serial == cb->serial_)
+                    return &set[w];
+            }
+            return nullptr;
+        }
+
+        void flush(CircuitBreaker* cb, Lease* l)
+        {
+            if (l->pending != 0)
+                cb->metrics_.rejected_open.Add(l->pending);
+            l->pending = 0;
+        }
+
+        // defer empties a slot. Its breaker may have been destroyed meanwhile, its rejections wait
+        // for a new lease on it or for the thread to exit, so the registry is kept off the rejection path.
+        void defer(Lease* l)
+        {
+            if (l->cb != nullptr && l->pending != 0)
+            {
+                deferred_.push_back(*l);
+                if (deferred_.size() >= kMaxDeferred)
+                    flushDeferred();
+            }
+            l->cb = nullptr;
+            l->pending = 0;
+        }
+
+        // flushDeferred adds the deferred rejections to the breakers that are still alive
+        void flushDeferred()
+        {
+            for (auto& l : deferred_)
+            {
+                Registry::Instance().With(l.id, [this, &l](CircuitBreaker* cb) {
+                    if (cb == l.cb && cb->serial_ == l.serial)
+                        flush(cb, &l);
+                });
+            }
+            deferred_.clear();
+        }
+
+        Lease slots_[kSets * kWays];
+        std::vector<Lease> deferred_;
+        uint64_t tick_ = 0;
+    };
+
+    namespace
+    {
+        thread_local LeaseTable lease_table;
+    }
+
     CircuitBreaker::CircuitBreaker(const Settings& st)
     {
-        settings_ = st;
         state_ = STATE_CLOSED;
         expiry_ = std::chrono::system_clock::from_time_t(0);
+        clock_ = st.clock;
+        tsc_ = dynamic_cast<TscClock*>(clock_);
+        serial_ = ++breaker_serials;
+        packed_ = st.packed_counts;
+        own_name_ = st.name;
+        name_ = &own_name_;
+        publish(std::unique_ptr<Settings>(new Settings(st)));
 
-        if (settings_.max_requests == 0)
-            settings_.max_requests = 1;
+        if (st.profile_every != 0)
+            metrics_.profile.reset(new ProfileMetrics());
+        if (st.per_cpu_metrics)
+            metrics_.UsePerCpu();
+        else if (st.per_node_metrics)
+            metrics_.UsePerNode();
+        if (st.top_codes != 0)
+        {
+            top_codes_.reset(new TopCodes(st.top_codes));
+            window_codes_.reset(new TopCodes(st.top_codes));
+        }
 
-        if (settings_.timeout.count() == 0)
-            settings_.timeout = std::chrono::seconds(60);
+        toNewGeneration(this->now());
+        id_ = Registry::Instance().Add(this);
+    }
 
-        if (settings_.ready_to_trip == nullptr)
+    CircuitBreaker::CircuitBreaker(const Settings* shared, const std::string* name, uint32_t id,
+        std::chrono::system_clock::time_point now)
+    {
+        state_ = STATE_CLOSED;
+        expiry_ = std::chrono::system_clock::from_time_t(0);
+        clock_ = shared->clock;
+        tsc_ = dynamic_cast<TscClock*>(clock_);
+        serial_ = ++breaker_serials;
+        packed_ = shared->packed_counts;
+        settings_.store(shared, std::memory_order_release);
+        name_ = name;
+        trackLatency(*shared);
+        trackPolicy(*shared);
+
+        if (shared->profile_every != 0)
+            metrics_.profile.reset(new ProfileMetrics());
+        if (shared->per_cpu_metrics)
+            metrics_.UsePerCpu();
+        else if (shared->per_node_metrics)
+            metrics_.UsePerNode();
+        if (shared->top_codes != 0)
         {
-            settings_.ready_to_trip = std::bind(&CircuitBreaker::defaultReadyToTrip, this, std::placeholders::_1);
+            top_codes_.reset(new TopCodes(shared->top_codes));
+            window_codes_.reset(new TopCodes(shared->top_codes));
         }
-        toNewGeneration(std::chrono::system_clock::now());
+
+        toNewGeneration(now);
+        id_ = id;
+    }
+
+    CircuitBreaker::~CircuitBreaker()
+    {
+        Registry::Instance().Remove(id_);
+    }
+
+    void* CircuitBreaker::operator new(size_t size)
+    {
+        void* p = nullptr;
+        if (posix_memalign(&p, kCacheLine, size) != 0)
+            throw std::bad_alloc();
+        return p;
+    }
+
+    void CircuitBreaker::operator delete(void* p)
+    {
+        free(p);
     }
 
     State CircuitBreaker::GetState()
     {
         std::lock_guard<std::mutex> lock(mutex_);
-        auto now = std::chrono::system_clock::now();
+        auto now = this->now();
         State st;
         currentState(now, &st);
         return st;
@@ -43,55 +295,411 @@ namespace cppbreaker
         return "open";
     }
 
-    int CircuitBreaker::beforeRequest(uint64_t* gen)
+    std::string CircuitBreaker::OverrideString(Override ov)
+    {
+        if (ov == OVERRIDE_FORCE_OPEN)
+            return "force open";
+        else if (ov == OVERRIDE_DISABLED)
+            return "disabled";
+        return "none";
+    }
+
+    Snapshot CircuitBreaker::GetSnapshot()
     {
         std::lock_guard<std::mutex> lock(mutex_);
+        auto now = this->now();
+        Snapshot snap;
+        snap.generation = currentState(now, &snap.state);
+        snap.override = override_;
+        snap.counts = readCounts();
+        snap.expiry = expiry_;
+        if (top_codes_ != nullptr)
+        {
+            snap.top_codes = top_codes_->Top();
+            snap.window_codes = window_codes_->Top();
+        }
+        return snap;
+    }
 
-        auto now = std::chrono::system_clock::now();
+    void CircuitBreaker::SetOverride(Override ov)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto now = this->now();
+        auto prev = override_;
+        override_ = ov;
+        lease_epoch_.fetch_add(1, std::memory_order_release);
+
+        switch (ov)
+        {
+        case OVERRIDE_FORCE_OPEN:
+            setState(STATE_OPEN, now);
+            // an open breaker only moves on once expiry_ has passed
+            expiry_ = std::chrono::system_clock::time_point::max();
+            break;
+        case OVERRIDE_DISABLED:
+            // onFailure does not consult ready_to_trip while disabled
+            setState(STATE_CLOSED, now);
+            break;
+        default:
+            if (prev == OVERRIDE_FORCE_OPEN && state_ == STATE_OPEN)
+                expiry_ = now + GetSettings().timeout;
+            break;
+        }
+        publishClosed();
+    }
+
+    void CircuitBreaker::Reset()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto now = this->now();
+        override_ = OVERRIDE_NONE;
+        lease_epoch_.fetch_add(1, std::memory_order_release);
+        if (state_ == STATE_CLOSED)
+        {
+            toNewGeneration(now);
+            const Settings& settings = GetSettings();
+            if (settings.trip_policy != nullptr)
+                settings.trip_policy->OnClose(policy_state_.load(std::memory_order_relaxed), nanosOf(now));
+        }
+        else
+        {
+            setState(STATE_CLOSED, now);
+        }
+    }
+
+    void CircuitBreaker::UpdateSettings(const Settings& st)
+    {
+        std::unique_ptr<Settings> next(new Settings(st));
+        std::lock_guard<std::mutex> lock(mutex_);
+        const Settings& cur = GetSettings();
+        next->name = *name_;
+        next->clock = cur.clock;
+        next->profile_every = cur.profile_every;
+        next->per_cpu_metrics = cur.per_cpu_metrics;
+        next->per_node_metrics = cur.per_node_metrics;
+        next->packed_counts = cur.packed_counts;
+        next->top_codes = cur.top_codes;
+        publish(std::move(next));
+    }
+
+    void CircuitBreaker::applyDefaults(Settings* st)
+    {
+        if (st->max_requests == 0)
+            st->max_requests = 1;
+
+        if (st->timeout.count() == 0)
+            st->timeout = std::chrono::seconds(60);
+    }
+
+    void CircuitBreaker::publish(std::unique_ptr<Settings> st)
+    {
+        applyDefaults(st.get());
+        if (st->ready_to_trip == nullptr && st->trip_expression != nullptr)
+        {
+            st->ready_to_trip = std::bind(&CircuitBreaker::expressionReadyToTrip, this, std::placeholders::_1);
+        }
+        else if (st->ready_to_trip == nullptr)
+        {
+            st->ready_to_trip = std::bind(&CircuitBreaker::defaultReadyToTrip, this, std::placeholders::_1);
+        }
+
+        trackLatency(*st);
+        trackPolicy(*st);
+        settings_.store(st.get(), std::memory_order_release);
+        // calls that read the previous settings without mutex_ may still use them
+        std::unique_ptr<const Settings> prev(std::move(own_settings_));
+        own_settings_ = std::move(st);
+        if (prev != nullptr)
+            Epoch::Retire(std::move(prev));
+    }
+
+    void CircuitBreaker::trackLatency(const Settings& settings)
+    {
+        if (latency_base_ != nullptr || settings.trip_expression == nullptr || !settings.trip_expression->UsesLatency())
+            return;
+        // the window starts now, it is reset with the Counts from then on
+        latency_base_.reset(new uint64_t[LatencyHistogram::kBuckets + 1]);
+        for (int i = 0; i <= LatencyHistogram::kBuckets; i++)
+            latency_base_[i] = metrics_.latency.Bucket(i);
+    }
+
+    void CircuitBreaker::trackPolicy(const Settings& settings)
+    {
+        const TripPolicy* policy = settings.trip_policy.get();
+        if (policy == nullptr || policy == state_policy_)
+            return;
+        // The word before the state names the policy it belongs to, see decideTrip.
+        std::unique_ptr<Word128[]> next(new Word128[policy->Words() + 1]());
+        next[0].lo = uint64_t(uintptr_t(policy));
+        state_policy_ = policy;
+        policy_state_.store(next.get() + 1, std::memory_order_release);
+        // calls that read the previous settings without mutex_ may still use the state of their policy
+        own_policy_state_.swap(next);
+        if (next != nullptr)
+            Epoch::Retire(std::move(next));
+    }
+
+    bool CircuitBreaker::decideTrip(const Settings& settings, const Counts& counts, bool success,
+        std::chrono::nanoseconds latency, std::chrono::system_clock::time_point now)
+    {
+        if (settings.trip_policy != nullptr)
+        {
+            // without mutex_, settings may have been replaced by those of another policy since they were read,
+            // whose state is not the size this policy expects: the outcome is not observed then
+            Word128* state = policy_state_.load(std::memory_order_acquire);
+            if (state[-1].lo != uint64_t(uintptr_t(settings.trip_policy.get())))
+                return false;
+            return settings.trip_policy->Observe(state, nanosOf(now), success, latency);
+        }
+        return !success && readyToTrip(settings, counts);
+    }
+
+    void CircuitBreaker::lock(std::unique_lock<std::mutex>* lock, bool sampled)
+    {
+        if (!sampled)
+        {
+            lock->lock();
+            return;
+        }
+
+        ProfileMetrics* prof = metrics_.profile.get();
+        prof->lock_samples.fetch_add(1, std::memory_order_relaxed);
+        if (lock->try_lock())
+            return;
+
+        prof->lock_contended.fetch_add(1, std::memory_order_relaxed);
+        auto start = std::chrono::steady_clock::now();
+        lock->lock();
+        prof->sites[PROFILE_LOCK_WAIT].Observe(std::chrono::steady_clock::now() - start);
+    }
+
+    int CircuitBreaker::beforeRequest(uint64_t* gen)
+    {
+        // settings are used after mutex_ is taken, when they may have been replaced
+        Epoch::Guard guard;
+        const Settings& settings = GetSettings();
+        if (settings.open_lease && lease_table.Reject(this, gen))
+        {
+            // Counts are not read without mutex_
+            CPPBREAKER_PROBE6(reject, id_, name_->c_str(), int(STATE_OPEN), int(ResultCodeErrOpenState), 0, 0);
+            return ResultCodeErrOpenState;
+        }
+
+        // sampling is decided once per request, by a counter of the breaker so that no breaker is skipped
+        ProfileMetrics* prof = metrics_.profile.get();
+        bool sampled = prof != nullptr &&
+            (prof->calls.fetch_add(1, std::memory_order_relaxed) + 1) % settings.profile_every == 0;
+        ProfileScope scope(prof, sampled, PROFILE_BEFORE_REQUEST);
+        if (packed_ && closedRequest(gen))
+        {
+            metrics_.requests.Add(1);
+            if (sampled)
+                *gen |= kSampledGeneration;
+            return ResultCodeOK;
+        }
+
+        std::unique_lock<std::mutex> lk(mutex_, std::defer_lock);
+        lock(&lk, sampled);
+
+        auto now = this->now();
         State st;
         *gen = currentState(now, &st);
         if (st == STATE_OPEN)
         {
+            metrics_.rejected_open.Add(1);
+            if (CPPBREAKER_PROBE_ENABLED(reject))
+            {
+                Counts counts = readCounts();
+                CPPBREAKER_PROBE6(reject, id_, name_->c_str(), int(st), int(ResultCodeErrOpenState),
+                    counts.requests, counts.consecutive_failures);
+            }
+            if (settings.open_lease)
+            {
+                // the lease table may take the registry lock, which is taken before breaker locks
+                auto epoch = lease_epoch_.load(std::memory_order_relaxed);
+                auto until = expiry_;
+                lk.unlock();
+                lease_table.Grant(this, epoch, *gen, until);
+            }
             return ResultCodeErrOpenState;
         }
         else if (st == STATE_HALF_OPEN &&
-            counts_.requests >= settings_.max_requests)
+            loadCounts().requests >= settings.max_requests)
         {   // too many requests are in flight while state is half open
+            metrics_.rejected_too_many.Add(1);
+            if (CPPBREAKER_PROBE_ENABLED(reject))
+            {
+                Counts counts = readCounts();
+                CPPBREAKER_PROBE6(reject, id_, name_->c_str(), int(st), int(ResultCodeErrTooManyRequests),
+                    counts.requests, counts.consecutive_failures);
+            }
             return ResultCodeErrTooManyRequests;
         }
 
-        counts_.onRequest();
+        countRequest();
+        metrics_.requests.Add(1);
+        if (sampled)
+            *gen |= kSampledGeneration;
         return ResultCodeOK;
     }
 
-    void CircuitBreaker::afterRequest(uint64_t before, bool success)
+    void CircuitBreaker::afterRequest(uint64_t before, bool success, std::chrono::nanoseconds latency, int code)
     {
-        std::lock_guard<std::mutex> lock(mutex_);
+        Epoch::Guard guard;
+        const Settings& settings = GetSettings();
+        bool sampled = (before & kSampledGeneration) != 0;
+        before &= ~kSampledGeneration;
+        ProfileScope scope(metrics_.profile.get(), sampled, PROFILE_AFTER_REQUEST);
+        metrics_.latency.Observe(latency);
+        if (success)
+            metrics_.successes.Add(1);
+        else
+            metrics_.failures.Add(1);
+        // the window is approximate, a failure of the previous generation may count in the next
+        if (!success && code != 0 && top_codes_ != nullptr)
+        {
+            top_codes_->Add(code);
+            window_codes_->Add(code);
+        }
+
+        if (packed_ && closedOutcome(before, success, latency, settings))
+            return;
+
+        std::unique_lock<std::mutex> lk(mutex_, std::defer_lock);
+        lock(&lk, sampled);
+        sampling_ = sampled;
 
-        auto now = std::chrono::system_clock::now();
+        auto now = this->now();
         State st;
         auto generation = currentState(now, &st);
+        OutcomeTraceWriter* trace = OutcomeTraceWriter::Current();
+        if (trace != nullptr)
+        {
+            auto ts = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch());
+            trace->Append(ts.count(), id_, success, latency.count());
+        }
+        CPPBREAKER_PROBE6(outcome, id_, name_->c_str(), before, int(generation != before),
+            int(success), int64_t(latency.count()));
 
         if (generation != before)
             return;
 
         if (success)
-            onSuccess(st, now);
+            onSuccess(st, now, latency);
+        else
+            onFailure(st, now, latency);
+    }
+
+    void CircuitBreaker::countRequest()
+    {
+        if (packed_)
+            packed_counts_.OnRequest(uint16_t(generation_));
+        else
+            counts_.onRequest();
+    }
+
+    Counts CircuitBreaker::countOutcome(bool success)
+    {
+        if (packed_)
+        {
+            // the tag is current under mutex_, the swap always succeeds
+            Counts after;
+            if (success)
+                packed_counts_.OnSuccess(uint16_t(generation_), &after);
+            else
+                packed_counts_.OnFailure(uint16_t(generation_), &after);
+            return after;
+        }
+        if (success)
+            counts_.onSuccess();
         else
-            onFailure(st, now);
+            counts_.onFailure();
+        return counts_;
+    }
+
+    bool CircuitBreaker::closedRequest(uint64_t* gen)
+    {
+        uint64_t g = closed_gen_.load(std::memory_order_acquire);
+        if (g == 0)
+            return false;
+        int64_t expiry = closed_expiry_.load(std::memory_order_relaxed);
+        if (expiry != 0 && nanosOf(now()) > expiry)
+            return false;
+        // fails if the generation has moved on since closed_gen_ was read
+        if (!packed_counts_.OnRequest(uint16_t(g)))
+            return false;
+        *gen = g;
+        return true;
+    }
+
+    bool CircuitBreaker::closedOutcome(uint64_t gen, bool success, std::chrono::nanoseconds latency,
+        const Settings& settings)
+    {
+        if (closed_gen_.load(std::memory_order_acquire) != gen)
+            return false;
+        auto now = this->now();
+        int64_t expiry = closed_expiry_.load(std::memory_order_relaxed);
+        if (expiry != 0 && nanosOf(now) > expiry)
+            return false;
+
+        // a success needs no Counts unless a trip policy looks at it
+        bool decides = !success || settings.trip_policy != nullptr;
+        Counts after;
+        if (success ? !packed_counts_.OnSuccess(uint16_t(gen), decides ? &after : nullptr) :
+            !packed_counts_.OnFailure(uint16_t(gen), &after))
+        {
+            return false;
+        }
+
+        OutcomeTraceWriter* trace = OutcomeTraceWriter::Current();
+        if (trace != nullptr)
+            trace->Append(nanosOf(now), id_, success, latency.count());
+        CPPBREAKER_PROBE6(outcome, id_, name_->c_str(), gen, 0, int(success), int64_t(latency.count()));
+
+        if (!decides || !decideTrip(settings, after, success, latency, now))
+            return true;
+
+        // the trip is decided without mutex_, it only stands if nothing changed meanwhile
+        std::lock_guard<std::mutex> lock(mutex_);
+        now = this->now();
+        State st;
+        if (currentState(now, &st) == gen && st == STATE_CLOSED && override_ != OVERRIDE_DISABLED)
+            setState(STATE_OPEN, now);
+        return true;
     }
 
-    void CircuitBreaker::onSuccess(State st, std::chrono::system_clock::time_point now)
+    void CircuitBreaker::publishClosed()
+    {
+        if (!packed_)
+            return;
+        if (state_ != STATE_CLOSED || override_ == OVERRIDE_DISABLED)
+        {
+            closed_gen_.store(0, std::memory_order_release);
+            return;
+        }
+        closed_expiry_.store(nanosOf(expiry_), std::memory_order_relaxed);
+        closed_gen_.store(generation_, std::memory_order_release);
+    }
+
+    void CircuitBreaker::onSuccess(State st, std::chrono::system_clock::time_point now, std::chrono::nanoseconds latency)
     {
         switch (st)
         {
         case STATE_CLOSED:
-            counts_.onSuccess();
+        {
+            Counts counts = countOutcome(true);
+            // only a trip policy trips on a success
+            const Settings& settings = GetSettings();
+            if (settings.trip_policy != nullptr && override_ != OVERRIDE_DISABLED &&
+                decideTrip(settings, counts, true, latency, now))
+            {
+                setState(STATE_OPEN, now);
+            }
             break;
+        }
         case STATE_HALF_OPEN:
         {
-            counts_.onSuccess();
-            if (counts_.consecutive_successes >= settings_.max_requests)
+            if (countOutcome(true).consecutive_successes >= GetSettings().max_requests)
             {
                 setState(STATE_CLOSED, now);
             }
@@ -102,14 +710,29 @@ namespace cppbreaker
         }
     }
 
-    void CircuitBreaker::onFailure(State st, std::chrono::system_clock::time_point now)
+    void CircuitBreaker::onFailure(State st, std::chrono::system_clock::time_point now, std::chrono::nanoseconds latency)
     {
         switch (st)
         {
         case STATE_CLOSED:
         {
-            counts_.onFailure();
-            if (settings_.ready_to_trip(counts_))
+            Counts counts = countOutcome(false);
+            if (override_ == OVERRIDE_DISABLED)
+                break;
+
+            const Settings& settings = GetSettings();
+            bool trip;
+            if (sampling_)
+            {
+                auto start = std::chrono::steady_clock::now();
+                trip = decideTrip(settings, counts, false, latency, now);
+                metrics_.profile->sites[PROFILE_READY_TO_TRIP].Observe(std::chrono::steady_clock::now() - start);
+            }
+            else
+            {
+                trip = decideTrip(settings, counts, false, latency, now);
+            }
+            if (trip)
                 setState(STATE_OPEN, now);
             break;
         }
@@ -156,39 +779,112 @@ namespace cppbreaker
         if (state_ == st)
             return;
 
+        const Settings& settings = GetSettings();
         auto prev = state_;
         state_ = st;
+        metrics_.state.store(st, std::memory_order_relaxed);
+        metrics_.transitions.Add(1);
 
+        Counts counts = readCounts();
+        CPPBREAKER_PROBE8(transition, id_, name_->c_str(), int(prev), int(st),
+            counts.requests, counts.total_failures, counts.consecutive_failures, generation_);
+        if (TraceRecorder::Enabled())
+            TraceRecorder::OnTransition(id_, prev, st);
+
+        Journal* journal = Journal::Current();
+        if (journal != nullptr)
+        {
+            auto ts = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch());
+            journal->Append(ts.count(), id_, *name_, prev, st, override_, generation_, counts);
+        }
+
+        if (st == STATE_CLOSED && settings.trip_policy != nullptr)
+            settings.trip_policy->OnClose(policy_state_.load(std::memory_order_relaxed), nanosOf(now));
+        // the event is filled before toNewGeneration clears the window
+        StateChangeEvent event;
+        if (settings.on_state_change_event != nullptr)
+        {
+            event.name = name_;
+            event.from = prev;
+            event.to = st;
+            event.counts = counts;
+            if (window_codes_ != nullptr)
+                event.codes = window_codes_->Top();
+        }
         toNewGeneration(now);
-        if (settings_.on_state_change != nullptr)
+        if (settings.on_state_change != nullptr)
         {
-            settings_.on_state_change(settings_.name, prev, st);
+            if (metrics_.profile != nullptr)
+            {
+                auto start = std::chrono::steady_clock::now();
+                settings.on_state_change(*name_, prev, st);
+                metrics_.profile->sites[PROFILE_ON_STATE_CHANGE].Observe(std::chrono::steady_clock::now() - start);
+            }
+            else
+            {
+                settings.on_state_change(*name_, prev, st);
+            }
+        }
+        if (settings.on_state_change_event != nullptr)
+            settings.on_state_change_event(event);
+    }
+
+    bool CircuitBreaker::expressionReadyToTrip(const Counts& counts)
+    {
+        TripInputs in;
+        in.counts = &counts;
+        uint64_t window[LatencyHistogram::kBuckets + 1];
+        const TripExpression* expr = GetSettings().trip_expression.get();
+        if (expr->UsesLatency())
+        {
+            // latencies are observed before mutex_ is taken, the window is approximate.
+            // The base is read atomically since packed Counts call this without mutex_.
+            for (int i = 0; i <= LatencyHistogram::kBuckets; i++)
+            {
+                uint64_t v = metrics_.latency.Bucket(i);
+                uint64_t base = __atomic_load_n(&latency_base_[i], __ATOMIC_RELAXED);
+                window[i] = v > base ? v - base : 0;
+            }
+            in.latency_buckets = window;
         }
+        return expr->Evaluate(in);
     }
 
     void CircuitBreaker::toNewGeneration(std::chrono::system_clock::time_point now)
     {
         generation_++;
-        counts_.clear();
+        if (packed_)
+            packed_counts_.Reset(uint16_t(generation_));
+        else
+            counts_.clear();
+        if (window_codes_ != nullptr)
+            window_codes_->Clear();
+        if (latency_base_ != nullptr)
+        {
+            for (int i = 0; i <= LatencyHistogram::kBuckets; i++)
+                __atomic_store_n(&latency_base_[i], metrics_.latency.Bucket(i), __ATOMIC_RELAXED);
+        }
 
+        const Settings& settings = GetSettings();
         auto zero = std::chrono::system_clock::from_time_t(0);
 
         switch (state_)
         {
         case STATE_CLOSED:
         {
-            if (settings_.interval.count() == 0)
+            if (settings.interval.count() == 0)
                 expiry_ = zero;
             else
-                expiry_ = now + settings_.interval;
+                expiry_ = now + settings.interval;
             break;
         }
         case STATE_OPEN:
-            expiry_ = now + settings_.timeout;
+            expiry_ = now + settings.timeout;
             break;
         default:
             expiry_ = zero;
             break;
         }
+        publishClosed();
     }
 }
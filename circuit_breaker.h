@@ -2,19 +2,31 @@
 
 #include <string>
 #include <chrono>
+#include <atomic>
 #include <functional>
+#include <memory>
 #include <mutex>
+#include <tuple>
+#include <vector>
+#include "clock.h"
+#include "epoch.h"
+#include "metrics.h"
+#include "packed_counts.h"
+#include "top_codes.h"
+#include "trace_recorder.h"
+#include "trip_expression.h"
+#include "trip_policy.h"
 
 namespace cppbreaker
 {
     class Counts
     {
     public:
-        uint32_t requests = 0;
-        uint32_t total_successes = 0;
-        uint32_t total_failures = 0;
-        uint32_t consecutive_successes = 0;
-        uint32_t consecutive_failures = 0;
+        uint64_t requests = 0;
+        uint64_t total_successes = 0;
+        uint64_t total_failures = 0;
+        uint64_t consecutive_successes = 0;
+        uint64_t consecutive_failures = 0;
 
         void onRequest() {
             requests++;
@@ -52,6 +64,41 @@ namespace cppbreaker
         STATE_OPEN = 2
     };
 
+    // Override is set by operators to pin a CircuitBreaker regardless of its Counts.
+    enum Override
+    {
+        OVERRIDE_NONE = 0,
+        // the breaker stays open until the override is cleared
+        OVERRIDE_FORCE_OPEN = 1,
+        // the breaker stays closed and never trips until the override is cleared
+        OVERRIDE_DISABLED = 2
+    };
+
+    // Snapshot is a consistent copy of the internal state of a CircuitBreaker
+    struct Snapshot
+    {
+        State state = STATE_CLOSED;
+        Override override = OVERRIDE_NONE;
+        uint64_t generation = 0;
+        Counts counts;
+        std::chrono::system_clock::time_point expiry;
+        // with Settings::top_codes, the most frequent failure codes since the breaker was constructed,
+        // and since Counts were last cleared
+        std::vector<CodeCount> top_codes;
+        std::vector<CodeCount> window_codes;
+    };
+
+    // StateChangeEvent describes a change of state to Settings::on_state_change_event, with the Counts
+    // and the most frequent failure codes of the generation that ends
+    struct StateChangeEvent
+    {
+        const std::string* name = nullptr;
+        State from = STATE_CLOSED;
+        State to = STATE_CLOSED;
+        Counts counts;
+        std::vector<CodeCount> codes;
+    };
+
     struct Settings
     {
         std::string name;
@@ -77,8 +124,56 @@ namespace cppbreaker
         // Default ready_to_trip returns true when the number of consecutive failures is more than 5.
         std::function<bool(const Counts& counts)> ready_to_trip = nullptr;
 
+        // trip_expression is used in place of ready_to_trip when ready_to_trip is nil.
+        // Its latency variables cover the requests since Counts were last cleared.
+        std::shared_ptr<const TripExpression> trip_expression = nullptr;
+
+        // trip_policy, if not nil, sees every outcome in the closed state and decides when to trip in place
+        // of ready_to_trip and trip_expression, with state the breaker keeps for it, see TripPolicy.
+        std::shared_ptr<const TripPolicy> trip_policy = nullptr;
+
         // on_state_change is called whenever the state of the CircuitBreaker changes.
         std::function<void(const std::string& name, State from, State to)> on_state_change =  nullptr;
+
+        // on_state_change_event, if not nil, is called after on_state_change with what led to the change.
+        std::function<void(const StateChangeEvent& event)> on_state_change_event = nullptr;
+
+        // top_codes is the number of failure codes, at most TopCodes::kMaxSlots, counted in Snapshot::top_codes
+        // and window_codes and in the events of on_state_change_event. Codes come from Execute or Done.
+        // If top_codes is 0, codes are not counted.
+        size_t top_codes = 0;
+
+        // profile_every enables self profiling: 1 in profile_every requests of the breaker is sampled,
+        // its beforeRequest and afterRequest are timed, along with their wait for the breaker mutex
+        // and the ready_to_trip callback.
+        // Every on_state_change call is timed. Results are in Metrics().profile.
+        // If profile_every is 0, the CircuitBreaker is not profiled.
+        uint32_t profile_every = 0;
+
+        // open_lease lets each thread remember, once rejected, that the breaker is open until its expiry
+        // and reject from then on without locking or writing the breaker. SetOverride and Reset revoke
+        // the leases. Rejections under a lease reach Metrics().rejected_open in batches, and at the
+        // latest when the thread exits.
+        bool open_lease = false;
+
+        // per_cpu_metrics counts the requests, outcomes and rejections of Metrics() per CPU, which
+        // takes one cache line per CPU for the breaker, see PerCpuCounters.
+        bool per_cpu_metrics = false;
+
+        // per_node_metrics counts them per NUMA node instead, in one cache line on each node,
+        // see PerNodeCounters. per_cpu_metrics takes precedence.
+        bool per_node_metrics = false;
+
+        // packed_counts keeps Counts in a PackedCounts, so that requests and their outcomes in the closed
+        // state take a single compare-and-swap instead of the breaker mutex. ready_to_trip is then called
+        // without the mutex, possibly from several threads at once, with the Counts a failure left.
+        // Consecutive runs saturate at PackedCounts::kMaxConsecutive.
+        bool packed_counts = false;
+
+        // clock is the time source of the CircuitBreaker, it must outlive it.
+        // If clock is nullptr, std::chrono::system_clock is used.
+        // With TscClock::Instance(), Execute also times requests with the TSC.
+        Clock* clock = nullptr;
     };
 
     enum ResultCode
@@ -90,11 +185,26 @@ namespace cppbreaker
         ResultCodeErrOpenState =  -0x70000000
     };
 
-    class CircuitBreaker
+    class BreakerSet;
+    class LeaseTable;
+
+    // CircuitBreaker is aligned to a cache line, so that breakers packed in an array share no line.
+    // It allocates itself on a cache line boundary with new. std::make_shared and std::allocator
+    // do not align it before C++17, it works but may share lines with its neighbours.
+    class alignas(64) CircuitBreaker
     {
     public:
+        static const size_t kCacheLine = 64;
+
         CircuitBreaker(const Settings& st);
-        virtual ~CircuitBreaker() {}
+        virtual ~CircuitBreaker();
+
+        static void* operator new(size_t size);
+        static void* operator new(size_t size, void* where)
+        {
+            return where;
+        }
+        static void operator delete(void* p);
 
         // std::get<0>(ret) : get expected result returned by Function_
         // std::get<1>(ret) : get code returned by Function_ or circuit breaker
@@ -103,45 +213,232 @@ namespace cppbreaker
         std::tuple<Result_, int> Execute(Function_ req)
         {
             uint64_t generation = 0;
-            auto err = beforeRequest(&generation);
+            auto err = Allow(&generation);
             if (err != ResultCodeOK)
                 return std::make_tuple(Result_(), (int)err);
 
+            if (tsc_ != nullptr)
+            {
+                uint64_t start = tsc_->Ticks();
+                std::tuple<Result_, int> ret = req();
+                afterRequest(generation, std::get<1>(ret) == 0, std::chrono::nanoseconds(tsc_->Nanos(tsc_->Ticks() - start)),
+                    std::get<1>(ret));
+                return ret;
+            }
+
+            auto start = std::chrono::steady_clock::now();
             std::tuple<Result_, int> ret = req();
-            afterRequest(generation, std::get<1>(ret) == 0);
+            afterRequest(generation, std::get<1>(ret) == 0, std::chrono::steady_clock::now() - start, std::get<1>(ret));
             return ret;
         }
 
+        // Allow is the first half of Execute for callers that cannot wrap the request in a function:
+        // on ResultCodeOK the request may proceed and its outcome must be reported with Done,
+        // any other value is the rejection code. generation is opaque and only meant for Done.
+        int Allow(uint64_t* generation)
+        {
+            auto err = beforeRequest(generation);
+            if (TraceRecorder::Enabled())
+                TraceRecorder::OnAdmission(id_, err);
+            return err;
+        }
+
+        // code is the result code of a failure, for Settings::top_codes, 0 if it has none
+        void Done(uint64_t generation, bool success, std::chrono::nanoseconds latency = std::chrono::nanoseconds(0),
+            int code = 0)
+        {
+            afterRequest(generation, success, latency, code);
+        }
+
         State GetState();
         static std::string StateString(State st);
+        static std::string OverrideString(Override ov);
+
+        Snapshot GetSnapshot();
+
+        // SetOverride pins the breaker open or closed, OVERRIDE_NONE releases it.
+        // The override is applied through state_ and expiry_, so requests pay nothing for it.
+        void SetOverride(Override ov);
+
+        // Reset moves the breaker to the closed state with fresh Counts and trip policy state,
+        // it may trip again afterwards.
+        void Reset();
+
+        // UpdateSettings replaces the settings while requests are running, except name, clock, profile_every,
+        // per_cpu_metrics, per_node_metrics, packed_counts and top_codes which are fixed at construction. max_requests, ready_to_trip
+        // and on_state_change apply at once, interval and timeout from the next expiry on.
+        // The replaced settings are freed once the calls that may still read them have returned.
+        void UpdateSettings(const Settings& st);
 
-        std::string GetName()
+        // GetSettings returns the current settings. The reference stays valid until UpdateSettings replaces
+        // them, a caller that keeps it while UpdateSettings may run holds an Epoch::Guard meanwhile.
+        const Settings& GetSettings() const
         {
-            return settings_.name;
+            return *settings_.load(std::memory_order_acquire);
+        }
+
+        const std::string& GetName() const
+        {
+            return *name_;
+        }
+
+        // GetId returns the id of the breaker in the Registry
+        uint32_t GetId() const
+        {
+            return id_;
+        }
+
+        // Metrics returns the cumulative counters of the breaker, readable without locking it
+        const BreakerMetrics& Metrics() const
+        {
+            return metrics_;
         }
 
     protected:
-        Settings settings_;
+        friend class BreakerSet;
+        friend class LeaseTable;
 
-        std::mutex mutex_;
+        // CircuitBreaker shares settings, which have defaults applied, and name with other breakers
+        // instead of copying them, both must outlive it. id was reserved with Registry::Reserve,
+        // the breaker is registered by Registry::AddReserved. now is the time of the clock of settings.
+        CircuitBreaker(const Settings* shared, const std::string* name, uint32_t id,
+            std::chrono::system_clock::time_point now);
+
+        // applyDefaults replaces the zero values of st that mean a default
+        static void applyDefaults(Settings* st);
+
+        // The members are grouped by how requests touch them, each group on cache lines of its own
+        // (kCacheLine) so that writes to one do not take the lines of the others away from readers.
+
+        // read-mostly: read by every call, written at construction or on a rare update
+        // settings_ is published with a release store, under mutex_, and read with one acquire load
+        std::atomic<const Settings*> settings_;
+        // the name the breaker was constructed with, own_name_ or that of a BreakerSet
+        const std::string* name_ = nullptr;
+        // Settings::clock, fixed at construction
+        Clock* clock_ = nullptr;
+        // clock_ if it is the TscClock, which also times Execute
+        TscClock* tsc_ = nullptr;
+        uint32_t id_ = 0;
+        // serial_ tells this breaker from a destroyed one at the same address or with the same id
+        uint64_t serial_ = 0;
+        // lease_epoch_ is bumped to revoke the open leases of every thread
+        std::atomic<uint64_t> lease_epoch_{0};
+        // the state of the trip_policy of the settings, published before them, after a word with the policy
+        std::atomic<Word128*> policy_state_{nullptr};
+        // Settings::packed_counts, fixed at construction
+        bool packed_ = false;
+        // with packed_, the generation while the breaker is closed and may trip, else 0,
+        // and its expiry in nanoseconds since the epoch, 0 if it has none
+        std::atomic<uint64_t> closed_gen_{0};
+        std::atomic<int64_t> closed_expiry_{0};
+        // failure codes of Settings::top_codes, fixed at construction, since then and since Counts were cleared
+        std::unique_ptr<TopCodes> top_codes_;
+        std::unique_ptr<TopCodes> window_codes_;
+
+        // written under mutex_ by every call
+        alignas(kCacheLine) std::mutex mutex_;
         State state_;
+        Override override_ = OVERRIDE_NONE;
         uint64_t generation_ = 0;
         Counts counts_;
+        // in place of counts_ with packed_, written by CAS without mutex_ in the closed state
+        PackedCounts packed_counts_;
         std::chrono::system_clock::time_point expiry_;
+        // whether the call holding mutex_ is sampled for profiling
+        bool sampling_ = false;
+
+        // written without a lock by every call
+        alignas(kCacheLine) BreakerMetrics metrics_;
+
+        // cold
+        // the current settings if this breaker published them, replaced ones are retired to Epoch
+        alignas(kCacheLine) std::unique_ptr<const Settings> own_settings_;
+        std::string own_name_;
+        // metrics_.latency when Counts were last cleared, allocated once a trip_expression uses latency
+        std::unique_ptr<uint64_t[]> latency_base_;
+        // the current policy state, from its header word on, replaced ones are retired to Epoch,
+        // and the policy it belongs to
+        std::unique_ptr<Word128[]> own_policy_state_;
+        const TripPolicy* state_policy_ = nullptr;
 
     protected:
+        std::chrono::system_clock::time_point now()
+        {
+            return clock_ == nullptr ? std::chrono::system_clock::now() : clock_->Now();
+        }
+
         bool defaultReadyToTrip(const Counts& counts)
         {
             return counts.consecutive_failures > 5;
         }
 
+        bool expressionReadyToTrip(const Counts& counts);
+
+        // readyToTrip calls the ready_to_trip of settings, or the rule it defaults to when shared settings leave it nil
+        bool readyToTrip(const Settings& settings, const Counts& counts)
+        {
+            if (settings.ready_to_trip != nullptr)
+                return settings.ready_to_trip(counts);
+            if (settings.trip_expression != nullptr)
+                return expressionReadyToTrip(counts);
+            return defaultReadyToTrip(counts);
+        }
+
+        // publish applies the defaults to st and makes it the current settings
+        void publish(std::unique_ptr<Settings> st);
+
+        // trackLatency starts keeping latency_base_ if the trip_expression of settings needs it
+        void trackLatency(const Settings& settings);
+
+        // trackPolicy allocates policy_state_ for the trip_policy of settings, unless it has one already
+        void trackPolicy(const Settings& settings);
+
+        // decideTrip returns whether an outcome in the closed state, which left counts, trips the breaker
+        bool decideTrip(const Settings& settings, const Counts& counts, bool success,
+            std::chrono::nanoseconds latency, std::chrono::system_clock::time_point now);
+
         int beforeRequest(uint64_t* gen);
 
-        void afterRequest(uint64_t before, bool success);
+        // loadCounts returns the Counts of the current generation
+        Counts loadCounts()
+        {
+            if (!packed_)
+                return counts_;
+            Counts counts;
+            packed_counts_.Load(&counts);
+            return counts;
+        }
+        // readCounts returns them for observers, which do not decide anything with them
+        Counts readCounts() const
+        {
+            if (!packed_)
+                return counts_;
+            Counts counts;
+            packed_counts_.Read(&counts);
+            return counts;
+        }
+
+        // countRequest and countOutcome update the Counts under mutex_, countOutcome returns them
+        void countRequest();
+        Counts countOutcome(bool success);
+
+        // closedRequest and closedOutcome count a request or its outcome without mutex_ if the breaker
+        // is closed in generation gen, they return false when it is not and mutex_ must be taken
+        bool closedRequest(uint64_t* gen);
+        bool closedOutcome(uint64_t gen, bool success, std::chrono::nanoseconds latency, const Settings& settings);
+
+        // publishClosed publishes closed_gen_ and closed_expiry_ after a change of state_, generation_ or override_
+        void publishClosed();
+
+        void afterRequest(uint64_t before, bool success, std::chrono::nanoseconds latency, int code);
+
+        // lock acquires mutex_, measuring the wait if the call is sampled for profiling
+        void lock(std::unique_lock<std::mutex>* lock, bool sampled);
 
-        void onSuccess(State st, std::chrono::system_clock::time_point now);
+        void onSuccess(State st, std::chrono::system_clock::time_point now, std::chrono::nanoseconds latency);
 
-        void onFailure(State st, std::chrono::system_clock::time_point now);
+        void onFailure(State st, std::chrono::system_clock::time_point now, std::chrono::nanoseconds latency);
 
         uint64_t currentState(std::chrono::system_clock::time_point now, State* st);
 
@@ -0,0 +1,110 @@
+#include "clock.h"
+
+#include <cstdio>
+#include <cstring>
+#include <time.h>
+#ifdef CPPBREAKER_HAVE_TSC
+#include <cpuid.h>
+#endif
+
+
+namespace cppbreaker
+{
+
+    namespace
+    {
+#ifdef CPPBREAKER_HAVE_TSC
+        // calibration spans this many nanoseconds of CLOCK_MONOTONIC
+        const int64_t kCalibrationNs = 10 * 1000 * 1000;
+
+        int64_t monotonicNs()
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+        }
+
+        bool invariantTsc()
+        {
+            unsigned int eax, ebx, ecx, edx;
+            if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0 || eax < 0x80000007)
+                return false;
+            __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+            return (edx & (1u << 8)) != 0;
+        }
+
+        // kernelTrustsTsc returns false if the kernel took tsc off its clocksources, as it does when
+        // it sees the counters of the CPUs disagree. Without sysfs the CPU flag is all there is.
+        bool kernelTrustsTsc()
+        {
+            FILE* f = fopen("/sys/devices/system/clocksource/clocksource0/available_clocksource", "r");
+            if (f == nullptr)
+                return true;
+            char buf[256] = {0};
+            bool found = false;
+            if (fgets(buf, sizeof(buf), f) != nullptr)
+            {
+                for (char* tok = strtok(buf, " \n"); tok != nullptr; tok = strtok(nullptr, " \n"))
+                    found = found || strcmp(tok, "tsc") == 0;
+            }
+            fclose(f);
+            return found;
+        }
+
+        // sample reads the TSC between two reads of CLOCK_MONOTONIC, retrying to keep them close,
+        // and returns the monotonic time of the middle
+        int64_t sample(uint64_t* ticks)
+        {
+            int64_t best_width = INT64_MAX;
+            int64_t best_ns = 0;
+            for (int i = 0; i < 5; i++)
+            {
+                int64_t before = monotonicNs();
+                uint64_t t = __rdtsc();
+                int64_t after = monotonicNs();
+                if (after - before < best_width)
+                {
+                    best_width = after - before;
+                    best_ns = before + (after - before) / 2;
+                    *ticks = t;
+                }
+            }
+            return best_ns;
+        }
+#endif
+    }
+
+    TscClock* TscClock::Instance()
+    {
+        static TscClock* clock = new TscClock();
+        return clock;
+    }
+
+    TscClock::TscClock()
+    {
+#ifdef CPPBREAKER_HAVE_TSC
+        if (!invariantTsc() || !kernelTrustsTsc())
+            return;
+
+        uint64_t start_ticks;
+        int64_t start_ns = sample(&start_ticks);
+        struct timespec pause = {0, long(kCalibrationNs)};
+        nanosleep(&pause, nullptr);
+        uint64_t end_ticks;
+        int64_t end_ns = sample(&end_ticks);
+
+        if (end_ticks <= start_ticks || end_ns <= start_ns)
+            return;
+        double ns_per_tick = double(end_ns - start_ns) / double(end_ticks - start_ticks);
+        // below 100 MHz or above 10 GHz the counter is not a TSC to trust
+        if (ns_per_tick < 0.1 || ns_per_tick > 10)
+            return;
+
+        ns_per_tick_ = uint64_t(ns_per_tick * 4294967296.0);
+        base_ticks_ = __rdtsc();
+        base_ns_ = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        reliable_ = true;
+#endif
+    }
+}
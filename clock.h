@@ -0,0 +1,117 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#if defined(__x86_64__) && !defined(CPPBREAKER_NO_TSC)
+#include <x86intrin.h>
+#define CPPBREAKER_HAVE_TSC 1
+#endif
+
+namespace cppbreaker
+{
+    // Clock is the time source of a CircuitBreaker, see Settings::clock.
+    class Clock
+    {
+    public:
+        virtual ~Clock() {}
+        virtual std::chrono::system_clock::time_point Now() = 0;
+    };
+
+    // VirtualClock only moves when told to, for deterministic tests and simulations.
+    class VirtualClock : public Clock
+    {
+    public:
+        // the default start is far from the epoch, a zero time_point means "no expiry" to the breaker
+        explicit VirtualClock(std::chrono::system_clock::time_point start =
+            std::chrono::system_clock::time_point(std::chrono::hours(24 * 365 * 30)))
+            : now_ns_(std::chrono::duration_cast<std::chrono::nanoseconds>(start.time_since_epoch()).count())
+        {}
+
+        std::chrono::system_clock::time_point Now() override
+        {
+            return std::chrono::system_clock::time_point(
+                std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                    std::chrono::nanoseconds(now_ns_.load(std::memory_order_acquire))));
+        }
+
+        void Advance(std::chrono::nanoseconds d)
+        {
+            now_ns_.fetch_add(d.count(), std::memory_order_acq_rel);
+        }
+
+        void Set(std::chrono::system_clock::time_point tp)
+        {
+            now_ns_.store(std::chrono::duration_cast<std::chrono::nanoseconds>(tp.time_since_epoch()).count(),
+                std::memory_order_release);
+        }
+
+    private:
+        std::atomic<int64_t> now_ns_;
+    };
+
+    // TscClock reads the time stamp counter instead of calling into the vDSO, a few cycles instead of
+    // about 20 ns. It is calibrated once against CLOCK_MONOTONIC and anchored to system_clock,
+    // from which it drifts by the error of the calibration, a few parts per million.
+    //
+    // The TSC is used only on x86-64 when the CPU reports an invariant TSC and the kernel has not marked
+    // it unstable. Otherwise, or with CPPBREAKER_NO_TSC defined, it falls back to system_clock and
+    // steady_clock. A breaker using it as Settings::clock also times Execute with Ticks.
+    class TscClock : public Clock
+    {
+    public:
+        // Instance returns the clock, calibrated on the first call, which takes about 10 ms
+        static TscClock* Instance();
+
+        std::chrono::system_clock::time_point Now() override
+        {
+            if (!reliable_)
+                return std::chrono::system_clock::now();
+            return std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                std::chrono::nanoseconds(base_ns_ + int64_t(Nanos(Ticks() - base_ticks_)))));
+        }
+
+        // Ticks returns the counter, or steady_clock nanoseconds when it is not reliable
+        uint64_t Ticks() const
+        {
+#ifdef CPPBREAKER_HAVE_TSC
+            if (reliable_)
+                return __rdtsc();
+#endif
+            return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+        }
+
+        // Nanos converts a difference of Ticks to nanoseconds
+        uint64_t Nanos(uint64_t ticks) const
+        {
+#ifdef CPPBREAKER_HAVE_TSC
+            if (reliable_)
+                return uint64_t((unsigned __int128)ticks * ns_per_tick_ >> 32);
+#endif
+            return ticks;
+        }
+
+        // Reliable returns whether the clock reads the TSC
+        bool Reliable() const
+        {
+            return reliable_;
+        }
+
+        // TicksPerSecond returns the calibrated frequency of the TSC, 0 when it is not used
+        double TicksPerSecond() const
+        {
+            return reliable_ ? 4294967296.0 * 1e9 / double(ns_per_tick_) : 0;
+        }
+
+    private:
+        TscClock();
+
+        bool reliable_ = false;
+        // nanoseconds per tick in 32.32 fixed point
+        uint64_t ns_per_tick_ = 0;
+        uint64_t base_ticks_ = 0;
+        // system_clock at base_ticks_, in nanoseconds since the epoch
+        int64_t base_ns_ = 0;
+    };
+}
@@ -0,0 +1,172 @@
+#include "counter.h"
+#include "numa.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#if !defined(CPPBREAKER_NO_RSEQ) && defined(__x86_64__) && defined(__linux__) && defined(__has_include)
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#ifdef RSEQ_SIG
+#define CPPBREAKER_HAVE_RSEQ 1
+#endif
+#endif
+#endif
+
+
+namespace cppbreaker
+{
+
+    namespace
+    {
+        static_assert(sizeof(uint64_t) * PerCpuCounters::kFields == 64, "a line of counters is a cache line");
+
+        size_t possibleCpus()
+        {
+            static size_t cpus = []() {
+                long n = sysconf(_SC_NPROCESSORS_CONF);
+                return n < 1 ? size_t(1) : size_t(n);
+            }();
+            return cpus;
+        }
+
+        // the spread of threads over the lines without rseq
+        std::atomic<uint32_t> next_shard{0};
+        thread_local uint32_t shard = next_shard.fetch_add(1, std::memory_order_relaxed);
+
+#ifdef CPPBREAKER_HAVE_RSEQ
+        struct rseq* rseqArea()
+        {
+            return (struct rseq*)((char*)__builtin_thread_pointer() + __rseq_offset);
+        }
+
+        // rseqAdd adds n to *v if the thread runs on cpu until the add is done, and returns false
+        // if the kernel aborted the sequence, the thread was preempted, migrated or signalled.
+        // The sequence is described to the kernel by a struct rseq_cs in the __rseq_cs section,
+        // the abort handler is preceded by the signature glibc registered rseq with.
+        inline bool rseqAdd(uint64_t* v, uint32_t cpu, uint64_t n)
+        {
+            __asm__ __volatile__ goto (
+                ".pushsection __rseq_cs, \"aw\"\n\t"
+                ".balign 32\n\t"
+                "3:\n\t"
+                ".long 0x0, 0x0\n\t"
+                ".quad 1f, (2f - 1f), 4f\n\t"
+                ".popsection\n\t"
+                "leaq 3b(%%rip), %%rax\n\t"
+                "movq %%rax, %%fs:8(%[rseq_offset])\n\t"
+                "1:\n\t"
+                "cmpl %[cpu], %%fs:4(%[rseq_offset])\n\t"
+                "jnz 4f\n\t"
+                "addq %[n], %[v]\n\t"
+                "2:\n\t"
+                ".pushsection __rseq_failure, \"ax\"\n\t"
+                ".byte 0x0f, 0xb9, 0x3d\n\t"
+                ".long 0x53053053\n\t"
+                "4:\n\t"
+                "jmp %l[abort]\n\t"
+                ".popsection\n\t"
+                :
+                : [rseq_offset] "r" (__rseq_offset), [cpu] "r" (cpu), [v] "m" (*v), [n] "r" (n)
+                : "memory", "cc", "rax"
+                : abort);
+            return true;
+        abort:
+            return false;
+        }
+#endif
+    }
+
+    PerCpuCounters::PerCpuCounters()
+    {
+        void* mem = nullptr;
+        size_t bytes = Lines() * sizeof(Line);
+        if (posix_memalign(&mem, 64, bytes) != 0)
+            abort();
+        memset(mem, 0, bytes);
+        lines_ = (Line*)mem;
+    }
+
+    PerCpuCounters::~PerCpuCounters()
+    {
+        free(lines_);
+    }
+
+    bool PerCpuCounters::UsesRseq()
+    {
+#ifdef CPPBREAKER_HAVE_RSEQ
+        // glibc leaves the size 0 when rseq is disabled or the kernel lacks it
+        return __rseq_size != 0;
+#else
+        return false;
+#endif
+    }
+
+    size_t PerCpuCounters::Lines()
+    {
+        // one more line for the threads rseq could not be registered for
+        return possibleCpus() + 1;
+    }
+
+    void PerCpuCounters::Add(int field, uint64_t n)
+    {
+#ifdef CPPBREAKER_HAVE_RSEQ
+        if (UsesRseq())
+        {
+            struct rseq* rs = rseqArea();
+            for (;;)
+            {
+                uint32_t cpu = __atomic_load_n(&rs->cpu_id_start, __ATOMIC_RELAXED);
+                if (int32_t(__atomic_load_n(&rs->cpu_id, __ATOMIC_RELAXED)) < 0 || cpu >= possibleCpus())
+                    break;
+                if (rseqAdd(&lines_[cpu].values[field], cpu, n))
+                    return;
+            }
+            __atomic_fetch_add(&lines_[possibleCpus()].values[field], n, __ATOMIC_RELAXED);
+            return;
+        }
+#endif
+        __atomic_fetch_add(&lines_[shard % Lines()].values[field], n, __ATOMIC_RELAXED);
+    }
+
+    uint64_t PerCpuCounters::Load(int field) const
+    {
+        uint64_t sum = 0;
+        size_t lines = Lines();
+        for (size_t i = 0; i < lines; i++)
+            sum += __atomic_load_n(&lines_[i].values[field], __ATOMIC_RELAXED);
+        return sum;
+    }
+
+    PerNodeCounters::PerNodeCounters()
+    {
+        lines_.resize(size_t(Numa::Nodes()));
+        for (size_t n = 0; n < lines_.size(); n++)
+        {
+            lines_[n] = (Line*)NodeArena::AllocateLine(int(n));
+            if (lines_[n] == nullptr)
+                abort();
+        }
+    }
+
+    PerNodeCounters::~PerNodeCounters()
+    {
+        for (size_t n = 0; n < lines_.size(); n++)
+            NodeArena::FreeLine(int(n), lines_[n]);
+    }
+
+    void PerNodeCounters::Add(int field, uint64_t n)
+    {
+        Line* line = lines_.size() == 1 ? lines_[0] : lines_[size_t(Numa::CurrentNode())];
+        __atomic_fetch_add(&line->values[field], n, __ATOMIC_RELAXED);
+    }
+
+    uint64_t PerNodeCounters::Load(int field) const
+    {
+        uint64_t sum = 0;
+        for (auto line : lines_)
+            sum += __atomic_load_n(&line->values[field], __ATOMIC_RELAXED);
+        return sum;
+    }
+}
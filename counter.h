@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace cppbreaker
+{
+    // PerCpuCounters is a group of up to kFields counters with one cache line per CPU, so that
+    // increments from different CPUs never touch the same line. Load sums the lines.
+    //
+    // On x86-64 Linux with glibc 2.35 or later an increment is a restartable sequence (rseq) on the
+    // line of the current CPU, a plain add without a lock prefix that the kernel restarts if the thread
+    // is preempted or migrated in the middle. Elsewhere, or with CPPBREAKER_NO_RSEQ defined, or when
+    // glibc has not registered rseq, threads are spread over the lines and add atomically.
+    class PerCpuCounters
+    {
+    public:
+        static const int kFields = 8;
+
+        PerCpuCounters();
+        ~PerCpuCounters();
+
+        PerCpuCounters(const PerCpuCounters&) = delete;
+        PerCpuCounters& operator=(const PerCpuCounters&) = delete;
+
+        void Add(int field, uint64_t n);
+        uint64_t Load(int field) const;
+
+        // UsesRseq returns whether increments are restartable sequences
+        static bool UsesRseq();
+        // Lines returns the number of cache lines of a group
+        static size_t Lines();
+
+    private:
+        struct Line
+        {
+            uint64_t values[kFields];
+        };
+
+        Line* lines_ = nullptr;
+    };
+
+    // PerNodeCounters is a group of up to kFields counters with one cache line on each NUMA node,
+    // taken from the NodeArena of the node. Threads add atomically to the line of the node they run on,
+    // so that increments stay within a socket. Load sums the lines.
+    // It costs a line per node where PerCpuCounters costs a line per CPU.
+    class PerNodeCounters
+    {
+    public:
+        static const int kFields = 8;
+
+        PerNodeCounters();
+        ~PerNodeCounters();
+
+        PerNodeCounters(const PerNodeCounters&) = delete;
+        PerNodeCounters& operator=(const PerNodeCounters&) = delete;
+
+        void Add(int field, uint64_t n);
+        uint64_t Load(int field) const;
+
+    private:
+        struct Line
+        {
+            uint64_t values[kFields];
+        };
+
+        std::vector<Line*> lines_;
+    };
+
+    // Counter is a cumulative counter of BreakerMetrics: a single atomic word, or a field of per-CPU
+    // or per-node counters shared with the other counters of the breaker, see Settings::per_cpu_metrics.
+    class Counter
+    {
+    public:
+        void Add(uint64_t n)
+        {
+            if (per_cpu_ != nullptr)
+                per_cpu_->Add(field_, n);
+            else if (per_node_ != nullptr)
+                per_node_->Add(field_, n);
+            else
+                value_.fetch_add(n, std::memory_order_relaxed);
+        }
+
+        uint64_t Load() const
+        {
+            if (per_cpu_ != nullptr)
+                return per_cpu_->Load(field_);
+            else if (per_node_ != nullptr)
+                return per_node_->Load(field_);
+            return value_.load(std::memory_order_relaxed);
+        }
+
+        // Bind moves the counter to a field of counters, before it is first added to
+        void Bind(PerCpuCounters* counters, int field)
+        {
+            per_cpu_ = counters;
+            field_ = field;
+        }
+        void Bind(PerNodeCounters* counters, int field)
+        {
+            per_node_ = counters;
+            field_ = field;
+        }
+
+    private:
+        std::atomic<uint64_t> value_{0};
+        PerCpuCounters* per_cpu_ = nullptr;
+        PerNodeCounters* per_node_ = nullptr;
+        int field_ = 0;
+    };
+}
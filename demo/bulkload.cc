@@ -0,0 +1,64 @@
+// bulkload times BreakerSet on a generated configuration of service x method x host breakers.
+//
+//   bulkload [-n breakers] [-c classes] [-j threads]
+
+#include "breaker_set.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+
+int main(int argc, char* argv[])
+{
+    int n = 200000;
+    int classes = 4;
+    unsigned threads = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:c:j:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            n = atoi(optarg);
+            break;
+        case 'c':
+            classes = std::max(1, atoi(optarg));
+            break;
+        case 'j':
+            threads = unsigned(atoi(optarg));
+            break;
+        default:
+            fprintf(stderr, "usage: bulkload [-n breakers] [-c classes] [-j threads]\n");
+            return 2;
+        }
+    }
+
+    std::string config;
+    for (int c = 0; c < classes; c++)
+        config += "class tier" + std::to_string(c) + " timeout=" + std::to_string(c + 1) +
+            "s trip=requests >= 20 && failure_ratio >= 0.5 || consecutive_failures > 5\n";
+    for (int i = 0; i < n; i++)
+    {
+        config += "tier" + std::to_string(i % classes) + " service" + std::to_string(i / 1000) + ".method" +
+            std::to_string(i / 50 % 20) + ".host" + std::to_string(i % 50) + "\n";
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        cppbreaker::BreakerSet set;
+        std::string err;
+        if (!set.Parse(config.data(), config.size(), &err, threads))
+        {
+            fprintf(stderr, "bulkload: %s\n", err.c_str());
+            return 1;
+        }
+        auto built = std::chrono::steady_clock::now();
+        printf("%zu breakers in %zu bytes of config built in %.1fms\n", set.Size(), config.size(),
+            std::chrono::duration<double, std::milli>(built - start).count());
+        start = std::chrono::steady_clock::now();
+    }
+    printf("destroyed in %.1fms\n",
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    return 0;
+}
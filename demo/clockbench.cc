@@ -0,0 +1,79 @@
+// clockbench compares the time sources a breaker reads on every call: system_clock and steady_clock
+// through the vDSO, and TscClock. It then runs Execute on a breaker with each clock, which reads
+// the clock to check expiry and times the request.
+//
+//   clockbench [-n reads]
+
+#include "circuit_breaker.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+
+typedef std::chrono::steady_clock Clock;
+
+// measure returns the nanoseconds per call of fn
+template<typename Function_>
+double measure(long n, Function_ fn)
+{
+    auto start = Clock::now();
+    for (long i = 0; i < n; i++)
+        fn();
+    return double(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count()) / double(n);
+}
+
+double execute(long n, cppbreaker::Clock* clock)
+{
+    cppbreaker::Settings st;
+    st.clock = clock;
+    st.interval = std::chrono::seconds(60);
+    cppbreaker::CircuitBreaker cb(st);
+    return measure(n, [&cb]() {
+        cb.Execute<int>([]() -> std::tuple<int, int> { return std::make_tuple(0, 0); });
+    });
+}
+
+int main(int argc, char* argv[])
+{
+    long n = 10000000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            n = std::max(1L, atol(optarg));
+            break;
+        default:
+            fprintf(stderr, "usage: clockbench [-n reads]\n");
+            return 2;
+        }
+    }
+
+    cppbreaker::TscClock* tsc = cppbreaker::TscClock::Instance();
+    if (tsc->Reliable())
+        printf("tsc: invariant, %.3f GHz\n", tsc->TicksPerSecond() / 1e9);
+    else
+        printf("tsc: not reliable, TscClock falls back to system_clock\n");
+
+    volatile int64_t sink = 0;
+    printf("%-24s %10s\n", "SOURCE", "NS/CALL");
+    printf("%-24s %10.1f\n", "system_clock::now", measure(n, [&sink]() {
+        sink = std::chrono::system_clock::now().time_since_epoch().count();
+    }));
+    printf("%-24s %10.1f\n", "steady_clock::now", measure(n, [&sink]() {
+        sink = std::chrono::steady_clock::now().time_since_epoch().count();
+    }));
+    printf("%-24s %10.1f\n", "TscClock::Now", measure(n, [&sink, tsc]() {
+        sink = tsc->Now().time_since_epoch().count();
+    }));
+    printf("%-24s %10.1f\n", "TscClock::Ticks", measure(n, [&sink, tsc]() {
+        sink = int64_t(tsc->Ticks());
+    }));
+    printf("%-24s %10.1f\n", "Execute, system_clock", execute(n / 10, nullptr));
+    printf("%-24s %10.1f\n", "Execute, TscClock", execute(n / 10, tsc));
+    return 0;
+}
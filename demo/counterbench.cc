@@ -0,0 +1,209 @@
+// counterbench compares the ways to count the requests and outcomes of a breaker from many threads:
+// a mutex around the counters, shared atomics, per-thread counters registered for aggregation,
+// and PerCpuCounters. One operation counts a request and its success.
+//
+//   counterbench [-t max_threads] [-n ops_per_thread] [-s ops_per_short_thread]
+//
+// Every backend runs with 1, 2, 4 ... max_threads long lived threads, then with waves of short lived
+// threads doing ops_per_short_thread operations each, where per-thread counters pay for registering.
+
+#include "counter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+
+typedef std::chrono::steady_clock Clock;
+
+struct MutexBackend
+{
+    std::mutex mutex;
+    uint64_t requests = 0;
+    uint64_t successes = 0;
+
+    void Count()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        requests++;
+        successes++;
+    }
+    uint64_t Requests()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return requests;
+    }
+};
+
+struct AtomicBackend
+{
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> successes{0};
+
+    void Count()
+    {
+        requests.fetch_add(1, std::memory_order_relaxed);
+        successes.fetch_add(1, std::memory_order_relaxed);
+    }
+    uint64_t Requests()
+    {
+        return requests.load(std::memory_order_relaxed);
+    }
+};
+
+// PerThreadBackend gives every thread its own line, registered on first use and folded into
+// retired when the thread exits
+struct PerThreadBackend
+{
+    // padded so that two slots never share a cache line, whatever the alignment new gives
+    struct Slot
+    {
+        std::atomic<uint64_t> requests{0};
+        std::atomic<uint64_t> successes{0};
+        char pad[112];
+    };
+
+    struct Holder
+    {
+        PerThreadBackend* backend = nullptr;
+        Slot* slot = nullptr;
+
+        ~Holder()
+        {
+            if (slot == nullptr)
+                return;
+            std::lock_guard<std::mutex> lock(backend->mutex);
+            backend->retired += slot->requests.load(std::memory_order_relaxed);
+            backend->slots.erase(std::find(backend->slots.begin(), backend->slots.end(), slot));
+            delete slot;
+        }
+    };
+
+    std::mutex mutex;
+    std::vector<Slot*> slots;
+    uint64_t retired = 0;
+
+    void Count()
+    {
+        static thread_local Holder holder;
+        if (holder.slot == nullptr)
+        {
+            holder.backend = this;
+            holder.slot = new Slot();
+            std::lock_guard<std::mutex> lock(mutex);
+            slots.push_back(holder.slot);
+        }
+        holder.slot->requests.store(holder.slot->requests.load(std::memory_order_relaxed) + 1,
+            std::memory_order_relaxed);
+        holder.slot->successes.store(holder.slot->successes.load(std::memory_order_relaxed) + 1,
+            std::memory_order_relaxed);
+    }
+    uint64_t Requests()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint64_t sum = retired;
+        for (auto s : slots)
+            sum += s->requests.load(std::memory_order_relaxed);
+        return sum;
+    }
+};
+
+struct PerCpuBackend
+{
+    cppbreaker::PerCpuCounters counters;
+
+    void Count()
+    {
+        counters.Add(0, 1);
+        counters.Add(1, 1);
+    }
+    uint64_t Requests()
+    {
+        return counters.Load(0);
+    }
+};
+
+// run returns the nanoseconds per operation of threads threads doing ops operations each, in waves
+// of short lived threads when waves is more than 1
+template<typename Backend_>
+double run(int threads, int waves, long ops)
+{
+    Backend_ backend;
+    auto start = Clock::now();
+    for (int w = 0; w < waves; w++)
+    {
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; t++)
+        {
+            workers.emplace_back([&backend, ops]() {
+                for (long i = 0; i < ops; i++)
+                    backend.Count();
+            });
+        }
+        for (auto& t : workers)
+            t.join();
+    }
+    double ns = double(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+    uint64_t total = uint64_t(threads) * uint64_t(waves) * uint64_t(ops);
+    if (backend.Requests() != total)
+    {
+        fprintf(stderr, "counterbench: counted %llu of %llu\n", (unsigned long long)backend.Requests(),
+            (unsigned long long)total);
+        exit(1);
+    }
+    // wall time per operation of one thread
+    return ns * threads / double(total);
+}
+
+template<typename Backend_>
+void report(const char* name, int max_threads, long ops, long short_ops)
+{
+    for (int t = 1; t <= max_threads; t *= 2)
+    {
+        double ns = run<Backend_>(t, 1, ops);
+        printf("%-12s %8d %8s %10.1f %10.1f\n", name, t, "long", ns, t * 1e3 / ns);
+    }
+    double ns = run<Backend_>(max_threads, 100, short_ops);
+    printf("%-12s %8d %8s %10.1f %10.1f\n", name, max_threads, "short", ns, max_threads * 1e3 / ns);
+}
+
+int main(int argc, char* argv[])
+{
+    int max_threads = int(std::max(2u, std::thread::hardware_concurrency()));
+    long ops = 2000000;
+    long short_ops = 1000;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:n:s:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            max_threads = std::max(1, atoi(optarg));
+            break;
+        case 'n':
+            ops = std::max(1L, atol(optarg));
+            break;
+        case 's':
+            short_ops = std::max(1L, atol(optarg));
+            break;
+        default:
+            fprintf(stderr, "usage: counterbench [-t max_threads] [-n ops_per_thread] [-s ops_per_short_thread]\n");
+            return 2;
+        }
+    }
+
+    printf("per-cpu increments use %s\n", cppbreaker::PerCpuCounters::UsesRseq() ? "rseq" : "sharded atomics");
+    printf("%-12s %8s %8s %10s %10s\n", "BACKEND", "THREADS", "LIFE", "NS/OP", "MOPS/S");
+    report<MutexBackend>("mutex", max_threads, ops, short_ops);
+    report<AtomicBackend>("atomic", max_threads, ops, short_ops);
+    report<PerThreadBackend>("per-thread", max_threads, ops, short_ops);
+    report<PerCpuBackend>("per-cpu", max_threads, ops, short_ops);
+    return 0;
+}
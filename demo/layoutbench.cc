@@ -0,0 +1,141 @@
+// layoutbench measures false sharing between breakers packed in an array: every thread runs requests
+// through its own breaker, so any slowdown as threads are added comes from cache lines the breakers share.
+//
+//   layoutbench [-t max_threads] [-n ops_per_thread]
+//
+// As a reference, the same is done with two atomic counters per slot, packed tightly and padded
+// to a cache line.
+
+#include "breaker_set.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+
+typedef std::chrono::steady_clock Clock;
+
+// PackedSlot is the counters of one thread, four slots share a cache line
+struct PackedSlot
+{
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> successes{0};
+
+    void Count()
+    {
+        requests.fetch_add(1, std::memory_order_relaxed);
+        successes.fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+struct alignas(64) PaddedSlot
+{
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> successes{0};
+
+    void Count()
+    {
+        requests.fetch_add(1, std::memory_order_relaxed);
+        successes.fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+// run returns the nanoseconds per operation of threads threads calling op(thread) ops times each
+template<typename Function_>
+double run(int threads, long ops, Function_ op)
+{
+    std::vector<std::thread> workers;
+    auto start = Clock::now();
+    for (int t = 0; t < threads; t++)
+    {
+        workers.emplace_back([t, ops, &op]() {
+            for (long i = 0; i < ops; i++)
+                op(t);
+        });
+    }
+    for (auto& w : workers)
+        w.join();
+    double ns = double(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+    return ns / double(ops);
+}
+
+template<typename Slot_>
+double runSlots(int threads, long ops)
+{
+    // new does not align to more than 16 bytes before C++17
+    void* mem = nullptr;
+    if (posix_memalign(&mem, 64, sizeof(Slot_) * size_t(threads)) != 0)
+        exit(1);
+    Slot_* slots = (Slot_*)mem;
+    for (int t = 0; t < threads; t++)
+        new (&slots[t]) Slot_();
+    double ns = run(threads, ops, [slots](int t) {
+        slots[t].Count();
+    });
+    for (int t = 0; t < threads; t++)
+        slots[t].~Slot_();
+    free(mem);
+    return ns;
+}
+
+double breakers(int threads, long ops)
+{
+    cppbreaker::BreakerSet set;
+    std::string conf;
+    for (int t = 0; t < threads; t++)
+        conf += "c b" + std::to_string(t) + "\n";
+    set.DefineClass("c", cppbreaker::Settings());
+    std::string err;
+    if (!set.Parse(conf.data(), conf.size(), &err))
+    {
+        fprintf(stderr, "layoutbench: %s\n", err.c_str());
+        exit(1);
+    }
+    return run(threads, ops, [&set](int t) {
+        cppbreaker::CircuitBreaker* cb = set.At(size_t(t));
+        uint64_t gen;
+        if (cb->Allow(&gen) == cppbreaker::ResultCodeOK)
+            cb->Done(gen, true);
+    });
+}
+
+int main(int argc, char* argv[])
+{
+    int max_threads = int(std::max(2u, std::thread::hardware_concurrency()));
+    long ops = 2000000;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:n:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            max_threads = std::max(1, atoi(optarg));
+            break;
+        case 'n':
+            ops = std::max(1L, atol(optarg));
+            break;
+        default:
+            fprintf(stderr, "usage: layoutbench [-t max_threads] [-n ops_per_thread]\n");
+            return 2;
+        }
+    }
+
+    printf("sizeof(PackedSlot) %zu, sizeof(PaddedSlot) %zu, sizeof(CircuitBreaker) %zu (%zu cache lines)\n",
+        sizeof(PackedSlot), sizeof(PaddedSlot), sizeof(cppbreaker::CircuitBreaker),
+        sizeof(cppbreaker::CircuitBreaker) / cppbreaker::CircuitBreaker::kCacheLine);
+    printf("%-14s %8s %10s\n", "ARRAY", "THREADS", "NS/OP");
+    for (int t = 1; t <= max_threads; t *= 2)
+    {
+        printf("%-14s %8d %10.1f\n", "packed slots", t, runSlots<PackedSlot>(t, ops));
+        printf("%-14s %8d %10.1f\n", "padded slots", t, runSlots<PaddedSlot>(t, ops));
+        printf("%-14s %8d %10.1f\n", "breakers", t, breakers(t, ops / 4));
+    }
+    return 0;
+}
@@ -0,0 +1,292 @@
+// loadgen drives a circuit breaker from many threads against an in-process fake backend
+// that goes through scripted phases, and reports per phase throughput, breaker overhead,
+// time to detect and recover, and wasted calls.
+//
+//   loadgen [-t threads] [-m mode] [-p phases] [-i interval_ms] [-o timeout_ms] [-l] [-c]
+//
+// phases is a comma separated list of name:seconds:error_rate:latency_us, by default
+//   healthy:3:0.001:200,brownout:3:0.4:2000,down:3:1:50,recovery:3:0.001:200
+// mode selects how the breaker trips: ratio (30% of at least 20 requests, the default),
+// consecutive (more than 5 consecutive failures), ewma (EwmaTripPolicy at 30% of a volume of 20 with
+// a half life of 1s), anomaly (AnomalyTripPolicy on errors and latency), burn (BurnRateTripPolicy burning
+// a 99% SLO 10 times over 1s and 10s) or default (the Settings default).
+// -l turns on Settings::open_lease, so that threads reject from their own lease while the breaker is open.
+// -c turns on Settings::packed_counts, so that closed state requests count with a CAS instead of the mutex.
+
+#include "circuit_breaker.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+
+typedef std::chrono::steady_clock Clock;
+
+struct Phase
+{
+    std::string name;
+    double seconds;
+    double error_rate;
+    int latency_us;
+};
+
+struct PhaseStats
+{
+    uint64_t calls = 0;
+    uint64_t admitted = 0;
+    uint64_t rejected = 0;
+    uint64_t failures = 0;
+    std::vector<int64_t> overhead_ns;
+};
+
+struct Transition
+{
+    Clock::time_point at;
+    cppbreaker::State from;
+    cppbreaker::State to;
+};
+
+static bool parsePhases(const std::string& spec, std::vector<Phase>* phases)
+{
+    std::istringstream in(spec);
+    std::string item;
+    while (std::getline(in, item, ','))
+    {
+        Phase p;
+        char name[64];
+        if (sscanf(item.c_str(), "%63[^:]:%lf:%lf:%d", name, &p.seconds, &p.error_rate, &p.latency_us) != 4)
+            return false;
+        p.name = name;
+        phases->push_back(p);
+    }
+    return !phases->empty();
+}
+
+static double percentile(std::vector<int64_t>* v, double q)
+{
+    if (v->empty())
+        return 0;
+    size_t k = std::min(v->size() - 1, size_t(q * double(v->size())));
+    std::nth_element(v->begin(), v->begin() + k, v->end());
+    return double((*v)[k]);
+}
+
+int main(int argc, char* argv[])
+{
+    int threads = int(std::max(2u, std::thread::hardware_concurrency()));
+    std::string spec = "healthy:3:0.001:200,brownout:3:0.4:2000,down:3:1:50,recovery:3:0.001:200";
+    int interval_ms = 1000;
+    int timeout_ms = 500;
+    std::string mode = "ratio";
+    bool open_lease = false;
+    bool packed_counts = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:m:p:i:o:lch")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            threads = std::max(1, atoi(optarg));
+            break;
+        case 'm':
+            mode = optarg;
+            break;
+        case 'p':
+            spec = optarg;
+            break;
+        case 'i':
+            interval_ms = atoi(optarg);
+            break;
+        case 'o':
+            timeout_ms = atoi(optarg);
+            break;
+        case 'l':
+            open_lease = true;
+            break;
+        case 'c':
+            packed_counts = true;
+            break;
+        default:
+            fprintf(stderr, "usage: loadgen [-t threads] [-m ratio|consecutive|ewma|anomaly|burn|default] [-p name:seconds:error_rate:latency_us,...] "
+                "[-i interval_ms] [-o timeout_ms] [-l] [-c]\n");
+            return 2;
+        }
+    }
+
+    std::vector<Phase> phases;
+    if (!parsePhases(spec, &phases))
+    {
+        fprintf(stderr, "loadgen: bad phases %s\n", spec.c_str());
+        return 2;
+    }
+    std::vector<Clock::time_point> phase_start;
+
+    std::mutex transitions_mutex;
+    std::vector<Transition> transitions;
+
+    cppbreaker::Settings st;
+    st.name = "loadgen";
+    st.max_requests = 5;
+    st.interval = std::chrono::milliseconds(interval_ms);
+    st.timeout = std::chrono::milliseconds(timeout_ms);
+    st.open_lease = open_lease;
+    st.packed_counts = packed_counts;
+    if (mode == "ratio")
+    {
+        st.ready_to_trip = [](const cppbreaker::Counts& counts) {
+            return counts.requests >= 20 && counts.total_failures * 10 >= counts.requests * 3;
+        };
+    }
+    else if (mode == "consecutive")
+    {
+        st.ready_to_trip = [](const cppbreaker::Counts& counts) {
+            return counts.consecutive_failures > 5;
+        };
+    }
+    else if (mode == "ewma")
+    {
+        cppbreaker::EwmaTripPolicy::Options ewma;
+        ewma.half_life = std::chrono::seconds(1);
+        ewma.failure_ratio = 0.3;
+        ewma.min_volume = 20;
+        st.trip_policy = std::make_shared<cppbreaker::EwmaTripPolicy>(ewma);
+    }
+    else if (mode == "anomaly")
+    {
+        cppbreaker::AnomalyTripPolicy::Options anomaly;
+        anomaly.latency_k = 6;
+        st.trip_policy = std::make_shared<cppbreaker::AnomalyTripPolicy>(anomaly);
+    }
+    else if (mode == "burn")
+    {
+        cppbreaker::BurnRateTripPolicy::Options burn;
+        burn.slo = 0.99;
+        burn.factor = 10;
+        burn.short_window = std::chrono::seconds(1);
+        burn.long_window = std::chrono::seconds(10);
+        st.trip_policy = std::make_shared<cppbreaker::BurnRateTripPolicy>(burn);
+    }
+    else if (mode != "default")
+    {
+        fprintf(stderr, "loadgen: unknown mode %s\n", mode.c_str());
+        return 2;
+    }
+    st.on_state_change = [&](const std::string&, cppbreaker::State from, cppbreaker::State to) {
+        std::lock_guard<std::mutex> lock(transitions_mutex);
+        transitions.push_back(Transition{ Clock::now(), from, to });
+    };
+    cppbreaker::CircuitBreaker cb(st);
+
+    auto start = Clock::now();
+    auto t = start;
+    for (auto& p : phases)
+    {
+        phase_start.push_back(t);
+        t += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(p.seconds));
+    }
+    auto end = t;
+
+    std::vector<std::vector<PhaseStats>> stats(size_t(threads), std::vector<PhaseStats>(phases.size()));
+    std::vector<std::thread> workers;
+    for (int w = 0; w < threads; w++)
+    {
+        workers.emplace_back([&, w]() {
+            std::mt19937_64 rng(uint64_t(w) * 7919 + 1);
+            std::uniform_real_distribution<double> uniform(0, 1);
+            for (;;)
+            {
+                auto t0 = Clock::now();
+                if (t0 >= end)
+                    return;
+                size_t phase = 0;
+                while (phase + 1 < phases.size() && t0 >= phase_start[phase + 1])
+                    phase++;
+                const Phase& p = phases[phase];
+                PhaseStats& s = stats[size_t(w)][phase];
+
+                Clock::time_point t1, t2;
+                bool admitted = false;
+                auto ret = cb.Execute<int>([&]()-> std::tuple<int, int> {
+                    admitted = true;
+                    t1 = Clock::now();
+                    std::this_thread::sleep_for(std::chrono::microseconds(p.latency_us));
+                    int code = uniform(rng) < p.error_rate ? 14 : 0;
+                    t2 = Clock::now();
+                    return std::make_tuple(0, code);
+                });
+                auto t3 = Clock::now();
+
+                s.calls++;
+                if (admitted)
+                {
+                    s.admitted++;
+                    if (std::get<1>(ret) != 0)
+                        s.failures++;
+                    s.overhead_ns.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        (t1 - t0) + (t3 - t2)).count());
+                }
+                else
+                {
+                    s.rejected++;
+                    s.overhead_ns.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(t3 - t0).count());
+                    // a rejected client backs off a little, as a real one would
+                    std::this_thread::sleep_for(std::chrono::microseconds(p.latency_us));
+                }
+            }
+        });
+    }
+    for (auto& w : workers)
+        w.join();
+
+    printf("%d threads, mode %s, breaker interval %dms, timeout %dms\n\n", threads, mode.c_str(),
+        interval_ms, timeout_ms);
+    printf("%-12s %10s %10s %9s %9s %10s %12s %12s %12s %12s\n", "PHASE", "CALLS/s", "ADMITTED/s", "REJECT%",
+        "WASTED", "WASTED%", "OVH_P50_NS", "OVH_P99_NS", "DETECT_MS", "RECOVER_MS");
+    for (size_t i = 0; i < phases.size(); i++)
+    {
+        PhaseStats total;
+        for (auto& per_thread : stats)
+        {
+            PhaseStats& s = per_thread[i];
+            total.calls += s.calls;
+            total.admitted += s.admitted;
+            total.rejected += s.rejected;
+            total.failures += s.failures;
+            total.overhead_ns.insert(total.overhead_ns.end(), s.overhead_ns.begin(), s.overhead_ns.end());
+        }
+
+        // time to detect: first trip in a phase that fails, time to recover: first close in one that does not
+        auto phase_end = i + 1 < phases.size() ? phase_start[i + 1] : end;
+        std::string detect = "-", recover = "-";
+        char buf[32];
+        for (auto& tr : transitions)
+        {
+            if (tr.at < phase_start[i] || tr.at >= phase_end)
+                continue;
+            auto ms = std::chrono::duration<double, std::milli>(tr.at - phase_start[i]).count();
+            snprintf(buf, sizeof(buf), "%.1f", ms);
+            if (tr.to == cppbreaker::STATE_OPEN && tr.from == cppbreaker::STATE_CLOSED && detect == "-")
+                detect = buf;
+            if (tr.to == cppbreaker::STATE_CLOSED && recover == "-")
+                recover = buf;
+        }
+
+        double secs = phases[i].seconds;
+        // calls admitted into a failing backend are wasted
+        printf("%-12s %10.0f %10.0f %8.2f%% %9llu %9.2f%% %12.0f %12.0f %12s %12s\n",
+            phases[i].name.c_str(), double(total.calls) / secs, double(total.admitted) / secs,
+            total.calls == 0 ? 0.0 : 100.0 * double(total.rejected) / double(total.calls),
+            (unsigned long long)total.failures,
+            total.admitted == 0 ? 0.0 : 100.0 * double(total.failures) / double(total.admitted),
+            percentile(&total.overhead_ns, 0.5), percentile(&total.overhead_ns, 0.99),
+            detect.c_str(), recover.c_str());
+    }
+    return 0;
+}
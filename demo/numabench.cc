@@ -0,0 +1,126 @@
+// numabench measures the cost of breaker state shared across NUMA nodes, with threads pinned round robin
+// to the nodes of the machine.
+//
+//   numabench [-t threads] [-n ops_per_thread] [-b breakers]
+//
+// counters: threads count requests and successes in the metrics of one breaker, shared atomics,
+//           per-CPU and per-node counters.
+// execute:  threads run requests through breakers of a BreakerSet, each thread taking breakers
+//           in turn. The breakers are all on node 0 (one set), or each node has a set of its own
+//           used by its threads (per-node arena), with per-node metrics.
+
+#include "breaker_set.h"
+#include "numa.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+
+typedef std::chrono::steady_clock Clock;
+
+// runPinned returns the nanoseconds per operation of threads pinned round robin to the nodes,
+// calling op(thread, node, i) ops times each
+template<typename Function_>
+double runPinned(int threads, long ops, Function_ op)
+{
+    std::vector<std::thread> workers;
+    auto start = Clock::now();
+    for (int t = 0; t < threads; t++)
+    {
+        workers.emplace_back([t, ops, &op]() {
+            int node = t % cppbreaker::Numa::Nodes();
+            cppbreaker::Numa::PinThread(node);
+            for (long i = 0; i < ops; i++)
+                op(t, node, i);
+        });
+    }
+    for (auto& w : workers)
+        w.join();
+    double ns = double(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+    return ns * threads / double(threads * ops);
+}
+
+double counters(int threads, long ops, bool per_cpu, bool per_node)
+{
+    // the counters a breaker adds to on every admitted request, without the breaker lock
+    cppbreaker::BreakerMetrics m;
+    if (per_cpu)
+        m.UsePerCpu();
+    else if (per_node)
+        m.UsePerNode();
+    return runPinned(threads, ops, [&m](int, int, long) {
+        m.requests.Add(1);
+        m.successes.Add(1);
+    });
+}
+
+double execute(int threads, long ops, int breakers, bool per_node)
+{
+    int sets = per_node ? cppbreaker::Numa::Nodes() : 1;
+    std::vector<std::unique_ptr<cppbreaker::BreakerSet>> set(sets);
+    std::string conf;
+    for (int b = 0; b < breakers; b++)
+        conf += "c b" + std::to_string(b) + "\n";
+    for (int s = 0; s < sets; s++)
+    {
+        set[s].reset(new cppbreaker::BreakerSet());
+        set[s]->SetNode(s);
+        cppbreaker::Settings st;
+        st.per_node_metrics = per_node;
+        set[s]->DefineClass("c", st);
+        std::string err;
+        if (!set[s]->Parse(conf.data(), conf.size(), &err))
+        {
+            fprintf(stderr, "numabench: %s\n", err.c_str());
+            exit(1);
+        }
+    }
+    return runPinned(threads, ops, [&](int t, int node, long i) {
+        cppbreaker::CircuitBreaker* cb = set[per_node ? node : 0]->At(size_t(t + i) % size_t(breakers));
+        uint64_t gen;
+        if (cb->Allow(&gen) == cppbreaker::ResultCodeOK)
+            cb->Done(gen, true);
+    });
+}
+
+int main(int argc, char* argv[])
+{
+    int threads = int(std::max(2u, std::thread::hardware_concurrency()));
+    long ops = 2000000;
+    int breakers = 64;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:n:b:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            threads = std::max(1, atoi(optarg));
+            break;
+        case 'n':
+            ops = std::max(1L, atol(optarg));
+            break;
+        case 'b':
+            breakers = std::max(1, atoi(optarg));
+            break;
+        default:
+            fprintf(stderr, "usage: numabench [-t threads] [-n ops_per_thread] [-b breakers]\n");
+            return 2;
+        }
+    }
+
+    printf("%d nodes, %d threads pinned round robin\n", cppbreaker::Numa::Nodes(), threads);
+    printf("%-10s %-24s %10s\n", "TEST", "PLACEMENT", "NS/OP");
+    printf("%-10s %-24s %10.1f\n", "counters", "shared atomics", counters(threads, ops, false, false));
+    printf("%-10s %-24s %10.1f\n", "counters", "per-cpu", counters(threads, ops, true, false));
+    printf("%-10s %-24s %10.1f\n", "counters", "per-node", counters(threads, ops, false, true));
+    printf("%-10s %-24s %10.1f\n", "execute", "node 0", execute(threads, ops / 4, breakers, false));
+    printf("%-10s %-24s %10.1f\n", "execute", "per-node sets", execute(threads, ops / 4, breakers, true));
+    return 0;
+}
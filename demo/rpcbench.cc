@@ -0,0 +1,190 @@
+// rpcbench runs a FaultServer and a TestbedClient in one process, over a Unix domain socket,
+// through scripted phases of faults, and reports per phase end to end overhead of the breaker,
+// latency, recovery and file descriptor use.
+//
+//   rpcbench [-c concurrency] [-w timeout_ms] [-p phases] [-i interval_ms] [-o timeout_ms]
+//
+// phases is a ; separated list of a name, a duration in seconds and faults as key=value pairs,
+// see cppbreaker::ParseFaults. By default
+//   healthy 2 latency_us=100;brownout 2 error_rate=0.4 latency_us=2000;down 2 reset_rate=0.5 hang_rate=0.5;
+//   recovery 2 latency_us=100
+
+#include "circuit_breaker.h"
+#include "testbed.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <mutex>
+#include <sstream>
+#include <unistd.h>
+#include <vector>
+
+
+typedef std::chrono::steady_clock Clock;
+
+struct Phase
+{
+    std::string name;
+    double seconds;
+    cppbreaker::Faults faults;
+};
+
+static bool parsePhases(const std::string& spec, std::vector<Phase>* phases)
+{
+    std::istringstream in(spec);
+    std::string item;
+    while (std::getline(in, item, ';'))
+    {
+        std::istringstream words(item);
+        Phase p;
+        if (!(words >> p.name >> p.seconds))
+            return false;
+        std::string rest;
+        std::getline(words, rest);
+        if (!cppbreaker::ParseFaults(rest, &p.faults))
+            return false;
+        phases->push_back(p);
+    }
+    return !phases->empty();
+}
+
+static double percentile(std::vector<int64_t>* v, double q)
+{
+    if (v->empty())
+        return 0;
+    size_t k = std::min(v->size() - 1, size_t(q * double(v->size())));
+    std::nth_element(v->begin(), v->begin() + k, v->end());
+    return double((*v)[k]);
+}
+
+static int openFds()
+{
+    DIR* dir = opendir("/proc/self/fd");
+    if (dir == nullptr)
+        return -1;
+    int n = 0;
+    while (readdir(dir) != nullptr)
+        n++;
+    closedir(dir);
+    // ., .. and the descriptor of dir itself
+    return n - 3;
+}
+
+struct Transition
+{
+    Clock::time_point at;
+    cppbreaker::State from;
+    cppbreaker::State to;
+};
+
+int main(int argc, char* argv[])
+{
+    int concurrency = 32;
+    int call_timeout_ms = 50;
+    std::string spec = "healthy 2 latency_us=100;brownout 2 error_rate=0.4 latency_us=2000;"
+        "down 2 reset_rate=0.5 hang_rate=0.5;recovery 2 latency_us=100";
+    int interval_ms = 1000;
+    int timeout_ms = 500;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:w:p:i:o:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            concurrency = std::max(1, atoi(optarg));
+            break;
+        case 'w':
+            call_timeout_ms = std::max(1, atoi(optarg));
+            break;
+        case 'p':
+            spec = optarg;
+            break;
+        case 'i':
+            interval_ms = atoi(optarg);
+            break;
+        case 'o':
+            timeout_ms = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: rpcbench [-c concurrency] [-w timeout_ms] [-p \"name seconds faults;...\"] "
+                "[-i interval_ms] [-o timeout_ms]\n");
+            return 2;
+        }
+    }
+
+    std::vector<Phase> phases;
+    if (!parsePhases(spec, &phases))
+    {
+        fprintf(stderr, "rpcbench: bad phases %s\n", spec.c_str());
+        return 2;
+    }
+
+    std::string path = "/tmp/cppbreaker_rpcbench." + std::to_string(getpid()) + ".sock";
+    cppbreaker::FaultServer server;
+    if (!server.Start(path))
+    {
+        fprintf(stderr, "rpcbench: cannot listen on %s\n", path.c_str());
+        return 1;
+    }
+
+    std::mutex transitions_mutex;
+    std::vector<Transition> transitions;
+    cppbreaker::Settings st;
+    st.name = "rpcbench";
+    st.max_requests = 5;
+    st.interval = std::chrono::milliseconds(interval_ms);
+    st.timeout = std::chrono::milliseconds(timeout_ms);
+    st.ready_to_trip = [](const cppbreaker::Counts& counts) {
+        return counts.requests >= 20 && counts.total_failures * 10 >= counts.requests * 3;
+    };
+    st.on_state_change = [&](const std::string&, cppbreaker::State from, cppbreaker::State to) {
+        std::lock_guard<std::mutex> lock(transitions_mutex);
+        transitions.push_back(Transition{ Clock::now(), from, to });
+    };
+    cppbreaker::CircuitBreaker cb(st);
+    cppbreaker::TestbedClient client(&cb, path, concurrency, std::chrono::milliseconds(call_timeout_ms));
+
+    printf("concurrency %d, call timeout %dms, breaker interval %dms, timeout %dms\n\n", concurrency,
+        call_timeout_ms, interval_ms, timeout_ms);
+    printf("%-10s %9s %8s %8s %8s %8s %8s %10s %10s %10s %10s %6s %6s %9s %10s\n", "PHASE", "CALLS/s", "REJECT%",
+        "OK", "ERR", "TIMEOUT", "RESET", "OVH_P50_NS", "OVH_P99_NS", "LAT_P50_US", "LAT_P99_US", "CONNS", "FDS",
+        "DETECT_MS", "RECOVER_MS");
+    for (auto& p : phases)
+    {
+        server.SetFaults(p.faults);
+        auto start = Clock::now();
+        auto stats = client.Run(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::duration<double>(p.seconds)));
+        auto end = Clock::now();
+        int fds = openFds();
+
+        std::string detect = "-", recover = "-";
+        char buf[32];
+        {
+            std::lock_guard<std::mutex> lock(transitions_mutex);
+            for (auto& tr : transitions)
+            {
+                if (tr.at < start || tr.at >= end)
+                    continue;
+                snprintf(buf, sizeof(buf), "%.1f", std::chrono::duration<double, std::milli>(tr.at - start).count());
+                if (tr.from == cppbreaker::STATE_CLOSED && tr.to == cppbreaker::STATE_OPEN && detect == "-")
+                    detect = buf;
+                if (tr.to == cppbreaker::STATE_CLOSED && recover == "-")
+                    recover = buf;
+            }
+        }
+
+        printf("%-10s %9.0f %7.2f%% %8llu %8llu %8llu %8llu %10.0f %10.0f %10.0f %10.0f %6d %6d %9s %10s\n",
+            p.name.c_str(), double(stats.calls) / p.seconds,
+            stats.calls == 0 ? 0.0 : 100.0 * double(stats.rejected) / double(stats.calls),
+            (unsigned long long)stats.successes, (unsigned long long)stats.failures,
+            (unsigned long long)stats.timeouts, (unsigned long long)stats.resets,
+            percentile(&stats.overhead_ns, 0.5), percentile(&stats.overhead_ns, 0.99),
+            percentile(&stats.latency_ns, 0.5) / 1000, percentile(&stats.latency_ns, 0.99) / 1000,
+            stats.max_connections, fds, detect.c_str(), recover.c_str());
+    }
+    server.Stop();
+    return 0;
+}
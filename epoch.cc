@@ -0,0 +1,202 @@
+#include "epoch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#if defined(__linux__) && !defined(CPPBREAKER_NO_MEMBARRIER)
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+namespace cppbreaker
+{
+
+    namespace
+    {
+        // Slot is the read section of a thread, slots are never freed and are reused by later threads
+        struct alignas(64) Slot
+        {
+            // the epoch the section of the thread started in, 0 outside one
+            std::atomic<uint64_t> epoch{0};
+            std::atomic<bool> used{false};
+            // written by the thread of the slot only
+            uint32_t depth = 0;
+            bool membarrier = false;
+            Slot* next = nullptr;
+        };
+
+        struct Retired
+        {
+            const void* p;
+            void (*destroy)(const void*);
+            // Guards that started in this epoch or before may hold p
+            uint64_t epoch;
+        };
+
+        struct State
+        {
+            std::atomic<uint64_t> epoch{1};
+            std::atomic<Slot*> slots{nullptr};
+            bool membarrier = false;
+
+            std::mutex mutex;
+            std::vector<Retired> retired;
+        };
+
+        bool registerMembarrier()
+        {
+#if defined(__linux__) && !defined(CPPBREAKER_NO_MEMBARRIER) && defined(__NR_membarrier)
+            return syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) == 0;
+#else
+            return false;
+#endif
+        }
+
+        State& state()
+        {
+            static State* st = []() {
+                State* s = new State();
+                s->membarrier = registerMembarrier();
+                return s;
+            }();
+            return *st;
+        }
+
+        // barrier orders the slots of every thread, as if each had taken a full fence, with the loads that follow
+        void barrier(const State& st)
+        {
+#if defined(__linux__) && !defined(CPPBREAKER_NO_MEMBARRIER) && defined(__NR_membarrier)
+            if (st.membarrier && syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0) == 0)
+                return;
+#endif
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+
+        // SlotOwner gives the slot of a thread back when the thread exits
+        struct SlotOwner
+        {
+            ~SlotOwner();
+        };
+
+        thread_local Slot* slot = nullptr;
+        thread_local SlotOwner owner;
+
+        SlotOwner::~SlotOwner()
+        {
+            if (slot == nullptr)
+                return;
+            slot->used.store(false, std::memory_order_release);
+            slot = nullptr;
+        }
+
+        Slot* acquireSlot()
+        {
+            State& st = state();
+            // touching owner registers its destructor for this thread
+            (void)&owner;
+            for (Slot* s = st.slots.load(std::memory_order_acquire); s != nullptr; s = s->next)
+            {
+                bool used = false;
+                if (!s->used.load(std::memory_order_relaxed) &&
+                    s->used.compare_exchange_strong(used, true, std::memory_order_acquire))
+                {
+                    slot = s;
+                    return s;
+                }
+            }
+
+            void* mem = nullptr;
+            if (posix_memalign(&mem, alignof(Slot), sizeof(Slot)) != 0)
+                abort();
+            Slot* s = new (mem) Slot();
+            s->used.store(true, std::memory_order_relaxed);
+            s->membarrier = st.membarrier;
+            Slot* head = st.slots.load(std::memory_order_relaxed);
+            do
+            {
+                s->next = head;
+            } while (!st.slots.compare_exchange_weak(head, s, std::memory_order_release, std::memory_order_relaxed));
+            slot = s;
+            return s;
+        }
+    }
+
+    void Epoch::Enter()
+    {
+        Slot* s = slot;
+        if (s == nullptr)
+            s = acquireSlot();
+        if (s->depth++ != 0)
+            return;
+        s->epoch.store(state().epoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+        // the epoch must be visible before the reads of the section, which barrier ensures with membarrier
+        if (s->membarrier)
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+        else
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    void Epoch::Exit()
+    {
+        Slot* s = slot;
+        if (--s->depth != 0)
+            return;
+        s->epoch.store(0, std::memory_order_release);
+    }
+
+    void Epoch::retire(const void* p, void (*destroy)(const void*))
+    {
+        State& st = state();
+        {
+            std::lock_guard<std::mutex> lock(st.mutex);
+            // Guards that start after the increment read the epoch after p was unlinked, and cannot load it
+            Retired r = { p, destroy, st.epoch.fetch_add(1, std::memory_order_acq_rel) };
+            st.retired.push_back(r);
+        }
+        Reclaim();
+    }
+
+    void Epoch::Reclaim()
+    {
+        State& st = state();
+        std::vector<Retired> ready;
+        {
+            std::lock_guard<std::mutex> lock(st.mutex);
+            if (st.retired.empty())
+                return;
+            barrier(st);
+            uint64_t oldest = UINT64_MAX;
+            for (Slot* s = st.slots.load(std::memory_order_acquire); s != nullptr; s = s->next)
+            {
+                uint64_t e = s->epoch.load(std::memory_order_acquire);
+                if (e != 0)
+                    oldest = std::min(oldest, e);
+            }
+            auto held = std::partition(st.retired.begin(), st.retired.end(),
+                [oldest](const Retired& r) { return r.epoch >= oldest; });
+            ready.assign(held, st.retired.end());
+            st.retired.erase(held, st.retired.end());
+        }
+        // destructors run without the lock, they may retire in turn
+        for (auto& r : ready)
+            r.destroy(r.p);
+    }
+
+    size_t Epoch::Pending()
+    {
+        State& st = state();
+        std::lock_guard<std::mutex> lock(st.mutex);
+        return st.retired.size();
+    }
+
+    bool Epoch::UsesMembarrier()
+    {
+        return state().membarrier;
+    }
+}
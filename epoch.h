@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace cppbreaker
+{
+    // Epoch frees objects that are replaced while threads read them without a lock. A reader holds a
+    // Guard while it uses what it loaded, the writer replaces the object and retires the old one, which
+    // is freed once every Guard that was held when it was retired is released.
+    //
+    // A Guard stores the global epoch in a slot of its thread. On Linux with membarrier (4.14 or later)
+    // the store is ordered by a process wide barrier the reclaiming thread issues, so that a Guard costs no
+    // fence. Elsewhere, or with CPPBREAKER_NO_MEMBARRIER defined, a Guard takes a full fence.
+    // Objects are freed by the thread that retires the next one, or that calls Reclaim.
+    class Epoch
+    {
+    public:
+        // Guard is a read section, Guards of a thread nest
+        class Guard
+        {
+        public:
+            Guard()
+            {
+                Epoch::Enter();
+            }
+            ~Guard()
+            {
+                Epoch::Exit();
+            }
+
+            Guard(const Guard&) = delete;
+            Guard& operator=(const Guard&) = delete;
+        };
+
+        static void Enter();
+        static void Exit();
+
+        // Retire frees p once no Guard that may hold it is left, p must not be reachable by new readers
+        template<typename T_>
+        static void Retire(std::unique_ptr<T_> p)
+        {
+            retire(p.release(), &destroy<T_>);
+        }
+        template<typename T_>
+        static void Retire(std::unique_ptr<T_[]> p)
+        {
+            retire(p.release(), &destroyArray<T_>);
+        }
+
+        // Reclaim frees the retired objects no Guard holds anymore
+        static void Reclaim();
+        // Pending returns the number of retired objects not freed yet
+        static size_t Pending();
+
+        // UsesMembarrier returns whether Guards are ordered by membarrier rather than by a fence
+        static bool UsesMembarrier();
+
+    private:
+        template<typename T_>
+        static void destroy(const void* p)
+        {
+            delete static_cast<const T_*>(p);
+        }
+        template<typename T_>
+        static void destroyArray(const void* p)
+        {
+            delete[] static_cast<const T_*>(p);
+        }
+
+        static void retire(const void* p, void (*destroy)(const void*));
+    };
+}
@@ -0,0 +1,193 @@
+#include "journal.h"
+#include "circuit_breaker.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace cppbreaker
+{
+
+    std::atomic<Journal*> Journal::current_(nullptr);
+
+    Journal::~Journal()
+    {
+        Close();
+    }
+
+    bool Journal::Open(const std::string& path, uint64_t capacity)
+    {
+        if (addr_ != nullptr || capacity == 0)
+            return false;
+
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0)
+            return false;
+
+        struct stat sb;
+        if (fstat(fd, &sb) != 0)
+        {
+            close(fd);
+            return false;
+        }
+
+        bool created = sb.st_size == 0;
+        if (created)
+        {
+            size_t size = sizeof(JournalHeader) + capacity * sizeof(JournalRecord);
+            if (ftruncate(fd, off_t(size)) != 0)
+            {
+                close(fd);
+                return false;
+            }
+            sb.st_size = off_t(size);
+        }
+        else if (size_t(sb.st_size) < sizeof(JournalHeader))
+        {
+            close(fd);
+            return false;
+        }
+
+        size_t size = size_t(sb.st_size);
+        void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED)
+            return false;
+
+        auto header = static_cast<JournalHeader*>(addr);
+        if (created)
+        {
+            header->header_size = sizeof(JournalHeader);
+            header->record_size = sizeof(JournalRecord);
+            header->capacity = capacity;
+            header->version = kJournalVersion;
+            header->magic = kJournalMagic;
+        }
+        else if (header->magic != kJournalMagic || header->version != kJournalVersion ||
+            header->header_size != sizeof(JournalHeader) || header->record_size != sizeof(JournalRecord) ||
+            header->capacity == 0 || sizeof(JournalHeader) + header->capacity * sizeof(JournalRecord) > size)
+        {
+            munmap(addr, size);
+            return false;
+        }
+
+        addr_ = addr;
+        size_ = size;
+        capacity_ = header->capacity;
+        records_ = reinterpret_cast<JournalRecord*>(static_cast<char*>(addr) + sizeof(JournalHeader));
+        return true;
+    }
+
+    void Journal::Close()
+    {
+        if (addr_ == nullptr)
+            return;
+        Journal* self = this;
+        current_.compare_exchange_strong(self, nullptr);
+        munmap(addr_, size_);
+        addr_ = nullptr;
+        records_ = nullptr;
+    }
+
+    void Journal::Append(int64_t timestamp_ns, uint32_t breaker_id, const std::string& name,
+        int from, int to, int override, uint64_t generation, const Counts& counts)
+    {
+        if (addr_ == nullptr)
+            return;
+
+        auto header = static_cast<JournalHeader*>(addr_);
+        uint64_t n = header->next.fetch_add(1, std::memory_order_relaxed);
+        JournalRecord* rec = &records_[n % capacity_];
+
+        rec->seq.store(2 * n + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        rec->timestamp_ns = timestamp_ns;
+        rec->breaker_id = breaker_id;
+        rec->from = uint8_t(from);
+        rec->to = uint8_t(to);
+        rec->override = uint8_t(override);
+        rec->reserved = 0;
+        rec->generation = generation;
+        rec->requests = counts.requests;
+        rec->total_successes = counts.total_successes;
+        rec->total_failures = counts.total_failures;
+        rec->consecutive_successes = counts.consecutive_successes;
+        rec->consecutive_failures = counts.consecutive_failures;
+        size_t len = std::min(name.size(), kJournalNameSize - 1);
+        memcpy(rec->name, name.data(), len);
+        memset(rec->name + len, 0, kJournalNameSize - len);
+
+        rec->seq.store(2 * n + 2, std::memory_order_release);
+    }
+
+    void Journal::Install(Journal* journal)
+    {
+        current_.store(journal, std::memory_order_release);
+    }
+
+    bool Journal::Read(const std::string& path, std::vector<JournalEntry>* entries)
+    {
+        entries->clear();
+
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+        struct stat sb;
+        if (fstat(fd, &sb) != 0 || size_t(sb.st_size) < sizeof(JournalHeader))
+        {
+            close(fd);
+            return false;
+        }
+        size_t size = size_t(sb.st_size);
+        void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED)
+            return false;
+
+        auto header = static_cast<const JournalHeader*>(addr);
+        if (header->magic != kJournalMagic || header->version != kJournalVersion ||
+            header->header_size != sizeof(JournalHeader) || header->record_size != sizeof(JournalRecord) ||
+            sizeof(JournalHeader) + header->capacity * sizeof(JournalRecord) > size)
+        {
+            munmap(addr, size);
+            return false;
+        }
+
+        auto records = reinterpret_cast<const JournalRecord*>(static_cast<const char*>(addr) + sizeof(JournalHeader));
+        for (uint64_t i = 0; i < header->capacity; i++)
+        {
+            const JournalRecord& rec = records[i];
+            uint64_t seq = rec.seq.load(std::memory_order_acquire);
+            // empty, or torn by a crash during Append
+            if (seq == 0 || (seq & 1))
+                continue;
+
+            JournalEntry e;
+            e.seq = seq / 2 - 1;
+            e.timestamp_ns = rec.timestamp_ns;
+            e.breaker_id = rec.breaker_id;
+            e.from = rec.from;
+            e.to = rec.to;
+            e.override = rec.override;
+            e.generation = rec.generation;
+            e.requests = rec.requests;
+            e.total_successes = rec.total_successes;
+            e.total_failures = rec.total_failures;
+            e.consecutive_successes = rec.consecutive_successes;
+            e.consecutive_failures = rec.consecutive_failures;
+            e.name.assign(rec.name, strnlen(rec.name, kJournalNameSize));
+            entries->push_back(e);
+        }
+        munmap(addr, size);
+
+        std::sort(entries->begin(), entries->end(), [](const JournalEntry& a, const JournalEntry& b) {
+            return a.seq < b.seq;
+        });
+        return true;
+    }
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace cppbreaker
+{
+    class Counts;
+
+    // On disk layout of the transition journal.
+    // Bump kJournalVersion whenever JournalHeader or JournalRecord changes.
+    static const uint32_t kJournalMagic = 0x4e524a43;   // "CJRN"
+    static const uint32_t kJournalVersion = 1;
+    static const size_t kJournalNameSize = 56;
+
+    struct JournalHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t header_size;
+        uint32_t record_size;
+        uint64_t capacity;
+        // sequence number of the next record, records live at seq % capacity
+        std::atomic<uint64_t> next;
+    };
+
+    // JournalRecord describes one state change of a breaker.
+    // seq is 2 * n + 1 while record n is written and 2 * n + 2 once it is complete.
+    struct JournalRecord
+    {
+        std::atomic<uint64_t> seq;
+        // system clock, nanoseconds since the epoch
+        int64_t timestamp_ns;
+        uint32_t breaker_id;
+        uint8_t from;
+        uint8_t to;
+        uint8_t override;
+        uint8_t reserved;
+        // generation the breaker left
+        uint64_t generation;
+        // Counts of the generation the breaker left
+        uint64_t requests;
+        uint64_t total_successes;
+        uint64_t total_failures;
+        uint64_t consecutive_successes;
+        uint64_t consecutive_failures;
+        char name[kJournalNameSize];
+    };
+
+    // JournalEntry is a decoded JournalRecord
+    struct JournalEntry
+    {
+        uint64_t seq = 0;
+        int64_t timestamp_ns = 0;
+        uint32_t breaker_id = 0;
+        int from = 0;
+        int to = 0;
+        int override = 0;
+        uint64_t generation = 0;
+        uint64_t requests = 0;
+        uint64_t total_successes = 0;
+        uint64_t total_failures = 0;
+        uint64_t consecutive_successes = 0;
+        uint64_t consecutive_failures = 0;
+        std::string name;
+    };
+
+    // Journal is a ring of fixed size transition records in a memory mapped file.
+    // Append is lock free and the records survive a crash of the process.
+    class Journal
+    {
+    public:
+        Journal() {}
+        ~Journal();
+
+        Journal(const Journal&) = delete;
+        Journal& operator=(const Journal&) = delete;
+
+        // Open creates path with room for capacity records, or continues an existing journal.
+        bool Open(const std::string& path, uint64_t capacity);
+        void Close();
+
+        void Append(int64_t timestamp_ns, uint32_t breaker_id, const std::string& name,
+            int from, int to, int override, uint64_t generation, const Counts& counts);
+
+        // Install makes journal the one every CircuitBreaker appends its transitions to, nullptr stops journaling.
+        // An installed journal must outlive every breaker.
+        static void Install(Journal* journal);
+        static Journal* Current()
+        {
+            return current_.load(std::memory_order_acquire);
+        }
+
+        // Read decodes the complete records of the journal at path, oldest first.
+        static bool Read(const std::string& path, std::vector<JournalEntry>* entries);
+
+    private:
+        static std::atomic<Journal*> current_;
+
+        void* addr_ = nullptr;
+        size_t size_ = 0;
+        JournalRecord* records_ = nullptr;
+        uint64_t capacity_ = 0;
+    };
+}
@@ -0,0 +1,289 @@
+#include "keyed_breaker.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+namespace cppbreaker
+{
+    KeyedBreaker::KeyedBreaker(const Options& options)
+        : options_(options)
+    {
+        Options defaults;
+        if (options_.depth == 0)
+            options_.depth = defaults.depth;
+        if (options_.half_life.count() <= 0)
+            options_.half_life = defaults.half_life;
+        if (options_.min_failures == 0)
+            options_.min_failures = 1;
+        // a row is a whole number of cache lines
+        width_ = 16;
+        while (width_ < options_.width && width_ < (uint32_t(1) << 30))
+            width_ <<= 1;
+        options_.width = width_;
+
+        void* mem = nullptr;
+        size_t bytes = size_t(options_.depth) * 2 * width_ * sizeof(uint32_t);
+        if (posix_memalign(&mem, CircuitBreaker::kCacheLine, bytes) != 0)
+            abort();
+        memset(mem, 0, bytes);
+        counters_ = (uint32_t*)mem;
+
+        entries_.reserve(options_.heavy_hitters);
+        probes_.assign(width_, 0);
+        next_decay_ns_.store(now() + options_.half_life.count(), std::memory_order_relaxed);
+    }
+
+    KeyedBreaker::~KeyedBreaker()
+    {
+        free(counters_);
+    }
+
+    uint64_t KeyedBreaker::hash(const std::string& key)
+    {
+        // FNV-1a, then mixed so that both halves of the hash are usable
+        uint64_t h = 14695981039346656037ULL;
+        for (char c : key)
+        {
+            h ^= uint8_t(c);
+            h *= 1099511628211ULL;
+        }
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    int64_t KeyedBreaker::now() const
+    {
+        auto tp = options_.clock == nullptr ? std::chrono::system_clock::now() : options_.clock->Now();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(tp.time_since_epoch()).count();
+    }
+
+    void KeyedBreaker::add(uint64_t h, bool success, uint64_t* requests, uint64_t* failures)
+    {
+        // the rows of a key are picked by double hashing of the two halves of h
+        uint32_t mask = width_ - 1;
+        uint32_t h1 = uint32_t(h);
+        uint32_t h2 = uint32_t(h >> 32) | 1;
+        uint32_t min_requests = UINT32_MAX;
+        uint32_t min_failures = UINT32_MAX;
+        for (uint32_t row = 0; row < options_.depth; row++)
+        {
+            uint32_t i = (h1 + row * h2) & mask;
+            uint32_t r = __atomic_add_fetch(&requestRow(row)[i], 1, __ATOMIC_RELAXED);
+            uint32_t f = success ? __atomic_load_n(&failureRow(row)[i], __ATOMIC_RELAXED)
+                : __atomic_add_fetch(&failureRow(row)[i], 1, __ATOMIC_RELAXED);
+            min_requests = std::min(min_requests, r);
+            min_failures = std::min(min_failures, f);
+        }
+        *requests = min_requests;
+        *failures = min_failures;
+    }
+
+    void KeyedBreaker::estimate(uint64_t h, uint64_t* requests, uint64_t* failures) const
+    {
+        uint32_t mask = width_ - 1;
+        uint32_t h1 = uint32_t(h);
+        uint32_t h2 = uint32_t(h >> 32) | 1;
+        uint32_t min_requests = UINT32_MAX;
+        uint32_t min_failures = UINT32_MAX;
+        for (uint32_t row = 0; row < options_.depth; row++)
+        {
+            uint32_t i = (h1 + row * h2) & mask;
+            min_requests = std::min(min_requests, __atomic_load_n(&requestRow(row)[i], __ATOMIC_RELAXED));
+            min_failures = std::min(min_failures, __atomic_load_n(&failureRow(row)[i], __ATOMIC_RELAXED));
+        }
+        *requests = min_requests;
+        *failures = min_failures;
+    }
+
+    bool KeyedBreaker::heavy(uint64_t requests, uint64_t failures) const
+    {
+        return failures >= options_.min_failures && double(failures) >= options_.failure_ratio * double(requests);
+    }
+
+    void KeyedBreaker::decay(int64_t now_ns)
+    {
+        int64_t next = next_decay_ns_.load(std::memory_order_relaxed);
+        if (now_ns < next)
+            return;
+        // one thread halves the counters, increments meanwhile may be lost
+        if (!next_decay_ns_.compare_exchange_strong(next, now_ns + options_.half_life.count(), std::memory_order_relaxed))
+            return;
+        size_t n = size_t(options_.depth) * 2 * width_;
+        for (size_t i = 0; i < n; i++)
+        {
+            uint32_t v = __atomic_load_n(&counters_[i], __ATOMIC_RELAXED);
+            if (v != 0)
+                __atomic_store_n(&counters_[i], v >> 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    bool KeyedBreaker::Allow(const std::string& key)
+    {
+        uint64_t h = hash(key);
+        uint64_t requests, failures;
+        estimate(h, &requests, &failures);
+        if (!heavy(requests, failures))
+            return true;
+
+        int64_t now_ns = now();
+        std::lock_guard<std::mutex> lock(mutex_);
+        return admit(key, h, now_ns);
+    }
+
+    void KeyedBreaker::Done(const std::string& key, bool success)
+    {
+        int64_t now_ns = now();
+        decay(now_ns);
+        uint64_t requests, failures;
+        add(hash(key), success, &requests, &failures);
+        if (!heavy(requests, failures))
+            return;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        record(key, success, now_ns);
+    }
+
+    void KeyedBreaker::Estimate(const std::string& key, uint64_t* requests, uint64_t* failures) const
+    {
+        estimate(hash(key), requests, failures);
+    }
+
+    bool KeyedBreaker::admit(const std::string& key, uint64_t h, int64_t now_ns)
+    {
+        auto it = entries_.find(key);
+        Entry* e;
+        if (it == entries_.end())
+        {
+            e = track(key, now_ns);
+            if (e == nullptr)
+            {
+                // the map has no room for key, its probe slot lets one request through every timeout
+                int64_t& until = probes_[uint32_t(h) & (width_ - 1)];
+                if (until != 0 && until <= now_ns)
+                {
+                    until = now_ns + options_.timeout.count();
+                    return true;
+                }
+                if (until == 0)
+                    until = now_ns + options_.timeout.count();
+                return false;
+            }
+            e->until_ns = now_ns + options_.timeout.count();
+        }
+        else
+        {
+            e = &it->second;
+        }
+
+        if (e->state == STATE_CLOSED)
+            return true;
+        if (now_ns < e->until_ns)
+        {
+            e->rejected++;
+            return false;
+        }
+        // one probe per timeout, a lost probe does not hold the key forever
+        e->state = STATE_HALF_OPEN;
+        e->until_ns = now_ns + options_.timeout.count();
+        return true;
+    }
+
+    void KeyedBreaker::record(const std::string& key, bool success, int64_t now_ns)
+    {
+        auto it = entries_.find(key);
+        Entry* e;
+        if (it == entries_.end())
+        {
+            if (success)
+                return;
+            e = track(key, now_ns);
+            if (e == nullptr)
+                return;
+            e->until_ns = now_ns + options_.timeout.count();
+            e->requests = 1;
+            e->failures = 1;
+            return;
+        }
+        e = &it->second;
+
+        e->requests++;
+        if (!success)
+            e->failures++;
+        switch (e->state)
+        {
+        case STATE_HALF_OPEN:
+            if (success)
+            {
+                e->state = STATE_CLOSED;
+                e->requests = 0;
+                e->failures = 0;
+            }
+            else
+            {
+                e->state = STATE_OPEN;
+                e->until_ns = now_ns + options_.timeout.count();
+            }
+            break;
+        case STATE_CLOSED:
+            if (!success && heavy(e->requests, e->failures))
+            {
+                e->state = STATE_OPEN;
+                e->until_ns = now_ns + options_.timeout.count();
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    KeyedBreaker::Entry* KeyedBreaker::track(const std::string& key, int64_t now_ns)
+    {
+        if (options_.heavy_hitters == 0)
+            return nullptr;
+        if (entries_.size() >= options_.heavy_hitters)
+        {
+            auto victim = entries_.end();
+            for (auto it = entries_.begin(); it != entries_.end(); ++it)
+            {
+                const Entry& e = it->second;
+                if (e.state != STATE_CLOSED && now_ns < e.until_ns)
+                    continue;
+                if (victim == entries_.end() || e.failures < victim->second.failures)
+                    victim = it;
+            }
+            if (victim == entries_.end())
+                return nullptr;
+            entries_.erase(victim);
+        }
+        return &entries_[key];
+    }
+
+    std::vector<KeyedBreaker::HeavyHitter> KeyedBreaker::HeavyHitters()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<HeavyHitter> ret;
+        ret.reserve(entries_.size());
+        for (auto& kv : entries_)
+        {
+            HeavyHitter hh;
+            hh.key = kv.first;
+            hh.state = kv.second.state;
+            hh.requests = kv.second.requests;
+            hh.failures = kv.second.failures;
+            hh.rejected = kv.second.rejected;
+            ret.push_back(hh);
+        }
+        return ret;
+    }
+
+    size_t KeyedBreaker::Bytes() const
+    {
+        // a node of the map holds the pair and a next pointer, the buckets a pointer per entry
+        size_t node = sizeof(std::pair<const std::string, Entry>) + 2 * sizeof(void*);
+        return size_t(options_.depth) * 2 * width_ * sizeof(uint32_t) + width_ * sizeof(int64_t) +
+            options_.heavy_hitters * node;
+    }
+}
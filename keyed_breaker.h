@@ -0,0 +1,134 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include "circuit_breaker.h"
+
+namespace cppbreaker
+{
+    // KeyedBreaker rejects the requests of the few keys, users or objects, that keep failing, without
+    // a breaker per key. Requests and failures of every key are counted in a count-min sketch, halved
+    // every half_life, and a key whose estimates show at least min_failures failures, failure_ratio of
+    // its requests, is heavy. The requests of a heavy key are decided by an exact entry of a map of
+    // at most heavy_hitters keys: open for timeout, then half open with one probe every timeout,
+    // closed again by a successful probe. A heavy key the map has no room for still gets a probe every
+    // timeout, shared with the keys that hash to the same probe slot, until it is tracked or stops
+    // being heavy. Keys that are not heavy never take the lock of the map.
+    //
+    // The sketch has depth rows of width counters for requests and as many for failures, each row
+    // aligned to a cache line, so its memory does not depend on how many keys there are. Estimates
+    // only ever exceed the true counts, more so when many keys share a narrow sketch.
+    class KeyedBreaker
+    {
+    public:
+        struct Options
+        {
+            // counters per row, rounded up to a power of 2 of at least 16, and rows
+            uint32_t width = 4096;
+            uint32_t depth = 4;
+            // counters are halved every half_life
+            std::chrono::nanoseconds half_life = std::chrono::seconds(60);
+            // a key is heavy at min_failures failures and failure_ratio of its requests
+            uint32_t min_failures = 20;
+            double failure_ratio = 0.5;
+            // keys tracked exactly
+            size_t heavy_hitters = 64;
+            // how long a heavy key is rejected before a probe
+            std::chrono::nanoseconds timeout = std::chrono::seconds(30);
+            // clock is the time source, it must outlive the breaker. If nullptr, std::chrono::system_clock is used.
+            Clock* clock = nullptr;
+        };
+
+        // HeavyHitter is a key tracked exactly, with its outcomes since it became heavy or closed again
+        struct HeavyHitter
+        {
+            std::string key;
+            State state = STATE_CLOSED;
+            uint64_t requests = 0;
+            uint64_t failures = 0;
+            uint64_t rejected = 0;
+        };
+
+        explicit KeyedBreaker(const Options& options);
+        ~KeyedBreaker();
+
+        KeyedBreaker(const KeyedBreaker&) = delete;
+        KeyedBreaker& operator=(const KeyedBreaker&) = delete;
+
+        // Execute runs req unless key is rejected, then it returns ResultCodeErrOpenState
+        template<typename Result_, typename Function_>
+        std::tuple<Result_, int> Execute(const std::string& key, Function_ req)
+        {
+            if (!Allow(key))
+                return std::make_tuple(Result_(), (int)ResultCodeErrOpenState);
+            std::tuple<Result_, int> ret = req();
+            Done(key, std::get<1>(ret) == 0);
+            return ret;
+        }
+
+        // Allow returns whether a request of key may proceed, its outcome is reported with Done
+        bool Allow(const std::string& key);
+        void Done(const std::string& key, bool success);
+
+        // Estimate returns the decayed requests and failures the sketch counts for key
+        void Estimate(const std::string& key, uint64_t* requests, uint64_t* failures) const;
+
+        // HeavyHitters returns the keys tracked exactly
+        std::vector<HeavyHitter> HeavyHitters();
+
+        // Bytes returns the memory of the sketch and of the map at its largest, keys aside
+        size_t Bytes() const;
+
+    private:
+        struct Entry
+        {
+            State state = STATE_OPEN;
+            // the end of the open state, or of the probe in the half open state
+            int64_t until_ns = 0;
+            uint64_t requests = 0;
+            uint64_t failures = 0;
+            uint64_t rejected = 0;
+        };
+
+        static uint64_t hash(const std::string& key);
+        int64_t now() const;
+        uint32_t* requestRow(uint32_t row) const
+        {
+            return counters_ + size_t(row) * 2 * width_;
+        }
+        uint32_t* failureRow(uint32_t row) const
+        {
+            return requestRow(row) + width_;
+        }
+        // add counts an outcome in the sketch and returns the estimates it leaves
+        void add(uint64_t h, bool success, uint64_t* requests, uint64_t* failures);
+        void estimate(uint64_t h, uint64_t* requests, uint64_t* failures) const;
+        bool heavy(uint64_t requests, uint64_t failures) const;
+        // decay halves the counters once half_life has passed since the last time
+        void decay(int64_t now_ns);
+        // admit decides a request of a heavy key of hash h, record an outcome, with mutex_ held
+        bool admit(const std::string& key, uint64_t h, int64_t now_ns);
+        void record(const std::string& key, bool success, int64_t now_ns);
+        // track adds key to the map, evicting the least failing closed or expired key if it is full,
+        // and returns nullptr if every entry is fresher
+        Entry* track(const std::string& key, int64_t now_ns);
+
+        Options options_;
+        uint32_t width_;
+        // depth rows of requests, each followed by its row of failures
+        uint32_t* counters_ = nullptr;
+        std::atomic<int64_t> next_decay_ns_{0};
+
+        std::mutex mutex_;
+        std::unordered_map<std::string, Entry> entries_;
+        // by hash, the end of the open state of heavy keys not in entries_, 0 if none was seen
+        std::vector<int64_t> probes_;
+    };
+}
@@ -0,0 +1,309 @@
+#include "metrics.h"
+#include "circuit_breaker.h"
+#include "registry.h"
+
+#include <algorithm>
+
+
+namespace cppbreaker
+{
+
+    const int64_t LatencyHistogram::kBoundsNs[LatencyHistogram::kBuckets] = {
+        100000, 250000, 500000,
+        1000000, 2500000, 5000000,
+        10000000, 25000000, 50000000,
+        100000000, 250000000, 500000000,
+        1000000000, 2500000000, 5000000000, 10000000000
+    };
+
+    // le labels of kBoundsNs, in seconds
+    static const char* const kBoundsLe[LatencyHistogram::kBuckets] = {
+        ",le=\"0.0001\"", ",le=\"0.00025\"", ",le=\"0.0005\"",
+        ",le=\"0.001\"", ",le=\"0.0025\"", ",le=\"0.005\"",
+        ",le=\"0.01\"", ",le=\"0.025\"", ",le=\"0.05\"",
+        ",le=\"0.1\"", ",le=\"0.25\"", ",le=\"0.5\"",
+        ",le=\"1.0\"", ",le=\"2.5\"", ",le=\"5.0\"", ",le=\"10.0\""
+    };
+
+    LatencyHistogram::LatencyHistogram()
+    {
+        for (auto& b : buckets_)
+            b.store(0, std::memory_order_relaxed);
+        sum_ns_.store(0, std::memory_order_relaxed);
+    }
+
+    OverheadHistogram::OverheadHistogram()
+    {
+        for (auto& b : buckets_)
+            b.store(0, std::memory_order_relaxed);
+        sum_ns_.store(0, std::memory_order_relaxed);
+    }
+
+    const char* ProfileMetrics::SiteString(ProfileSite site)
+    {
+        switch (site)
+        {
+        case PROFILE_BEFORE_REQUEST:
+            return "before_request";
+        case PROFILE_AFTER_REQUEST:
+            return "after_request";
+        case PROFILE_LOCK_WAIT:
+            return "lock_wait";
+        case PROFILE_READY_TO_TRIP:
+            return "ready_to_trip";
+        case PROFILE_ON_STATE_CHANGE:
+            return "on_state_change";
+        default:
+            return "unknown";
+        }
+    }
+
+    namespace
+    {
+        void appendUint(std::string* out, uint64_t v)
+        {
+            char buf[20];
+            int n = 0;
+            do
+            {
+                buf[n++] = char('0' + v % 10);
+                v /= 10;
+            } while (v != 0);
+            while (n > 0)
+                out->push_back(buf[--n]);
+        }
+
+        // appendSeconds writes ns as a decimal number of seconds
+        void appendSeconds(std::string* out, uint64_t ns)
+        {
+            appendUint(out, ns / 1000000000);
+            out->push_back('.');
+            char frac[9];
+            uint64_t rem = ns % 1000000000;
+            for (int i = 8; i >= 0; i--)
+            {
+                frac[i] = char('0' + rem % 10);
+                rem /= 10;
+            }
+            out->append(frac, 9);
+        }
+
+        void appendLabelValue(std::string* out, const std::string& v)
+        {
+            for (char c : v)
+            {
+                if (c == '\\' || c == '"')
+                {
+                    out->push_back('\\');
+                    out->push_back(c);
+                }
+                else if (c == '\n')
+                {
+                    out->append("\\n", 2);
+                }
+                else
+                {
+                    out->push_back(c);
+                }
+            }
+        }
+
+        // appendSample writes `family{name="<name>"<extra>} value\n`
+        void appendSample(std::string* out, const char* family, const std::string& name,
+            const char* extra, uint64_t value)
+        {
+            out->append(family);
+            out->append("{name=\"", 7);
+            appendLabelValue(out, name);
+            out->push_back('"');
+            if (extra != nullptr)
+                out->append(extra);
+            out->append("} ", 2);
+            appendUint(out, value);
+            out->push_back('\n');
+        }
+
+        void appendHeader(std::string* out, const char* family, const char* help)
+        {
+            out->append("# TYPE ");
+            out->append(family);
+            out->append(" counter\n# HELP ");
+            out->append(family);
+            out->push_back(' ');
+            out->append(help);
+            out->push_back('\n');
+        }
+    }
+
+    const std::string& OpenMetricsWriter::Render()
+    {
+        return Render(Registry::Instance());
+    }
+
+    void OpenMetricsWriter::copy(Registry& registry)
+    {
+        size_ = 0;
+        profiled_ = 0;
+        registry.ForEach([&](CircuitBreaker* cb) {
+            if (size_ == rows_.size())
+                rows_.emplace_back();
+            Row& r = rows_[size_++];
+            const BreakerMetrics& m = cb->Metrics();
+            r.name.assign(cb->GetName());
+            r.state = m.state.load(std::memory_order_relaxed);
+            r.requests = m.requests.Load();
+            r.successes = m.successes.Load();
+            r.failures = m.failures.Load();
+            r.transitions = m.transitions.Load();
+            r.rejected_open = m.rejected_open.Load();
+            r.rejected_too_many = m.rejected_too_many.Load();
+            for (int i = 0; i <= LatencyHistogram::kBuckets; i++)
+                r.latency[i] = m.latency.Bucket(i);
+            r.latency_sum_ns = m.latency.SumNs();
+
+            const ProfileMetrics* prof = m.profile.get();
+            r.profile = kNoProfile;
+            if (prof == nullptr)
+                return;
+            if (profiled_ == profiles_.size())
+                profiles_.emplace_back();
+            r.profile = profiled_;
+            ProfileRow& p = profiles_[profiled_++];
+            for (int site = 0; site < PROFILE_SITES; site++)
+            {
+                for (int i = 0; i <= OverheadHistogram::kBuckets; i++)
+                    p.overhead[site][i] = prof->sites[site].Bucket(i);
+                p.overhead[site][OverheadHistogram::kBuckets + 1] = prof->sites[site].SumNs();
+            }
+            // a contended acquisition is sampled first, reading it first keeps it within the samples
+            p.lock_contended = prof->lock_contended.load(std::memory_order_acquire);
+            p.lock_samples = std::max(prof->lock_samples.load(std::memory_order_acquire), p.lock_contended);
+        });
+    }
+
+    const std::string& OpenMetricsWriter::Render(Registry& registry)
+    {
+        copy(registry);
+        std::string* out = &buffer_;
+        out->clear();
+
+        out->append("# TYPE cppbreaker_state stateset\n"
+            "# HELP cppbreaker_state Current state of the circuit breaker.\n");
+        for (size_t k = 0; k < size_; k++)
+        {
+            const Row& r = rows_[k];
+            appendSample(out, "cppbreaker_state", r.name, ",cppbreaker_state=\"closed\"", r.state == STATE_CLOSED);
+            appendSample(out, "cppbreaker_state", r.name, ",cppbreaker_state=\"half_open\"", r.state == STATE_HALF_OPEN);
+            appendSample(out, "cppbreaker_state", r.name, ",cppbreaker_state=\"open\"", r.state == STATE_OPEN);
+        }
+
+        struct
+        {
+            const char* family;
+            const char* sample;
+            const char* help;
+            uint64_t Row::* field;
+        } counters[] = {
+            {"cppbreaker_requests", "cppbreaker_requests_total",
+                "Requests admitted by the circuit breaker.", &Row::requests},
+            {"cppbreaker_successes", "cppbreaker_successes_total",
+                "Admitted requests that succeeded.", &Row::successes},
+            {"cppbreaker_failures", "cppbreaker_failures_total",
+                "Admitted requests that failed.", &Row::failures},
+            {"cppbreaker_transitions", "cppbreaker_transitions_total",
+                "State changes of the circuit breaker.", &Row::transitions},
+        };
+        for (auto& c : counters)
+        {
+            appendHeader(out, c.family, c.help);
+            for (size_t k = 0; k < size_; k++)
+                appendSample(out, c.sample, rows_[k].name, nullptr, rows_[k].*c.field);
+        }
+
+        out->append("# TYPE cppbreaker_rejections counter\n"
+            "# HELP cppbreaker_rejections Requests rejected by the circuit breaker.\n");
+        for (size_t k = 0; k < size_; k++)
+        {
+            const Row& r = rows_[k];
+            appendSample(out, "cppbreaker_rejections_total", r.name, ",reason=\"open\"", r.rejected_open);
+            appendSample(out, "cppbreaker_rejections_total", r.name, ",reason=\"too_many_requests\"",
+                r.rejected_too_many);
+        }
+
+        out->append("# TYPE cppbreaker_latency_seconds histogram\n"
+            "# HELP cppbreaker_latency_seconds Latency of requests admitted by the circuit breaker.\n");
+        for (size_t k = 0; k < size_; k++)
+        {
+            const Row& r = rows_[k];
+            uint64_t cumulative = 0;
+            for (int i = 0; i < LatencyHistogram::kBuckets; i++)
+            {
+                cumulative += r.latency[i];
+                appendSample(out, "cppbreaker_latency_seconds_bucket", r.name, kBoundsLe[i], cumulative);
+            }
+            cumulative += r.latency[LatencyHistogram::kBuckets];
+            appendSample(out, "cppbreaker_latency_seconds_bucket", r.name, ",le=\"+Inf\"", cumulative);
+            appendSample(out, "cppbreaker_latency_seconds_count", r.name, nullptr, cumulative);
+
+            out->append("cppbreaker_latency_seconds_sum{name=\"");
+            appendLabelValue(out, r.name);
+            out->append("\"} ");
+            appendSeconds(out, r.latency_sum_ns);
+            out->push_back('\n');
+        }
+
+        out->append("# TYPE cppbreaker_overhead_seconds histogram\n"
+            "# HELP cppbreaker_overhead_seconds Time spent inside the circuit breaker, sampled.\n");
+        for (size_t k = 0; k < size_; k++)
+        {
+            const Row& r = rows_[k];
+            if (r.profile == kNoProfile)
+                continue;
+            char extra[96];
+            for (int site = 0; site < PROFILE_SITES; site++)
+            {
+                const uint64_t* h = profiles_[r.profile].overhead[site];
+                const char* site_name = ProfileMetrics::SiteString(ProfileSite(site));
+                uint64_t cumulative = 0;
+                for (int i = 0; i < OverheadHistogram::kBuckets; i++)
+                {
+                    cumulative += h[i];
+                    uint64_t bound = uint64_t(OverheadHistogram::kMinNs) << i;
+                    snprintf(extra, sizeof(extra), ",site=\"%s\",le=\"%llu.%09llu\"", site_name,
+                        (unsigned long long)(bound / 1000000000), (unsigned long long)(bound % 1000000000));
+                    appendSample(out, "cppbreaker_overhead_seconds_bucket", r.name, extra, cumulative);
+                }
+                cumulative += h[OverheadHistogram::kBuckets];
+                snprintf(extra, sizeof(extra), ",site=\"%s\",le=\"+Inf\"", site_name);
+                appendSample(out, "cppbreaker_overhead_seconds_bucket", r.name, extra, cumulative);
+                snprintf(extra, sizeof(extra), ",site=\"%s\"", site_name);
+                appendSample(out, "cppbreaker_overhead_seconds_count", r.name, extra, cumulative);
+
+                out->append("cppbreaker_overhead_seconds_sum{name=\"");
+                appendLabelValue(out, r.name);
+                out->append("\"");
+                out->append(extra);
+                out->append("} ");
+                appendSeconds(out, h[OverheadHistogram::kBuckets + 1]);
+                out->push_back('\n');
+            }
+        }
+
+        out->append("# TYPE cppbreaker_lock_acquisitions counter\n"
+            "# HELP cppbreaker_lock_acquisitions Sampled acquisitions of the breaker mutex.\n");
+        for (size_t k = 0; k < size_; k++)
+        {
+            const Row& r = rows_[k];
+            if (r.profile == kNoProfile)
+                continue;
+            const ProfileRow& p = profiles_[r.profile];
+            appendSample(out, "cppbreaker_lock_acquisitions_total", r.name, ",contended=\"false\"",
+                p.lock_samples - p.lock_contended);
+            appendSample(out, "cppbreaker_lock_acquisitions_total", r.name, ",contended=\"true\"",
+                p.lock_contended);
+        }
+
+        out->append("# EOF\n");
+        return buffer_;
+    }
+}
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "counter.h"
+
+namespace cppbreaker
+{
+    class Registry;
+
+    // LatencyHistogram counts observations in fixed buckets.
+    // Observe is lock free, readers see each bucket atomically but not the whole histogram.
+    class LatencyHistogram
+    {
+    public:
+        // kBuckets upper bounds plus one overflow (+Inf) bucket
+        static const int kBuckets = 16;
+        static const int64_t kBoundsNs[kBuckets];
+
+        LatencyHistogram();
+
+        void Observe(std::chrono::nanoseconds d)
+        {
+            auto ns = d.count();
+            int i = 0;
+            while (i < kBuckets && ns > kBoundsNs[i])
+                i++;
+            buckets_[i].fetch_add(1, std::memory_order_relaxed);
+            sum_ns_.fetch_add(uint64_t(ns < 0 ? 0 : ns), std::memory_order_relaxed);
+        }
+
+        // Bucket returns the non-cumulative count of bucket i, i == kBuckets is +Inf.
+        uint64_t Bucket(int i) const
+        {
+            return buckets_[i].load(std::memory_order_relaxed);
+        }
+        uint64_t SumNs() const
+        {
+            return sum_ns_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        std::atomic<uint64_t> buckets_[kBuckets + 1];
+        std::atomic<uint64_t> sum_ns_;
+    };
+
+    // OverheadHistogram counts short durations in power of two buckets, from 16ns to 16ms.
+    class OverheadHistogram
+    {
+    public:
+        // bucket i counts durations up to kMinNs << i, bucket kBuckets the longer ones
+        static const int kBuckets = 21;
+        static const int64_t kMinNs = 16;
+
+        OverheadHistogram();
+
+        void Observe(std::chrono::nanoseconds d)
+        {
+            auto ns = d.count();
+            int i = 0;
+            if (ns > kMinNs)
+            {
+                // ceil(log2(ns)) - log2(kMinNs)
+                i = 64 - __builtin_clzll(uint64_t(ns - 1)) - 4;
+                if (i > kBuckets)
+                    i = kBuckets;
+            }
+            buckets_[i].fetch_add(1, std::memory_order_relaxed);
+            sum_ns_.fetch_add(uint64_t(ns < 0 ? 0 : ns), std::memory_order_relaxed);
+        }
+
+        uint64_t Bucket(int i) const
+        {
+            return buckets_[i].load(std::memory_order_relaxed);
+        }
+        uint64_t SumNs() const
+        {
+            return sum_ns_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        std::atomic<uint64_t> buckets_[kBuckets + 1];
+        std::atomic<uint64_t> sum_ns_;
+    };
+
+    // Where a profiled CircuitBreaker spends its own time
+    enum ProfileSite
+    {
+        // whole beforeRequest and afterRequest calls, including lock waits and callbacks
+        PROFILE_BEFORE_REQUEST = 0,
+        PROFILE_AFTER_REQUEST = 1,
+        // time blocked on the breaker mutex, only when it was contended
+        PROFILE_LOCK_WAIT = 2,
+        PROFILE_READY_TO_TRIP = 3,
+        PROFILE_ON_STATE_CHANGE = 4,
+        PROFILE_SITES = 5
+    };
+
+    // ProfileMetrics holds the self profiling results of a CircuitBreaker, see Settings::profile_every.
+    struct ProfileMetrics
+    {
+        OverheadHistogram sites[PROFILE_SITES];
+        // calls of beforeRequest, 1 in Settings::profile_every of them is sampled with its afterRequest
+        std::atomic<uint32_t> calls{0};
+        // sampled lock acquisitions, and how many of them had to wait
+        std::atomic<uint64_t> lock_samples{0};
+        std::atomic<uint64_t> lock_contended{0};
+
+        static const char* SiteString(ProfileSite site);
+    };
+
+    // BreakerMetrics holds the cumulative, never reset counters of a CircuitBreaker.
+    // They are written by the breaker and can be read at any time without its lock.
+    struct BreakerMetrics
+    {
+        // counted on every call, per CPU or per node with Settings::per_cpu_metrics or per_node_metrics
+        Counter requests;
+        Counter successes;
+        Counter failures;
+        Counter rejected_open;
+        Counter rejected_too_many;
+
+        Counter transitions;
+        // last State the breaker has moved to
+        std::atomic<int> state{0};
+
+        // latency of admitted requests
+        LatencyHistogram latency;
+
+        // self profiling, nullptr unless Settings::profile_every is set
+        std::unique_ptr<ProfileMetrics> profile;
+
+        // per_cpu or per_node hold the per call counters once UsePerCpu or UsePerNode is called,
+        // before they are first added to
+        std::unique_ptr<PerCpuCounters> per_cpu;
+        std::unique_ptr<PerNodeCounters> per_node;
+
+        void UsePerCpu()
+        {
+            per_cpu.reset(new PerCpuCounters());
+            requests.Bind(per_cpu.get(), 0);
+            successes.Bind(per_cpu.get(), 1);
+            failures.Bind(per_cpu.get(), 2);
+            rejected_open.Bind(per_cpu.get(), 3);
+            rejected_too_many.Bind(per_cpu.get(), 4);
+        }
+
+        void UsePerNode()
+        {
+            per_node.reset(new PerNodeCounters());
+            requests.Bind(per_node.get(), 0);
+            successes.Bind(per_node.get(), 1);
+            failures.Bind(per_node.get(), 2);
+            rejected_open.Bind(per_node.get(), 3);
+            rejected_too_many.Bind(per_node.get(), 4);
+        }
+    };
+
+    // OpenMetricsWriter renders every registered breaker in the OpenMetrics text format.
+    // The metrics of every breaker are copied in a single walk of the registry, which is locked
+    // only for that walk, and the families are rendered from the copy.
+    // The copy and the output buffer are reused between calls, so after the first scrape rendering
+    // allocates only when the number of breakers grows.
+    class OpenMetricsWriter
+    {
+    public:
+        // Render returns a reference to the internal buffer, valid until the next call.
+        const std::string& Render();
+        const std::string& Render(Registry& registry);
+
+    private:
+        // Row is the copy of the metrics of a breaker
+        struct Row
+        {
+            std::string name;
+            int state = 0;
+            uint64_t requests = 0;
+            uint64_t successes = 0;
+            uint64_t failures = 0;
+            uint64_t transitions = 0;
+            uint64_t rejected_open = 0;
+            uint64_t rejected_too_many = 0;
+            uint64_t latency[LatencyHistogram::kBuckets + 1];
+            uint64_t latency_sum_ns = 0;
+            // the ProfileRow of a profiled breaker, else kNoProfile
+            size_t profile = 0;
+        };
+        static const size_t kNoProfile = ~size_t(0);
+
+        // ProfileRow is the copy of the ProfileMetrics of a profiled breaker
+        struct ProfileRow
+        {
+            // the buckets then the sum of each site
+            uint64_t overhead[PROFILE_SITES][OverheadHistogram::kBuckets + 2];
+            uint64_t lock_samples = 0;
+            uint64_t lock_contended = 0;
+        };
+
+        void copy(Registry& registry);
+
+        std::string buffer_;
+        std::vector<Row> rows_;
+        size_t size_ = 0;
+        std::vector<ProfileRow> profiles_;
+        size_t profiled_ = 0;
+    };
+}
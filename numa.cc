@@ -0,0 +1,204 @@
+#include "numa.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <linux/mempolicy.h>
+#include <mutex>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+
+namespace cppbreaker
+{
+
+    namespace
+    {
+        // lines are carved from blocks of this size
+        const size_t kArenaBlock = 256 * 1024;
+
+        struct Topology
+        {
+            std::vector<int> node_of_cpu;
+            std::vector<std::vector<int>> cpus_of_node;
+        };
+
+        // parseCpuList reads a cpulist such as 0-3,8,10-11
+        std::vector<int> parseCpuList(const char* list)
+        {
+            std::vector<int> cpus;
+            const char* p = list;
+            while (*p != '\0' && *p != '\n')
+            {
+                char* end;
+                long first = strtol(p, &end, 10);
+                if (end == p)
+                    break;
+                long last = first;
+                p = end;
+                if (*p == '-')
+                {
+                    last = strtol(p + 1, &end, 10);
+                    p = end;
+                }
+                for (long c = first; c <= last; c++)
+                    cpus.push_back(int(c));
+                if (*p == ',')
+                    p++;
+            }
+            return cpus;
+        }
+
+        const Topology& topology()
+        {
+            static Topology* topo = []() {
+                Topology* t = new Topology();
+                long cpus = sysconf(_SC_NPROCESSORS_CONF);
+                t->node_of_cpu.assign(size_t(cpus < 1 ? 1 : cpus), 0);
+
+                DIR* dir = opendir("/sys/devices/system/node");
+                if (dir != nullptr)
+                {
+                    struct dirent* ent;
+                    while ((ent = readdir(dir)) != nullptr)
+                    {
+                        int node;
+                        if (sscanf(ent->d_name, "node%d", &node) != 1 || node < 0)
+                            continue;
+                        char path[128];
+                        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+                        FILE* f = fopen(path, "r");
+                        if (f == nullptr)
+                            continue;
+                        char buf[4096];
+                        if (fgets(buf, sizeof(buf), f) != nullptr)
+                        {
+                            if (t->cpus_of_node.size() <= size_t(node))
+                                t->cpus_of_node.resize(size_t(node) + 1);
+                            t->cpus_of_node[size_t(node)] = parseCpuList(buf);
+                            for (int c : t->cpus_of_node[size_t(node)])
+                            {
+                                if (size_t(c) >= t->node_of_cpu.size())
+                                    t->node_of_cpu.resize(size_t(c) + 1, 0);
+                                t->node_of_cpu[size_t(c)] = node;
+                            }
+                        }
+                        fclose(f);
+                    }
+                    closedir(dir);
+                }
+                if (t->cpus_of_node.empty())
+                {
+                    t->cpus_of_node.resize(1);
+                    for (size_t c = 0; c < t->node_of_cpu.size(); c++)
+                        t->cpus_of_node[0].push_back(int(c));
+                }
+                return t;
+            }();
+            return *topo;
+        }
+
+        // Arena is the free lines and the current block of a node
+        struct Arena
+        {
+            std::mutex mutex;
+            std::vector<void*> free;
+            char* block = nullptr;
+            size_t used = kArenaBlock;
+        };
+
+        std::vector<Arena>& arenas()
+        {
+            static std::vector<Arena>* arenas = new std::vector<Arena>(size_t(Numa::Nodes()));
+            return *arenas;
+        }
+    }
+
+    int Numa::Nodes()
+    {
+        return int(topology().cpus_of_node.size());
+    }
+
+    int Numa::NodeOfCpu(int cpu)
+    {
+        const Topology& t = topology();
+        if (cpu < 0 || size_t(cpu) >= t.node_of_cpu.size())
+            return 0;
+        return t.node_of_cpu[size_t(cpu)];
+    }
+
+    int Numa::CurrentNode()
+    {
+        // glibc answers sched_getcpu from its rseq area when it has registered one
+        return NodeOfCpu(sched_getcpu());
+    }
+
+    void* Numa::Allocate(size_t bytes, int node)
+    {
+        void* mem = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED)
+            return nullptr;
+        if (Nodes() > 1 && node >= 0 && node < 8 * int(sizeof(unsigned long)))
+        {
+            unsigned long mask = 1UL << node;
+            // a failure leaves the default policy, local to the thread that touches the pages first
+            syscall(SYS_mbind, mem, bytes, MPOL_PREFERRED, &mask, 8 * sizeof(mask), 0);
+        }
+        return mem;
+    }
+
+    void Numa::Free(void* mem, size_t bytes)
+    {
+        if (mem != nullptr)
+            munmap(mem, bytes);
+    }
+
+    bool Numa::PinThread(int node)
+    {
+        const Topology& t = topology();
+        if (node < 0 || size_t(node) >= t.cpus_of_node.size() || t.cpus_of_node[size_t(node)].empty())
+            return false;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int c : t.cpus_of_node[size_t(node)])
+            CPU_SET(c, &set);
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+    }
+
+    void* NodeArena::AllocateLine(int node)
+    {
+        Arena& a = arenas()[size_t(node)];
+        std::lock_guard<std::mutex> lock(a.mutex);
+        if (!a.free.empty())
+        {
+            void* line = a.free.back();
+            a.free.pop_back();
+            return line;
+        }
+        if (a.used == kArenaBlock)
+        {
+            // blocks are never unmapped, freed lines are reused
+            a.block = (char*)Numa::Allocate(kArenaBlock, node);
+            if (a.block == nullptr)
+                return nullptr;
+            a.used = 0;
+        }
+        void* line = a.block + a.used;
+        a.used += kLine;
+        return line;
+    }
+
+    void NodeArena::FreeLine(int node, void* line)
+    {
+        Arena& a = arenas()[size_t(node)];
+        std::lock_guard<std::mutex> lock(a.mutex);
+        // recycled lines may hold old values
+        memset(line, 0, kLine);
+        a.free.push_back(line);
+    }
+}
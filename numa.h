@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace cppbreaker
+{
+    // Numa describes the NUMA nodes of the machine, read once from /sys/devices/system/node.
+    // Without that directory the machine is one node.
+    class Numa
+    {
+    public:
+        static int Nodes();
+        static int NodeOfCpu(int cpu);
+        // CurrentNode returns the node of the CPU the thread runs on, which it may leave at any time
+        static int CurrentNode();
+
+        // Allocate maps bytes of zeroed memory whose pages prefer node, they are placed when first touched.
+        // It returns nullptr when out of memory. The preference is ignored by kernels without NUMA.
+        static void* Allocate(size_t bytes, int node);
+        static void Free(void* mem, size_t bytes);
+
+        // PinThread binds the calling thread to the CPUs of node, it returns false on failure
+        static bool PinThread(int node);
+    };
+
+    // NodeArena hands out cache lines on a node for data replicated per node, such as PerNodeCounters.
+    // Lines are carved from large blocks of the node and recycled when freed.
+    class NodeArena
+    {
+    public:
+        static const size_t kLine = 64;
+
+        static void* AllocateLine(int node);
+        static void FreeLine(int node, void* line);
+    };
+}
@@ -0,0 +1,144 @@
+#include "outcome_trace.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace cppbreaker
+{
+
+    std::atomic<OutcomeTraceWriter*> OutcomeTraceWriter::current_(nullptr);
+
+    OutcomeTraceWriter::~OutcomeTraceWriter()
+    {
+        Close();
+    }
+
+    bool OutcomeTraceWriter::Open(const std::string& path, uint64_t capacity)
+    {
+        if (addr_ != nullptr || capacity == 0)
+            return false;
+
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+            return false;
+        size_t size = sizeof(OutcomeTraceHeader) + capacity * sizeof(OutcomeRecord);
+        if (ftruncate(fd, off_t(size)) != 0)
+        {
+            close(fd);
+            return false;
+        }
+        void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED)
+            return false;
+
+        auto header = static_cast<OutcomeTraceHeader*>(addr);
+        header->header_size = sizeof(OutcomeTraceHeader);
+        header->record_size = sizeof(OutcomeRecord);
+        header->capacity = capacity;
+        header->version = kOutcomeTraceVersion;
+        header->magic = kOutcomeTraceMagic;
+
+        addr_ = addr;
+        size_ = size;
+        capacity_ = capacity;
+        records_ = reinterpret_cast<OutcomeRecord*>(static_cast<char*>(addr) + sizeof(OutcomeTraceHeader));
+        return true;
+    }
+
+    void OutcomeTraceWriter::Close()
+    {
+        if (addr_ == nullptr)
+            return;
+        OutcomeTraceWriter* self = this;
+        current_.compare_exchange_strong(self, nullptr);
+        munmap(addr_, size_);
+        addr_ = nullptr;
+        records_ = nullptr;
+    }
+
+    void OutcomeTraceWriter::Append(int64_t timestamp_ns, uint32_t breaker_id, bool success, int64_t latency_ns)
+    {
+        if (addr_ == nullptr)
+            return;
+
+        auto header = static_cast<OutcomeTraceHeader*>(addr_);
+        uint64_t n = header->count.fetch_add(1, std::memory_order_relaxed);
+        if (n >= capacity_)
+            return;
+
+        uint64_t latency_us = latency_ns <= 0 ? 0 : uint64_t(latency_ns) / 1000;
+        OutcomeRecord& rec = records_[n];
+        rec.timestamp_ns = timestamp_ns;
+        rec.breaker_id = breaker_id;
+        rec.outcome = uint32_t(std::min<uint64_t>(latency_us, 0x7fffffffu)) | (success ? 0 : 0x80000000u);
+    }
+
+    uint64_t OutcomeTraceWriter::Count() const
+    {
+        if (addr_ == nullptr)
+            return 0;
+        auto header = static_cast<const OutcomeTraceHeader*>(addr_);
+        return std::min(header->count.load(std::memory_order_relaxed), capacity_);
+    }
+
+    void OutcomeTraceWriter::Install(OutcomeTraceWriter* writer)
+    {
+        current_.store(writer, std::memory_order_release);
+    }
+
+    OutcomeTraceReader::~OutcomeTraceReader()
+    {
+        Close();
+    }
+
+    bool OutcomeTraceReader::Open(const std::string& path)
+    {
+        if (addr_ != nullptr)
+            return false;
+
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+        struct stat sb;
+        if (fstat(fd, &sb) != 0 || size_t(sb.st_size) < sizeof(OutcomeTraceHeader))
+        {
+            close(fd);
+            return false;
+        }
+        size_t size = size_t(sb.st_size);
+        void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED)
+            return false;
+
+        auto header = static_cast<const OutcomeTraceHeader*>(addr);
+        if (header->magic != kOutcomeTraceMagic || header->version != kOutcomeTraceVersion ||
+            header->header_size != sizeof(OutcomeTraceHeader) || header->record_size != sizeof(OutcomeRecord) ||
+            sizeof(OutcomeTraceHeader) + header->capacity * sizeof(OutcomeRecord) > size)
+        {
+            munmap(addr, size);
+            return false;
+        }
+
+        addr_ = addr;
+        size_ = size;
+        records_ = reinterpret_cast<const OutcomeRecord*>(static_cast<const char*>(addr) + sizeof(OutcomeTraceHeader));
+        size_records_ = std::min(header->count.load(std::memory_order_acquire), header->capacity);
+        return true;
+    }
+
+    void OutcomeTraceReader::Close()
+    {
+        if (addr_ == nullptr)
+            return;
+        munmap(const_cast<void*>(addr_), size_);
+        addr_ = nullptr;
+        records_ = nullptr;
+        size_records_ = 0;
+    }
+}
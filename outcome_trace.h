@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace cppbreaker
+{
+    // On disk layout of an outcome trace, a header followed by an array of OutcomeRecord
+    // that can be used in place once the file is mapped.
+    // Bump kOutcomeTraceVersion whenever OutcomeTraceHeader or OutcomeRecord changes.
+    static const uint32_t kOutcomeTraceMagic = 0x544f4243;   // "CBOT"
+    static const uint32_t kOutcomeTraceVersion = 1;
+
+    struct OutcomeTraceHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t header_size;
+        uint32_t record_size;
+        uint64_t capacity;
+        // number of records appended, records past capacity are dropped
+        std::atomic<uint64_t> count;
+    };
+
+    struct OutcomeRecord
+    {
+        // clock of the breaker, nanoseconds since the epoch
+        int64_t timestamp_ns;
+        uint32_t breaker_id;
+        // bit 31 is set for failures, the low 31 bits are the latency in microseconds, saturated
+        uint32_t outcome;
+
+        bool Failed() const
+        {
+            return (outcome & 0x80000000u) != 0;
+        }
+        uint32_t LatencyUs() const
+        {
+            return outcome & 0x7fffffffu;
+        }
+    };
+
+    // OutcomeTraceWriter records the outcome of every request admitted by a breaker into a
+    // preallocated memory mapped file. Append is lock free.
+    // Rejected requests have no outcome and are not recorded.
+    class OutcomeTraceWriter
+    {
+    public:
+        OutcomeTraceWriter() {}
+        ~OutcomeTraceWriter();
+
+        OutcomeTraceWriter(const OutcomeTraceWriter&) = delete;
+        OutcomeTraceWriter& operator=(const OutcomeTraceWriter&) = delete;
+
+        // Open creates path, replacing it, with room for capacity records
+        bool Open(const std::string& path, uint64_t capacity);
+        void Close();
+
+        void Append(int64_t timestamp_ns, uint32_t breaker_id, bool success, int64_t latency_ns);
+
+        uint64_t Count() const;
+
+        // Install makes writer the one every CircuitBreaker records to, nullptr stops recording.
+        // An installed writer must outlive every breaker.
+        static void Install(OutcomeTraceWriter* writer);
+        static OutcomeTraceWriter* Current()
+        {
+            return current_.load(std::memory_order_acquire);
+        }
+
+    private:
+        static std::atomic<OutcomeTraceWriter*> current_;
+
+        void* addr_ = nullptr;
+        size_t size_ = 0;
+        OutcomeRecord* records_ = nullptr;
+        uint64_t capacity_ = 0;
+    };
+
+    // OutcomeTraceReader maps a trace read only
+    class OutcomeTraceReader
+    {
+    public:
+        OutcomeTraceReader() {}
+        ~OutcomeTraceReader();
+
+        OutcomeTraceReader(const OutcomeTraceReader&) = delete;
+        OutcomeTraceReader& operator=(const OutcomeTraceReader&) = delete;
+
+        bool Open(const std::string& path);
+        void Close();
+
+        // Records are in append order, concurrent requests may be slightly out of time order
+        const OutcomeRecord* Records() const
+        {
+            return records_;
+        }
+        uint64_t Size() const
+        {
+            return size_records_;
+        }
+
+    private:
+        const void* addr_ = nullptr;
+        size_t size_ = 0;
+        const OutcomeRecord* records_ = nullptr;
+        uint64_t size_records_ = 0;
+    };
+}
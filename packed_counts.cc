@@ -0,0 +1,129 @@
+#include "packed_counts.h"
+#include "circuit_breaker.h"
+
+#include <algorithm>
+
+
+namespace cppbreaker
+{
+
+    namespace
+    {
+        const int kTagShift = 48;
+        const int kFailedShift = 63;
+
+        uint16_t tagOf(uint64_t word)
+        {
+            return uint16_t(word >> kTagShift);
+        }
+
+        uint64_t increment(uint64_t v, uint64_t max)
+        {
+            return v < max ? v + 1 : max;
+        }
+
+#if !defined(__x86_64__)
+        const size_t kSpinLocks = 64;
+        std::atomic_flag spin_locks[kSpinLocks];
+#endif
+    }
+
+#if !defined(__x86_64__)
+    std::atomic_flag* SpinLock128(const void* word)
+    {
+        return &spin_locks[(uintptr_t(word) >> 4) % kSpinLocks];
+    }
+#endif
+
+    void PackedCounts::Reset(uint16_t tag)
+    {
+        Store128(&outcomes_, Word128{uint64_t(tag) << kTagShift, 0});
+        requests_.store(uint64_t(tag) << kTagShift, std::memory_order_relaxed);
+    }
+
+    bool PackedCounts::OnRequest(uint16_t tag)
+    {
+        uint64_t cur = requests_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            if (tagOf(cur) != tag)
+                return false;
+            if ((cur & kMaxTotal) == kMaxTotal)
+                return true;
+            if (requests_.compare_exchange_weak(cur, cur + 1, std::memory_order_relaxed))
+                return true;
+        }
+    }
+
+    bool PackedCounts::OnSuccess(uint16_t tag, Counts* after)
+    {
+        return onOutcome(tag, true, after);
+    }
+
+    bool PackedCounts::OnFailure(uint16_t tag, Counts* after)
+    {
+        return onOutcome(tag, false, after);
+    }
+
+    bool PackedCounts::onOutcome(uint16_t tag, bool success, Counts* after)
+    {
+        // the halves may be read torn, a failed swap reloads them at once
+        Word128 cur = Peek128(&outcomes_);
+        for (;;)
+        {
+            if (tagOf(cur.lo) != tag)
+                return false;
+
+            uint64_t successes = cur.lo & kMaxTotal;
+            uint64_t failures = cur.hi & kMaxTotal;
+            uint64_t run = (cur.hi >> kTagShift) & kMaxConsecutive;
+            bool failed = (cur.hi >> kFailedShift) != 0;
+            if (success)
+            {
+                successes = increment(successes, kMaxTotal);
+                run = failed ? 1 : increment(run, kMaxConsecutive);
+            }
+            else
+            {
+                failures = increment(failures, kMaxTotal);
+                run = failed ? increment(run, kMaxConsecutive) : 1;
+            }
+
+            Word128 next{(uint64_t(tag) << kTagShift) | successes,
+                failures | (run << kTagShift) | (uint64_t(!success) << kFailedShift)};
+            if (CompareExchange128(&outcomes_, &cur, next))
+            {
+                if (after != nullptr)
+                    unpack(next, requests_.load(std::memory_order_relaxed), after);
+                return true;
+            }
+        }
+    }
+
+    void PackedCounts::Load(Counts* counts) const
+    {
+        unpack(Load128(&outcomes_), requests_.load(std::memory_order_relaxed), counts);
+    }
+
+    void PackedCounts::Read(Counts* counts) const
+    {
+        unpack(Read128(&outcomes_), requests_.load(std::memory_order_relaxed), counts);
+    }
+
+    void PackedCounts::unpack(const Word128& o, uint64_t requests, Counts* counts) const
+    {
+        counts->total_successes = o.lo & kMaxTotal;
+        counts->total_failures = o.hi & kMaxTotal;
+        uint64_t run = (o.hi >> kTagShift) & kMaxConsecutive;
+        bool failed = (o.hi >> kFailedShift) != 0;
+        counts->consecutive_successes = failed ? 0 : run;
+        counts->consecutive_failures = failed ? run : 0;
+
+        // every outcome was a request of the same generation, unless requests moved on to the next one
+        uint64_t outcomes = counts->total_successes + counts->total_failures;
+        if (tagOf(requests) == tagOf(o.lo))
+            counts->requests = std::max(requests & kMaxTotal, outcomes);
+        else
+            counts->requests = outcomes;
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "atomic128.h"
+
+namespace cppbreaker
+{
+    class Counts;
+
+    // PackedCounts holds the Counts of one generation of a breaker in two words, each updated with a
+    // single compare-and-swap instead of under a lock, see Settings::packed_counts:
+    //
+    //   requests   64 bits: requests (48) | tag (16)
+    //   outcomes  128 bits: total_successes (48) | tag (16), total_failures (48) | consecutive (15) | failed (1)
+    //
+    // tag is the low 16 bits of the generation the counts belong to, an update for another generation
+    // fails and leaves them alone. Only one of consecutive_successes and consecutive_failures is non zero
+    // at a time, the failed bit tells which one consecutive is. Counts saturate: totals at 2^48 - 1,
+    // consecutive runs at 2^15 - 1.
+    //
+    // The outcome word is swapped with CompareExchange128.
+    class PackedCounts
+    {
+    public:
+        static const uint64_t kMaxTotal = (uint64_t(1) << 48) - 1;
+        static const uint64_t kMaxConsecutive = (uint64_t(1) << 15) - 1;
+
+        // Reset starts the counts of tag at zero, concurrent updates for the previous tag are lost
+        void Reset(uint16_t tag);
+
+        // OnRequest counts a request of tag, it returns false if the counts belong to another tag
+        bool OnRequest(uint16_t tag);
+
+        // OnSuccess and OnFailure count an outcome of tag and fill after, if not nullptr, with the Counts
+        // as this outcome left them. They return false if the counts belong to another tag.
+        bool OnSuccess(uint16_t tag, Counts* after);
+        bool OnFailure(uint16_t tag, Counts* after);
+
+        // Load returns the counts, the outcomes are read at once and requests separately.
+        // Read returns them for an observer, with Read128.
+        void Load(Counts* counts) const;
+        void Read(Counts* counts) const;
+
+    private:
+        bool onOutcome(uint16_t tag, bool success, Counts* after);
+        void unpack(const Word128& o, uint64_t requests, Counts* counts) const;
+
+        // Load swaps it for itself
+        mutable Word128 outcomes_{0, 0};
+        std::atomic<uint64_t> requests_{0};
+    };
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+// USDT (SDT) probe points of cppbreaker, listed with `bpftrace -l 'usdt:<binary>:cppbreaker:*'`.
+// Probes compile to a nop and cost nothing until a tracer attaches to them.
+// Without <sys/sdt.h> (systemtap-sdt-dev), or with CPPBREAKER_NO_SDT defined, they compile to nothing.
+//
+//   cppbreaker:reject      (id, name, state, code, requests, consecutive_failures)
+//   cppbreaker:outcome     (id, name, generation, stale, success, latency_ns)
+//   cppbreaker:transition  (id, name, from, to, requests, total_failures, consecutive_failures, generation)
+
+//
+// Each probe has a semaphore, counting the tracers attached to it. CPPBREAKER_PROBE_ENABLED(name) reads
+// it, so that probe arguments that cost something to compute are only computed for a tracer.
+
+#if !defined(CPPBREAKER_NO_SDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#define CPPBREAKER_HAVE_SDT 1
+#endif
+#endif
+
+#ifdef CPPBREAKER_HAVE_SDT
+#define CPPBREAKER_SEMAPHORE(name) cppbreaker_##name##_semaphore
+// CPPBREAKER_DEFINE_SEMAPHORE is used once per probe, at global scope, by the file with the probes
+#define CPPBREAKER_DEFINE_SEMAPHORE(name) \
+    extern "C" { __extension__ volatile unsigned short CPPBREAKER_SEMAPHORE(name) \
+    __attribute__((unused)) __attribute__((section(".probes"))) = 0; } static_assert(true, "")
+#define CPPBREAKER_PROBE_ENABLED(name) __builtin_expect(CPPBREAKER_SEMAPHORE(name) != 0, 0)
+#define CPPBREAKER_PROBE6(name, a1, a2, a3, a4, a5, a6) \
+    DTRACE_PROBE6(cppbreaker, name, a1, a2, a3, a4, a5, a6)
+#define CPPBREAKER_PROBE8(name, a1, a2, a3, a4, a5, a6, a7, a8) \
+    DTRACE_PROBE8(cppbreaker, name, a1, a2, a3, a4, a5, a6, a7, a8)
+
+#define CPPBREAKER_DECLARE_SEMAPHORE(name) \
+    extern "C" __extension__ volatile unsigned short CPPBREAKER_SEMAPHORE(name) \
+    __attribute__((unused)) __attribute__((section(".probes")))
+
+CPPBREAKER_DECLARE_SEMAPHORE(reject);
+CPPBREAKER_DECLARE_SEMAPHORE(outcome);
+CPPBREAKER_DECLARE_SEMAPHORE(transition);
+#else
+// the arguments are not evaluated, only checked
+template<typename... Args_>
+inline void cppbreakerProbeArgs(const Args_&...) {}
+
+#define CPPBREAKER_DEFINE_SEMAPHORE(name) static_assert(true, "")
+#define CPPBREAKER_PROBE_ENABLED(name) false
+#define CPPBREAKER_PROBE6(name, a1, a2, a3, a4, a5, a6) \
+    do { if (false) cppbreakerProbeArgs(a1, a2, a3, a4, a5, a6); } while (0)
+#define CPPBREAKER_PROBE8(name, a1, a2, a3, a4, a5, a6, a7, a8) \
+    do { if (false) cppbreakerProbeArgs(a1, a2, a3, a4, a5, a6, a7, a8); } while (0)
+#endif
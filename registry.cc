@@ -0,0 +1,79 @@
+#include "registry.h"
+
+
+namespace cppbreaker
+{
+
+    Registry& Registry::Instance()
+    {
+        static Registry* registry = new Registry();
+        return *registry;
+    }
+
+    uint32_t Registry::Add(CircuitBreaker* cb)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_++;
+        if (!free_.empty())
+        {
+            auto id = free_.back();
+            free_.pop_back();
+            breakers_[id] = cb;
+            return id;
+        }
+        breakers_.push_back(cb);
+        pins_.push_back(0);
+        return uint32_t(breakers_.size() - 1);
+    }
+
+    void Registry::Remove(uint32_t id)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (id >= breakers_.size() || breakers_[id] == nullptr)
+            return;
+        while (pins_[id] != 0)
+            unpinned_.wait(lock);
+        breakers_[id] = nullptr;
+        free_.push_back(id);
+        size_--;
+    }
+
+    uint32_t Registry::Reserve(size_t n)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto first = uint32_t(breakers_.size());
+        breakers_.resize(breakers_.size() + n, nullptr);
+        pins_.resize(breakers_.size(), 0);
+        return first;
+    }
+
+    void Registry::AddReserved(uint32_t first, CircuitBreaker* const* cbs, size_t n)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < n; i++)
+            breakers_[first + i] = cbs[i];
+        size_ += n;
+    }
+
+    CircuitBreaker* Registry::pin(uint32_t id)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (id >= breakers_.size() || breakers_[id] == nullptr)
+            return nullptr;
+        pins_[id]++;
+        return breakers_[id];
+    }
+
+    void Registry::unpin(uint32_t id)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--pins_[id] == 0)
+            unpinned_.notify_all();
+    }
+
+    size_t Registry::Size()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return size_;
+    }
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace cppbreaker
+{
+    class CircuitBreaker;
+
+    // Registry tracks every live CircuitBreaker of the process so that exporters
+    // can walk them without the application keeping its own list.
+    // Breakers register themselves on construction and unregister on destruction.
+    class Registry
+    {
+    public:
+        static Registry& Instance();
+
+        // Add returns the id of the breaker, ids of destroyed breakers are reused.
+        uint32_t Add(CircuitBreaker* cb);
+        // Remove waits until no With call runs on the breaker
+        void Remove(uint32_t id);
+
+        // Reserve returns the first of n consecutive ids for breakers registered later, all at once,
+        // by AddReserved. The breakers are not visible until then.
+        uint32_t Reserve(size_t n);
+        // AddReserved registers cbs[i] under id first + i
+        void AddReserved(uint32_t first, CircuitBreaker* const* cbs, size_t n);
+
+        size_t Size();
+
+        // ForEach calls fn(CircuitBreaker*) for every registered breaker.
+        // The registry is locked during the walk, breakers are not.
+        template<typename Function_>
+        void ForEach(Function_ fn)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto cb : breakers_)
+            {
+                if (cb != nullptr)
+                    fn(cb);
+            }
+        }
+
+        // ForEachId calls fn(uint32_t id, CircuitBreaker*) for every registered breaker, like ForEach,
+        // with the id of the breaker in this registry
+        template<typename Function_>
+        void ForEachId(Function_ fn)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (size_t id = 0; id < breakers_.size(); id++)
+            {
+                if (breakers_[id] != nullptr)
+                    fn(uint32_t(id), breakers_[id]);
+            }
+        }
+
+        // With calls fn(CircuitBreaker*) if a breaker is registered under id, and returns whether it was.
+        // The registry is not locked while fn runs, so fn may change the state of the breaker and
+        // run its callbacks, which may construct or destroy other breakers. The breaker is pinned instead,
+        // its destruction waits until fn returns, so fn must not destroy it.
+        template<typename Function_>
+        bool With(uint32_t id, Function_ fn)
+        {
+            CircuitBreaker* cb = pin(id);
+            if (cb == nullptr)
+                return false;
+            fn(cb);
+            unpin(id);
+            return true;
+        }
+
+    private:
+        CircuitBreaker* pin(uint32_t id);
+        void unpin(uint32_t id);
+
+        std::mutex mutex_;
+        std::condition_variable unpinned_;
+        std::vector<CircuitBreaker*> breakers_;
+        // With calls running on each breaker
+        std::vector<uint32_t> pins_;
+        std::vector<uint32_t> free_;
+        size_t size_ = 0;
+    };
+}
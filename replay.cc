@@ -0,0 +1,191 @@
+#include "replay.h"
+#include "clock.h"
+
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+
+
+namespace cppbreaker
+{
+
+    namespace
+    {
+        struct Incident
+        {
+            int64_t start_ns;
+            int64_t end_ns;
+        };
+
+        struct Transition
+        {
+            int64_t at_ns;
+            State from;
+            State to;
+        };
+
+        struct Replayed
+        {
+            std::unique_ptr<CircuitBreaker> cb;
+            std::vector<Transition> transitions;
+
+            // current bucket of the ground truth
+            int64_t bucket = -1;
+            uint64_t bucket_requests = 0;
+            uint64_t bucket_failures = 0;
+            std::vector<Incident> incidents;
+            // healthy flag of every bucket seen, by bucket number from first_bucket
+            int64_t first_bucket = -1;
+            std::vector<bool> unhealthy;
+        };
+
+        void closeBucket(Replayed* r, const ReplayOptions& options)
+        {
+            if (r->bucket < 0)
+                return;
+            bool bad = r->bucket_requests >= options.min_bucket_requests &&
+                double(r->bucket_failures) >= options.unhealthy_ratio * double(r->bucket_requests);
+            size_t idx = size_t(r->bucket - r->first_bucket);
+            if (r->unhealthy.size() <= idx)
+                r->unhealthy.resize(idx + 1, false);
+            r->unhealthy[idx] = bad;
+
+            int64_t width = options.bucket.count();
+            if (!bad)
+                return;
+            if (!r->incidents.empty() && r->incidents.back().end_ns == r->bucket * width)
+                r->incidents.back().end_ns += width;
+            else
+                r->incidents.push_back(Incident{ r->bucket * width, (r->bucket + 1) * width });
+        }
+    }
+
+    bool SortedByTime(const OutcomeRecord* records, uint64_t n)
+    {
+        for (uint64_t i = 1; i < n; i++)
+        {
+            if (records[i].timestamp_ns < records[i - 1].timestamp_ns)
+                return false;
+        }
+        return true;
+    }
+
+    ReplayResult Replay(const OutcomeRecord* records, uint64_t n, const std::string& label,
+        const Settings& settings, const ReplayOptions& options)
+    {
+        ReplayResult result;
+        result.label = label;
+        if (n == 0)
+            return result;
+
+        int64_t width = std::max<int64_t>(options.bucket.count(), 1);
+        VirtualClock clock(std::chrono::system_clock::time_point(
+            std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                std::chrono::nanoseconds(records[0].timestamp_ns))));
+        int64_t now_ns = records[0].timestamp_ns;
+
+        // breakers in the order their ids first appear, the ids of the trace are not trusted to be dense
+        std::vector<Replayed> breakers;
+        std::unordered_map<uint32_t, size_t> index;
+        for (uint64_t i = 0; i < n; i++)
+        {
+            const OutcomeRecord& rec = records[i];
+            auto it = index.find(rec.breaker_id);
+            if (it == index.end())
+            {
+                size_t idx = breakers.size();
+                it = index.emplace(rec.breaker_id, idx).first;
+                breakers.emplace_back();
+
+                Settings st = settings;
+                st.clock = &clock;
+                auto on_state_change = settings.on_state_change;
+                st.on_state_change = [&breakers, &now_ns, idx, on_state_change](const std::string& name,
+                    State from, State to) {
+                    if (on_state_change != nullptr)
+                        on_state_change(name, from, to);
+                    breakers[idx].transitions.push_back(Transition{ now_ns, from, to });
+                };
+                breakers[idx].cb.reset(new CircuitBreaker(st));
+            }
+            Replayed& r = breakers[it->second];
+
+            int64_t bucket = rec.timestamp_ns / width;
+            if (bucket != r.bucket)
+            {
+                closeBucket(&r, options);
+                if (r.first_bucket < 0)
+                    r.first_bucket = bucket;
+                r.bucket = bucket;
+                r.bucket_requests = 0;
+                r.bucket_failures = 0;
+            }
+            r.bucket_requests++;
+            if (rec.Failed())
+                r.bucket_failures++;
+
+            now_ns = rec.timestamp_ns;
+            clock.Set(std::chrono::system_clock::time_point(
+                std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                    std::chrono::nanoseconds(rec.timestamp_ns))));
+            result.requests++;
+            uint64_t generation = 0;
+            if (r.cb->Allow(&generation) == ResultCodeOK)
+            {
+                result.admitted++;
+                if (rec.Failed())
+                    result.admitted_failures++;
+                r.cb->Done(generation, !rec.Failed(), std::chrono::microseconds(rec.LatencyUs()));
+            }
+            else if (rec.Failed())
+            {
+                result.rejected_bad++;
+            }
+            else
+            {
+                result.rejected_good++;
+            }
+        }
+
+        for (auto& r : breakers)
+        {
+            closeBucket(&r, options);
+
+            for (auto& t : r.transitions)
+            {
+                if (t.from != STATE_CLOSED || t.to != STATE_OPEN)
+                    continue;
+                result.trips++;
+                int64_t idx = t.at_ns / width - r.first_bucket;
+                if (idx < 0 || size_t(idx) >= r.unhealthy.size() || !r.unhealthy[size_t(idx)])
+                    result.false_trips++;
+            }
+
+            for (auto& inc : r.incidents)
+            {
+                result.incidents++;
+                auto trip = std::find_if(r.transitions.begin(), r.transitions.end(), [&](const Transition& t) {
+                    return t.to == STATE_OPEN && t.at_ns >= inc.start_ns && t.at_ns < inc.end_ns;
+                });
+                if (trip == r.transitions.end())
+                    continue;
+
+                result.detected++;
+                std::chrono::nanoseconds ttt(trip->at_ns - inc.start_ns);
+                result.total_time_to_trip += ttt;
+                result.max_time_to_trip = std::max(result.max_time_to_trip, ttt);
+
+                auto closed = std::find_if(trip, r.transitions.end(), [&](const Transition& t) {
+                    return t.to == STATE_CLOSED && t.at_ns >= inc.end_ns;
+                });
+                if (closed == r.transitions.end())
+                    continue;
+                result.recovered++;
+                std::chrono::nanoseconds rt(closed->at_ns - inc.end_ns);
+                result.total_recovery_time += rt;
+                result.max_recovery_time = std::max(result.max_recovery_time, rt);
+            }
+        }
+        return result;
+    }
+}
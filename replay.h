@@ -0,0 +1,57 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "circuit_breaker.h"
+#include "outcome_trace.h"
+
+namespace cppbreaker
+{
+    // ReplayOptions defines the ground truth a replay is judged against: the trace of each breaker is cut
+    // in buckets, a bucket is unhealthy when it has at least min_bucket_requests requests and
+    // a failure ratio of at least unhealthy_ratio. Consecutive unhealthy buckets form an incident.
+    struct ReplayOptions
+    {
+        std::chrono::nanoseconds bucket = std::chrono::seconds(1);
+        double unhealthy_ratio = 0.5;
+        uint32_t min_bucket_requests = 5;
+    };
+
+    struct ReplayResult
+    {
+        std::string label;
+
+        uint64_t requests = 0;
+        uint64_t admitted = 0;
+        uint64_t admitted_failures = 0;
+        // rejected requests that succeeded, or failed, in the trace
+        uint64_t rejected_good = 0;
+        uint64_t rejected_bad = 0;
+
+        // transitions from closed to open, and those that happened in a healthy bucket
+        uint64_t trips = 0;
+        uint64_t false_trips = 0;
+
+        uint64_t incidents = 0;
+        // incidents during which the breaker tripped, and the time it took from the start of the incident
+        uint64_t detected = 0;
+        std::chrono::nanoseconds total_time_to_trip{0};
+        std::chrono::nanoseconds max_time_to_trip{0};
+        // detected incidents after which the breaker closed again, and the time it took from their end
+        uint64_t recovered = 0;
+        std::chrono::nanoseconds total_recovery_time{0};
+        std::chrono::nanoseconds max_recovery_time{0};
+    };
+
+    // Replay runs records, sorted by time, through one breaker per breaker id configured with settings,
+    // on a virtual clock. Admitted requests complete immediately with their recorded outcome, transitions
+    // are taken from on_state_change, which still calls the one of settings.
+    // Replays of different settings are independent and can run in parallel.
+    ReplayResult Replay(const OutcomeRecord* records, uint64_t n, const std::string& label,
+        const Settings& settings, const ReplayOptions& options);
+
+    // SortedByTime returns whether records are sorted by timestamp
+    bool SortedByTime(const OutcomeRecord* records, uint64_t n);
+}
@@ -0,0 +1,247 @@
+#include "shm_segment.h"
+#include "circuit_breaker.h"
+#include "registry.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace cppbreaker
+{
+
+    std::string ShmSegmentName(int pid)
+    {
+        return "/cppbreaker." + std::to_string(pid);
+    }
+
+    static ShmSlot* slotAt(void* addr, uint32_t i)
+    {
+        return reinterpret_cast<ShmSlot*>(static_cast<char*>(addr) + sizeof(ShmHeader) + i * sizeof(ShmSlot));
+    }
+
+    static const ShmSlot* slotAt(const void* addr, uint32_t i)
+    {
+        return reinterpret_cast<const ShmSlot*>(
+            static_cast<const char*>(addr) + sizeof(ShmHeader) + i * sizeof(ShmSlot));
+    }
+
+    ShmPublisher::~ShmPublisher()
+    {
+        Stop();
+        Close();
+    }
+
+    bool ShmPublisher::Open(uint32_t capacity, const std::string& name)
+    {
+        if (addr_ != nullptr)
+            return false;
+
+        name_ = name.empty() ? ShmSegmentName(getpid()) : name;
+        size_ = sizeof(ShmHeader) + size_t(capacity) * sizeof(ShmSlot);
+
+        int fd = shm_open(name_.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+        if (fd < 0)
+            return false;
+        if (ftruncate(fd, off_t(size_)) != 0)
+        {
+            close(fd);
+            shm_unlink(name_.c_str());
+            return false;
+        }
+        void* addr = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED)
+        {
+            shm_unlink(name_.c_str());
+            return false;
+        }
+
+        // the segment is zero filled, which is a valid initial value for every field
+        auto header = static_cast<ShmHeader*>(addr);
+        header->header_size = sizeof(ShmHeader);
+        header->slot_size = sizeof(ShmSlot);
+        header->capacity = capacity;
+        header->pid = uint32_t(getpid());
+        header->version = kShmVersion;
+        std::atomic_thread_fence(std::memory_order_release);
+        header->magic = kShmMagic;
+
+        addr_ = addr;
+        return true;
+    }
+
+    void ShmPublisher::Close()
+    {
+        if (addr_ == nullptr)
+            return;
+        munmap(addr_, size_);
+        shm_unlink(name_.c_str());
+        addr_ = nullptr;
+    }
+
+    void ShmPublisher::Publish()
+    {
+        Publish(Registry::Instance());
+    }
+
+    void ShmPublisher::Publish(Registry& registry)
+    {
+        if (addr_ == nullptr)
+            return;
+
+        auto header = static_cast<ShmHeader*>(addr_);
+        uint32_t i = 0;
+        registry.ForEach([&](CircuitBreaker* cb) {
+            if (i >= header->capacity)
+                return;
+
+            const BreakerMetrics& m = cb->Metrics();
+            ShmSlot* slot = slotAt(addr_, i++);
+            auto seq = slot->seq.load(std::memory_order_relaxed);
+            slot->seq.store(seq + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+
+            slot->id = cb->GetId();
+            slot->state.store(m.state.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            slot->requests.store(m.requests.Load(), std::memory_order_relaxed);
+            slot->successes.store(m.successes.Load(), std::memory_order_relaxed);
+            slot->failures.store(m.failures.Load(), std::memory_order_relaxed);
+            slot->rejected_open.store(m.rejected_open.Load(), std::memory_order_relaxed);
+            slot->rejected_too_many.store(m.rejected_too_many.Load(),
+                std::memory_order_relaxed);
+            slot->transitions.store(m.transitions.Load(), std::memory_order_relaxed);
+            const std::string& name = cb->GetName();
+            size_t n = std::min(name.size(), kShmNameSize - 1);
+            memcpy(slot->name, name.data(), n);
+            slot->name[n] = '\0';
+
+            slot->seq.store(seq + 2, std::memory_order_release);
+        });
+
+        auto now = std::chrono::steady_clock::now().time_since_epoch();
+        header->count.store(i, std::memory_order_release);
+        header->published_ns.store(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count()),
+            std::memory_order_release);
+    }
+
+    bool ShmPublisher::Start(std::chrono::nanoseconds interval)
+    {
+        if (addr_ == nullptr || thread_.joinable())
+            return false;
+
+        stop_ = false;
+        thread_ = std::thread([this, interval]() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (!stop_)
+            {
+                Publish();
+                cond_.wait_for(lock, interval, [this]() { return stop_; });
+            }
+        });
+        return true;
+    }
+
+    void ShmPublisher::Stop()
+    {
+        if (!thread_.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cond_.notify_all();
+        thread_.join();
+    }
+
+    ShmReader::~ShmReader()
+    {
+        Detach();
+    }
+
+    bool ShmReader::Attach(const std::string& name)
+    {
+        if (addr_ != nullptr)
+            return false;
+
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0)
+            return false;
+
+        struct stat sb;
+        if (fstat(fd, &sb) != 0 || size_t(sb.st_size) < sizeof(ShmHeader))
+        {
+            close(fd);
+            return false;
+        }
+        size_t size = size_t(sb.st_size);
+        void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED)
+            return false;
+
+        auto header = static_cast<const ShmHeader*>(addr);
+        if (header->magic != kShmMagic || header->version != kShmVersion ||
+            header->header_size != sizeof(ShmHeader) || header->slot_size != sizeof(ShmSlot) ||
+            sizeof(ShmHeader) + size_t(header->capacity) * sizeof(ShmSlot) > size)
+        {
+            munmap(addr, size);
+            return false;
+        }
+
+        addr_ = addr;
+        size_ = size;
+        return true;
+    }
+
+    void ShmReader::Detach()
+    {
+        if (addr_ == nullptr)
+            return;
+        munmap(const_cast<void*>(addr_), size_);
+        addr_ = nullptr;
+    }
+
+    void ShmReader::Read(std::vector<ShmRecord>* records) const
+    {
+        records->clear();
+        if (addr_ == nullptr)
+            return;
+
+        auto header = Header();
+        uint32_t count = std::min(header->count.load(std::memory_order_acquire), header->capacity);
+        records->resize(count);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            const ShmSlot* slot = slotAt(addr_, i);
+            ShmRecord& r = (*records)[i];
+            char name[kShmNameSize];
+            // a publisher that died while writing leaves seq odd, give up after a while
+            for (int retries = 0; ; retries++)
+            {
+                auto seq = slot->seq.load(std::memory_order_acquire);
+                if ((seq & 1) && retries < 1000)
+                    continue;
+
+                r.id = slot->id;
+                r.state = slot->state.load(std::memory_order_relaxed);
+                r.requests = slot->requests.load(std::memory_order_relaxed);
+                r.successes = slot->successes.load(std::memory_order_relaxed);
+                r.failures = slot->failures.load(std::memory_order_relaxed);
+                r.rejected_open = slot->rejected_open.load(std::memory_order_relaxed);
+                r.rejected_too_many = slot->rejected_too_many.load(std::memory_order_relaxed);
+                r.transitions = slot->transitions.load(std::memory_order_relaxed);
+                memcpy(name, slot->name, kShmNameSize);
+
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (slot->seq.load(std::memory_order_relaxed) == seq || retries >= 1000)
+                    break;
+            }
+            name[kShmNameSize - 1] = '\0';
+            r.name = name;
+        }
+    }
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace cppbreaker
+{
+    class Registry;
+
+    // Layout of the shared memory segment, shared by the publisher and external readers such as cbctl.
+    // Bump kShmVersion whenever ShmHeader or ShmSlot changes.
+    static const uint32_t kShmMagic = 0x4d534243;   // "CBSM"
+    static const uint32_t kShmVersion = 1;
+    static const size_t kShmNameSize = 96;
+
+    struct ShmHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t header_size;
+        uint32_t slot_size;
+        uint32_t capacity;
+        uint32_t pid;
+        // number of slots in use
+        std::atomic<uint32_t> count;
+        uint32_t reserved;
+        // steady clock time of the last publication
+        std::atomic<uint64_t> published_ns;
+    };
+
+    // ShmSlot is protected by a seqlock: seq is odd while the publisher writes it.
+    struct ShmSlot
+    {
+        std::atomic<uint32_t> seq;
+        uint32_t id;
+        std::atomic<int32_t> state;
+        uint32_t reserved;
+        std::atomic<uint64_t> requests;
+        std::atomic<uint64_t> successes;
+        std::atomic<uint64_t> failures;
+        std::atomic<uint64_t> rejected_open;
+        std::atomic<uint64_t> rejected_too_many;
+        std::atomic<uint64_t> transitions;
+        char name[kShmNameSize];
+    };
+
+    // ShmRecord is a consistent copy of a ShmSlot
+    struct ShmRecord
+    {
+        uint32_t id = 0;
+        int32_t state = 0;
+        uint64_t requests = 0;
+        uint64_t successes = 0;
+        uint64_t failures = 0;
+        uint64_t rejected_open = 0;
+        uint64_t rejected_too_many = 0;
+        uint64_t transitions = 0;
+        std::string name;
+    };
+
+    // ShmPublisher copies the state and counters of every registered breaker
+    // into a POSIX shared memory segment, named ShmSegmentName(getpid()) by default.
+    class ShmPublisher
+    {
+    public:
+        ShmPublisher() {}
+        ~ShmPublisher();
+
+        ShmPublisher(const ShmPublisher&) = delete;
+        ShmPublisher& operator=(const ShmPublisher&) = delete;
+
+        // Open creates the segment with room for capacity breakers.
+        // Breakers beyond capacity are not published.
+        bool Open(uint32_t capacity, const std::string& name = "");
+        void Close();
+
+        // Publish copies the registry into the segment once.
+        // There must be a single publishing thread, do not call it while Start is running.
+        void Publish();
+        void Publish(Registry& registry);
+
+        // Start publishes every interval from a background thread until Stop.
+        bool Start(std::chrono::nanoseconds interval);
+        void Stop();
+
+        const std::string& Name() const
+        {
+            return name_;
+        }
+
+    private:
+        std::string name_;
+        void* addr_ = nullptr;
+        size_t size_ = 0;
+
+        std::mutex mutex_;
+        std::condition_variable cond_;
+        bool stop_ = false;
+        std::thread thread_;
+    };
+
+    // ShmReader attaches read only to a segment created by ShmPublisher.
+    class ShmReader
+    {
+    public:
+        ShmReader() {}
+        ~ShmReader();
+
+        ShmReader(const ShmReader&) = delete;
+        ShmReader& operator=(const ShmReader&) = delete;
+
+        // Attach returns false if the segment does not exist or has an unknown version.
+        bool Attach(const std::string& name);
+        void Detach();
+
+        const ShmHeader* Header() const
+        {
+            return static_cast<const ShmHeader*>(addr_);
+        }
+
+        // Read copies every published slot into records.
+        void Read(std::vector<ShmRecord>* records) const;
+
+    private:
+        const void* addr_ = nullptr;
+        size_t size_ = 0;
+    };
+
+    // ShmSegmentName returns the default segment name of process pid
+    std::string ShmSegmentName(int pid);
+}
@@ -0,0 +1,189 @@
+#include "simulator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+
+namespace cppbreaker
+{
+
+    namespace
+    {
+        uint64_t splitmix64(uint64_t* x)
+        {
+            uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            return z ^ (z >> 31);
+        }
+
+        uint64_t rotl(uint64_t x, int k)
+        {
+            return (x << k) | (x >> (64 - k));
+        }
+    }
+
+    Simulator::Simulator(uint64_t seed)
+    {
+        for (auto& r : rng_)
+            r = splitmix64(&seed);
+        start_ = clock_.Now();
+    }
+
+    // xoshiro256**
+    uint64_t Simulator::Next()
+    {
+        uint64_t result = rotl(rng_[1] * 5, 7) * 9;
+        uint64_t t = rng_[1] << 17;
+        rng_[2] ^= rng_[0];
+        rng_[3] ^= rng_[1];
+        rng_[1] ^= rng_[2];
+        rng_[0] ^= rng_[3];
+        rng_[2] ^= t;
+        rng_[3] = rotl(rng_[3], 45);
+        return result;
+    }
+
+    double Simulator::Uniform()
+    {
+        return double(Next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    std::chrono::nanoseconds Simulator::Exponential(std::chrono::nanoseconds mean)
+    {
+        return std::chrono::nanoseconds(int64_t(-std::log(1.0 - Uniform()) * double(mean.count())));
+    }
+
+    int Simulator::AddClients(CircuitBreaker* cb, const std::vector<SimPhase>& phases, uint32_t clients,
+        std::chrono::nanoseconds think)
+    {
+        Group g;
+        g.cb = cb;
+        g.phases = phases;
+        if (g.phases.empty())
+            g.phases.push_back(SimPhase());
+        int64_t end = 0;
+        for (auto& p : g.phases)
+        {
+            end += p.duration.count();
+            g.phase_ends_ns.push_back(end);
+        }
+        g.stats.resize(g.phases.size());
+        g.think_ns = think.count();
+        groups_.push_back(g);
+
+        int group = int(groups_.size() - 1);
+        for (uint32_t i = 0; i < clients; i++)
+        {
+            Event ev;
+            ev.at_ns = now_ns_ + int64_t(Uniform() * double(std::max<int64_t>(g.think_ns, 1000)));
+            ev.client = uint32_t(clients_.size());
+            ev.kind = EVENT_REQUEST;
+            ev.success = 0;
+            ev.phase = 0;
+            ev.generation = 0;
+            ev.latency_ns = 0;
+            clients_.push_back(uint32_t(group));
+            push(ev);
+        }
+        return group;
+    }
+
+    size_t Simulator::phaseAt(const Group& g, int64_t at_ns) const
+    {
+        auto it = std::upper_bound(g.phase_ends_ns.begin(), g.phase_ends_ns.end(), at_ns);
+        size_t i = size_t(it - g.phase_ends_ns.begin());
+        return std::min(i, g.phases.size() - 1);
+    }
+
+    void Simulator::push(const Event& ev)
+    {
+        Event e = ev;
+        e.seq = seq_++;
+        queue_.push_back(e);
+        std::push_heap(queue_.begin(), queue_.end(), std::greater<Event>());
+    }
+
+    void Simulator::Run(std::chrono::nanoseconds duration)
+    {
+        int64_t end_ns = now_ns_ + duration.count();
+        while (!queue_.empty() && queue_.front().at_ns <= end_ns)
+        {
+            std::pop_heap(queue_.begin(), queue_.end(), std::greater<Event>());
+            Event ev = queue_.back();
+            queue_.pop_back();
+
+            now_ns_ = ev.at_ns;
+            clock_.Set(start_ + std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                std::chrono::nanoseconds(now_ns_)));
+            handle(ev);
+            events_++;
+        }
+        now_ns_ = end_ns;
+        clock_.Set(start_ + std::chrono::duration_cast<std::chrono::system_clock::duration>(
+            std::chrono::nanoseconds(now_ns_)));
+    }
+
+    void Simulator::record(int group, State from)
+    {
+        State to = State(groups_[group].cb->Metrics().state.load(std::memory_order_relaxed));
+        if (to == from)
+            return;
+        SimTransition t;
+        t.at = std::chrono::nanoseconds(now_ns_);
+        t.group = group;
+        t.from = from;
+        t.to = to;
+        transitions_.push_back(t);
+    }
+
+    void Simulator::handle(const Event& ev)
+    {
+        uint32_t group = clients_[ev.client];
+        Group& g = groups_[group];
+        Event next = ev;
+        // a call of the breaker makes at most one transition: one that expires the state
+        // ends the generation of the request, which then changes nothing more
+        State from = State(g.cb->Metrics().state.load(std::memory_order_relaxed));
+
+        if (ev.kind == EVENT_REQUEST)
+        {
+            size_t phase = phaseAt(g, now_ns_);
+            const SimPhase& p = g.phases[phase];
+            SimPhaseStats& stats = g.stats[phase];
+            stats.requests++;
+
+            uint64_t generation = 0;
+            if (g.cb->Allow(&generation) == ResultCodeOK)
+            {
+                stats.admitted++;
+                next.kind = EVENT_RESPONSE;
+                next.generation = generation;
+                next.phase = uint16_t(phase);
+                next.success = Uniform() >= p.error_rate;
+                next.latency_ns = Exponential(p.latency).count();
+                next.at_ns = now_ns_ + next.latency_ns;
+            }
+            else
+            {
+                stats.rejected++;
+                next.at_ns = now_ns_ + std::max<int64_t>(g.think_ns, 1000);
+            }
+        }
+        else
+        {
+            g.cb->Done(ev.generation, ev.success != 0, std::chrono::nanoseconds(ev.latency_ns));
+            SimPhaseStats& stats = g.stats[ev.phase];
+            if (ev.success)
+                stats.successes++;
+            else
+                stats.failures++;
+
+            next.kind = EVENT_REQUEST;
+            next.at_ns = now_ns_ + g.think_ns;
+        }
+        record(int(group), from);
+        push(next);
+    }
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "circuit_breaker.h"
+#include "clock.h"
+
+namespace cppbreaker
+{
+    // SimPhase is a period of behaviour of a simulated backend
+    struct SimPhase
+    {
+        std::string name;
+        std::chrono::nanoseconds duration = std::chrono::seconds(60);
+        // probability that a request fails
+        double error_rate = 0;
+        // mean of the exponentially distributed latency
+        std::chrono::nanoseconds latency = std::chrono::milliseconds(1);
+    };
+
+    // SimPhaseStats counts what the clients of one group saw during one phase.
+    // Outcomes are accounted to the phase the request was sent in.
+    struct SimPhaseStats
+    {
+        uint64_t requests = 0;
+        uint64_t admitted = 0;
+        uint64_t rejected = 0;
+        uint64_t successes = 0;
+        uint64_t failures = 0;
+    };
+
+    struct SimTransition
+    {
+        // virtual time since the start of the simulation
+        std::chrono::nanoseconds at;
+        int group;
+        State from;
+        State to;
+    };
+
+    // Simulator is a single threaded discrete event simulation of closed loop clients
+    // calling backends through circuit breakers, in virtual time.
+    // Breakers must use GetClock() as their Settings::clock.
+    // Given the same seed and setup, every run produces the same results.
+    class Simulator
+    {
+    public:
+        explicit Simulator(uint64_t seed);
+
+        VirtualClock* GetClock()
+        {
+            return &clock_;
+        }
+
+        // AddClients adds a group of clients sending requests through cb to a backend that goes
+        // through phases, the last phase lasts forever. Each client waits think after every answer,
+        // at least 1us after a rejection. Transitions of cb made by the calls of the group are recorded,
+        // the settings of cb are left as they are. It returns the group number.
+        int AddClients(CircuitBreaker* cb, const std::vector<SimPhase>& phases, uint32_t clients,
+            std::chrono::nanoseconds think);
+
+        // Run simulates duration more of virtual time
+        void Run(std::chrono::nanoseconds duration);
+
+        const std::vector<SimPhaseStats>& Stats(int group) const
+        {
+            return groups_[group].stats;
+        }
+        const std::vector<SimTransition>& Transitions() const
+        {
+            return transitions_;
+        }
+        uint64_t Events() const
+        {
+            return events_;
+        }
+        std::chrono::nanoseconds Elapsed() const
+        {
+            return std::chrono::nanoseconds(now_ns_);
+        }
+
+        // random numbers of the simulation
+        uint64_t Next();
+        double Uniform();
+        std::chrono::nanoseconds Exponential(std::chrono::nanoseconds mean);
+
+    private:
+        enum EventKind
+        {
+            EVENT_REQUEST = 0,
+            EVENT_RESPONSE = 1
+        };
+
+        struct Event
+        {
+            int64_t at_ns;
+            uint64_t seq;
+            uint32_t client;
+            uint8_t kind;
+            uint8_t success;
+            uint16_t phase;
+            uint64_t generation;
+            int64_t latency_ns;
+
+            bool operator>(const Event& e) const
+            {
+                return at_ns != e.at_ns ? at_ns > e.at_ns : seq > e.seq;
+            }
+        };
+
+        struct Group
+        {
+            CircuitBreaker* cb;
+            std::vector<SimPhase> phases;
+            std::vector<int64_t> phase_ends_ns;
+            std::vector<SimPhaseStats> stats;
+            int64_t think_ns;
+        };
+
+        size_t phaseAt(const Group& g, int64_t at_ns) const;
+        void push(const Event& ev);
+        void handle(const Event& ev);
+        // record records the transition of group from state from made by the last call, if any
+        void record(int group, State from);
+
+        VirtualClock clock_;
+        std::chrono::system_clock::time_point start_;
+        uint64_t rng_[4];
+        int64_t now_ns_ = 0;
+        uint64_t seq_ = 0;
+        uint64_t events_ = 0;
+
+        std::vector<Group> groups_;
+        // group of each client
+        std::vector<uint32_t> clients_;
+        // min heap of pending events
+        std::vector<Event> queue_;
+        std::vector<SimTransition> transitions_;
+    };
+}
@@ -0,0 +1,150 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "admin_server.h"
+#include "circuit_breaker.h"
+#include "registry.h"
+
+using namespace cppbreaker;
+
+class AdminServerTest : public testing::Test
+{
+};
+
+static std::string request(const std::string& path, const std::string& cmd)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        return "";
+    }
+    std::string line = cmd + "\n";
+    if (write(fd, line.data(), line.size()) != ssize_t(line.size()))
+    {
+        close(fd);
+        return "";
+    }
+
+    std::string out;
+    char buf[4096];
+    while (out.empty() || out.back() != '\n')
+    {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0)
+            break;
+        out.append(buf, size_t(n));
+    }
+    close(fd);
+    return out;
+}
+
+TEST_F(AdminServerTest, TestHandle)
+{
+    Registry registry;
+    Settings st;
+    st.name = "svc.a";
+    CircuitBreaker a(st);
+    st.name = "svc.b";
+    CircuitBreaker b(st);
+    st.name = "other";
+    CircuitBreaker c(st);
+    registry.Add(&a);
+    registry.Add(&b);
+    registry.Add(&c);
+
+    std::string path = "/tmp/cppbreaker_admin_test." + std::to_string(getpid());
+    AdminServer server;
+    ASSERT_TRUE(server.Start(path, registry));
+
+    auto out = request(path, "list");
+    ASSERT_EQ('[', out[0]);
+    ASSERT_NE(std::string::npos, out.find("\"name\":\"svc.a\",\"state\":\"close\""));
+    ASSERT_NE(std::string::npos, out.find("\"name\":\"other\""));
+
+    ASSERT_EQ("{\"matched\":2}\n", request(path, "force svc. open"));
+    ASSERT_EQ(STATE_OPEN, a.GetState());
+    ASSERT_EQ(STATE_OPEN, b.GetState());
+    ASSERT_EQ(STATE_CLOSED, c.GetState());
+
+    out = request(path, "snapshot svc.b");
+    ASSERT_NE(std::string::npos, out.find("\"state\":\"open\",\"override\":\"force open\""));
+    ASSERT_NE(std::string::npos, out.find("\"top_codes\":[],\"window_codes\":[]"));
+
+    ASSERT_EQ("{\"matched\":3}\n", request(path, "force * disabled"));
+    ASSERT_EQ(STATE_CLOSED, a.GetState());
+    ASSERT_EQ(OVERRIDE_DISABLED, c.GetSnapshot().override);
+
+    ASSERT_EQ("{\"matched\":1}\n", request(path, "force other closed"));
+    ASSERT_EQ(OVERRIDE_NONE, c.GetSnapshot().override);
+
+    out = request(path, "force svc. sideways");
+    ASSERT_NE(std::string::npos, out.find("\"error\""));
+    out = request(path, "bogus");
+    ASSERT_NE(std::string::npos, out.find("\"error\""));
+
+    server.Stop();
+    ASSERT_EQ("", request(path, "list"));
+}
+
+TEST_F(AdminServerTest, TestLargeAnswer)
+{
+    Registry registry;
+    std::vector<std::unique_ptr<CircuitBreaker>> breakers;
+    Settings st;
+    for (int i = 0; i < 5000; i++)
+    {
+        st.name = "breaker_with_a_long_name_" + std::to_string(i);
+        breakers.emplace_back(new CircuitBreaker(st));
+        registry.Add(breakers.back().get());
+    }
+
+    std::string path = "/tmp/cppbreaker_admin_test_large." + std::to_string(getpid());
+    AdminServer server;
+    ASSERT_TRUE(server.Start(path, registry));
+    auto out = request(path, "list");
+    ASSERT_GT(out.size(), 5000u * 100);
+    ASSERT_NE(std::string::npos, out.find("breaker_with_a_long_name_4999"));
+    ASSERT_EQ("]\n", out.substr(out.size() - 2));
+}
+
+TEST_F(AdminServerTest, TestForceCallbacks)
+{
+    // on_state_change constructs and destroys a breaker, which takes the lock of the registry
+    int changes = 0;
+    VirtualClock clock;
+    Settings st;
+    st.name = "admin_test.callback";
+    st.clock = &clock;
+    st.on_state_change = [&changes](const std::string&, State, State) {
+        Settings tmp;
+        tmp.name = "admin_test.tmp";
+        CircuitBreaker cb(tmp);
+        changes++;
+    };
+    CircuitBreaker a(st);
+
+    std::string path = "/tmp/cppbreaker_admin_test_callbacks." + std::to_string(getpid());
+    AdminServer server;
+    ASSERT_TRUE(server.Start(path));
+    ASSERT_EQ("{\"matched\":1}\n", request(path, "force admin_test. open"));
+    ASSERT_EQ(STATE_OPEN, a.GetState());
+    ASSERT_EQ("{\"matched\":1}\n", request(path, "force admin_test. closed"));
+    ASSERT_EQ(STATE_CLOSED, a.GetState());
+    ASSERT_EQ(2, changes);
+
+    // a snapshot that finds the open state expired moves it to half open
+    for (int i = 0; i < 6; i++)
+        a.Execute<int>([]()-> std::tuple<int, int> { return std::make_tuple(0, 1); });
+    ASSERT_EQ(3, changes);
+    clock.Advance(std::chrono::seconds(61));
+    ASSERT_NE(std::string::npos, request(path, "snapshot admin_test.callback").find("\"state\":\"half open\""));
+    ASSERT_EQ(4, changes);
+    server.Stop();
+}
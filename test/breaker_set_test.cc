@@ -0,0 +1,165 @@
+#include <gtest/gtest.h>
+#include "breaker_set.h"
+#include "registry.h"
+
+using namespace cppbreaker;
+
+class BreakerSetTest : public testing::Test
+{
+};
+
+TEST_F(BreakerSetTest, TestParse)
+{
+    std::string config =
+        "# classes\n"
+        "class fast timeout=5s interval=10s max_requests=3\n"
+        "class strict trip=requests >= 4 && failure_ratio >= 0.5\n"
+        "\n"
+        "fast svc.get.host1\n"
+        "  fast   svc.get.host2  \n"
+        "strict svc.put.host1\r\n"
+        "coded svc.del.host1\n";
+
+    size_t before = Registry::Instance().Size();
+    BreakerSet set;
+    Settings coded;
+    coded.interval = std::chrono::seconds(1);
+    ASSERT_TRUE(set.DefineClass("coded", coded));
+    ASSERT_FALSE(set.DefineClass("coded", coded));
+
+    std::string err;
+    ASSERT_TRUE(set.Parse(config.data(), config.size(), &err)) << err;
+    ASSERT_EQ(4u, set.Size());
+    ASSERT_EQ(before + 4, Registry::Instance().Size());
+    ASSERT_EQ("svc.get.host1", set.At(0)->GetName());
+    ASSERT_EQ("svc.get.host2", set.At(1)->GetName());
+    ASSERT_EQ("svc.put.host1", set.At(2)->GetName());
+    ASSERT_EQ("svc.del.host1", set.At(3)->GetName());
+
+    // breakers of a class share their settings
+    const Settings* fast = set.GetClass("fast");
+    ASSERT_TRUE(fast != nullptr);
+    ASSERT_EQ(fast, &set.At(0)->GetSettings());
+    ASSERT_EQ(fast, &set.At(1)->GetSettings());
+    ASSERT_EQ(3u, fast->max_requests);
+    ASSERT_EQ(std::chrono::seconds(5), fast->timeout);
+    ASSERT_EQ(std::chrono::seconds(10), fast->interval);
+    ASSERT_EQ(std::chrono::seconds(60), set.GetClass("strict")->timeout);
+    ASSERT_EQ(std::chrono::seconds(1), set.At(3)->GetSettings().interval);
+    ASSERT_TRUE(set.GetClass("none") == nullptr);
+
+    ASSERT_EQ(set.At(2), set.Find("svc.put.host1"));
+    ASSERT_EQ(set.At(0), set.Find("svc.get.host1"));
+    ASSERT_TRUE(set.Find("svc.put.host2") == nullptr);
+
+    // ids are those of the registry
+    size_t seen = 0;
+    Registry::Instance().ForEach([&](CircuitBreaker* cb) {
+        for (size_t i = 0; i < set.Size(); i++)
+        {
+            if (set.At(i) == cb)
+                seen++;
+        }
+    });
+    ASSERT_EQ(4u, seen);
+    ASSERT_EQ(set.At(0)->GetId() + 3, set.At(3)->GetId());
+
+    // the trip expression of the class applies, the default rule without one
+    uint64_t gen;
+    auto strict = set.At(2);
+    for (int i = 0; i < 4; i++)
+    {
+        ASSERT_EQ(ResultCodeOK, strict->Allow(&gen));
+        strict->Done(gen, i % 2 == 0);
+    }
+    ASSERT_EQ(STATE_OPEN, strict->GetState());
+    for (int i = 0; i < 6; i++)
+    {
+        ASSERT_EQ(ResultCodeOK, set.At(0)->Allow(&gen));
+        set.At(0)->Done(gen, false);
+    }
+    ASSERT_EQ(STATE_OPEN, set.At(0)->GetState());
+    ASSERT_EQ(STATE_CLOSED, set.At(1)->GetState());
+
+    // settings of one breaker can still be replaced
+    Settings st;
+    st.max_requests = 7;
+    set.At(1)->UpdateSettings(st);
+    ASSERT_EQ(7u, set.At(1)->GetSettings().max_requests);
+    ASSERT_EQ("svc.get.host2", set.At(1)->GetName());
+    ASSERT_EQ(3u, fast->max_requests);
+
+    ASSERT_FALSE(set.Parse(config.data(), config.size(), &err));
+}
+
+TEST_F(BreakerSetTest, TestErrors)
+{
+    const char* bad[] = {
+        "nope a\n",
+        "class c\nc\n",
+        "class c\nc a b\n",
+        "class c\nclass c\n",
+        "class\n",
+        "class c timeout=5\n",
+        "class c bogus=1\n",
+        "class c trip=requests >\n",
+        "class c max_requests=x\n",
+        "class c max_requests=-1\n",
+        "class c max_requests=3x\n",
+        "class c max_requests=99999999999\n",
+        "class c timeout=s\n",
+        "class c\nc a\nc b\nc a\n",
+    };
+    size_t before = Registry::Instance().Size();
+    for (auto config : bad)
+    {
+        BreakerSet set;
+        std::string err;
+        ASSERT_FALSE(set.Parse(config, strlen(config), &err)) << config;
+        ASSERT_EQ(0, err.compare(0, 5, "line ")) << err;
+        ASSERT_EQ(0u, set.Size());
+        ASSERT_TRUE(set.Find("a") == nullptr);
+    }
+    ASSERT_EQ(before, Registry::Instance().Size());
+
+    // a failed parse drops the classes it defined, those defined before stay
+    BreakerSet partial;
+    Settings st;
+    ASSERT_TRUE(partial.DefineClass("coded", st));
+    std::string err;
+    const char* config = "class c\nc a\nclass d bogus=1\n";
+    ASSERT_FALSE(partial.Parse(config, strlen(config), &err));
+    ASSERT_TRUE(partial.GetClass("c") == nullptr);
+    ASSERT_TRUE(partial.GetClass("coded") != nullptr);
+    config = "class c\nc a\ncoded b\n";
+    ASSERT_TRUE(partial.Parse(config, strlen(config), &err)) << err;
+    ASSERT_EQ(2u, partial.Size());
+    ASSERT_EQ(partial.At(1), partial.Find("b"));
+
+    BreakerSet set;
+    ASSERT_FALSE(set.Load("/nonexistent/breakers.conf", &err));
+}
+
+TEST_F(BreakerSetTest, TestParallel)
+{
+    std::string config = "class a\nclass b timeout=1s\n";
+    const int n = 20000;
+    for (int i = 0; i < n; i++)
+        config += (i % 2 == 0 ? "a svc." : "b svc.") + std::to_string(i) + "\n";
+
+    size_t before = Registry::Instance().Size();
+    {
+        BreakerSet set;
+        std::string err;
+        ASSERT_TRUE(set.Parse(config.data(), config.size(), &err, 4)) << err;
+        ASSERT_EQ(size_t(n), set.Size());
+        ASSERT_EQ(before + n, Registry::Instance().Size());
+        for (int i = 0; i < n; i++)
+        {
+            ASSERT_EQ("svc." + std::to_string(i), set.At(size_t(i))->GetName());
+            ASSERT_EQ(set.GetClass(i % 2 == 0 ? "a" : "b"), &set.At(size_t(i))->GetSettings());
+        }
+        ASSERT_EQ(set.At(12345), set.Find("svc.12345"));
+    }
+    ASSERT_EQ(before, Registry::Instance().Size());
+}
@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 #include <memory>
 #include <future>
+#include <thread>
 #include "circuit_breaker.h"
 
 using namespace cppbreaker;
@@ -32,23 +33,37 @@ public:
     testCircuitBreaker(const Settings& st) : CircuitBreaker(st)
     {}
     const Settings& settings() {
-        return settings_;
+        return GetSettings();
     }
-    const Counts& counts() {
-        return counts_;
+    Counts counts() {
+        return loadCounts();
     }
     std::chrono::system_clock::time_point expiry() {
         return expiry_;
     }
-    void setExpiry(std::chrono::system_clock::time_point ep)
+
+    // line returns the cache line of a member, counted from the start of the breaker
+    size_t line(const void* member) const
+    {
+        return size_t((const char*)member - (const char*)this) / kCacheLine;
+    }
+    void checkLayout() const
     {
-        expiry_ = ep;
+        ASSERT_EQ(0u, uintptr_t(this) % kCacheLine);
+        size_t read_mostly = line(&settings_);
+        ASSERT_EQ(read_mostly, line(&lease_epoch_));
+        ASSERT_NE(read_mostly, line(&mutex_));
+        ASSERT_EQ(line(&mutex_), line(&generation_));
+        ASSERT_LT(line(&expiry_), line(&metrics_));
+        ASSERT_EQ(0u, size_t((const char*)&metrics_ - (const char*)this) % kCacheLine);
+        ASSERT_LT(line(&metrics_.latency), line(&own_settings_));
     }
 
-    static std::shared_ptr<testCircuitBreaker> newCustom()
+    static std::shared_ptr<testCircuitBreaker> newCustom(Clock* clock = nullptr)
     {
         Settings st;
         st.name = "cb";
+        st.clock = clock;
         st.max_requests = 3;
         st.interval = std::chrono::seconds(30);
         st.timeout = std::chrono::seconds(90);
@@ -88,16 +103,24 @@ public:
         return err;
     }
 
-    std::future<int> succeedLater(std::chrono::nanoseconds delay)
+    // succeedWhen runs a successful request that returns once release is ready
+    std::future<int> succeedWhen(std::shared_future<void> release)
     {
         return std::async(std::launch::async, [=]() {
             auto ret = Execute<int>([&]()-> std::tuple<int, int> {
-                std::this_thread::sleep_for(delay);
+                release.wait();
                 return std::make_tuple(0, 0);
                 });
             return std::get<1>(ret);
             });
     }
+
+    // waitRequests waits until the generation has counted requests
+    void waitRequests(uint32_t requests)
+    {
+        while (counts().requests < requests)
+            std::this_thread::yield();
+    }
 };
 
 static Counts newCounts(uint32_t requests, uint32_t total_successes,
@@ -110,12 +133,6 @@ static Counts newCounts(uint32_t requests, uint32_t total_successes,
     return cc;
 }
 
-void pseudoSleep(testCircuitBreaker* cb, std::chrono::nanoseconds period)
-{
-    if (cb->expiry().time_since_epoch().count() != 0)
-        cb->setExpiry(cb->expiry() + -1 * period);
-}
-
 TEST_F(CbTest, TestStateConstants)
 {
     ASSERT_EQ(State(0), STATE_CLOSED);
@@ -154,7 +171,9 @@ TEST_F(CbTest, TestNewCircuitBreaker)
 
 TEST_F(CbTest, TestDefaultCircuitBreaker)
 {
+    VirtualClock clock;
     Settings settings;
+    settings.clock = &clock;
     testCircuitBreaker defaultCB(settings);
     ASSERT_EQ(0, defaultCB.expiry().time_since_epoch().count());
 
@@ -186,11 +205,11 @@ TEST_F(CbTest, TestDefaultCircuitBreaker)
     ASSERT_NE(0, defaultCB.fail());
     ASSERT_EQ(newCounts(0, 0, 0, 0, 0), defaultCB.counts());
 
-    pseudoSleep(&defaultCB, std::chrono::seconds(59));
+    clock.Advance(std::chrono::seconds(59));
     ASSERT_EQ(STATE_OPEN, defaultCB.GetState());
 
     // StateOpen to StateHalfOpen
-    pseudoSleep(&defaultCB, std::chrono::seconds(1));
+    clock.Advance(std::chrono::seconds(2));
     ASSERT_EQ(STATE_HALF_OPEN, defaultCB.GetState());
     ASSERT_EQ(0, defaultCB.expiry().time_since_epoch().count());
 
@@ -201,7 +220,7 @@ TEST_F(CbTest, TestDefaultCircuitBreaker)
     ASSERT_NE(0, defaultCB.expiry().time_since_epoch().count());
 
     // StateOpen to StateHalfOpen
-    pseudoSleep(&defaultCB, std::chrono::seconds(60));
+    clock.Advance(std::chrono::seconds(61));
     ASSERT_EQ(STATE_HALF_OPEN, defaultCB.GetState());
     ASSERT_EQ(0, defaultCB.expiry().time_since_epoch().count());
 
@@ -215,7 +234,8 @@ TEST_F(CbTest, TestDefaultCircuitBreaker)
 
 TEST_F(CbTest, TestCustomCircuitBreaker)
 {
-    auto customCB = testCircuitBreaker::newCustom();
+    VirtualClock clock;
+    auto customCB = testCircuitBreaker::newCustom(&clock);
     ASSERT_EQ("cb", customCB->GetName());
 
     for (int i = 0; i < 5; i++)
@@ -226,12 +246,12 @@ TEST_F(CbTest, TestCustomCircuitBreaker)
     ASSERT_EQ(STATE_CLOSED, customCB->GetState());
     ASSERT_EQ(newCounts(10, 5, 5, 0, 1), customCB->counts());
 
-    pseudoSleep(customCB.get(), std::chrono::seconds(29));
+    clock.Advance(std::chrono::seconds(29));
     ASSERT_EQ(0, customCB->succeed());
     ASSERT_EQ(STATE_CLOSED, customCB->GetState());
     ASSERT_EQ(newCounts(11, 6, 5, 1, 0), customCB->counts());
 
-    pseudoSleep(customCB.get(), std::chrono::seconds(1));
+    clock.Advance(std::chrono::seconds(2));
     ASSERT_EQ(0, customCB->fail());
     ASSERT_EQ(STATE_CLOSED, customCB->GetState());
     ASSERT_EQ(newCounts(1, 0, 1, 0, 1), customCB->counts());
@@ -245,7 +265,7 @@ TEST_F(CbTest, TestCustomCircuitBreaker)
     ASSERT_EQ(StateChange("cb", STATE_CLOSED, STATE_OPEN), stateChange);
 
     // StateOpen to StateHalfOpen
-    pseudoSleep(customCB.get(), std::chrono::seconds(90));
+    clock.Advance(std::chrono::seconds(91));
     ASSERT_EQ(STATE_HALF_OPEN, customCB->GetState());
     ASSERT_EQ(0, customCB->expiry().time_since_epoch().count());
     ASSERT_EQ(StateChange("cb", STATE_OPEN, STATE_HALF_OPEN), stateChange);
@@ -256,10 +276,12 @@ TEST_F(CbTest, TestCustomCircuitBreaker)
     ASSERT_EQ(newCounts(2, 2, 0, 2, 0), customCB->counts());
 
     // StateHalfOpen to StateClosed
-    auto ch = customCB->succeedLater(std::chrono::milliseconds(100));
-    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    std::promise<void> release;
+    auto ch = customCB->succeedWhen(release.get_future().share());
+    customCB->waitRequests(3);
     ASSERT_EQ(newCounts(3, 2, 0, 2, 0), customCB->counts());
     ASSERT_NE(0, customCB->succeed());
+    release.set_value();
     ASSERT_EQ(0, ch.get());
     ASSERT_EQ(STATE_CLOSED, customCB->GetState());
     ASSERT_EQ(newCounts(0, 0, 0, 0, 0), customCB->counts());
@@ -269,16 +291,20 @@ TEST_F(CbTest, TestCustomCircuitBreaker)
 
 TEST_F(CbTest, TestCircuitBreakerInParallel)
 {
-    auto customCB = testCircuitBreaker::newCustom();
-    pseudoSleep(customCB.get(), std::chrono::seconds(29));
+    VirtualClock clock;
+    auto customCB = testCircuitBreaker::newCustom(&clock);
+    clock.Advance(std::chrono::seconds(29));
     ASSERT_EQ(0, customCB->succeed());
-    auto ch = customCB->succeedLater(std::chrono::milliseconds(1500));
-    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    std::promise<void> release;
+    auto ch = customCB->succeedWhen(release.get_future().share());
+    customCB->waitRequests(2);
     ASSERT_EQ(newCounts(2, 1, 0, 1, 0), customCB->counts());
 
-    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    // the interval ends while the request runs, its outcome belongs to the old generation
+    clock.Advance(std::chrono::seconds(2));
     ASSERT_EQ(STATE_CLOSED, customCB->GetState());
     ASSERT_EQ(newCounts(0, 0, 0, 0, 0), customCB->counts());
+    release.set_value();
     ASSERT_EQ(0, ch.get());
     ASSERT_EQ(newCounts(0, 0, 0, 0, 0), customCB->counts());
 }
@@ -311,3 +337,252 @@ TEST_F(CbTest, TestGeneration)
 }
 
 
+
+TEST_F(CbTest, TestOverride)
+{
+    VirtualClock clock;
+    Settings settings;
+    settings.clock = &clock;
+    testCircuitBreaker cb(settings);
+
+    cb.SetOverride(OVERRIDE_FORCE_OPEN);
+    ASSERT_EQ(STATE_OPEN, cb.GetState());
+    ASSERT_EQ(ResultCodeErrOpenState, cb.succeed());
+    clock.Advance(std::chrono::hours(24 * 365));
+    ASSERT_EQ(STATE_OPEN, cb.GetState());
+    ASSERT_EQ(OVERRIDE_FORCE_OPEN, cb.GetSnapshot().override);
+
+    // releasing the override starts a regular open period
+    cb.SetOverride(OVERRIDE_NONE);
+    ASSERT_EQ(STATE_OPEN, cb.GetState());
+    clock.Advance(std::chrono::seconds(61));
+    ASSERT_EQ(STATE_HALF_OPEN, cb.GetState());
+
+    cb.SetOverride(OVERRIDE_DISABLED);
+    ASSERT_EQ(STATE_CLOSED, cb.GetState());
+    for (int i = 0; i < 20; i++)
+    {
+        ASSERT_EQ(0, cb.fail());
+    }
+    ASSERT_EQ(STATE_CLOSED, cb.GetState());
+    ASSERT_EQ(newCounts(20, 0, 20, 0, 20), cb.counts());
+
+    // Reset clears the override, the next failure trips
+    cb.Reset();
+    ASSERT_EQ(OVERRIDE_NONE, cb.GetSnapshot().override);
+    ASSERT_EQ(newCounts(0, 0, 0, 0, 0), cb.counts());
+    for (int i = 0; i < 6; i++)
+    {
+        ASSERT_EQ(0, cb.fail());
+    }
+    ASSERT_EQ(STATE_OPEN, cb.GetState());
+    cb.Reset();
+    ASSERT_EQ(STATE_CLOSED, cb.GetState());
+}
+
+TEST_F(CbTest, TestUpdateSettings)
+{
+    VirtualClock clock;
+    Settings settings;
+    settings.name = "cb";
+    settings.clock = &clock;
+    testCircuitBreaker cb(settings);
+    {
+        // the replaced settings stay readable while a guard held before they were replaced is
+        Epoch::Guard guard;
+        const Settings& before = cb.settings();
+
+        settings.name = "renamed";
+        settings.max_requests = 0;
+        settings.timeout = std::chrono::seconds(5);
+        settings.ready_to_trip = [](const Counts& counts) { return counts.consecutive_failures >= 2; };
+        cb.UpdateSettings(settings);
+        // name is fixed, defaults apply
+        ASSERT_EQ("cb", cb.GetName());
+        ASSERT_EQ(1, cb.settings().max_requests);
+        ASSERT_EQ("cb", before.name);
+        ASSERT_EQ(std::chrono::seconds(60), before.timeout);
+    }
+
+    ASSERT_EQ(0, cb.fail());
+    ASSERT_EQ(STATE_CLOSED, cb.GetState());
+    ASSERT_EQ(0, cb.fail());
+    ASSERT_EQ(STATE_OPEN, cb.GetState());
+    clock.Advance(std::chrono::seconds(6));
+    ASSERT_EQ(STATE_HALF_OPEN, cb.GetState());
+
+    // requests keep running while settings are replaced
+    std::atomic<bool> stop(false);
+    std::thread updater([&]() {
+        Settings st;
+        for (uint32_t i = 0; !stop; i++)
+        {
+            st.max_requests = i % 4;
+            cb.UpdateSettings(st);
+        }
+    });
+    for (int i = 0; i < 10000; i++)
+        cb.Execute<int>([]()-> std::tuple<int, int> { return std::make_tuple(0, 0); });
+    stop = true;
+    updater.join();
+    ASSERT_EQ(STATE_CLOSED, cb.GetState());
+}
+
+TEST_F(CbTest, TestOpenLease)
+{
+    VirtualClock clock;
+    Settings settings;
+    settings.clock = &clock;
+    settings.timeout = std::chrono::seconds(10);
+    settings.open_lease = true;
+    testCircuitBreaker cb(settings);
+
+    for (int i = 0; i < 6; i++)
+        ASSERT_EQ(0, cb.fail());
+    ASSERT_EQ(STATE_OPEN, cb.GetState());
+
+    // rejections under a lease are counted in batches, all of them once the thread exits
+    std::thread t([&]() {
+        for (int i = 0; i < 1000; i++)
+            ASSERT_EQ(ResultCodeErrOpenState, cb.succeed());
+        ASSERT_LT(cb.Metrics().rejected_open.Load(), 1000u);
+    });
+    t.join();
+    ASSERT_EQ(1000u, cb.Metrics().rejected_open.Load());
+
+    // the lease ends with the open state
+    ASSERT_EQ(ResultCodeErrOpenState, cb.succeed());
+    clock.Advance(std::chrono::seconds(11));
+    ASSERT_EQ(0, cb.succeed());
+    ASSERT_EQ(STATE_CLOSED, cb.GetState());
+
+    // Reset and SetOverride revoke it
+    for (int i = 0; i < 6; i++)
+        ASSERT_EQ(0, cb.fail());
+    ASSERT_EQ(ResultCodeErrOpenState, cb.succeed());
+    ASSERT_EQ(ResultCodeErrOpenState, cb.succeed());
+    cb.Reset();
+    ASSERT_EQ(0, cb.succeed());
+
+    cb.SetOverride(OVERRIDE_FORCE_OPEN);
+    ASSERT_EQ(ResultCodeErrOpenState, cb.succeed());
+    ASSERT_EQ(ResultCodeErrOpenState, cb.succeed());
+    cb.SetOverride(OVERRIDE_DISABLED);
+    ASSERT_EQ(0, cb.succeed());
+    ASSERT_EQ(1000u + 5, cb.Metrics().rejected_open.Load());
+}
+
+TEST_F(CbTest, TestOpenLeaseMany)
+{
+    VirtualClock clock;
+    Settings settings;
+    settings.clock = &clock;
+    settings.open_lease = true;
+    // more breakers than leases, which push each other out
+    std::vector<std::unique_ptr<testCircuitBreaker>> cbs;
+    for (int i = 0; i < 100; i++)
+    {
+        cbs.emplace_back(new testCircuitBreaker(settings));
+        for (int j = 0; j < 6; j++)
+            ASSERT_EQ(0, cbs.back()->fail());
+        ASSERT_EQ(STATE_OPEN, cbs.back()->GetState());
+    }
+
+    std::thread t([&]() {
+        for (int i = 0; i < 1000; i++)
+        {
+            for (auto& cb : cbs)
+                ASSERT_EQ(ResultCodeErrOpenState, cb->succeed());
+        }
+        // a breaker destroyed under a lease is skipped
+        cbs.pop_back();
+    });
+    t.join();
+    for (auto& cb : cbs)
+        ASSERT_EQ(1000u, cb->Metrics().rejected_open.Load());
+}
+
+TEST_F(CbTest, TestLayout)
+{
+    ASSERT_EQ(size_t(CircuitBreaker::kCacheLine), alignof(CircuitBreaker));
+    ASSERT_EQ(0u, sizeof(CircuitBreaker) % CircuitBreaker::kCacheLine);
+
+    Settings settings;
+    testCircuitBreaker cb(settings);
+    cb.checkLayout();
+    std::unique_ptr<testCircuitBreaker> heap(new testCircuitBreaker(settings));
+    heap->checkLayout();
+}
+
+TEST_F(CbTest, TestPackedCounts)
+{
+    VirtualClock clock;
+    Settings settings;
+    settings.clock = &clock;
+    settings.interval = std::chrono::seconds(30);
+    settings.packed_counts = true;
+    testCircuitBreaker cb(settings);
+
+    for (int i = 0; i < 5; i++)
+        ASSERT_EQ(0, cb.fail());
+    ASSERT_EQ(0, cb.succeed());
+    ASSERT_EQ(newCounts(6, 1, 5, 1, 0), cb.counts());
+
+    // the interval clears the counts, the sixth consecutive failure trips
+    clock.Advance(std::chrono::seconds(31));
+    ASSERT_EQ(newCounts(0, 0, 0, 0, 0), cb.GetSnapshot().counts);
+    for (int i = 0; i < 6; i++)
+        ASSERT_EQ(0, cb.fail());
+    ASSERT_EQ(STATE_OPEN, cb.GetState());
+    ASSERT_EQ(ResultCodeErrOpenState, cb.succeed());
+
+    // half-open counts under the mutex
+    clock.Advance(std::chrono::seconds(61));
+    ASSERT_EQ(STATE_HALF_OPEN, cb.GetState());
+    ASSERT_EQ(0, cb.succeed());
+    ASSERT_EQ(STATE_CLOSED, cb.GetState());
+
+    // outcomes of a previous generation are ignored
+    uint64_t gen;
+    ASSERT_EQ(ResultCodeOK, cb.Allow(&gen));
+    clock.Advance(std::chrono::seconds(31));
+    cb.Done(gen, false);
+    ASSERT_EQ(newCounts(0, 0, 0, 0, 0), cb.counts());
+
+    cb.SetOverride(OVERRIDE_DISABLED);
+    for (int i = 0; i < 10; i++)
+        ASSERT_EQ(0, cb.fail());
+    ASSERT_EQ(STATE_CLOSED, cb.GetState());
+    ASSERT_EQ(newCounts(10, 0, 10, 0, 10), cb.counts());
+    cb.SetOverride(OVERRIDE_NONE);
+    ASSERT_EQ(0, cb.fail());
+    ASSERT_EQ(STATE_OPEN, cb.GetState());
+}
+
+TEST_F(CbTest, TestPackedCountsConcurrent)
+{
+    Settings settings;
+    settings.packed_counts = true;
+    settings.ready_to_trip = [](const Counts& counts) {
+        return counts.total_failures > 0 && counts.requests >= 4000;
+    };
+    testCircuitBreaker cb(settings);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++)
+    {
+        threads.emplace_back([&cb]() {
+            for (int i = 0; i < 1000; i++)
+                ASSERT_EQ(0, cb.succeed());
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+    ASSERT_EQ(newCounts(4000, 4000, 0, 4000, 0), cb.counts());
+    ASSERT_EQ(4000u, cb.Metrics().requests.Load());
+
+    // a failure decided without the mutex still trips
+    ASSERT_EQ(0, cb.fail());
+    ASSERT_EQ(STATE_OPEN, cb.GetState());
+    ASSERT_EQ(1u, cb.Metrics().transitions.Load());
+}
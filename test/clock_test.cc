@@ -0,0 +1,63 @@
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <thread>
+#include "circuit_breaker.h"
+#include "clock.h"
+
+using namespace cppbreaker;
+
+class ClockTest : public testing::Test
+{
+};
+
+static int64_t nanosSince(std::chrono::system_clock::time_point a, std::chrono::system_clock::time_point b)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(b - a).count();
+}
+
+TEST_F(ClockTest, TestTscClock)
+{
+    TscClock* clock = TscClock::Instance();
+    ASSERT_EQ(clock, TscClock::Instance());
+    if (clock->Reliable())
+    {
+        ASSERT_GT(clock->TicksPerSecond(), 1e8);
+        ASSERT_LT(clock->TicksPerSecond(), 1e10);
+    }
+
+    // it follows system_clock, within the error of the calibration
+    auto now = clock->Now();
+    ASSERT_LT(std::abs(nanosSince(now, std::chrono::system_clock::now())), 5000000);
+
+    auto prev = clock->Now();
+    for (int i = 0; i < 100000; i++)
+    {
+        auto cur = clock->Now();
+        ASSERT_LE(prev, cur);
+        prev = cur;
+    }
+
+    uint64_t start = clock->Ticks();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    uint64_t ns = clock->Nanos(clock->Ticks() - start);
+    ASSERT_GE(ns, 19000000u);
+    ASSERT_LT(ns, 500000000u);
+}
+
+TEST_F(ClockTest, TestBreakerWithTscClock)
+{
+    Settings settings;
+    settings.clock = TscClock::Instance();
+    settings.interval = std::chrono::seconds(30);
+    CircuitBreaker cb(settings);
+
+    auto ret = cb.Execute<int>([]() -> std::tuple<int, int> {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        return std::make_tuple(1, 0);
+    });
+    ASSERT_EQ(0, std::get<1>(ret));
+    ASSERT_GE(cb.Metrics().latency.SumNs(), 2000000u);
+    ASSERT_EQ(1u, cb.GetSnapshot().counts.total_successes);
+    ASSERT_LT(std::abs(nanosSince(cb.GetSnapshot().expiry - std::chrono::seconds(30), std::chrono::system_clock::now())),
+        100000000);
+}
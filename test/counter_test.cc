@@ -0,0 +1,108 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+#include "circuit_breaker.h"
+#include "counter.h"
+#include "numa.h"
+
+using namespace cppbreaker;
+
+class CounterTest : public testing::Test
+{
+};
+
+TEST_F(CounterTest, TestPerCpuCounters)
+{
+    PerCpuCounters counters;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; t++)
+    {
+        threads.emplace_back([&counters, t]() {
+            for (int i = 0; i < 100000; i++)
+            {
+                counters.Add(0, 1);
+                counters.Add(1 + t % 2, 3);
+            }
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+
+    ASSERT_EQ(800000u, counters.Load(0));
+    ASSERT_EQ(1200000u, counters.Load(1));
+    ASSERT_EQ(1200000u, counters.Load(2));
+    ASSERT_EQ(0u, counters.Load(PerCpuCounters::kFields - 1));
+}
+
+TEST_F(CounterTest, TestShortLivedThreads)
+{
+    PerCpuCounters counters;
+    for (int wave = 0; wave < 50; wave++)
+    {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 20; t++)
+        {
+            threads.emplace_back([&counters]() {
+                for (int i = 0; i < 10; i++)
+                    counters.Add(5, 1);
+            });
+        }
+        for (auto& t : threads)
+            t.join();
+    }
+    ASSERT_EQ(10000u, counters.Load(5));
+}
+
+TEST_F(CounterTest, TestBreaker)
+{
+    Settings st;
+    st.per_cpu_metrics = true;
+    CircuitBreaker cb(st);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++)
+    {
+        threads.emplace_back([&cb, t]() {
+            for (int i = 0; i < 1000; i++)
+            {
+                cb.Execute<int>([&]()-> std::tuple<int, int> {
+                    return std::make_tuple(0, i % 100 == 0 && t == 0 ? 1 : 0);
+                });
+            }
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+
+    const BreakerMetrics& m = cb.Metrics();
+    ASSERT_TRUE(m.per_cpu != nullptr);
+    ASSERT_EQ(4000u, m.requests.Load());
+    ASSERT_EQ(3990u, m.successes.Load());
+    ASSERT_EQ(10u, m.failures.Load());
+    ASSERT_EQ(0u, m.rejected_open.Load());
+}
+
+TEST_F(CounterTest, TestPerNodeCounters)
+{
+    PerNodeCounters counters;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; t++)
+    {
+        threads.emplace_back([&counters, t]() {
+            Numa::PinThread(t % Numa::Nodes());
+            for (int i = 0; i < 100000; i++)
+                counters.Add(3, 2);
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+    ASSERT_EQ(1600000u, counters.Load(3));
+    ASSERT_EQ(0u, counters.Load(0));
+
+    Settings st;
+    st.per_cpu_metrics = true;
+    st.per_node_metrics = true;
+    CircuitBreaker cb(st);
+    ASSERT_TRUE(cb.Metrics().per_cpu != nullptr);
+    ASSERT_TRUE(cb.Metrics().per_node == nullptr);
+}
@@ -0,0 +1,131 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "circuit_breaker.h"
+#include "epoch.h"
+
+using namespace cppbreaker;
+
+class EpochTest : public testing::Test
+{
+};
+
+struct Tracked
+{
+    explicit Tracked(std::atomic<int>* freed)
+        : freed(freed)
+    {
+    }
+    ~Tracked()
+    {
+        value = 0;
+        freed->fetch_add(1);
+    }
+
+    std::atomic<int>* freed;
+    int value = 42;
+};
+
+TEST_F(EpochTest, TestGuard)
+{
+    std::atomic<int> freed{0};
+    {
+        Epoch::Guard outer;
+        {
+            Epoch::Guard inner;
+            Epoch::Retire(std::unique_ptr<Tracked>(new Tracked(&freed)));
+        }
+        // the outer guard still holds it
+        Epoch::Reclaim();
+        ASSERT_EQ(0, freed.load());
+    }
+    Epoch::Reclaim();
+    ASSERT_EQ(1, freed.load());
+
+    // without a guard the next retirement frees it at once
+    Epoch::Retire(std::unique_ptr<int[]>(new int[16]));
+    Epoch::Retire(std::unique_ptr<Tracked>(new Tracked(&freed)));
+    ASSERT_EQ(2, freed.load());
+}
+
+TEST_F(EpochTest, TestOtherThread)
+{
+    std::atomic<int> freed{0};
+    std::atomic<int> step{0};
+    std::thread reader([&step]() {
+        Epoch::Guard guard;
+        step.store(1);
+        while (step.load() != 2)
+            std::this_thread::yield();
+    });
+    while (step.load() != 1)
+        std::this_thread::yield();
+
+    // objects retired while a guard of another thread is held wait for it
+    Epoch::Retire(std::unique_ptr<Tracked>(new Tracked(&freed)));
+    ASSERT_EQ(0, freed.load());
+    step.store(2);
+    reader.join();
+    Epoch::Reclaim();
+    ASSERT_EQ(1, freed.load());
+}
+
+TEST_F(EpochTest, TestConcurrent)
+{
+    std::atomic<int> freed{0};
+    std::atomic<Tracked*> current{new Tracked(&freed)};
+    std::atomic<bool> done{false};
+    std::atomic<int> bad{0};
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; t++)
+    {
+        readers.emplace_back([&]() {
+            while (!done.load(std::memory_order_relaxed))
+            {
+                Epoch::Guard guard;
+                Tracked* p = current.load(std::memory_order_acquire);
+                for (int i = 0; i < 10; i++)
+                {
+                    if (p->value != 42)
+                        bad.fetch_add(1);
+                }
+            }
+        });
+    }
+    for (int i = 0; i < 10000; i++)
+    {
+        std::unique_ptr<Tracked> prev(current.exchange(new Tracked(&freed), std::memory_order_acq_rel));
+        Epoch::Retire(std::move(prev));
+    }
+    done.store(true);
+    for (auto& t : readers)
+        t.join();
+    Epoch::Reclaim();
+    ASSERT_EQ(0, bad.load());
+    ASSERT_EQ(10000, freed.load());
+    delete current.load();
+}
+
+TEST_F(EpochTest, TestUpdateSettings)
+{
+    Settings st;
+    st.name = "epoch_cb";
+    st.top_codes = 4;
+    CircuitBreaker cb(st);
+
+    // replaced settings do not pile up, and fixed ones are kept
+    st.top_codes = 0;
+    for (int i = 0; i < 1000; i++)
+    {
+        st.max_requests = uint32_t(i + 1);
+        cb.UpdateSettings(st);
+    }
+    Epoch::Reclaim();
+    ASSERT_EQ(0u, Epoch::Pending());
+    ASSERT_EQ(1000u, cb.GetSettings().max_requests);
+    ASSERT_EQ(4u, cb.GetSettings().top_codes);
+    ASSERT_EQ("epoch_cb", cb.GetName());
+    ASSERT_EQ("epoch_cb", cb.GetSettings().name);
+}
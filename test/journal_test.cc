@@ -0,0 +1,82 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include "circuit_breaker.h"
+#include "journal.h"
+
+using namespace cppbreaker;
+
+class JournalTest : public testing::Test
+{
+};
+
+static std::string journalPath(const char* name)
+{
+    return std::string("/tmp/cppbreaker_") + name + "." + std::to_string(getpid());
+}
+
+TEST_F(JournalTest, TestTransitions)
+{
+    auto path = journalPath("journal");
+    unlink(path.c_str());
+
+    Journal journal;
+    ASSERT_TRUE(journal.Open(path, 16));
+    Journal::Install(&journal);
+    {
+        Settings st;
+        st.name = "journal_cb";
+        CircuitBreaker cb(st);
+        for (int i = 0; i < 6; i++)
+        {
+            cb.Execute<int>([]()-> std::tuple<int, int> {
+                return std::make_tuple(0, 1);
+            });
+        }
+        cb.SetOverride(OVERRIDE_DISABLED);
+    }
+    Journal::Install(nullptr);
+
+    std::vector<JournalEntry> entries;
+    ASSERT_TRUE(Journal::Read(path, &entries));
+    ASSERT_EQ(2u, entries.size());
+    ASSERT_EQ("journal_cb", entries[0].name);
+    ASSERT_EQ(STATE_CLOSED, entries[0].from);
+    ASSERT_EQ(STATE_OPEN, entries[0].to);
+    ASSERT_EQ(6u, entries[0].requests);
+    ASSERT_EQ(6u, entries[0].consecutive_failures);
+    ASSERT_EQ(STATE_OPEN, entries[1].from);
+    ASSERT_EQ(STATE_CLOSED, entries[1].to);
+    ASSERT_EQ(OVERRIDE_DISABLED, entries[1].override);
+    ASSERT_LE(entries[0].timestamp_ns, entries[1].timestamp_ns);
+    ASSERT_LT(entries[0].generation, entries[1].generation);
+
+    // reopening continues the sequence
+    journal.Close();
+    ASSERT_TRUE(journal.Open(path, 1));
+    journal.Append(1, 7, "x", STATE_CLOSED, STATE_OPEN, OVERRIDE_NONE, 1, Counts());
+    ASSERT_TRUE(Journal::Read(path, &entries));
+    ASSERT_EQ(3u, entries.size());
+    ASSERT_EQ(2u, entries[2].seq);
+    unlink(path.c_str());
+}
+
+TEST_F(JournalTest, TestRingWraps)
+{
+    auto path = journalPath("journal_ring");
+    unlink(path.c_str());
+
+    Journal journal;
+    ASSERT_TRUE(journal.Open(path, 4));
+    for (int i = 0; i < 10; i++)
+        journal.Append(i, uint32_t(i), "ring", STATE_CLOSED, STATE_OPEN, OVERRIDE_NONE, uint64_t(i), Counts());
+
+    std::vector<JournalEntry> entries;
+    ASSERT_TRUE(Journal::Read(path, &entries));
+    ASSERT_EQ(4u, entries.size());
+    for (int i = 0; i < 4; i++)
+    {
+        ASSERT_EQ(uint64_t(6 + i), entries[i].seq);
+        ASSERT_EQ(uint32_t(6 + i), entries[i].breaker_id);
+    }
+    unlink(path.c_str());
+}
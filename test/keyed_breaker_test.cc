@@ -0,0 +1,208 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "keyed_breaker.h"
+
+using namespace cppbreaker;
+
+class KeyedBreakerTest : public testing::Test
+{
+};
+
+static std::string keyOf(int i)
+{
+    return "user" + std::to_string(i);
+}
+
+TEST_F(KeyedBreakerTest, TestSketch)
+{
+    KeyedBreaker::Options options;
+    options.width = 1000;
+    options.depth = 3;
+    KeyedBreaker kb(options);
+    // widths are rounded up to a power of 2
+    ASSERT_GE(kb.Bytes(), 3u * 2 * 1024 * 4);
+
+    for (int i = 0; i < 2000; i++)
+    {
+        for (int j = 0; j <= i % 10; j++)
+            kb.Done(keyOf(i), j != 0);
+    }
+    // estimates never fall below the counts
+    for (int i = 0; i < 2000; i++)
+    {
+        uint64_t requests, failures;
+        kb.Estimate(keyOf(i), &requests, &failures);
+        ASSERT_GE(requests, uint64_t(i % 10 + 1));
+        ASSERT_GE(failures, 1u);
+    }
+    uint64_t requests, failures;
+    kb.Estimate("nobody", &requests, &failures);
+    ASSERT_LT(requests, 30u);
+    ASSERT_LT(failures, 10u);
+}
+
+TEST_F(KeyedBreakerTest, TestPoisonKey)
+{
+    VirtualClock clock;
+    KeyedBreaker::Options options;
+    options.min_failures = 10;
+    options.failure_ratio = 0.5;
+    options.timeout = std::chrono::seconds(5);
+    options.half_life = std::chrono::seconds(60);
+    options.clock = &clock;
+    KeyedBreaker kb(options);
+
+    auto ok = [&](const std::string& key) {
+        return std::get<1>(kb.Execute<int>(key, []() { return std::make_tuple(0, 0); }));
+    };
+    auto failing = [&](const std::string& key) {
+        return std::get<1>(kb.Execute<int>(key, []() { return std::make_tuple(0, 1); }));
+    };
+
+    // one poison object among many healthy keys, which fail now and then
+    int poison_calls = 0;
+    for (int i = 0; i < 10000; i++)
+    {
+        if (i % 5 == 0 && failing("poison") != ResultCodeErrOpenState)
+            poison_calls++;
+        if (i % 100 == 0)
+            failing(keyOf(i));
+        else
+            ASSERT_EQ(0, ok(keyOf(i % 1000)));
+    }
+    ASSERT_EQ(10, poison_calls);
+    auto heavy = kb.HeavyHitters();
+    ASSERT_EQ(1u, heavy.size());
+    ASSERT_EQ("poison", heavy[0].key);
+    ASSERT_EQ(STATE_OPEN, heavy[0].state);
+    ASSERT_EQ(1990u, heavy[0].rejected);
+
+    // a timeout later one probe goes through, a failing probe opens again
+    clock.Advance(std::chrono::seconds(5));
+    ASSERT_TRUE(kb.Allow("poison"));
+    ASSERT_FALSE(kb.Allow("poison"));
+    kb.Done("poison", false);
+    ASSERT_FALSE(kb.Allow("poison"));
+
+    // a successful probe closes the key, it fails again on min_failures exact failures
+    clock.Advance(std::chrono::seconds(5));
+    ASSERT_EQ(0, ok("poison"));
+    ASSERT_EQ(STATE_CLOSED, kb.HeavyHitters()[0].state);
+    for (int i = 0; i < 9; i++)
+        ASSERT_EQ(1, failing("poison"));
+    ASSERT_EQ(1, failing("poison"));
+    ASSERT_EQ(ResultCodeErrOpenState, failing("poison"));
+}
+
+TEST_F(KeyedBreakerTest, TestDecay)
+{
+    VirtualClock clock;
+    KeyedBreaker::Options options;
+    options.half_life = std::chrono::seconds(10);
+    options.clock = &clock;
+    KeyedBreaker kb(options);
+
+    for (int i = 0; i < 64; i++)
+        kb.Done("a", false);
+    uint64_t requests, failures;
+    kb.Estimate("a", &requests, &failures);
+    ASSERT_EQ(64u, requests);
+    ASSERT_EQ(64u, failures);
+
+    // counters are halved by the first outcome after half_life
+    clock.Advance(std::chrono::seconds(10));
+    kb.Done("b", true);
+    kb.Estimate("a", &requests, &failures);
+    ASSERT_EQ(32u, requests);
+    clock.Advance(std::chrono::seconds(10));
+    kb.Done("b", true);
+    kb.Estimate("a", &requests, &failures);
+    ASSERT_EQ(16u, failures);
+    ASSERT_TRUE(kb.Allow("a"));
+}
+
+TEST_F(KeyedBreakerTest, TestFixedMemory)
+{
+    KeyedBreaker::Options options;
+    options.width = 256;
+    options.heavy_hitters = 8;
+    options.min_failures = 5;
+    KeyedBreaker kb(options);
+    size_t bytes = kb.Bytes();
+
+    // many failing keys fill the map, the rest are rejected by the sketch alone
+    for (int i = 0; i < 100; i++)
+    {
+        for (int j = 0; j < 5; j++)
+            kb.Done(keyOf(i), false);
+    }
+    ASSERT_EQ(8u, kb.HeavyHitters().size());
+    ASSERT_FALSE(kb.Allow(keyOf(99)));
+    ASSERT_EQ(8u, kb.HeavyHitters().size());
+    ASSERT_EQ(bytes, kb.Bytes());
+}
+
+TEST_F(KeyedBreakerTest, TestProbeWithoutRoom)
+{
+    VirtualClock clock;
+    KeyedBreaker::Options options;
+    options.min_failures = 10;
+    options.heavy_hitters = 2;
+    options.timeout = std::chrono::seconds(5);
+    options.half_life = std::chrono::minutes(10);
+    options.clock = &clock;
+    KeyedBreaker kb(options);
+
+    // more poison keys than the map holds, the keys in it stay fresh with their failing probes
+    for (int k = 0; k < 4; k++)
+    {
+        for (int i = 0; i < 10; i++)
+            kb.Done(keyOf(k), false);
+    }
+    ASSERT_EQ(2u, kb.HeavyHitters().size());
+
+    // every key gets one probe every timeout, whether it is in the map or not
+    int probes[4] = {};
+    for (int s = 0; s <= 30; s++)
+    {
+        for (int k = 0; k < 4; k++)
+        {
+            if (kb.Allow(keyOf(k)))
+            {
+                probes[k]++;
+                kb.Done(keyOf(k), false);
+            }
+        }
+        clock.Advance(std::chrono::seconds(1));
+    }
+    for (int k = 0; k < 4; k++)
+        ASSERT_EQ(6, probes[k]) << keyOf(k);
+    ASSERT_EQ(2u, kb.HeavyHitters().size());
+}
+
+TEST_F(KeyedBreakerTest, TestConcurrent)
+{
+    KeyedBreaker::Options options;
+    options.min_failures = 1000000;
+    KeyedBreaker kb(options);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++)
+    {
+        threads.emplace_back([&kb]() {
+            for (int i = 0; i < 10000; i++)
+            {
+                ASSERT_TRUE(kb.Allow(keyOf(i % 100)));
+                kb.Done(keyOf(i % 100), i % 2 == 0);
+            }
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+    uint64_t requests, failures;
+    kb.Estimate(keyOf(7), &requests, &failures);
+    ASSERT_GE(requests, 400u);
+    ASSERT_GE(failures, 200u);
+}
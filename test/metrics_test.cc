@@ -0,0 +1,184 @@
+#include <gtest/gtest.h>
+#include "circuit_breaker.h"
+#include "registry.h"
+
+using namespace cppbreaker;
+
+class MetricsTest : public testing::Test
+{
+};
+
+static int execute(CircuitBreaker* cb, int code)
+{
+    auto ret = cb->Execute<int>([=]()-> std::tuple<int, int> {
+        return std::make_tuple(0, code);
+    });
+    return std::get<1>(ret);
+}
+
+TEST_F(MetricsTest, TestRegistry)
+{
+    auto before = Registry::Instance().Size();
+    {
+        Settings st;
+        st.name = "registry_cb";
+        CircuitBreaker cb(st);
+        ASSERT_EQ(before + 1, Registry::Instance().Size());
+
+        bool found = false;
+        Registry::Instance().ForEach([&](CircuitBreaker* c) {
+            if (c == &cb)
+                found = true;
+        });
+        ASSERT_TRUE(found);
+    }
+    ASSERT_EQ(before, Registry::Instance().Size());
+}
+
+TEST_F(MetricsTest, TestBreakerMetrics)
+{
+    Settings st;
+    st.name = "metrics_cb";
+    CircuitBreaker cb(st);
+
+    ASSERT_EQ(0, execute(&cb, 0));
+    for (int i = 0; i < 6; i++)
+        ASSERT_EQ(1, execute(&cb, 1));
+    ASSERT_EQ(STATE_OPEN, cb.GetState());
+    ASSERT_EQ(ResultCodeErrOpenState, execute(&cb, 0));
+
+    const BreakerMetrics& m = cb.Metrics();
+    ASSERT_EQ(7u, m.requests.Load());
+    ASSERT_EQ(1u, m.successes.Load());
+    ASSERT_EQ(6u, m.failures.Load());
+    ASSERT_EQ(1u, m.rejected_open.Load());
+    ASSERT_EQ(0u, m.rejected_too_many.Load());
+    ASSERT_EQ(1u, m.transitions.Load());
+    ASSERT_EQ(STATE_OPEN, m.state.load());
+
+    uint64_t observed = 0;
+    for (int i = 0; i <= LatencyHistogram::kBuckets; i++)
+        observed += m.latency.Bucket(i);
+    ASSERT_EQ(7u, observed);
+}
+
+TEST_F(MetricsTest, TestLatencyHistogram)
+{
+    LatencyHistogram h;
+    h.Observe(std::chrono::microseconds(50));
+    h.Observe(std::chrono::microseconds(100));
+    h.Observe(std::chrono::milliseconds(3));
+    h.Observe(std::chrono::seconds(20));
+    ASSERT_EQ(2u, h.Bucket(0));
+    ASSERT_EQ(1u, h.Bucket(5));
+    ASSERT_EQ(1u, h.Bucket(LatencyHistogram::kBuckets));
+    ASSERT_EQ(20003150000u, h.SumNs());
+}
+
+TEST_F(MetricsTest, TestOpenMetrics)
+{
+    Registry registry;
+    Settings st;
+    st.name = "om\"cb";
+    CircuitBreaker cb(st);
+    registry.Add(&cb);
+
+    ASSERT_EQ(0, execute(&cb, 0));
+    ASSERT_EQ(1, execute(&cb, 1));
+
+    OpenMetricsWriter writer;
+    const std::string& out = writer.Render(registry);
+
+    ASSERT_NE(std::string::npos, out.find("# TYPE cppbreaker_state stateset\n"));
+    ASSERT_NE(std::string::npos, out.find("cppbreaker_state{name=\"om\\\"cb\",cppbreaker_state=\"closed\"} 1\n"));
+    ASSERT_NE(std::string::npos, out.find("cppbreaker_state{name=\"om\\\"cb\",cppbreaker_state=\"open\"} 0\n"));
+    ASSERT_NE(std::string::npos, out.find("cppbreaker_requests_total{name=\"om\\\"cb\"} 2\n"));
+    ASSERT_NE(std::string::npos, out.find("cppbreaker_successes_total{name=\"om\\\"cb\"} 1\n"));
+    ASSERT_NE(std::string::npos, out.find("cppbreaker_failures_total{name=\"om\\\"cb\"} 1\n"));
+    ASSERT_NE(std::string::npos,
+        out.find("cppbreaker_rejections_total{name=\"om\\\"cb\",reason=\"open\"} 0\n"));
+    ASSERT_NE(std::string::npos, out.find("cppbreaker_latency_seconds_bucket{name=\"om\\\"cb\",le=\"+Inf\"} 2\n"));
+    ASSERT_NE(std::string::npos, out.find("cppbreaker_latency_seconds_count{name=\"om\\\"cb\"} 2\n"));
+    ASSERT_EQ(out.size() - 6, out.rfind("# EOF\n"));
+
+    // the buffer is reused
+    auto capacity = out.capacity();
+    const std::string& again = writer.Render(registry);
+    ASSERT_EQ(&out, &again);
+    ASSERT_EQ(capacity, again.capacity());
+}
+
+TEST_F(MetricsTest, TestOverheadHistogram)
+{
+    OverheadHistogram h;
+    h.Observe(std::chrono::nanoseconds(3));
+    h.Observe(std::chrono::nanoseconds(16));
+    h.Observe(std::chrono::nanoseconds(17));
+    h.Observe(std::chrono::nanoseconds(1000));
+    h.Observe(std::chrono::seconds(1));
+    ASSERT_EQ(2u, h.Bucket(0));
+    ASSERT_EQ(1u, h.Bucket(1));
+    ASSERT_EQ(1u, h.Bucket(6));
+    ASSERT_EQ(1u, h.Bucket(OverheadHistogram::kBuckets));
+}
+
+TEST_F(MetricsTest, TestProfile)
+{
+    Settings st;
+    st.name = "unprofiled_cb";
+    CircuitBreaker plain(st);
+    ASSERT_EQ(nullptr, plain.Metrics().profile);
+
+    st.name = "profiled_cb";
+    st.profile_every = 2;
+    st.on_state_change = [](const std::string&, State, State) {};
+    CircuitBreaker cb(st);
+    ASSERT_NE(nullptr, cb.Metrics().profile);
+
+    for (int i = 0; i < 10; i++)
+        execute(&cb, 1);
+    ASSERT_EQ(STATE_OPEN, cb.GetState());
+
+    auto count = [&](ProfileSite site) {
+        uint64_t n = 0;
+        for (int i = 0; i <= OverheadHistogram::kBuckets; i++)
+            n += cb.Metrics().profile->sites[site].Bucket(i);
+        return n;
+    };
+    // 6 admitted requests and 4 rejected ones, one in two requests is sampled:
+    // the 2nd, 4th and 6th have both of their sites timed, the 8th and 10th are rejected
+    ASSERT_EQ(5u, count(PROFILE_BEFORE_REQUEST));
+    ASSERT_EQ(3u, count(PROFILE_AFTER_REQUEST));
+    ASSERT_EQ(8u, cb.Metrics().profile->lock_samples.load());
+    ASSERT_EQ(1u, count(PROFILE_ON_STATE_CHANGE));
+    ASSERT_LE(count(PROFILE_READY_TO_TRIP), 6u);
+    ASSERT_EQ(cb.Metrics().profile->lock_contended.load(), count(PROFILE_LOCK_WAIT));
+
+    // breakers called in turn by one thread are sampled alike
+    st.name = "profiled_a";
+    st.ready_to_trip = [](const Counts&) { return false; };
+    CircuitBreaker a(st);
+    st.name = "profiled_b";
+    CircuitBreaker b(st);
+    for (int i = 0; i < 8; i++)
+    {
+        execute(&a, i % 2);
+        execute(&b, i % 2);
+    }
+    // 4 sampled requests each, locking in both halves
+    ASSERT_EQ(8u, a.Metrics().profile->lock_samples.load());
+    ASSERT_EQ(8u, b.Metrics().profile->lock_samples.load());
+
+    Registry registry;
+    registry.Add(&plain);
+    registry.Add(&cb);
+    OpenMetricsWriter writer;
+    const std::string& out = writer.Render(registry);
+    ASSERT_NE(std::string::npos, out.find(
+        "cppbreaker_overhead_seconds_bucket{name=\"profiled_cb\",site=\"before_request\",le=\"0.000000016\"}"));
+    ASSERT_NE(std::string::npos, out.find(
+        "cppbreaker_overhead_seconds_count{name=\"profiled_cb\",site=\"on_state_change\"} 1\n"));
+    ASSERT_NE(std::string::npos, out.find(
+        "cppbreaker_lock_acquisitions_total{name=\"profiled_cb\",contended=\"false\"}"));
+    ASSERT_EQ(std::string::npos, out.find("cppbreaker_overhead_seconds_count{name=\"unprofiled_cb\""));
+}
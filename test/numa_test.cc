@@ -0,0 +1,80 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include <set>
+#include <thread>
+#include "breaker_set.h"
+#include "numa.h"
+
+using namespace cppbreaker;
+
+class NumaTest : public testing::Test
+{
+};
+
+TEST_F(NumaTest, TestTopology)
+{
+    int nodes = Numa::Nodes();
+    ASSERT_GE(nodes, 1);
+    for (unsigned c = 0; c < std::thread::hardware_concurrency(); c++)
+    {
+        ASSERT_GE(Numa::NodeOfCpu(int(c)), 0);
+        ASSERT_LT(Numa::NodeOfCpu(int(c)), nodes);
+    }
+    ASSERT_EQ(0, Numa::NodeOfCpu(-1));
+    ASSERT_LT(Numa::CurrentNode(), nodes);
+
+    std::thread t([]() {
+        ASSERT_TRUE(Numa::PinThread(0));
+        ASSERT_EQ(0, Numa::CurrentNode());
+    });
+    t.join();
+    ASSERT_FALSE(Numa::PinThread(nodes + 1));
+}
+
+TEST_F(NumaTest, TestArena)
+{
+    char* mem = (char*)Numa::Allocate(1 << 20, 0);
+    ASSERT_TRUE(mem != nullptr);
+    ASSERT_EQ(0, mem[12345]);
+    mem[12345] = 1;
+    Numa::Free(mem, 1 << 20);
+
+    // lines are distinct, aligned and zeroed when reused
+    std::set<void*> lines;
+    for (int i = 0; i < 10000; i++)
+    {
+        void* line = NodeArena::AllocateLine(0);
+        ASSERT_TRUE(line != nullptr);
+        ASSERT_EQ(0u, uintptr_t(line) % NodeArena::kLine);
+        ASSERT_TRUE(lines.insert(line).second);
+    }
+    void* line = *lines.begin();
+    memset(line, 0xff, NodeArena::kLine);
+    NodeArena::FreeLine(0, line);
+    ASSERT_EQ(line, NodeArena::AllocateLine(0));
+    for (size_t i = 0; i < NodeArena::kLine; i++)
+        ASSERT_EQ(0, ((char*)line)[i]);
+    for (auto l : lines)
+        NodeArena::FreeLine(0, l);
+}
+
+TEST_F(NumaTest, TestBreakerSetOnNode)
+{
+    BreakerSet set;
+    set.SetNode(Numa::Nodes() - 1);
+    Settings st;
+    st.per_node_metrics = true;
+    ASSERT_TRUE(set.DefineClass("local", st));
+    std::string conf = "local a\nlocal b\n";
+    std::string err;
+    ASSERT_TRUE(set.Parse(conf.data(), conf.size(), &err)) << err;
+
+    CircuitBreaker* cb = set.Find("b");
+    ASSERT_TRUE(cb != nullptr);
+    ASSERT_TRUE(cb->Metrics().per_node != nullptr);
+    uint64_t gen;
+    ASSERT_EQ(ResultCodeOK, cb->Allow(&gen));
+    cb->Done(gen, true);
+    ASSERT_EQ(1u, cb->Metrics().requests.Load());
+    ASSERT_EQ(1u, cb->Metrics().successes.Load());
+}
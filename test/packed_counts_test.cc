@@ -0,0 +1,114 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "circuit_breaker.h"
+#include "packed_counts.h"
+
+using namespace cppbreaker;
+
+class PackedCountsTest : public testing::Test
+{
+};
+
+TEST_F(PackedCountsTest, TestCounts)
+{
+    PackedCounts packed;
+    packed.Reset(7);
+    Counts counts;
+    packed.Load(&counts);
+    ASSERT_EQ(Counts(), counts);
+
+    ASSERT_TRUE(packed.OnRequest(7));
+    ASSERT_TRUE(packed.OnRequest(7));
+    ASSERT_TRUE(packed.OnRequest(7));
+    ASSERT_TRUE(packed.OnSuccess(7, nullptr));
+    Counts after;
+    ASSERT_TRUE(packed.OnFailure(7, &after));
+    ASSERT_EQ(3u, after.requests);
+    ASSERT_EQ(1u, after.total_successes);
+    ASSERT_EQ(1u, after.total_failures);
+    ASSERT_EQ(0u, after.consecutive_successes);
+    ASSERT_EQ(1u, after.consecutive_failures);
+    ASSERT_TRUE(packed.OnFailure(7, &after));
+    ASSERT_EQ(2u, after.consecutive_failures);
+    ASSERT_TRUE(packed.OnSuccess(7, &after));
+    ASSERT_EQ(1u, after.consecutive_successes);
+    ASSERT_EQ(0u, after.consecutive_failures);
+    packed.Load(&counts);
+    ASSERT_EQ(after, counts);
+
+    // updates for another generation are refused
+    ASSERT_FALSE(packed.OnRequest(6));
+    ASSERT_FALSE(packed.OnFailure(8, &after));
+    packed.Reset(8);
+    ASSERT_FALSE(packed.OnSuccess(7, nullptr));
+    packed.Load(&counts);
+    ASSERT_EQ(Counts(), counts);
+}
+
+TEST_F(PackedCountsTest, TestSaturation)
+{
+    PackedCounts packed;
+    packed.Reset(1);
+    Counts after;
+    for (uint64_t i = 0; i < PackedCounts::kMaxConsecutive + 10; i++)
+    {
+        ASSERT_TRUE(packed.OnRequest(1));
+        ASSERT_TRUE(packed.OnFailure(1, &after));
+    }
+    ASSERT_EQ(uint64_t(PackedCounts::kMaxConsecutive), after.consecutive_failures);
+    ASSERT_EQ(uint64_t(PackedCounts::kMaxConsecutive) + 10, after.total_failures);
+    ASSERT_EQ(after.total_failures, after.requests);
+}
+
+TEST_F(PackedCountsTest, TestConcurrent)
+{
+    PackedCounts packed;
+    packed.Reset(3);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; t++)
+    {
+        threads.emplace_back([&packed, t]() {
+            Counts after;
+            for (int i = 0; i < 50000; i++)
+            {
+                ASSERT_TRUE(packed.OnRequest(3));
+                if ((i + t) % 3 == 0)
+                    ASSERT_TRUE(packed.OnFailure(3, &after));
+                else
+                    ASSERT_TRUE(packed.OnSuccess(3, &after));
+                // every view is one the counts went through
+                ASSERT_GE(after.requests, after.total_successes + after.total_failures);
+                ASSERT_LE(after.consecutive_failures, after.total_failures);
+                ASSERT_LE(after.consecutive_successes, after.total_successes);
+                ASSERT_TRUE(after.consecutive_failures == 0 || after.consecutive_successes == 0);
+            }
+        });
+    }
+    // an observer reads the outcomes without swapping them, as they were at some point
+    std::atomic<bool> stop(false);
+    std::thread observer([&packed, &stop]() {
+        Counts seen;
+        while (!stop.load())
+        {
+            packed.Read(&seen);
+            ASSERT_LE(seen.consecutive_failures, seen.total_failures);
+            ASSERT_LE(seen.consecutive_successes, seen.total_successes);
+            ASSERT_TRUE(seen.consecutive_failures == 0 || seen.consecutive_successes == 0);
+        }
+    });
+    for (auto& t : threads)
+        t.join();
+    stop = true;
+    observer.join();
+
+    Counts counts;
+    packed.Load(&counts);
+    Counts read;
+    packed.Read(&read);
+    ASSERT_EQ(counts, read);
+    ASSERT_EQ(400000u, counts.requests);
+    ASSERT_EQ(400000u, counts.total_successes + counts.total_failures);
+    ASSERT_EQ(133333u, counts.total_failures);
+}
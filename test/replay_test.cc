@@ -0,0 +1,121 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <vector>
+#include "circuit_breaker.h"
+#include "outcome_trace.h"
+#include "replay.h"
+
+using namespace cppbreaker;
+
+class ReplayTest : public testing::Test
+{
+};
+
+static std::string tracePath(const char* name)
+{
+    return std::string("/tmp/cppbreaker_") + name + "." + std::to_string(getpid());
+}
+
+TEST_F(ReplayTest, TestRecordFromExecute)
+{
+    auto path = tracePath("outcomes");
+    OutcomeTraceWriter writer;
+    ASSERT_TRUE(writer.Open(path, 4));
+    OutcomeTraceWriter::Install(&writer);
+    {
+        Settings st;
+        CircuitBreaker cb(st);
+        cb.Execute<int>([]()-> std::tuple<int, int> {
+            return std::make_tuple(0, 0);
+        });
+        cb.Execute<int>([]()-> std::tuple<int, int> {
+            return std::make_tuple(0, 3);
+        });
+    }
+    OutcomeTraceWriter::Install(nullptr);
+    // records past the capacity are dropped
+    for (int i = 0; i < 4; i++)
+        writer.Append(i, 9, true, 0);
+    ASSERT_EQ(4u, writer.Count());
+
+    OutcomeTraceReader reader;
+    ASSERT_TRUE(reader.Open(path));
+    ASSERT_EQ(4u, reader.Size());
+    ASSERT_FALSE(reader.Records()[0].Failed());
+    ASSERT_TRUE(reader.Records()[1].Failed());
+    ASSERT_EQ(reader.Records()[0].breaker_id, reader.Records()[1].breaker_id);
+    ASSERT_LE(reader.Records()[0].timestamp_ns, reader.Records()[1].timestamp_ns);
+    unlink(path.c_str());
+}
+
+TEST_F(ReplayTest, TestReplay)
+{
+    auto path = tracePath("replay");
+    OutcomeTraceWriter writer;
+    ASSERT_TRUE(writer.Open(path, 1 << 20));
+
+    // 100 requests per second to breaker 0 for 5 minutes, failing from minute 2 to 3,
+    // and a healthy breaker 1 with an isolated burst of failures
+    const int64_t second = 1000000000;
+    int64_t base = 1700000000 * second;
+    for (int64_t t = 0; t < 300 * second; t += second / 100)
+    {
+        bool down = t >= 120 * second && t < 180 * second;
+        writer.Append(base + t, 0, !down, 2000);
+        bool burst = t >= 30 * second && t < 30 * second + second / 10;
+        writer.Append(base + t, 1, !burst, 2000);
+    }
+
+    OutcomeTraceReader reader;
+    ASSERT_TRUE(reader.Open(path));
+    ASSERT_TRUE(SortedByTime(reader.Records(), reader.Size()));
+
+    Settings st;
+    st.timeout = std::chrono::seconds(5);
+    ReplayOptions options;
+    auto r = Replay(reader.Records(), reader.Size(), "default", st, options);
+    ASSERT_EQ("default", r.label);
+    ASSERT_EQ(60000u, r.requests);
+    ASSERT_EQ(1u, r.incidents);
+    ASSERT_EQ(1u, r.detected);
+    ASSERT_LT(r.max_time_to_trip, std::chrono::milliseconds(100));
+    ASSERT_EQ(1u, r.recovered);
+    ASSERT_LE(r.max_recovery_time, std::chrono::seconds(5));
+    // the burst on breaker 1 trips the consecutive failures rule
+    ASSERT_EQ(1u, r.false_trips);
+    ASSERT_GT(r.rejected_good, 0u);
+    ASSERT_GT(r.rejected_bad, 5000u);
+
+    // a ratio rule over a 10s interval ignores the burst
+    st.interval = std::chrono::seconds(10);
+    st.ready_to_trip = [](const Counts& counts) {
+        return counts.requests >= 100 && counts.total_failures * 2 >= counts.requests;
+    };
+    r = Replay(reader.Records(), reader.Size(), "ratio", st, options);
+    ASSERT_EQ(0u, r.false_trips);
+    ASSERT_EQ(1u, r.detected);
+    ASSERT_GT(r.max_time_to_trip, std::chrono::milliseconds(100));
+    unlink(path.c_str());
+}
+
+TEST_F(ReplayTest, TestSparseIds)
+{
+    // breaker ids as large as a corrupt trace may hold cost one breaker each
+    const int64_t second = 1000000000;
+    std::vector<OutcomeRecord> records;
+    for (int64_t t = 0; t < 20 * second; t += second / 100)
+    {
+        bool down = t >= 10 * second;
+        records.push_back(OutcomeRecord{ t, 0xfffffff0u, down ? 0x80000000u : 0u });
+        records.push_back(OutcomeRecord{ t, 7u, 0u });
+    }
+
+    Settings st;
+    ReplayOptions options;
+    auto r = Replay(records.data(), records.size(), "sparse", st, options);
+    ASSERT_EQ(4000u, r.requests);
+    ASSERT_EQ(1u, r.incidents);
+    ASSERT_EQ(1u, r.trips);
+    ASSERT_EQ(0u, r.false_trips);
+    ASSERT_EQ(0u, r.rejected_good);
+}
@@ -0,0 +1,80 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include "circuit_breaker.h"
+#include "registry.h"
+#include "shm_segment.h"
+
+using namespace cppbreaker;
+
+class ShmSegmentTest : public testing::Test
+{
+};
+
+TEST_F(ShmSegmentTest, TestPublishAndRead)
+{
+    Registry registry;
+    Settings st;
+    st.name = "shm_cb";
+    CircuitBreaker cb(st);
+    registry.Add(&cb);
+    for (int i = 0; i < 6; i++)
+    {
+        cb.Execute<int>([]()-> std::tuple<int, int> {
+            return std::make_tuple(0, 1);
+        });
+    }
+    ASSERT_EQ(STATE_OPEN, cb.GetState());
+
+    std::string name = "/cppbreaker_test." + std::to_string(getpid());
+    ShmPublisher publisher;
+    ASSERT_TRUE(publisher.Open(4, name));
+    publisher.Publish(registry);
+
+    ShmReader reader;
+    ASSERT_TRUE(reader.Attach(name));
+    ASSERT_EQ(kShmVersion, reader.Header()->version);
+    ASSERT_EQ(uint32_t(getpid()), reader.Header()->pid);
+
+    std::vector<ShmRecord> records;
+    reader.Read(&records);
+    ASSERT_EQ(1u, records.size());
+    ASSERT_EQ("shm_cb", records[0].name);
+    ASSERT_EQ(STATE_OPEN, records[0].state);
+    ASSERT_EQ(6u, records[0].requests);
+    ASSERT_EQ(6u, records[0].failures);
+    ASSERT_EQ(1u, records[0].transitions);
+
+    cb.Execute<int>([]()-> std::tuple<int, int> {
+        return std::make_tuple(0, 0);
+    });
+    publisher.Publish(registry);
+    reader.Read(&records);
+    ASSERT_EQ(1u, records[0].rejected_open);
+
+    reader.Detach();
+    publisher.Close();
+    ASSERT_FALSE(reader.Attach(name));
+}
+
+TEST_F(ShmSegmentTest, TestCapacity)
+{
+    Registry registry;
+    Settings st;
+    CircuitBreaker cb1(st), cb2(st), cb3(st);
+    registry.Add(&cb1);
+    registry.Add(&cb2);
+    registry.Add(&cb3);
+
+    std::string name = "/cppbreaker_test_cap." + std::to_string(getpid());
+    ShmPublisher publisher;
+    ASSERT_TRUE(publisher.Open(2, name));
+    ASSERT_TRUE(publisher.Start(std::chrono::milliseconds(1)));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    publisher.Stop();
+
+    ShmReader reader;
+    ASSERT_TRUE(reader.Attach(name));
+    std::vector<ShmRecord> records;
+    reader.Read(&records);
+    ASSERT_EQ(2u, records.size());
+}
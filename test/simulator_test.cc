@@ -0,0 +1,151 @@
+#include <gtest/gtest.h>
+#include <memory>
+#include "circuit_breaker.h"
+#include "clock.h"
+#include "simulator.h"
+
+using namespace cppbreaker;
+
+class SimulatorTest : public testing::Test
+{
+};
+
+static std::vector<SimPhase> outage()
+{
+    std::vector<SimPhase> phases(3);
+    phases[0].name = "healthy";
+    phases[0].duration = std::chrono::minutes(10);
+    phases[0].error_rate = 0.001;
+    phases[1].name = "down";
+    phases[1].duration = std::chrono::hours(1);
+    phases[1].error_rate = 1;
+    phases[1].latency = std::chrono::milliseconds(20);
+    phases[2].name = "recovered";
+    phases[2].duration = std::chrono::minutes(10);
+    phases[2].error_rate = 0.001;
+    return phases;
+}
+
+static Settings outageSettings(Clock* clock)
+{
+    Settings st;
+    st.name = "sim_cb";
+    st.timeout = std::chrono::seconds(30);
+    st.interval = std::chrono::seconds(10);
+    st.clock = clock;
+    return st;
+}
+
+TEST_F(SimulatorTest, TestVirtualClock)
+{
+    VirtualClock clock;
+    Settings st;
+    st.clock = &clock;
+    st.timeout = std::chrono::seconds(60);
+    CircuitBreaker cb(st);
+
+    uint64_t generation = 0;
+    for (int i = 0; i < 6; i++)
+    {
+        ASSERT_EQ(ResultCodeOK, cb.Allow(&generation));
+        cb.Done(generation, false);
+    }
+    ASSERT_EQ(STATE_OPEN, cb.GetState());
+    ASSERT_EQ(clock.Now() + std::chrono::seconds(60), cb.GetSnapshot().expiry);
+
+    clock.Advance(std::chrono::seconds(59));
+    ASSERT_EQ(ResultCodeErrOpenState, cb.Allow(&generation));
+    clock.Advance(std::chrono::seconds(2));
+    ASSERT_EQ(STATE_HALF_OPEN, cb.GetState());
+
+    ASSERT_EQ(ResultCodeOK, cb.Allow(&generation));
+    ASSERT_EQ(int(ResultCodeErrTooManyRequests), cb.Allow(&generation));
+    cb.Done(generation, true, std::chrono::milliseconds(3));
+    ASSERT_EQ(STATE_CLOSED, cb.GetState());
+}
+
+TEST_F(SimulatorTest, TestHourLongOutage)
+{
+    Simulator sim(42);
+    CircuitBreaker cb(outageSettings(sim.GetClock()));
+    int group = sim.AddClients(&cb, outage(), 100, std::chrono::seconds(1));
+    sim.Run(std::chrono::minutes(80));
+
+    const auto& stats = sim.Stats(group);
+    ASSERT_EQ(3u, stats.size());
+    // healthy: nothing rejected
+    ASSERT_EQ(0u, stats[0].rejected);
+    ASSERT_GT(stats[0].successes, 50000u);
+    // down: the breaker trips quickly and only lets probes through
+    ASSERT_GT(stats[1].rejected, stats[1].admitted * 100);
+    ASSERT_EQ(stats[1].admitted, stats[1].failures);
+    // recovered: probes succeed and the breaker closes
+    ASSERT_GT(stats[2].successes, 50000u);
+    ASSERT_EQ(STATE_CLOSED, cb.GetState());
+
+    const auto& transitions = sim.Transitions();
+    ASSERT_GE(transitions.size(), 3u);
+    ASSERT_EQ(STATE_OPEN, transitions.front().to);
+    ASSERT_GE(transitions.front().at, std::chrono::minutes(10));
+    ASSERT_LT(transitions.front().at, std::chrono::minutes(10) + std::chrono::seconds(1));
+    ASSERT_EQ(STATE_CLOSED, transitions.back().to);
+    ASSERT_GE(transitions.back().at, std::chrono::minutes(70));
+    ASSERT_LE(transitions.back().at, std::chrono::minutes(70) + std::chrono::seconds(31));
+}
+
+TEST_F(SimulatorTest, TestReproducible)
+{
+    auto run = [](uint64_t seed, std::vector<SimPhaseStats>* stats, std::vector<SimTransition>* transitions) {
+        Simulator sim(seed);
+        CircuitBreaker cb(outageSettings(sim.GetClock()));
+        int group = sim.AddClients(&cb, outage(), 20, std::chrono::seconds(1));
+        sim.Run(std::chrono::minutes(80));
+        *stats = sim.Stats(group);
+        *transitions = sim.Transitions();
+    };
+
+    std::vector<SimPhaseStats> s1, s2, s3;
+    std::vector<SimTransition> t1, t2, t3;
+    run(7, &s1, &t1);
+    run(7, &s2, &t2);
+    run(8, &s3, &t3);
+
+    ASSERT_EQ(t1.size(), t2.size());
+    for (size_t i = 0; i < t1.size(); i++)
+    {
+        ASSERT_EQ(t1[i].at, t2[i].at);
+        ASSERT_EQ(t1[i].to, t2[i].to);
+    }
+    bool same_as_other_seed = s1[0].successes == s3[0].successes && s1[0].failures == s3[0].failures;
+    for (size_t i = 0; i < s1.size(); i++)
+    {
+        ASSERT_EQ(s1[i].requests, s2[i].requests);
+        ASSERT_EQ(s1[i].rejected, s2[i].rejected);
+        ASSERT_EQ(s1[i].successes, s2[i].successes);
+        ASSERT_EQ(s1[i].failures, s2[i].failures);
+    }
+    ASSERT_FALSE(same_as_other_seed && t1.size() == t3.size() && t1.back().at == t3.back().at);
+}
+
+TEST_F(SimulatorTest, TestSettingsUntouched)
+{
+    int changes = 0;
+    std::unique_ptr<Simulator> sim(new Simulator(1));
+    Settings st = outageSettings(sim->GetClock());
+    st.on_state_change = [&changes](const std::string&, State, State) { changes++; };
+    CircuitBreaker cb(st);
+    sim->AddClients(&cb, outage(), 10, std::chrono::seconds(1));
+    sim->AddClients(&cb, outage(), 10, std::chrono::seconds(1));
+    sim->Run(std::chrono::minutes(80));
+
+    // each transition is recorded once, by the group whose call made it
+    ASSERT_GE(changes, 3);
+    ASSERT_EQ(size_t(changes), sim->Transitions().size());
+    ASSERT_EQ(STATE_CLOSED, sim->Transitions().back().to);
+
+    // the breaker outlives the simulator with the callback it was set up with
+    sim.reset();
+    int seen = changes;
+    cb.GetSettings().on_state_change("sim_cb", STATE_CLOSED, STATE_OPEN);
+    ASSERT_EQ(seen + 1, changes);
+}
@@ -0,0 +1,140 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "circuit_breaker.h"
+#include "testbed.h"
+
+using namespace cppbreaker;
+
+class TestbedTest : public testing::Test
+{
+protected:
+    void SetUp()
+    {
+        path_ = "/tmp/cppbreaker_testbed_test." + std::to_string(getpid()) + ".sock";
+        ASSERT_TRUE(server_.Start(path_));
+    }
+
+    std::string path_;
+    FaultServer server_;
+};
+
+TEST_F(TestbedTest, TestParseFaults)
+{
+    Faults f;
+    ASSERT_TRUE(ParseFaults("error_rate=0.5 latency_us=200 jitter_us=50 hang_rate=0.1", &f));
+    ASSERT_EQ(0.5, f.error_rate);
+    ASSERT_EQ(200, f.latency.count());
+    ASSERT_EQ(50, f.jitter.count());
+    ASSERT_EQ(0.1, f.hang_rate);
+    ASSERT_EQ(0, f.reset_rate);
+
+    ASSERT_FALSE(ParseFaults("error_rate", &f));
+    ASSERT_FALSE(ParseFaults("bogus=1", &f));
+    ASSERT_FALSE(ParseFaults("reset_rate=x", &f));
+    // a bad spec leaves faults untouched
+    ASSERT_FALSE(ParseFaults("reset_rate=1 bogus=1", &f));
+    ASSERT_EQ(0, f.reset_rate);
+}
+
+TEST_F(TestbedTest, TestHealthy)
+{
+    server_.SetFaults(Faults());
+    Settings st;
+    CircuitBreaker cb(st);
+    TestbedClient client(&cb, path_, 4, std::chrono::milliseconds(500));
+
+    auto stats = client.Run(std::chrono::milliseconds(100));
+    ASSERT_GT(stats.successes, 0u);
+    ASSERT_EQ(stats.calls, stats.successes);
+    ASSERT_EQ(0u, stats.failures + stats.timeouts + stats.resets + stats.rejected);
+    ASSERT_EQ(stats.calls, stats.overhead_ns.size());
+    ASSERT_EQ(stats.successes, stats.latency_ns.size());
+    ASSERT_EQ(4, stats.max_connections);
+    ASSERT_EQ(4, client.OpenConnections());
+    ASSERT_EQ(stats.calls, server_.Calls());
+    ASSERT_EQ(STATE_CLOSED, cb.GetState());
+}
+
+TEST_F(TestbedTest, TestErrorsTrip)
+{
+    Faults f;
+    f.error_rate = 1;
+    server_.SetFaults(f);
+    Settings st;
+    CircuitBreaker cb(st);
+    TestbedClient client(&cb, path_, 2, std::chrono::milliseconds(500));
+
+    auto stats = client.Run(std::chrono::milliseconds(50));
+    ASSERT_EQ(0u, stats.successes);
+    // the default Settings trip after more than 5 consecutive failures
+    ASSERT_GE(stats.failures, 6u);
+    ASSERT_GT(stats.rejected, 0u);
+    ASSERT_EQ(STATE_OPEN, cb.GetState());
+}
+
+TEST_F(TestbedTest, TestResetsAndHangs)
+{
+    Faults f;
+    f.reset_rate = 1;
+    server_.SetFaults(f);
+    Settings st;
+    st.ready_to_trip = [](const Counts&) { return false; };
+    CircuitBreaker cb(st);
+    TestbedClient client(&cb, path_, 2, std::chrono::milliseconds(20));
+
+    auto stats = client.Run(std::chrono::milliseconds(30));
+    ASSERT_GT(stats.resets, 0u);
+    ASSERT_EQ(stats.calls, stats.resets);
+    ASSERT_EQ(stats.resets, server_.Resets());
+
+    f.reset_rate = 0;
+    f.hang_rate = 1;
+    server_.SetFaults(f);
+    stats = client.Run(std::chrono::milliseconds(30));
+    ASSERT_GT(stats.timeouts, 0u);
+    ASSERT_EQ(stats.calls, stats.timeouts);
+    ASSERT_EQ(0, client.OpenConnections());
+    ASSERT_EQ(stats.timeouts, cb.GetSnapshot().counts.total_failures - server_.Resets());
+}
+
+TEST_F(TestbedTest, TestLatency)
+{
+    Faults f;
+    f.latency = std::chrono::milliseconds(5);
+    server_.SetFaults(f);
+    Settings st;
+    CircuitBreaker cb(st);
+    TestbedClient client(&cb, path_, 1, std::chrono::milliseconds(500));
+
+    auto stats = client.Run(std::chrono::milliseconds(20));
+    ASSERT_GT(stats.successes, 0u);
+    for (auto ns : stats.latency_ns)
+        ASSERT_GE(ns, 5000000);
+}
+
+TEST_F(TestbedTest, TestControl)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path_.c_str(), sizeof(addr.sun_path) - 1);
+    ASSERT_EQ(0, connect(fd, (sockaddr*)&addr, sizeof(addr)));
+
+    std::string cmd = "faults error_rate=1 latency_us=10\n";
+    ASSERT_EQ(ssize_t(cmd.size()), write(fd, cmd.data(), cmd.size()));
+    char buf[16];
+    ASSERT_EQ(3, read(fd, buf, sizeof(buf)));
+    ASSERT_EQ(0, memcmp(buf, "ok\n", 3));
+    ASSERT_EQ(1, server_.GetFaults().error_rate);
+    ASSERT_EQ(10, server_.GetFaults().latency.count());
+
+    cmd = "call\n";
+    ASSERT_EQ(ssize_t(cmd.size()), write(fd, cmd.data(), cmd.size()));
+    ASSERT_EQ(4, read(fd, buf, sizeof(buf)));
+    ASSERT_EQ(0, memcmp(buf, "err\n", 4));
+    close(fd);
+}
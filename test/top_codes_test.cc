@@ -0,0 +1,121 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+#include "circuit_breaker.h"
+#include "top_codes.h"
+
+using namespace cppbreaker;
+
+class TopCodesTest : public testing::Test
+{
+};
+
+static int run(CircuitBreaker* cb, int code)
+{
+    return std::get<1>(cb->Execute<int>([code]() -> std::tuple<int, int> { return std::make_tuple(0, code); }));
+}
+
+TEST_F(TopCodesTest, TestSpaceSaving)
+{
+    TopCodes top(4);
+    ASSERT_TRUE(top.Top().empty());
+
+    // code 14 is 90% of the failures, a long tail of other codes shares the rest
+    for (int i = 0; i < 1000; i++)
+        top.Add(i % 10 == 0 ? 100 + i : 14);
+    ASSERT_EQ(1000u, top.Total());
+    auto codes = top.Top();
+    ASSERT_EQ(4u, codes.size());
+    ASSERT_EQ(14, codes[0].code);
+    ASSERT_EQ(900u, codes[0].count);
+    ASSERT_EQ(0u, codes[0].error);
+    // tail codes took over each other's slots, their counts bound the error
+    for (size_t i = 1; i < codes.size(); i++)
+    {
+        ASSERT_LE(codes[i].count, codes[i - 1].count);
+        ASSERT_LE(codes[i].count - codes[i].error, 1u);
+    }
+
+    top.Clear();
+    ASSERT_EQ(0u, top.Total());
+    ASSERT_TRUE(top.Top().empty());
+
+    // slots are capped
+    TopCodes wide(100);
+    for (int i = 1; i <= 100; i++)
+        wide.Add(i);
+    ASSERT_EQ(size_t(TopCodes::kMaxSlots), wide.Top().size());
+}
+
+TEST_F(TopCodesTest, TestConcurrent)
+{
+    TopCodes top(8);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++)
+    {
+        threads.emplace_back([&top, t]() {
+            for (int i = 0; i < 10000; i++)
+                top.Add(i % 2 == 0 ? 7 : 10 + t);
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+    auto codes = top.Top();
+    ASSERT_EQ(40000u, top.Total());
+    ASSERT_EQ(5u, codes.size());
+    ASSERT_EQ(7, codes[0].code);
+    ASSERT_EQ(20000u, codes[0].count);
+}
+
+TEST_F(TopCodesTest, TestBreaker)
+{
+    for (bool packed : {false, true})
+    {
+        std::vector<StateChangeEvent> events;
+        Settings settings;
+        settings.top_codes = 3;
+        settings.packed_counts = packed;
+        settings.on_state_change_event = [&](const StateChangeEvent& event) {
+            events.push_back(event);
+        };
+        CircuitBreaker cb(settings);
+
+        ASSERT_EQ(0, run(&cb, 0));
+        ASSERT_EQ(14, run(&cb, 14));
+        ASSERT_EQ(0, run(&cb, 0));
+        uint64_t gen;
+        ASSERT_EQ(0, cb.Allow(&gen));
+        cb.Done(gen, false, std::chrono::nanoseconds(0), 5);
+        ASSERT_EQ(0, cb.Allow(&gen));
+        // a failure without a code is not counted
+        cb.Done(gen, false);
+        ASSERT_EQ(0, run(&cb, 0));
+        Snapshot snap = cb.GetSnapshot();
+        ASSERT_EQ(2u, snap.top_codes.size());
+        ASSERT_EQ(2u, snap.window_codes.size());
+
+        // six failures in a row trip, the event tells which codes did it
+        for (int i = 0; i < 6; i++)
+            ASSERT_EQ(14, run(&cb, 14));
+        ASSERT_EQ(STATE_OPEN, cb.GetState());
+        ASSERT_EQ(1u, events.size());
+        ASSERT_EQ(STATE_CLOSED, events[0].from);
+        ASSERT_EQ(STATE_OPEN, events[0].to);
+        ASSERT_EQ(2u, events[0].codes.size());
+        ASSERT_EQ(14, events[0].codes[0].code);
+        ASSERT_EQ(7u, events[0].codes[0].count);
+        ASSERT_EQ(5, events[0].codes[1].code);
+        ASSERT_EQ(9u, events[0].counts.total_failures);
+
+        // the window starts over with the open state, the totals do not
+        snap = cb.GetSnapshot();
+        ASSERT_TRUE(snap.window_codes.empty());
+        ASSERT_EQ(14, snap.top_codes[0].code);
+        ASSERT_EQ(7u, snap.top_codes[0].count);
+    }
+
+    // without top_codes snapshots have none
+    CircuitBreaker plain(Settings{});
+    run(&plain, 14);
+    ASSERT_TRUE(plain.GetSnapshot().top_codes.empty());
+}
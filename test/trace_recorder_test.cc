@@ -0,0 +1,114 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include "circuit_breaker.h"
+#include "registry.h"
+#include "trace_recorder.h"
+
+using namespace cppbreaker;
+
+class TraceRecorderTest : public testing::Test
+{
+};
+
+static size_t countOf(const std::string& s, const std::string& sub)
+{
+    size_t n = 0;
+    for (size_t pos = s.find(sub); pos != std::string::npos; pos = s.find(sub, pos + 1))
+        n++;
+    return n;
+}
+
+TEST_F(TraceRecorderTest, TestExport)
+{
+    Registry registry;
+    Settings st;
+    st.name = "trace_cb";
+    CircuitBreaker cb(st);
+    registry.Add(&cb);
+
+    TraceRecorder::Clear();
+    TraceRecorder::Enable(1);
+    // recorded from another thread, which exits before the export
+    std::thread([&]() {
+        for (int i = 0; i < 6; i++)
+        {
+            cb.Execute<int>([]()-> std::tuple<int, int> {
+                return std::make_tuple(0, 1);
+            });
+        }
+    }).join();
+    cb.Execute<int>([]()-> std::tuple<int, int> {
+        return std::make_tuple(0, 0);
+    });
+    cb.SetOverride(OVERRIDE_DISABLED);
+    TraceRecorder::Disable();
+
+    // nothing is recorded while disabled
+    cb.Execute<int>([]()-> std::tuple<int, int> {
+        return std::make_tuple(0, 0);
+    });
+
+    auto json = TraceRecorder::Export(registry);
+    ASSERT_EQ(0u, json.find("{\"displayTimeUnit\":\"ms\",\"traceEvents\":["));
+    ASSERT_NE(std::string::npos, json.find("\"args\":{\"name\":\"trace_cb\"}"));
+    ASSERT_EQ(6u, countOf(json, "\"name\":\"admit\""));
+    ASSERT_EQ(1u, countOf(json, "\"name\":\"reject\""));
+    ASSERT_EQ(1u, countOf(json, "\"name\":\"closed -> open\""));
+    ASSERT_EQ(1u, countOf(json, "\"name\":\"open -> closed\""));
+    // one span per state reached
+    ASSERT_EQ(2u, countOf(json, "\"cat\":\"state\""));
+
+    TraceRecorder::Clear();
+    json = TraceRecorder::Export(registry);
+    ASSERT_EQ(0u, countOf(json, "\"cat\":\"admission\""));
+}
+
+TEST_F(TraceRecorderTest, TestSampling)
+{
+    Registry registry;
+    Settings st;
+    CircuitBreaker cb(st);
+    registry.Add(&cb);
+
+    TraceRecorder::Clear();
+    TraceRecorder::Enable(10);
+    std::thread([&]() {
+        for (int i = 0; i < 100; i++)
+        {
+            cb.Execute<int>([]()-> std::tuple<int, int> {
+                return std::make_tuple(0, 0);
+            });
+        }
+    }).join();
+    TraceRecorder::Disable();
+
+    ASSERT_EQ(10u, countOf(TraceRecorder::Export(registry), "\"name\":\"admit\""));
+    TraceRecorder::Clear();
+}
+
+TEST_F(TraceRecorderTest, TestShortLivedThreads)
+{
+    Registry registry;
+    Settings st;
+    CircuitBreaker cb(st);
+    registry.Add(&cb);
+
+    TraceRecorder::Clear();
+    size_t rings = TraceRecorder::Rings();
+    TraceRecorder::Enable(1);
+    // a thread takes over the ring of the one before it, events are kept
+    for (int i = 0; i < 50; i++)
+    {
+        std::thread([&]() {
+            cb.Execute<int>([]()-> std::tuple<int, int> {
+                return std::make_tuple(0, 0);
+            });
+        }).join();
+    }
+    TraceRecorder::Disable();
+
+    ASSERT_LE(TraceRecorder::Rings(), rings + 1);
+    ASSERT_EQ(50u, countOf(TraceRecorder::Export(registry), "\"name\":\"admit\""));
+    TraceRecorder::Clear();
+    ASSERT_LE(TraceRecorder::Rings(), rings);
+}
@@ -0,0 +1,149 @@
+#include <gtest/gtest.h>
+#include "circuit_breaker.h"
+#include "trip_expression.h"
+
+using namespace cppbreaker;
+
+class TripExpressionTest : public testing::Test
+{
+};
+
+static double value(const std::string& src, const Counts& c, const uint64_t* latency = nullptr)
+{
+    std::string err;
+    auto expr = TripExpression::Compile(src, &err);
+    EXPECT_TRUE(expr != nullptr) << src << ": " << err;
+    if (expr == nullptr)
+        return -1;
+    TripInputs in;
+    in.counts = &c;
+    in.latency_buckets = latency;
+    return expr->Value(in);
+}
+
+TEST_F(TripExpressionTest, TestArithmetic)
+{
+    Counts c;
+    ASSERT_EQ(7, value("1 + 2 * 3", c));
+    ASSERT_EQ(9, value("(1 + 2) * 3", c));
+    ASSERT_EQ(-1, value("2 - 3", c));
+    ASSERT_EQ(1, value("--1", c));
+    ASSERT_EQ(0.25, value("1 / 4", c));
+    ASSERT_EQ(0, value("1 / 0", c));
+    ASSERT_EQ(1, value("1 < 2", c));
+    ASSERT_EQ(0, value("2 <= 1", c));
+    ASSERT_EQ(1, value("2 >= 2 == 1", c));
+    ASSERT_EQ(1, value("1 != 2", c));
+    ASSERT_EQ(0, value("!(1 < 2)", c));
+    ASSERT_EQ(1, value("!1 < 0", c));
+    ASSERT_EQ(1, value("0 || 3", c));
+    ASSERT_EQ(0, value("3 && 0", c));
+    ASSERT_EQ(1, value("1 || 0 && 0", c));
+    ASSERT_EQ(0, value("(1 || 0) && 0", c));
+    ASSERT_EQ(1, value("0 || 0 || 0 || 2", c));
+}
+
+TEST_F(TripExpressionTest, TestVariables)
+{
+    Counts c;
+    for (int i = 0; i < 20; i++)
+        c.onRequest();
+    for (int i = 0; i < 10; i++)
+        c.onSuccess();
+    for (int i = 0; i < 6; i++)
+        c.onFailure();
+
+    ASSERT_EQ(20, value("requests", c));
+    ASSERT_EQ(10, value("total_successes", c));
+    ASSERT_EQ(6, value("total_failures", c));
+    ASSERT_EQ(0, value("consecutive_successes", c));
+    ASSERT_EQ(6, value("consecutive_failures", c));
+    ASSERT_EQ(0.3, value("failure_ratio", c));
+    ASSERT_EQ(0.5, value("success_ratio", c));
+
+    const char* rule = "requests >= 20 && failure_ratio >= 0.5 || consecutive_failures > 5 || p99_ms > 800";
+    ASSERT_EQ(1, value(rule, c));
+    c.onSuccess();
+    ASSERT_EQ(0, value(rule, c));
+
+    // without latencies, latency variables are 0
+    ASSERT_EQ(0, value("p99_ms", c));
+
+    // 90 requests within 1ms, 10 between 500ms and 1s
+    uint64_t latency[LatencyHistogram::kBuckets + 1] = {};
+    int fast = 0, slow = 0;
+    while (LatencyHistogram::kBoundsNs[fast] < 1000000)
+        fast++;
+    while (LatencyHistogram::kBoundsNs[slow] < 1000000000)
+        slow++;
+    latency[fast] = 90;
+    latency[slow] = 10;
+    ASSERT_LE(value("p50_ms", c, latency), 1);
+    ASSERT_GT(value("p99_ms", c, latency), 800);
+    ASSERT_LE(value("p99_ms", c, latency), 1000);
+    ASSERT_EQ(1, value(rule, c, latency));
+}
+
+TEST_F(TripExpressionTest, TestErrors)
+{
+    const char* bad[] = { "", "requests >", "(requests > 1", "requests > 1)", "foo > 1", "requests ? 1",
+        "1 2", "requests & 1", "requests = 1" };
+    for (auto src : bad)
+    {
+        std::string err;
+        ASSERT_TRUE(TripExpression::Compile(src, &err) == nullptr) << src;
+        ASSERT_FALSE(err.empty()) << src;
+    }
+
+    std::string err;
+    // right nested operands each hold one more value on the stack
+    std::string deep;
+    for (int i = 0; i < TripExpression::kMaxStack; i++)
+        deep += "1+(";
+    deep += "1";
+    deep += std::string(TripExpression::kMaxStack, ')');
+    ASSERT_TRUE(TripExpression::Compile(deep, &err) == nullptr);
+    ASSERT_EQ("expression too deep", err);
+
+    auto expr = TripExpression::Compile("requests > 3 && p90_ms > 1", &err);
+    ASSERT_TRUE(expr != nullptr);
+    ASSERT_TRUE(expr->UsesLatency());
+    ASSERT_FALSE(TripExpression::Compile("requests > 3", &err)->UsesLatency());
+}
+
+TEST_F(TripExpressionTest, TestBreaker)
+{
+    Settings st;
+    st.trip_expression = TripExpression::Compile("requests >= 4 && failure_ratio >= 0.5 || p90_ms > 500", nullptr);
+    ASSERT_TRUE(st.trip_expression != nullptr);
+    CircuitBreaker cb(st);
+
+    uint64_t gen;
+    for (int i = 0; i < 3; i++)
+    {
+        ASSERT_EQ(ResultCodeOK, cb.Allow(&gen));
+        cb.Done(gen, i == 0, std::chrono::milliseconds(1));
+    }
+    ASSERT_EQ(STATE_CLOSED, cb.GetState());
+    ASSERT_EQ(ResultCodeOK, cb.Allow(&gen));
+    cb.Done(gen, false, std::chrono::milliseconds(1));
+    ASSERT_EQ(STATE_OPEN, cb.GetState());
+
+    // slow requests trip it as soon as one fails
+    cb.Reset();
+    for (int i = 0; i < 3; i++)
+    {
+        ASSERT_EQ(ResultCodeOK, cb.Allow(&gen));
+        cb.Done(gen, true, std::chrono::seconds(2));
+    }
+    ASSERT_EQ(STATE_CLOSED, cb.GetState());
+    ASSERT_EQ(ResultCodeOK, cb.Allow(&gen));
+    cb.Done(gen, false, std::chrono::seconds(2));
+    ASSERT_EQ(STATE_OPEN, cb.GetState());
+
+    // the latency window starts over with the Counts
+    cb.Reset();
+    ASSERT_EQ(ResultCodeOK, cb.Allow(&gen));
+    cb.Done(gen, false, std::chrono::milliseconds(1));
+    ASSERT_EQ(STATE_CLOSED, cb.GetState());
+}
@@ -0,0 +1,375 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+#include "circuit_breaker.h"
+#include "trip_policy.h"
+
+using namespace cppbreaker;
+
+class TripPolicyTest : public testing::Test
+{
+};
+
+static const int64_t kMs = 1000000;
+
+static int fail(CircuitBreaker* cb)
+{
+    return std::get<1>(cb->Execute<int>([]() -> std::tuple<int, int> { return std::make_tuple(0, 1); }));
+}
+
+static int succeed(CircuitBreaker* cb)
+{
+    return std::get<1>(cb->Execute<int>([]() -> std::tuple<int, int> { return std::make_tuple(0, 0); }));
+}
+
+TEST_F(TripPolicyTest, TestEwma)
+{
+    EwmaTripPolicy::Options options;
+    options.half_life = std::chrono::seconds(1);
+    options.failure_ratio = 0.5;
+    options.min_volume = 10;
+    EwmaTripPolicy policy(options);
+    ASSERT_EQ(1u, policy.Words());
+
+    Word128 state[1] = {};
+    int64_t now = 1000 * kMs;
+    policy.OnClose(state, now);
+
+    // under the volume floor failures do not trip
+    for (int i = 0; i < 5; i++)
+        ASSERT_FALSE(policy.Observe(state, now, false, std::chrono::nanoseconds(0)));
+    double requests, failures;
+    policy.Rates(state, now, &requests, &failures);
+    ASSERT_DOUBLE_EQ(5, requests);
+    ASSERT_DOUBLE_EQ(5, failures);
+
+    // a half life later they weigh half
+    now += 1000 * kMs;
+    policy.Rates(state, now, &requests, &failures);
+    ASSERT_NEAR(2.5, requests, 1e-6);
+    for (int i = 0; i < 20; i++)
+        ASSERT_FALSE(policy.Observe(state, now, true, std::chrono::nanoseconds(0)));
+    // 2.5 failures of 22.5 requests, 18 more failures reach half
+    for (int i = 0; i < 17; i++)
+        ASSERT_FALSE(policy.Observe(state, now, false, std::chrono::nanoseconds(0)));
+    ASSERT_TRUE(policy.Observe(state, now, false, std::chrono::nanoseconds(0)));
+
+    // old failures fade away
+    now += 20000 * kMs;
+    policy.Rates(state, now, &requests, &failures);
+    ASSERT_LT(requests, 1e-3);
+    ASSERT_FALSE(policy.Observe(state, now, false, std::chrono::nanoseconds(0)));
+
+    policy.OnClose(state, now);
+    policy.Rates(state, now, &requests, &failures);
+    ASSERT_EQ(0, requests);
+}
+
+TEST_F(TripPolicyTest, TestEwmaBreaker)
+{
+    VirtualClock clock;
+    EwmaTripPolicy::Options options;
+    options.half_life = std::chrono::seconds(5);
+    options.failure_ratio = 0.2;
+    options.min_volume = 50;
+    Settings settings;
+    settings.clock = &clock;
+    settings.timeout = std::chrono::seconds(10);
+    settings.trip_policy = std::make_shared<EwmaTripPolicy>(options);
+    CircuitBreaker cb(settings);
+
+    // 10% of failures never trip, though they come 10 in a row
+    for (int i = 0; i < 1000; i++)
+    {
+        clock.Advance(std::chrono::milliseconds(10));
+        if (i % 100 < 10)
+            fail(&cb);
+        else
+            ASSERT_EQ(0, succeed(&cb));
+    }
+    ASSERT_EQ(STATE_CLOSED, cb.GetState());
+
+    int failures = 0;
+    while (cb.GetState() == STATE_CLOSED && failures < 1000)
+    {
+        clock.Advance(std::chrono::milliseconds(10));
+        fail(&cb);
+        failures++;
+    }
+    ASSERT_EQ(STATE_OPEN, cb.GetState());
+    // the decayed volume is about 500 requests, 10% of them failures
+    ASSERT_GT(failures, 30);
+    ASSERT_LT(failures, 150);
+
+    // closing again starts the averages over
+    clock.Advance(std::chrono::seconds(11));
+    ASSERT_EQ(0, succeed(&cb));
+    ASSERT_EQ(STATE_CLOSED, cb.GetState());
+    for (int i = 0; i < 40; i++)
+        fail(&cb);
+    ASSERT_EQ(STATE_CLOSED, cb.GetState());
+    fail(&cb);
+    for (int i = 0; i < 10; i++)
+        fail(&cb);
+    ASSERT_EQ(STATE_OPEN, cb.GetState());
+}
+
+TEST_F(TripPolicyTest, TestPackedCounts)
+{
+    EwmaTripPolicy::Options options;
+    options.min_volume = 1000;
+    options.failure_ratio = 0.5;
+    Settings settings;
+    settings.packed_counts = true;
+    settings.trip_policy = std::make_shared<EwmaTripPolicy>(options);
+    CircuitBreaker cb(settings);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++)
+    {
+        threads.emplace_back([&cb]() {
+            for (int i = 0; i < 1000; i++)
+                ASSERT_EQ(0, succeed(&cb));
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+    ASSERT_EQ(STATE_CLOSED, cb.GetState());
+
+    int failures = 0;
+    while (cb.GetState() == STATE_CLOSED && failures < 10000)
+    {
+        fail(&cb);
+        failures++;
+    }
+    ASSERT_EQ(STATE_OPEN, cb.GetState());
+    // about as many failures as successes, less what decayed meanwhile
+    ASSERT_GT(failures, 1000);
+    ASSERT_LE(failures, 4001);
+}
+
+TEST_F(TripPolicyTest, TestUpdatePolicy)
+{
+    Settings settings;
+    settings.packed_counts = true;
+    settings.trip_policy = std::make_shared<EwmaTripPolicy>(EwmaTripPolicy::Options());
+    CircuitBreaker cb(settings);
+
+    // outcomes decided without the mutex race with settings of policies of other sizes
+    std::atomic<bool> done{false};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++)
+    {
+        threads.emplace_back([&cb, &done]() {
+            while (!done.load(std::memory_order_relaxed))
+                succeed(&cb);
+        });
+    }
+    for (int i = 0; i < 30000; i++)
+    {
+        if (i % 3 == 0)
+            settings.trip_policy = std::make_shared<BurnRateTripPolicy>(BurnRateTripPolicy::Options());
+        else if (i % 3 == 1)
+            settings.trip_policy = std::make_shared<AnomalyTripPolicy>(AnomalyTripPolicy::Options());
+        else
+            settings.trip_policy = std::make_shared<EwmaTripPolicy>(EwmaTripPolicy::Options());
+        cb.UpdateSettings(settings);
+    }
+    done.store(true);
+    for (auto& t : threads)
+        t.join();
+    ASSERT_EQ(cb.Metrics().requests.Load(), cb.Metrics().successes.Load());
+}
+
+// learn runs n outcomes through policy, failing at random with failure_rate, and returns the index
+// of the first that trips, or -1
+static int learn(const AnomalyTripPolicy& policy, Word128* state, int n, double failure_rate,
+    std::chrono::nanoseconds latency = std::chrono::nanoseconds(0))
+{
+    static std::mt19937 rng(7);
+    std::bernoulli_distribution fails(failure_rate);
+    for (int i = 0; i < n; i++)
+    {
+        if (policy.Observe(state, 0, !fails(rng), latency))
+            return i;
+    }
+    return -1;
+}
+
+TEST_F(TripPolicyTest, TestAnomaly)
+{
+    AnomalyTripPolicy policy(AnomalyTripPolicy::Options{});
+    ASSERT_EQ(2u, policy.Words());
+
+    // a backend failing 3% of requests is learned, and keeps failing so without tripping
+    Word128 usual[2] = {};
+    ASSERT_EQ(-1, learn(policy, usual, 20000, 0.03));
+    AnomalyTripPolicy::Signal errors, latency;
+    uint32_t volume;
+    policy.Read(usual, &errors, &latency, &volume);
+    ASSERT_EQ(20000u, volume);
+    ASSERT_NEAR(0.03, errors.mean, 0.005);
+    ASSERT_GT(errors.stddev, 0);
+    // 20% is anomalous for it
+    int tripped = learn(policy, usual, 1000, 0.2);
+    ASSERT_GE(tripped, 0);
+
+    // a backend failing 0.01% trips on the same 20%, sooner
+    Word128 rare[2] = {};
+    ASSERT_EQ(-1, learn(policy, rare, 20000, 0.0001));
+    int rare_tripped = learn(policy, rare, 1000, 0.2);
+    ASSERT_GE(rare_tripped, 0);
+    ASSERT_LE(rare_tripped, tripped);
+
+    // nothing trips before min_volume outcomes
+    Word128 fresh[2] = {};
+    ASSERT_EQ(-1, learn(policy, fresh, 500, 1));
+
+    // closing keeps the baseline and restarts current from it
+    policy.OnClose(usual, 0);
+    policy.Read(usual, &errors, &latency, &volume);
+    ASSERT_FLOAT_EQ(errors.mean, errors.current);
+    ASSERT_EQ(-1, learn(policy, usual, 5000, 0.03));
+}
+
+TEST_F(TripPolicyTest, TestAnomalyLatency)
+{
+    AnomalyTripPolicy::Options options;
+    options.latency_k = 4;
+    AnomalyTripPolicy policy(options);
+
+    Word128 state[2] = {};
+    for (int i = 0; i < 5000; i++)
+    {
+        auto latency = std::chrono::microseconds(i % 2 == 0 ? 900 : 1100);
+        ASSERT_FALSE(policy.Observe(state, 0, true, latency));
+    }
+    AnomalyTripPolicy::Signal errors, latency;
+    uint32_t volume;
+    policy.Read(state, &errors, &latency, &volume);
+    ASSERT_NEAR(1e6, latency.mean, 5e4);
+
+    // successes that got ten times slower trip
+    ASSERT_GE(learn(policy, state, 100, 0, std::chrono::milliseconds(10)), 0);
+}
+
+TEST_F(TripPolicyTest, TestAnomalyBreaker)
+{
+    AnomalyTripPolicy::Options options;
+    options.min_volume = 200;
+    Settings settings;
+    settings.trip_policy = std::make_shared<AnomalyTripPolicy>(options);
+    CircuitBreaker cb(settings);
+
+    // 20% of failures, 5 in a row, are the norm
+    for (int i = 0; i < 5000; i++)
+    {
+        if (i % 25 < 5)
+            fail(&cb);
+        else
+            ASSERT_EQ(0, succeed(&cb));
+    }
+    ASSERT_EQ(STATE_CLOSED, cb.GetState());
+
+    int failures = 0;
+    while (cb.GetState() == STATE_CLOSED && failures < 1000)
+    {
+        fail(&cb);
+        failures++;
+    }
+    ASSERT_EQ(STATE_OPEN, cb.GetState());
+    ASSERT_LT(failures, 100);
+}
+
+TEST_F(TripPolicyTest, TestBurnRate)
+{
+    BurnRateTripPolicy::Options options;
+    options.slo = 0.99;
+    options.factor = 10;
+    options.short_window = std::chrono::seconds(5);
+    options.long_window = std::chrono::seconds(60);
+    options.fine_buckets = 5;
+    options.coarse_buckets = 12;
+    BurnRateTripPolicy policy(options);
+    // a minute of one second buckets takes 17 words
+    ASSERT_EQ(17u, policy.Words());
+
+    std::vector<Word128> state(policy.Words(), Word128{0, 0});
+    int64_t now = 1000000 * kMs;
+    auto observe = [&](bool success) {
+        now += 10 * kMs;
+        return policy.Observe(state.data(), now, success, std::chrono::nanoseconds(0));
+    };
+
+    // a minute at 100 requests per second burning 2% of budget, 2 times the rate
+    for (int i = 0; i < 6000; i++)
+        ASSERT_FALSE(observe(i % 50 != 0));
+    BurnRateTripPolicy::Window short_window, long_window;
+    policy.Read(state.data(), now, &short_window, &long_window);
+    ASSERT_NEAR(2, short_window.burn, 0.5);
+    ASSERT_NEAR(2, long_window.burn, 0.2);
+    // the coarse buckets hold what the fine ones rolled up, each outcome once
+    ASSERT_GE(long_window.requests, 5400u);
+    ASSERT_LE(long_window.requests, 6000u);
+    ASSERT_LT(short_window.requests, 501u);
+
+    // a short burst burns the short window only
+    for (int i = 0; i < 200; i++)
+        ASSERT_FALSE(observe(i % 2 != 0));
+    policy.Read(state.data(), now, &short_window, &long_window);
+    ASSERT_GE(short_window.burn, 10);
+    ASSERT_LT(long_window.burn, 10);
+    for (int i = 0; i < 1000; i++)
+        ASSERT_FALSE(observe(i % 50 != 0));
+
+    // an outage trips once the long window burns too
+    int failures = 0;
+    while (!observe(false))
+        failures++;
+    ASSERT_GT(failures, 300);
+    ASSERT_LT(failures, 800);
+    policy.Read(state.data(), now, &short_window, &long_window);
+    ASSERT_GE(long_window.burn, 10);
+
+    // windows empty out after a long idle, and on close
+    policy.Read(state.data(), now + 61000 * kMs, &short_window, &long_window);
+    ASSERT_EQ(0u, long_window.requests);
+    policy.OnClose(state.data(), now);
+    policy.Read(state.data(), now, &short_window, &long_window);
+    ASSERT_EQ(0u, long_window.requests);
+    ASSERT_EQ(0, long_window.burn);
+}
+
+TEST_F(TripPolicyTest, TestBurnRateBreaker)
+{
+    VirtualClock clock;
+    BurnRateTripPolicy::Options options;
+    options.slo = 0.9;
+    options.factor = 5;
+    options.short_window = std::chrono::seconds(1);
+    options.long_window = std::chrono::seconds(10);
+    Settings settings;
+    settings.clock = &clock;
+    settings.trip_policy = std::make_shared<BurnRateTripPolicy>(options);
+    CircuitBreaker cb(settings);
+
+    for (int i = 0; i < 1000; i++)
+    {
+        clock.Advance(std::chrono::milliseconds(10));
+        ASSERT_EQ(0, succeed(&cb));
+    }
+    int failures = 0;
+    while (cb.GetState() == STATE_CLOSED && failures < 1000)
+    {
+        clock.Advance(std::chrono::milliseconds(10));
+        fail(&cb);
+        failures++;
+    }
+    ASSERT_EQ(STATE_OPEN, cb.GetState());
+    // half of the long window must fail
+    ASSERT_GT(failures, 400);
+    ASSERT_LT(failures, 600);
+}
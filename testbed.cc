@@ -0,0 +1,549 @@
+#include "testbed.h"
+#include "circuit_breaker.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <sstream>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+namespace cppbreaker
+{
+
+    namespace
+    {
+        bool unixAddress(const std::string& path, sockaddr_un* addr)
+        {
+            memset(addr, 0, sizeof(*addr));
+            addr->sun_family = AF_UNIX;
+            if (path.empty() || path.size() >= sizeof(addr->sun_path))
+                return false;
+            memcpy(addr->sun_path, path.data(), path.size());
+            return true;
+        }
+
+        int64_t elapsedNs(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to)
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count();
+        }
+    }
+
+    bool ParseFaults(const std::string& spec, Faults* faults)
+    {
+        std::istringstream in(spec);
+        std::string kv;
+        Faults f = *faults;
+        while (in >> kv)
+        {
+            auto eq = kv.find('=');
+            if (eq == std::string::npos)
+                return false;
+            std::string key = kv.substr(0, eq);
+            const char* value = kv.c_str() + eq + 1;
+            char* end = nullptr;
+            double v = strtod(value, &end);
+            if (end == value || *end != '\0' || v < 0)
+                return false;
+            if (key == "error_rate")
+                f.error_rate = v;
+            else if (key == "latency_us")
+                f.latency = std::chrono::microseconds(int64_t(v));
+            else if (key == "jitter_us")
+                f.jitter = std::chrono::microseconds(int64_t(v));
+            else if (key == "reset_rate")
+                f.reset_rate = v;
+            else if (key == "hang_rate")
+                f.hang_rate = v;
+            else
+                return false;
+        }
+        *faults = f;
+        return true;
+    }
+
+    FaultServer::~FaultServer()
+    {
+        Stop();
+    }
+
+    bool FaultServer::Start(const std::string& path, uint64_t seed)
+    {
+        if (thread_.joinable())
+            return false;
+
+        sockaddr_un addr;
+        if (!unixAddress(path, &addr))
+            return false;
+
+        listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (listen_fd_ < 0 || epoll_fd_ < 0 || event_fd_ < 0 || timer_fd_ < 0)
+        {
+            Stop();
+            return false;
+        }
+
+        unlink(path.c_str());
+        if (bind(listen_fd_, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd_, SOMAXCONN) != 0)
+        {
+            Stop();
+            return false;
+        }
+        path_ = path;
+
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        for (int fd : { listen_fd_, event_fd_, timer_fd_ })
+        {
+            ev.data.u64 = uint64_t(fd);
+            epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev);
+        }
+
+        rng_.seed(seed);
+        calls_ = 0;
+        resets_ = 0;
+        hangs_ = 0;
+        thread_ = std::thread(&FaultServer::run, this);
+        return true;
+    }
+
+    void FaultServer::Stop()
+    {
+        if (thread_.joinable())
+        {
+            uint64_t one = 1;
+            ssize_t n = write(event_fd_, &one, sizeof(one));
+            (void)n;
+            thread_.join();
+        }
+        for (auto& conn : connections_)
+            closeConnection(&conn);
+        answers_.clear();
+
+        for (int* fd : { &listen_fd_, &epoll_fd_, &event_fd_, &timer_fd_ })
+        {
+            if (*fd >= 0)
+                close(*fd);
+            *fd = -1;
+        }
+
+        if (!path_.empty())
+            unlink(path_.c_str());
+        path_.clear();
+    }
+
+    void FaultServer::SetFaults(const Faults& faults)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        faults_ = faults;
+    }
+
+    Faults FaultServer::GetFaults()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return faults_;
+    }
+
+    void FaultServer::run()
+    {
+        epoll_event events[64];
+        for (;;)
+        {
+            int n = epoll_wait(epoll_fd_, events, 64, -1);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return;
+            }
+
+            size_t pending = answers_.size();
+            for (int i = 0; i < n; i++)
+            {
+                int fd = int(events[i].data.u64);
+                if (fd == event_fd_)
+                    return;
+                if (fd == listen_fd_)
+                {
+                    accept();
+                    continue;
+                }
+                if (fd == timer_fd_)
+                {
+                    uint64_t expirations;
+                    ssize_t r = read(timer_fd_, &expirations, sizeof(expirations));
+                    (void)r;
+                    answerDue();
+                    pending = ~size_t(0);
+                    continue;
+                }
+
+                Connection* conn = &connections_[size_t(fd)];
+                if (conn->fd < 0)
+                    continue;
+                if (events[i].events & (EPOLLERR | EPOLLHUP))
+                    closeConnection(conn);
+                else
+                    onReadable(conn);
+            }
+
+            // rearm the timer for the first answer due when the heap changed
+            if (pending != answers_.size())
+            {
+                itimerspec spec;
+                memset(&spec, 0, sizeof(spec));
+                if (!answers_.empty())
+                {
+                    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        answers_.front().due.time_since_epoch()).count();
+                    // a zero it_value disarms the timer
+                    ns = std::max<int64_t>(ns, 1);
+                    spec.it_value.tv_sec = time_t(ns / 1000000000);
+                    spec.it_value.tv_nsec = long(ns % 1000000000);
+                }
+                timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr);
+            }
+        }
+    }
+
+    void FaultServer::accept()
+    {
+        int fd;
+        while ((fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+        {
+            if (connections_.size() <= size_t(fd))
+                connections_.resize(size_t(fd) + 1);
+            Connection* conn = &connections_[size_t(fd)];
+            conn->fd = fd;
+            conn->serial = ++serial_;
+            conn->in_len = 0;
+            open_++;
+
+            epoll_event ev;
+            ev.events = EPOLLIN | EPOLLRDHUP;
+            ev.data.u64 = uint64_t(fd);
+            epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev);
+        }
+    }
+
+    void FaultServer::closeConnection(Connection* conn)
+    {
+        if (conn->fd < 0)
+            return;
+        if (epoll_fd_ >= 0)
+            epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, conn->fd, nullptr);
+        close(conn->fd);
+        conn->fd = -1;
+        conn->in_len = 0;
+        open_--;
+    }
+
+    void FaultServer::onReadable(Connection* conn)
+    {
+        for (;;)
+        {
+            ssize_t n = read(conn->fd, conn->in + conn->in_len, sizeof(conn->in) - conn->in_len);
+            if (n == 0)
+            {
+                closeConnection(conn);
+                return;
+            }
+            if (n < 0)
+            {
+                if (errno != EAGAIN && errno != EINTR)
+                    closeConnection(conn);
+                return;
+            }
+            conn->in_len += size_t(n);
+
+            size_t start = 0;
+            for (size_t i = 0; i < conn->in_len; i++)
+            {
+                if (conn->in[i] != '\n')
+                    continue;
+                std::string line(conn->in + start, i - start);
+                start = i + 1;
+                if (line == "call")
+                {
+                    onCall(conn);
+                    if (conn->fd < 0)
+                        return;
+                }
+                else if (line.compare(0, 7, "faults ") == 0)
+                {
+                    Faults faults = GetFaults();
+                    bool ok = ParseFaults(line.substr(7), &faults);
+                    if (ok)
+                        SetFaults(faults);
+                    answer(conn, ok ? "ok\n" : "err\n");
+                }
+                else
+                {
+                    answer(conn, "err\n");
+                }
+            }
+            if (start == 0 && conn->in_len == sizeof(conn->in))
+            {
+                closeConnection(conn);
+                return;
+            }
+            memmove(conn->in, conn->in + start, conn->in_len - start);
+            conn->in_len -= start;
+        }
+    }
+
+    void FaultServer::onCall(Connection* conn)
+    {
+        Faults faults = GetFaults();
+        calls_.fetch_add(1, std::memory_order_relaxed);
+
+        std::uniform_real_distribution<double> uniform(0, 1);
+        double u = uniform(rng_);
+        if (u < faults.reset_rate)
+        {
+            resets_.fetch_add(1, std::memory_order_relaxed);
+            closeConnection(conn);
+            return;
+        }
+        if (u < faults.reset_rate + faults.hang_rate)
+        {
+            hangs_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        bool ok = uniform(rng_) >= faults.error_rate;
+        std::chrono::nanoseconds delay = faults.latency;
+        if (faults.jitter.count() > 0)
+        {
+            std::exponential_distribution<double> exponential(1.0 / double(faults.jitter.count()));
+            delay += std::chrono::microseconds(int64_t(exponential(rng_)));
+        }
+        if (delay.count() == 0)
+        {
+            answer(conn, ok ? "ok\n" : "err\n");
+            return;
+        }
+
+        answers_.push_back(Answer{ std::chrono::steady_clock::now() + delay, conn->fd, conn->serial, ok });
+        std::push_heap(answers_.begin(), answers_.end(), std::greater<Answer>());
+    }
+
+    void FaultServer::answerDue()
+    {
+        auto now = std::chrono::steady_clock::now();
+        while (!answers_.empty() && answers_.front().due <= now)
+        {
+            Answer a = answers_.front();
+            std::pop_heap(answers_.begin(), answers_.end(), std::greater<Answer>());
+            answers_.pop_back();
+
+            Connection* conn = &connections_[size_t(a.fd)];
+            if (conn->fd == a.fd && conn->serial == a.serial)
+                answer(conn, a.ok ? "ok\n" : "err\n");
+        }
+    }
+
+    void FaultServer::answer(Connection* conn, const char* line)
+    {
+        // answers are short and one is in flight per connection, they fit in the socket buffer
+        ssize_t n = send(conn->fd, line, strlen(line), MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && errno != EAGAIN)
+            closeConnection(conn);
+    }
+
+    TestbedClient::TestbedClient(CircuitBreaker* cb, const std::string& path, int concurrency,
+        std::chrono::milliseconds timeout)
+        : cb_(cb), path_(path), timeout_(timeout)
+    {
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        slots_.resize(size_t(std::max(concurrency, 1)));
+    }
+
+    TestbedClient::~TestbedClient()
+    {
+        for (auto& slot : slots_)
+            disconnect(&slot);
+        if (epoll_fd_ >= 0)
+            close(epoll_fd_);
+    }
+
+    bool TestbedClient::connect(Slot* slot)
+    {
+        sockaddr_un addr;
+        if (!unixAddress(path_, &addr))
+            return false;
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            return false;
+        // a Unix domain socket connects at once, or fails when the backlog is full
+        if (::connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0)
+        {
+            close(fd);
+            return false;
+        }
+
+        epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.u64 = uint64_t(slot - &slots_[0]);
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev);
+        slot->fd = fd;
+        slot->in_len = 0;
+        open_++;
+        return true;
+    }
+
+    void TestbedClient::disconnect(Slot* slot)
+    {
+        if (slot->fd < 0)
+            return;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, slot->fd, nullptr);
+        close(slot->fd);
+        slot->fd = -1;
+        slot->in_len = 0;
+        open_--;
+    }
+
+    void TestbedClient::startCall(Slot* slot, TestbedStats* stats)
+    {
+        stats->calls++;
+        auto t0 = std::chrono::steady_clock::now();
+        int rc = cb_->Allow(&slot->generation);
+        auto t1 = std::chrono::steady_clock::now();
+        if (rc != ResultCodeOK)
+        {
+            stats->rejected++;
+            stats->overhead_ns.push_back(elapsedNs(t0, t1));
+            slot->next = t1 + backoff_;
+            return;
+        }
+
+        slot->allow_ns = elapsedNs(t0, t1);
+        slot->start = t1;
+        slot->deadline = t1 + timeout_;
+        slot->in_flight = true;
+        static const char kCall[] = "call\n";
+        if ((slot->fd < 0 && !connect(slot)) ||
+            send(slot->fd, kCall, sizeof(kCall) - 1, MSG_NOSIGNAL | MSG_DONTWAIT) != ssize_t(sizeof(kCall) - 1))
+        {
+            stats->resets++;
+            disconnect(slot);
+            finishCall(slot, false, stats);
+        }
+    }
+
+    void TestbedClient::finishCall(Slot* slot, bool success, TestbedStats* stats)
+    {
+        auto t0 = std::chrono::steady_clock::now();
+        cb_->Done(slot->generation, success, t0 - slot->start);
+        auto t1 = std::chrono::steady_clock::now();
+        stats->overhead_ns.push_back(slot->allow_ns + elapsedNs(t0, t1));
+        slot->in_flight = false;
+        slot->next = t1;
+    }
+
+    void TestbedClient::onReadable(Slot* slot, TestbedStats* stats)
+    {
+        for (;;)
+        {
+            ssize_t n = read(slot->fd, slot->in + slot->in_len, sizeof(slot->in) - slot->in_len);
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+            {
+                disconnect(slot);
+                if (slot->in_flight)
+                {
+                    stats->resets++;
+                    finishCall(slot, false, stats);
+                }
+                return;
+            }
+            if (n < 0)
+                return;
+            slot->in_len += size_t(n);
+
+            char* nl = (char*)memchr(slot->in, '\n', slot->in_len);
+            if (nl == nullptr)
+            {
+                if (slot->in_len == sizeof(slot->in))
+                    slot->in_len = 0;
+                continue;
+            }
+            bool ok = nl - slot->in == 2 && memcmp(slot->in, "ok", 2) == 0;
+            slot->in_len = 0;
+            if (!slot->in_flight)
+                continue;
+            if (ok)
+                stats->successes++;
+            else
+                stats->failures++;
+            stats->latency_ns.push_back(elapsedNs(slot->start, std::chrono::steady_clock::now()));
+            finishCall(slot, ok, stats);
+        }
+    }
+
+    TestbedStats TestbedClient::Run(std::chrono::nanoseconds duration)
+    {
+        TestbedStats stats;
+        auto now = std::chrono::steady_clock::now();
+        auto end = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(duration);
+        for (auto& slot : slots_)
+            slot.next = now;
+
+        epoll_event events[64];
+        for (;;)
+        {
+            now = std::chrono::steady_clock::now();
+            bool issuing = now < end;
+            bool in_flight = false;
+            auto wake = end;
+            for (auto& slot : slots_)
+            {
+                if (slot.in_flight && now >= slot.deadline)
+                {
+                    // a hung connection cannot be reused
+                    stats.timeouts++;
+                    disconnect(&slot);
+                    finishCall(&slot, false, &stats);
+                }
+                if (!slot.in_flight && issuing && now >= slot.next)
+                    startCall(&slot, &stats);
+
+                if (slot.in_flight)
+                {
+                    in_flight = true;
+                    wake = std::min(wake, slot.deadline);
+                }
+                else if (issuing)
+                {
+                    wake = std::min(wake, slot.next);
+                }
+            }
+            stats.max_connections = std::max(stats.max_connections, open_);
+            if (!issuing && !in_flight)
+                break;
+
+            int timeout_ms = 0;
+            if (wake > now)
+            {
+                timeout_ms = int(std::chrono::duration_cast<std::chrono::milliseconds>(
+                    wake - now + std::chrono::microseconds(999)).count());
+            }
+            int n = epoll_wait(epoll_fd_, events, 64, timeout_ms);
+            for (int i = 0; i < n; i++)
+            {
+                Slot* slot = &slots_[events[i].data.u64];
+                if (slot->fd >= 0)
+                    onReadable(slot, &stats);
+            }
+        }
+        return stats;
+    }
+}
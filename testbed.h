@@ -0,0 +1,205 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace cppbreaker
+{
+    class CircuitBreaker;
+
+    // Faults of a FaultServer, drawn independently for every request
+    struct Faults
+    {
+        double error_rate = 0;
+        // the answer is delayed by latency plus an exponentially distributed time of mean jitter
+        std::chrono::microseconds latency{0};
+        std::chrono::microseconds jitter{0};
+        // probability that the connection is closed instead of answered
+        double reset_rate = 0;
+        // probability that the request is never answered
+        double hang_rate = 0;
+    };
+
+    // ParseFaults reads space separated key=value pairs into faults, keys are
+    // error_rate, latency_us, jitter_us, reset_rate and hang_rate. Missing keys keep their value.
+    bool ParseFaults(const std::string& spec, Faults* faults);
+
+    // FaultServer is a stand in backend on a Unix domain socket served from a single epoll thread,
+    // whose faults can be changed while it runs.
+    //
+    // The protocol is line based, one request in flight per connection:
+    //   call                   answered by "ok" or "err", late, or never, or by closing the connection
+    //   faults <key=value...>  changes the faults, as ParseFaults, answered by "ok"
+    class FaultServer
+    {
+    public:
+        FaultServer() {}
+        ~FaultServer();
+
+        FaultServer(const FaultServer&) = delete;
+        FaultServer& operator=(const FaultServer&) = delete;
+
+        // Start binds path, replacing a stale socket file, and starts the server thread
+        bool Start(const std::string& path, uint64_t seed = 1);
+        void Stop();
+
+        void SetFaults(const Faults& faults);
+        Faults GetFaults();
+
+        // counters since Start
+        uint64_t Calls() const
+        {
+            return calls_.load(std::memory_order_relaxed);
+        }
+        uint64_t Resets() const
+        {
+            return resets_.load(std::memory_order_relaxed);
+        }
+        uint64_t Hangs() const
+        {
+            return hangs_.load(std::memory_order_relaxed);
+        }
+        int OpenConnections() const
+        {
+            return open_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        struct Connection
+        {
+            int fd = -1;
+            // tells a reused fd from the connection a delayed answer was for
+            uint64_t serial = 0;
+            size_t in_len = 0;
+            char in[256];
+        };
+
+        struct Answer
+        {
+            std::chrono::steady_clock::time_point due;
+            int fd;
+            uint64_t serial;
+            bool ok;
+
+            bool operator>(const Answer& o) const
+            {
+                return due > o.due;
+            }
+        };
+
+        void run();
+        void accept();
+        void closeConnection(Connection* conn);
+        void onReadable(Connection* conn);
+        void onCall(Connection* conn);
+        void answer(Connection* conn, const char* line);
+        void answerDue();
+
+        std::string path_;
+        int listen_fd_ = -1;
+        int epoll_fd_ = -1;
+        int event_fd_ = -1;
+        // fires when the first delayed answer is due
+        int timer_fd_ = -1;
+        // indexed by fd
+        std::vector<Connection> connections_;
+        uint64_t serial_ = 0;
+        // min heap of delayed answers
+        std::vector<Answer> answers_;
+        std::mt19937_64 rng_;
+        std::thread thread_;
+
+        std::mutex mutex_;
+        Faults faults_;
+
+        std::atomic<uint64_t> calls_{0};
+        std::atomic<uint64_t> resets_{0};
+        std::atomic<uint64_t> hangs_{0};
+        std::atomic<int> open_{0};
+    };
+
+    // TestbedStats counts what a TestbedClient saw during one Run
+    struct TestbedStats
+    {
+        uint64_t calls = 0;
+        uint64_t rejected = 0;
+        uint64_t successes = 0;
+        // answered "err"
+        uint64_t failures = 0;
+        // not answered within the timeout
+        uint64_t timeouts = 0;
+        // the connection was closed or could not be established
+        uint64_t resets = 0;
+        // most connections open at once
+        int max_connections = 0;
+        // time spent in Allow and Done of every call
+        std::vector<int64_t> overhead_ns;
+        // time from send to answer of the calls answered
+        std::vector<int64_t> latency_ns;
+    };
+
+    // TestbedClient drives calls to a FaultServer through a breaker from a single epoll thread,
+    // keeping concurrency calls in flight, each on its own connection, each wrapped in Allow and Done.
+    // Timeouts and resets are failures, a hung connection is closed and connected again for the next call.
+    class TestbedClient
+    {
+    public:
+        TestbedClient(CircuitBreaker* cb, const std::string& path, int concurrency,
+            std::chrono::milliseconds timeout);
+        ~TestbedClient();
+
+        TestbedClient(const TestbedClient&) = delete;
+        TestbedClient& operator=(const TestbedClient&) = delete;
+
+        // backoff is how long a slot waits after a rejection before the next call
+        void SetBackoff(std::chrono::microseconds backoff)
+        {
+            backoff_ = backoff;
+        }
+
+        // Run issues calls for duration, then waits for those in flight. Connections are kept
+        // across runs, so that a scenario can be run one phase at a time.
+        TestbedStats Run(std::chrono::nanoseconds duration);
+
+        int OpenConnections() const
+        {
+            return open_;
+        }
+
+    private:
+        struct Slot
+        {
+            int fd = -1;
+            bool in_flight = false;
+            uint64_t generation = 0;
+            std::chrono::steady_clock::time_point start;
+            std::chrono::steady_clock::time_point deadline;
+            // time spent in Allow for the call in flight
+            int64_t allow_ns = 0;
+            // when an idle slot makes its next call
+            std::chrono::steady_clock::time_point next;
+            size_t in_len = 0;
+            char in[16];
+        };
+
+        bool connect(Slot* slot);
+        void disconnect(Slot* slot);
+        void startCall(Slot* slot, TestbedStats* stats);
+        void finishCall(Slot* slot, bool success, TestbedStats* stats);
+        void onReadable(Slot* slot, TestbedStats* stats);
+
+        CircuitBreaker* cb_;
+        std::string path_;
+        std::chrono::milliseconds timeout_;
+        std::chrono::microseconds backoff_{1000};
+        int epoll_fd_ = -1;
+        int open_ = 0;
+        std::vector<Slot> slots_;
+    };
+}
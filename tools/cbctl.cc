@@ -0,0 +1,151 @@
+// cbctl shows a live, top like view of the circuit breakers of a process
+// that publishes them with cppbreaker::ShmPublisher.
+//
+//   cbctl [-i interval_ms] [-n iterations] <pid | /segment-name>
+
+#include "circuit_breaker.h"
+#include "shm_segment.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <thread>
+#include <unistd.h>
+
+
+static void usage()
+{
+    fprintf(stderr, "usage: cbctl [-i interval_ms] [-n iterations] <pid | /segment-name>\n");
+}
+
+// readPublication reads the records and returns the time of the publication they belong to,
+// reading again if a publication ended meanwhile
+static uint64_t readPublication(const cppbreaker::ShmReader& reader, std::vector<cppbreaker::ShmRecord>* records)
+{
+    auto header = reader.Header();
+    for (int tries = 0; ; tries++)
+    {
+        uint64_t before = header->published_ns.load(std::memory_order_acquire);
+        reader.Read(records);
+        uint64_t after = header->published_ns.load(std::memory_order_acquire);
+        if (before == after || tries >= 10)
+            return after;
+    }
+}
+
+struct Row
+{
+    const cppbreaker::ShmRecord* record;
+    double req_rate;
+    double err_ratio;
+    double rej_rate;
+};
+
+int main(int argc, char* argv[])
+{
+    int interval_ms = 1000;
+    int iterations = -1;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:n:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'i':
+            interval_ms = atoi(optarg);
+            break;
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        default:
+            usage();
+            return 2;
+        }
+    }
+    if (optind != argc - 1 || interval_ms <= 0)
+    {
+        usage();
+        return 2;
+    }
+
+    std::string target = argv[optind];
+    std::string name = target[0] == '/' ? target : cppbreaker::ShmSegmentName(atoi(target.c_str()));
+
+    cppbreaker::ShmReader reader;
+    errno = 0;
+    if (!reader.Attach(name))
+    {
+        fprintf(stderr, "cbctl: cannot attach to %s: %s\n", name.c_str(),
+            errno != 0 ? strerror(errno) : "unknown segment version");
+        return 1;
+    }
+
+    std::vector<cppbreaker::ShmRecord> prev, cur;
+    uint64_t prev_published = readPublication(reader, &prev);
+    bool tty = isatty(STDOUT_FILENO);
+
+    for (int it = 0; iterations < 0 || it < iterations; it++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+        // rates are over the interval between publications, a refresh without a new one shows nothing new
+        uint64_t published = readPublication(reader, &cur);
+        if (published == 0 || published == prev_published)
+            continue;
+        double secs = prev_published == 0 ? 0 : double(published - prev_published) / 1e9;
+
+        std::map<uint32_t, const cppbreaker::ShmRecord*> last;
+        for (auto& r : prev)
+            last[r.id] = &r;
+
+        std::vector<Row> rows;
+        rows.reserve(cur.size());
+        for (auto& r : cur)
+        {
+            Row row = { &r, 0, 0, 0 };
+            auto p = last.find(r.id);
+            if (secs > 0 && p != last.end() && p->second->name == r.name)
+            {
+                const cppbreaker::ShmRecord* o = p->second;
+                uint64_t done = (r.successes - o->successes) + (r.failures - o->failures);
+                row.req_rate = double(r.requests - o->requests) / secs;
+                row.err_ratio = done == 0 ? 0 : double(r.failures - o->failures) / double(done);
+                row.rej_rate = double((r.rejected_open - o->rejected_open) +
+                    (r.rejected_too_many - o->rejected_too_many)) / secs;
+            }
+            rows.push_back(row);
+        }
+        std::sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) {
+            if (a.rej_rate != b.rej_rate)
+                return a.rej_rate > b.rej_rate;
+            return a.record->name < b.record->name;
+        });
+
+        if (tty)
+            printf("\033[H\033[2J");
+        auto header = reader.Header();
+        uint64_t age_ms = 0;
+        auto mono = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+        if (published != 0 && mono > published)
+            age_ms = (mono - published) / 1000000;
+        printf("pid %u  breakers %zu  published %llu ms ago\n\n", header->pid, cur.size(),
+            (unsigned long long)age_ms);
+        printf("%-40s %-10s %12s %8s %12s %12s\n", "NAME", "STATE", "REQ/s", "ERR%", "REJ/s", "TRANSITIONS");
+        for (auto& row : rows)
+        {
+            const cppbreaker::ShmRecord* r = row.record;
+            printf("%-40.40s %-10s %12.1f %7.2f%% %12.1f %12llu\n", r->name.c_str(),
+                cppbreaker::CircuitBreaker::StateString(cppbreaker::State(r->state)).c_str(),
+                row.req_rate, row.err_ratio * 100, row.rej_rate, (unsigned long long)r->transitions);
+        }
+        if (!tty)
+            printf("\n");
+        fflush(stdout);
+
+        prev.swap(cur);
+        prev_published = published;
+    }
+    return 0;
+}
@@ -0,0 +1,128 @@
+// cbjournal prints the transition journal written by cppbreaker::Journal, oldest first.
+//
+//   cbjournal [-n name-prefix] [-i breaker-id] [-t open|half-open|close] [-s since-unix-seconds] <journal-file>
+
+#include "circuit_breaker.h"
+#include "journal.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <map>
+#include <unistd.h>
+
+
+static void usage()
+{
+    fprintf(stderr, "usage: cbjournal [-n name-prefix] [-i breaker-id] [-t open|half-open|close] "
+        "[-s since-unix-seconds] <journal-file>\n");
+}
+
+static std::string formatTime(int64_t ns)
+{
+    time_t secs = time_t(ns / 1000000000);
+    struct tm tm;
+    gmtime_r(&secs, &tm);
+    char buf[64];
+    size_t n = strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+    snprintf(buf + n, sizeof(buf) - n, ".%09lldZ", (long long)(ns % 1000000000));
+    return buf;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string prefix;
+    long long id = -1;
+    int to = -1;
+    int64_t since_ns = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:i:t:s:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            prefix = optarg;
+            break;
+        case 'i':
+            id = atoll(optarg);
+            break;
+        case 't':
+        {
+            std::string st = optarg;
+            if (st == "close" || st == "closed")
+                to = cppbreaker::STATE_CLOSED;
+            else if (st == "half-open")
+                to = cppbreaker::STATE_HALF_OPEN;
+            else if (st == "open")
+                to = cppbreaker::STATE_OPEN;
+            else
+            {
+                usage();
+                return 2;
+            }
+            break;
+        }
+        case 's':
+            since_ns = int64_t(atoll(optarg)) * 1000000000;
+            break;
+        default:
+            usage();
+            return 2;
+        }
+    }
+    if (optind != argc - 1)
+    {
+        usage();
+        return 2;
+    }
+
+    std::vector<cppbreaker::JournalEntry> entries;
+    if (!cppbreaker::Journal::Read(argv[optind], &entries))
+    {
+        fprintf(stderr, "cbjournal: cannot read journal %s\n", argv[optind]);
+        return 1;
+    }
+
+    // time each breaker became open, to report how long it stayed open
+    std::map<std::pair<uint32_t, std::string>, int64_t> opened;
+    for (auto& e : entries)
+    {
+        auto key = std::make_pair(e.breaker_id, e.name);
+        int64_t open_ns = -1;
+        if (e.from == cppbreaker::STATE_OPEN)
+        {
+            auto it = opened.find(key);
+            if (it != opened.end())
+            {
+                open_ns = e.timestamp_ns - it->second;
+                opened.erase(it);
+            }
+        }
+        if (e.to == cppbreaker::STATE_OPEN)
+            opened[key] = e.timestamp_ns;
+
+        if (!prefix.empty() && e.name.compare(0, prefix.size(), prefix) != 0)
+            continue;
+        if (id >= 0 && e.breaker_id != uint64_t(id))
+            continue;
+        if (to >= 0 && e.to != to)
+            continue;
+        if (e.timestamp_ns < since_ns)
+            continue;
+
+        printf("%s #%u %s %s -> %s gen=%llu requests=%llu successes=%llu failures=%llu "
+            "consecutive_successes=%llu consecutive_failures=%llu",
+            formatTime(e.timestamp_ns).c_str(), e.breaker_id, e.name.c_str(),
+            cppbreaker::CircuitBreaker::StateString(cppbreaker::State(e.from)).c_str(),
+            cppbreaker::CircuitBreaker::StateString(cppbreaker::State(e.to)).c_str(),
+            (unsigned long long)e.generation, (unsigned long long)e.requests,
+            (unsigned long long)e.total_successes, (unsigned long long)e.total_failures,
+            (unsigned long long)e.consecutive_successes, (unsigned long long)e.consecutive_failures);
+        if (e.override != cppbreaker::OVERRIDE_NONE)
+            printf(" override=%s", cppbreaker::CircuitBreaker::OverrideString(cppbreaker::Override(e.override)).c_str());
+        if (open_ns >= 0)
+            printf(" open_for=%.3fs", double(open_ns) / 1e9);
+        printf("\n");
+    }
+    return 0;
+}
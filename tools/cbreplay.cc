@@ -0,0 +1,238 @@
+// cbreplay replays an outcome trace recorded with cppbreaker::OutcomeTraceWriter through candidate
+// breaker configurations, in parallel, and reports how each one would have behaved.
+//
+//   cbreplay [-j threads] [-b bucket_ms] [-u unhealthy_ratio] [-m min_bucket_requests] <trace> <configs>
+//
+// The configs file has one candidate per line, a label followed by key=value settings:
+//
+//   # label        settings
+//   default        timeout=60s
+//   fast           timeout=5s interval=10s consecutive_failures=3
+//   ratio          timeout=30s interval=10s min_requests=20 failure_ratio=0.5 max_requests=3
+//
+// Durations take a ms, s or m suffix. consecutive_failures=N trips after more than N consecutive failures,
+// min_requests and failure_ratio trip on the failure ratio; both rules may be combined.
+
+#include "circuit_breaker.h"
+#include "outcome_trace.h"
+#include "replay.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+
+static void usage()
+{
+    fprintf(stderr, "usage: cbreplay [-j threads] [-b bucket_ms] [-u unhealthy_ratio] [-m min_bucket_requests] "
+        "<trace> <configs>\n");
+}
+
+static bool parseDuration(const std::string& v, std::chrono::nanoseconds* d)
+{
+    char* end = nullptr;
+    double n = strtod(v.c_str(), &end);
+    std::string unit(end);
+    double ns;
+    if (unit == "ms")
+        ns = n * 1e6;
+    else if (unit == "s")
+        ns = n * 1e9;
+    else if (unit == "m")
+        ns = n * 60e9;
+    else
+        return false;
+    *d = std::chrono::nanoseconds(int64_t(ns));
+    return true;
+}
+
+struct Candidate
+{
+    std::string label;
+    cppbreaker::Settings settings;
+};
+
+static bool parseCandidate(const std::string& line, Candidate* c, std::string* err)
+{
+    std::istringstream in(line);
+    in >> c->label;
+
+    long consecutive = -1;
+    long min_requests = -1;
+    double failure_ratio = -1;
+    std::string kv;
+    while (in >> kv)
+    {
+        auto eq = kv.find('=');
+        if (eq == std::string::npos)
+        {
+            *err = "expected key=value: " + kv;
+            return false;
+        }
+        std::string key = kv.substr(0, eq);
+        std::string value = kv.substr(eq + 1);
+        bool ok = true;
+        if (key == "timeout")
+            ok = parseDuration(value, &c->settings.timeout);
+        else if (key == "interval")
+            ok = parseDuration(value, &c->settings.interval);
+        else if (key == "max_requests")
+            c->settings.max_requests = uint32_t(atol(value.c_str()));
+        else if (key == "consecutive_failures")
+            consecutive = atol(value.c_str());
+        else if (key == "min_requests")
+            min_requests = atol(value.c_str());
+        else if (key == "failure_ratio")
+            failure_ratio = atof(value.c_str());
+        else
+            ok = false;
+        if (!ok)
+        {
+            *err = "bad setting: " + kv;
+            return false;
+        }
+    }
+
+    if (min_requests >= 0 || failure_ratio >= 0)
+    {
+        min_requests = std::max(min_requests, 1L);
+        failure_ratio = failure_ratio < 0 ? 0.5 : failure_ratio;
+        c->settings.ready_to_trip = [=](const cppbreaker::Counts& counts) {
+            if (consecutive >= 0 && counts.consecutive_failures > uint64_t(consecutive))
+                return true;
+            return counts.requests >= uint64_t(min_requests) &&
+                double(counts.total_failures) >= failure_ratio * double(counts.requests);
+        };
+    }
+    else if (consecutive >= 0)
+    {
+        c->settings.ready_to_trip = [=](const cppbreaker::Counts& counts) {
+            return counts.consecutive_failures > uint64_t(consecutive);
+        };
+    }
+    return true;
+}
+
+static std::string seconds(std::chrono::nanoseconds d)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.3f", std::chrono::duration<double>(d).count());
+    return buf;
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    cppbreaker::ReplayOptions options;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:b:u:m:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'j':
+            threads = unsigned(std::max(1, atoi(optarg)));
+            break;
+        case 'b':
+            options.bucket = std::chrono::milliseconds(std::max(1, atoi(optarg)));
+            break;
+        case 'u':
+            options.unhealthy_ratio = atof(optarg);
+            break;
+        case 'm':
+            options.min_bucket_requests = uint32_t(atoi(optarg));
+            break;
+        default:
+            usage();
+            return 2;
+        }
+    }
+    if (optind != argc - 2)
+    {
+        usage();
+        return 2;
+    }
+
+    cppbreaker::OutcomeTraceReader reader;
+    if (!reader.Open(argv[optind]))
+    {
+        fprintf(stderr, "cbreplay: cannot read trace %s\n", argv[optind]);
+        return 1;
+    }
+
+    std::vector<Candidate> candidates;
+    std::ifstream configs(argv[optind + 1]);
+    if (!configs)
+    {
+        fprintf(stderr, "cbreplay: cannot read configs %s\n", argv[optind + 1]);
+        return 1;
+    }
+    std::string line;
+    int lineno = 0;
+    while (std::getline(configs, line))
+    {
+        lineno++;
+        auto first = line.find_first_not_of(" \t");
+        if (first == std::string::npos || line[first] == '#')
+            continue;
+        Candidate c;
+        std::string err;
+        if (!parseCandidate(line, &c, &err))
+        {
+            fprintf(stderr, "cbreplay: %s:%d: %s\n", argv[optind + 1], lineno, err.c_str());
+            return 1;
+        }
+        candidates.push_back(c);
+    }
+
+    // the mapped records are used in place unless concurrent writers left them out of order
+    const cppbreaker::OutcomeRecord* records = reader.Records();
+    std::vector<cppbreaker::OutcomeRecord> sorted;
+    if (!cppbreaker::SortedByTime(records, reader.Size()))
+    {
+        sorted.assign(records, records + reader.Size());
+        std::stable_sort(sorted.begin(), sorted.end(),
+            [](const cppbreaker::OutcomeRecord& a, const cppbreaker::OutcomeRecord& b) {
+                return a.timestamp_ns < b.timestamp_ns;
+            });
+        records = sorted.data();
+    }
+
+    std::vector<cppbreaker::ReplayResult> results(candidates.size());
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < std::min<size_t>(threads, candidates.size()); t++)
+    {
+        workers.emplace_back([&]() {
+            for (size_t i = next++; i < candidates.size(); i = next++)
+            {
+                results[i] = cppbreaker::Replay(records, reader.Size(), candidates[i].label,
+                    candidates[i].settings, options);
+            }
+        });
+    }
+    for (auto& w : workers)
+        w.join();
+
+    printf("%-16s %10s %8s %10s %6s %6s %9s %12s %12s %9s %12s %12s\n", "CONFIG", "REQUESTS", "REJECT%",
+        "REJ_GOOD", "TRIPS", "FALSE", "DETECTED", "TTT_MEAN_S", "TTT_MAX_S", "RECOVERED", "REC_MEAN_S", "REC_MAX_S");
+    for (auto& r : results)
+    {
+        uint64_t rejected = r.rejected_good + r.rejected_bad;
+        printf("%-16s %10llu %7.2f%% %10llu %6llu %6llu %4llu/%-4llu %12s %12s %9llu %12s %12s\n",
+            r.label.c_str(), (unsigned long long)r.requests,
+            r.requests == 0 ? 0.0 : 100.0 * double(rejected) / double(r.requests),
+            (unsigned long long)r.rejected_good, (unsigned long long)r.trips, (unsigned long long)r.false_trips,
+            (unsigned long long)r.detected, (unsigned long long)r.incidents,
+            r.detected == 0 ? "-" : seconds(r.total_time_to_trip / r.detected).c_str(),
+            r.detected == 0 ? "-" : seconds(r.max_time_to_trip).c_str(),
+            (unsigned long long)r.recovered,
+            r.recovered == 0 ? "-" : seconds(r.total_recovery_time / r.recovered).c_str(),
+            r.recovered == 0 ? "-" : seconds(r.max_recovery_time).c_str());
+    }
+    return 0;
+}
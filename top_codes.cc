@@ -0,0 +1,85 @@
+#include "top_codes.h"
+
+#include <algorithm>
+
+namespace cppbreaker
+{
+    TopCodes::TopCodes(size_t slots)
+        : slots_(slots)
+    {
+        if (slots_ > kMaxSlots)
+            slots_ = kMaxSlots;
+        if (slots_ == 0)
+            slots_ = 1;
+        for (size_t i = 0; i < kMaxSlots; i++)
+        {
+            codes_[i] = 0;
+            counts_[i] = 0;
+            errors_[i] = 0;
+        }
+    }
+
+    void TopCodes::Add(int code)
+    {
+        lock();
+        // a free slot has count 0, it is the smallest and never matches
+        size_t hit = slots_;
+        size_t min = 0;
+        for (size_t i = 0; i < slots_; i++)
+        {
+            hit = (codes_[i] == code && counts_[i] != 0) ? i : hit;
+            min = counts_[i] < counts_[min] ? i : min;
+        }
+        if (hit == slots_)
+        {
+            codes_[min] = code;
+            errors_[min] = counts_[min];
+            hit = min;
+        }
+        counts_[hit]++;
+        total_++;
+        unlock();
+    }
+
+    void TopCodes::Clear()
+    {
+        lock();
+        for (size_t i = 0; i < slots_; i++)
+        {
+            counts_[i] = 0;
+            errors_[i] = 0;
+        }
+        total_ = 0;
+        unlock();
+    }
+
+    uint64_t TopCodes::Total() const
+    {
+        lock();
+        uint64_t total = total_;
+        unlock();
+        return total;
+    }
+
+    std::vector<CodeCount> TopCodes::Top() const
+    {
+        std::vector<CodeCount> ret;
+        ret.reserve(slots_);
+        lock();
+        for (size_t i = 0; i < slots_; i++)
+        {
+            if (counts_[i] == 0)
+                continue;
+            CodeCount c;
+            c.code = codes_[i];
+            c.count = counts_[i];
+            c.error = errors_[i];
+            ret.push_back(c);
+        }
+        unlock();
+        std::sort(ret.begin(), ret.end(), [](const CodeCount& a, const CodeCount& b) {
+            return a.count > b.count;
+        });
+        return ret;
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <sched.h>
+#include <vector>
+
+namespace cppbreaker
+{
+    // CodeCount is a result code and the times it was seen, of which at most error may belong to the
+    // codes it took the slot of
+    struct CodeCount
+    {
+        int code = 0;
+        uint64_t count = 0;
+        uint64_t error = 0;
+    };
+
+    // TopCodes keeps the most frequent result codes in a fixed number of slots with the space-saving
+    // algorithm: a code with a slot counts in it, any other code takes over the slot with the smallest
+    // count and inherits that count as its error. Every code seen more than Total() / slots times has
+    // a slot, and no count is below the true one.
+    //
+    // Add scans the slots once, picking the slot of the code and the smallest one with conditional
+    // moves, under a spin lock held for that scan only. Waiters pause between attempts and yield the CPU
+    // after kSpins of them, to a holder that may have been preempted.
+    class TopCodes
+    {
+    public:
+        static const size_t kMaxSlots = 16;
+        static const uint32_t kSpins = 64;
+
+        // slots is at most kMaxSlots
+        explicit TopCodes(size_t slots);
+
+        TopCodes(const TopCodes&) = delete;
+        TopCodes& operator=(const TopCodes&) = delete;
+
+        // Add counts code, which is not 0
+        void Add(int code);
+        void Clear();
+
+        // Total returns the codes added since the last Clear
+        uint64_t Total() const;
+        // Top returns the codes by decreasing count
+        std::vector<CodeCount> Top() const;
+
+    private:
+        void lock() const
+        {
+            for (uint32_t spins = 0; lock_.test_and_set(std::memory_order_acquire); spins++)
+            {
+                if (spins < kSpins)
+                {
+#if defined(__x86_64__) || defined(__i386__)
+                    __builtin_ia32_pause();
+#endif
+                }
+                else
+                {
+                    sched_yield();
+                }
+            }
+        }
+        void unlock() const
+        {
+            lock_.clear(std::memory_order_release);
+        }
+
+        size_t slots_;
+        uint64_t total_ = 0;
+        int codes_[kMaxSlots];
+        uint64_t counts_[kMaxSlots];
+        uint64_t errors_[kMaxSlots];
+        mutable std::atomic_flag lock_ = ATOMIC_FLAG_INIT;
+    };
+}
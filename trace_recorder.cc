@@ -0,0 +1,312 @@
+#include "trace_recorder.h"
+#include "circuit_breaker.h"
+#include "registry.h"
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <vector>
+
+
+namespace cppbreaker
+{
+
+    std::atomic<bool> TraceRecorder::enabled_(false);
+    std::atomic<uint32_t> TraceRecorder::sample_every_(1);
+
+    namespace
+    {
+        // Ring has a single writer, its thread, and publishes events through head. The slot of event
+        // head is written after head is published, readers tell overwritten slots by reading head again.
+        struct Ring
+        {
+            std::atomic<uint64_t> head{0};
+            TraceEvent events[TraceRecorder::kRingSize];
+        };
+
+        std::mutex& ringsMutex()
+        {
+            static std::mutex* mutex = new std::mutex();
+            return *mutex;
+        }
+
+        std::vector<Ring*>& rings()
+        {
+            static std::vector<Ring*>* rings = new std::vector<Ring*>();
+            return *rings;
+        }
+
+        // rings of exited threads, their events are exported until a new thread takes them over
+        std::vector<Ring*>& freeRings()
+        {
+            static std::vector<Ring*>* rings = new std::vector<Ring*>();
+            return *rings;
+        }
+
+        // RingHolder gives the ring of an exiting thread back to freeRings
+        struct RingHolder
+        {
+            Ring* ring = nullptr;
+            uint32_t tick = 0;
+
+            ~RingHolder()
+            {
+                if (ring == nullptr)
+                    return;
+                std::lock_guard<std::mutex> lock(ringsMutex());
+                freeRings().push_back(ring);
+            }
+        };
+
+        thread_local RingHolder tls_ring;
+
+        void push(const TraceEvent& ev)
+        {
+            Ring* ring = tls_ring.ring;
+            if (ring == nullptr)
+            {
+                std::lock_guard<std::mutex> lock(ringsMutex());
+                auto& free = freeRings();
+                if (!free.empty())
+                {
+                    ring = free.back();
+                    free.pop_back();
+                }
+                else
+                {
+                    ring = new Ring();
+                    rings().push_back(ring);
+                }
+                tls_ring.ring = ring;
+            }
+            uint64_t head = ring->head.load(std::memory_order_relaxed);
+            // the slot is not written before head, which readers check, is published
+            std::atomic_thread_fence(std::memory_order_release);
+            ring->events[head % TraceRecorder::kRingSize] = ev;
+            ring->head.store(head + 1, std::memory_order_release);
+        }
+
+        int64_t nowNs()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        void appendTs(std::string* out, const char* key, int64_t ns)
+        {
+            char buf[64];
+            snprintf(buf, sizeof(buf), ",\"%s\":%lld.%03lld", key, (long long)(ns / 1000), (long long)(ns % 1000));
+            out->append(buf);
+        }
+
+        void appendEscaped(std::string* out, const std::string& v)
+        {
+            for (char c : v)
+            {
+                if (c == '"' || c == '\\')
+                    out->push_back('\\');
+                if ((unsigned char)c < 0x20)
+                    c = ' ';
+                out->push_back(c);
+            }
+        }
+
+        const char* stateName(int st)
+        {
+            if (st == STATE_CLOSED)
+                return "closed";
+            else if (st == STATE_HALF_OPEN)
+                return "half open";
+            return "open";
+        }
+    }
+
+    void TraceRecorder::Enable(uint32_t sample_every)
+    {
+        sample_every_.store(sample_every == 0 ? 1 : sample_every, std::memory_order_relaxed);
+        enabled_.store(true, std::memory_order_release);
+    }
+
+    void TraceRecorder::Disable()
+    {
+        enabled_.store(false, std::memory_order_release);
+    }
+
+    void TraceRecorder::OnAdmission(uint32_t breaker_id, int code)
+    {
+        if (++tls_ring.tick % sample_every_.load(std::memory_order_relaxed) != 0)
+            return;
+
+        TraceEvent ev;
+        ev.ts_ns = nowNs();
+        ev.breaker_id = breaker_id;
+        ev.type = uint8_t(code == ResultCodeOK ? TRACE_ADMIT : TRACE_REJECT);
+        ev.from = ev.to = 0;
+        ev.reserved = 0;
+        ev.code = code;
+        push(ev);
+    }
+
+    void TraceRecorder::OnTransition(uint32_t breaker_id, int from, int to)
+    {
+        TraceEvent ev;
+        ev.ts_ns = nowNs();
+        ev.breaker_id = breaker_id;
+        ev.type = TRACE_TRANSITION;
+        ev.from = uint8_t(from);
+        ev.to = uint8_t(to);
+        ev.reserved = 0;
+        ev.code = 0;
+        push(ev);
+    }
+
+    std::string TraceRecorder::Export()
+    {
+        return Export(Registry::Instance());
+    }
+
+    std::string TraceRecorder::Export(Registry& registry)
+    {
+        std::vector<TraceEvent> events;
+        {
+            std::lock_guard<std::mutex> lock(ringsMutex());
+            for (auto ring : rings())
+            {
+                uint64_t head = ring->head.load(std::memory_order_acquire);
+                uint64_t begin = head > kRingSize ? head - kRingSize : 0;
+                size_t first = events.size();
+                for (uint64_t i = begin; i < head; i++)
+                    events.push_back(ring->events[i % kRingSize]);
+
+                // the writer went on meanwhile, the slots it may have written are dropped: the slot of
+                // event n is written while head is at most n, it overwrote event n - kRingSize
+                std::atomic_thread_fence(std::memory_order_acquire);
+                uint64_t after = ring->head.load(std::memory_order_relaxed);
+                uint64_t valid = after + 1 > kRingSize ? after + 1 - kRingSize : 0;
+                if (valid > begin)
+                {
+                    size_t drop = size_t(std::min(valid, head) - begin);
+                    events.erase(events.begin() + first, events.begin() + first + drop);
+                }
+            }
+        }
+        std::stable_sort(events.begin(), events.end(), [](const TraceEvent& a, const TraceEvent& b) {
+            return a.ts_ns < b.ts_ns;
+        });
+
+        std::map<uint32_t, std::string> names;
+        registry.ForEach([&](CircuitBreaker* cb) {
+            names[cb->GetId()] = cb->GetName();
+        });
+
+        std::string out;
+        out.reserve(events.size() * 100 + 256);
+        out.append("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        out.append("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"cppbreaker\"}}");
+
+        // one track per breaker
+        std::map<uint32_t, const TraceEvent*> last_transition;
+        for (auto& ev : events)
+        {
+            if (last_transition.count(ev.breaker_id) != 0)
+                continue;
+            last_transition[ev.breaker_id] = nullptr;
+
+            auto name = names.find(ev.breaker_id);
+            out.append(",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":");
+            out.append(std::to_string(ev.breaker_id));
+            out.append(",\"args\":{\"name\":\"");
+            if (name != names.end())
+                appendEscaped(&out, name->second);
+            else
+                out.append("breaker " + std::to_string(ev.breaker_id));
+            out.append("\"}}");
+        }
+
+        auto appendSpan = [&](const TraceEvent& from, int64_t end_ns) {
+            out.append(",\n{\"name\":\"");
+            out.append(stateName(from.to));
+            out.append("\",\"cat\":\"state\",\"ph\":\"X\",\"pid\":1,\"tid\":");
+            out.append(std::to_string(from.breaker_id));
+            appendTs(&out, "ts", from.ts_ns);
+            appendTs(&out, "dur", end_ns - from.ts_ns);
+            out.append("}");
+        };
+
+        for (auto& ev : events)
+        {
+            out.append(",\n{\"name\":\"");
+            if (ev.type == TRACE_TRANSITION)
+            {
+                out.append(stateName(ev.from));
+                out.append(" -> ");
+                out.append(stateName(ev.to));
+                out.append("\",\"cat\":\"transition\"");
+            }
+            else if (ev.type == TRACE_ADMIT)
+            {
+                out.append("admit\",\"cat\":\"admission\"");
+            }
+            else
+            {
+                out.append("reject\",\"cat\":\"admission\"");
+            }
+            out.append(",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":");
+            out.append(std::to_string(ev.breaker_id));
+            appendTs(&out, "ts", ev.ts_ns);
+            if (ev.type == TRACE_REJECT)
+            {
+                out.append(",\"args\":{\"code\":");
+                out.append(std::to_string(ev.code));
+                out.append("}");
+            }
+            out.append("}");
+
+            if (ev.type == TRACE_TRANSITION)
+            {
+                const TraceEvent*& prev = last_transition[ev.breaker_id];
+                if (prev != nullptr)
+                    appendSpan(*prev, ev.ts_ns);
+                prev = &ev;
+            }
+        }
+
+        // the current state lasts until the end of the trace
+        int64_t end_ns = events.empty() ? 0 : events.back().ts_ns;
+        for (auto& it : last_transition)
+        {
+            if (it.second != nullptr)
+                appendSpan(*it.second, end_ns);
+        }
+
+        out.append("\n]}\n");
+        return out;
+    }
+
+    size_t TraceRecorder::Rings()
+    {
+        std::lock_guard<std::mutex> lock(ringsMutex());
+        return rings().size();
+    }
+
+    void TraceRecorder::Clear()
+    {
+        std::lock_guard<std::mutex> lock(ringsMutex());
+        auto& all = rings();
+        auto& free = freeRings();
+        std::vector<Ring*> live;
+        for (auto ring : all)
+        {
+            if (std::find(free.begin(), free.end(), ring) != free.end())
+            {
+                delete ring;
+                continue;
+            }
+            ring->head.store(0, std::memory_order_release);
+            live.push_back(ring);
+        }
+        all.swap(live);
+        free.clear();
+    }
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace cppbreaker
+{
+    class Registry;
+
+    enum TraceEventType
+    {
+        TRACE_ADMIT = 0,
+        TRACE_REJECT = 1,
+        TRACE_TRANSITION = 2
+    };
+
+    struct TraceEvent
+    {
+        // steady clock, nanoseconds
+        int64_t ts_ns;
+        uint32_t breaker_id;
+        uint8_t type;
+        uint8_t from;
+        uint8_t to;
+        uint8_t reserved;
+        // result code of a rejection
+        int32_t code;
+    };
+
+    // TraceRecorder records sampled admissions and rejections and every transition of all breakers
+    // into per thread rings, and exports them in the Chrome trace event format
+    // (chrome://tracing, ui.perfetto.dev), one track per breaker.
+    //
+    // It is always compiled in, while disabled a breaker pays one predicted branch for it.
+    class TraceRecorder
+    {
+    public:
+        // kRingSize events are kept per thread, older ones are overwritten. The ring of a thread that
+        // exits goes to the next thread that records, so rings are only as many as threads at once.
+        static const uint32_t kRingSize = 1 << 16;
+
+        // Enable starts recording, admissions and rejections are sampled 1 in sample_every.
+        static void Enable(uint32_t sample_every = 1);
+        static void Disable();
+
+        static bool Enabled()
+        {
+            return __builtin_expect(enabled_.load(std::memory_order_relaxed), false);
+        }
+
+        // OnAdmission is called by the breaker with the result of beforeRequest
+        static void OnAdmission(uint32_t breaker_id, int code);
+        static void OnTransition(uint32_t breaker_id, int from, int to);
+
+        // Export writes everything recorded so far as Chrome trace event JSON.
+        // Breakers are named after the registry, export while the breakers are still alive.
+        // Events overwritten while they are copied are skipped.
+        static std::string Export();
+        static std::string Export(Registry& registry);
+
+        // Rings returns the rings allocated
+        static size_t Rings();
+
+        // Clear drops the recorded events and frees the rings of exited threads, call it while the
+        // recorder is disabled.
+        static void Clear();
+
+    private:
+        static std::atomic<bool> enabled_;
+        static std::atomic<uint32_t> sample_every_;
+    };
+}
@@ -0,0 +1,510 @@
+#include "trip_expression.h"
+#include "circuit_breaker.h"
+#include "metrics.h"
+
+#include <cstdlib>
+#include <cstring>
+
+
+namespace cppbreaker
+{
+
+    namespace
+    {
+        enum Variable
+        {
+            VAR_REQUESTS,
+            VAR_TOTAL_SUCCESSES,
+            VAR_TOTAL_FAILURES,
+            VAR_CONSECUTIVE_SUCCESSES,
+            VAR_CONSECUTIVE_FAILURES,
+            VAR_FAILURE_RATIO,
+            VAR_SUCCESS_RATIO,
+            VAR_P50_MS,
+            VAR_P90_MS,
+            VAR_P99_MS
+        };
+
+        const char* const kVariables[] = {
+            "requests",
+            "total_successes",
+            "total_failures",
+            "consecutive_successes",
+            "consecutive_failures",
+            "failure_ratio",
+            "success_ratio",
+            "p50_ms",
+            "p90_ms",
+            "p99_ms",
+        };
+
+        // latencyQuantileMs interpolates linearly within the bucket holding the quantile,
+        // the overflow bucket counts as the largest bound
+        double latencyQuantileMs(const uint64_t* buckets, double q)
+        {
+            uint64_t total = 0;
+            for (int i = 0; i <= LatencyHistogram::kBuckets; i++)
+                total += buckets[i];
+            if (total == 0)
+                return 0;
+
+            double rank = q * double(total);
+            // the first bucket whose cumulative count reaches rank holds the quantile
+            uint64_t target = uint64_t(rank);
+            target += double(target) < rank ? 1 : 0;
+            uint64_t cum = 0;
+            for (int i = 0; i < LatencyHistogram::kBuckets; i++)
+            {
+                if (buckets[i] != 0 && cum + buckets[i] >= target)
+                {
+                    double lower = i == 0 ? 0 : double(LatencyHistogram::kBoundsNs[i - 1]);
+                    double upper = double(LatencyHistogram::kBoundsNs[i]);
+                    return (lower + (upper - lower) * (rank - double(cum)) / double(buckets[i])) / 1e6;
+                }
+                cum += buckets[i];
+            }
+            return double(LatencyHistogram::kBoundsNs[LatencyHistogram::kBuckets - 1]) / 1e6;
+        }
+
+        double variable(uint8_t var, const TripInputs& in)
+        {
+            const Counts& c = *in.counts;
+            switch (var)
+            {
+            case VAR_REQUESTS:
+                return double(c.requests);
+            case VAR_TOTAL_SUCCESSES:
+                return double(c.total_successes);
+            case VAR_TOTAL_FAILURES:
+                return double(c.total_failures);
+            case VAR_CONSECUTIVE_SUCCESSES:
+                return double(c.consecutive_successes);
+            case VAR_CONSECUTIVE_FAILURES:
+                return double(c.consecutive_failures);
+            case VAR_FAILURE_RATIO:
+                return c.requests == 0 ? 0 : double(c.total_failures) / double(c.requests);
+            case VAR_SUCCESS_RATIO:
+                return c.requests == 0 ? 0 : double(c.total_successes) / double(c.requests);
+            case VAR_P50_MS:
+                return in.latency_buckets == nullptr ? 0 : latencyQuantileMs(in.latency_buckets, 0.5);
+            case VAR_P90_MS:
+                return in.latency_buckets == nullptr ? 0 : latencyQuantileMs(in.latency_buckets, 0.9);
+            default:
+                return in.latency_buckets == nullptr ? 0 : latencyQuantileMs(in.latency_buckets, 0.99);
+            }
+        }
+    }
+
+    // Parser is a recursive descent parser emitting code as it goes
+    class TripExpression::Parser
+    {
+    public:
+        Parser(const std::string& source, TripExpression* expr) : src_(source), expr_(expr) {}
+
+        bool Parse(std::string* error)
+        {
+            next();
+            if (parseOr() && tok_ != T_END)
+                fail("unexpected " + text());
+            if (!error_.empty())
+            {
+                if (error != nullptr)
+                    *error = error_;
+                return false;
+            }
+            return true;
+        }
+
+    private:
+        enum Token
+        {
+            T_END,
+            T_NUMBER,
+            T_IDENT,
+            T_LPAREN,
+            T_RPAREN,
+            T_OR,
+            T_AND,
+            T_NOT,
+            T_LT,
+            T_LE,
+            T_GT,
+            T_GE,
+            T_EQ,
+            T_NE,
+            T_ADD,
+            T_SUB,
+            T_MUL,
+            T_DIV,
+            T_BAD
+        };
+
+        void next()
+        {
+            while (pos_ < src_.size() && (src_[pos_] == ' ' || src_[pos_] == '\t'))
+                pos_++;
+            start_ = pos_;
+            if (pos_ >= src_.size())
+            {
+                tok_ = T_END;
+                return;
+            }
+
+            char c = src_[pos_];
+            char n = pos_ + 1 < src_.size() ? src_[pos_ + 1] : '\0';
+            if ((c >= '0' && c <= '9') || c == '.')
+            {
+                char* end = nullptr;
+                number_ = strtod(src_.c_str() + pos_, &end);
+                pos_ = size_t(end - src_.c_str());
+                tok_ = pos_ == start_ ? T_BAD : T_NUMBER;
+                if (pos_ == start_)
+                    pos_++;
+                return;
+            }
+            if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_')
+            {
+                while (pos_ < src_.size() && ((src_[pos_] >= 'a' && src_[pos_] <= 'z') ||
+                    (src_[pos_] >= 'A' && src_[pos_] <= 'Z') || (src_[pos_] >= '0' && src_[pos_] <= '9') ||
+                    src_[pos_] == '_'))
+                    pos_++;
+                tok_ = T_IDENT;
+                return;
+            }
+
+            pos_++;
+            switch (c)
+            {
+            case '(':
+                tok_ = T_LPAREN;
+                return;
+            case ')':
+                tok_ = T_RPAREN;
+                return;
+            case '+':
+                tok_ = T_ADD;
+                return;
+            case '-':
+                tok_ = T_SUB;
+                return;
+            case '*':
+                tok_ = T_MUL;
+                return;
+            case '/':
+                tok_ = T_DIV;
+                return;
+            }
+            pos_++;
+            if (c == '|' && n == '|')
+                tok_ = T_OR;
+            else if (c == '&' && n == '&')
+                tok_ = T_AND;
+            else if (c == '<' && n == '=')
+                tok_ = T_LE;
+            else if (c == '>' && n == '=')
+                tok_ = T_GE;
+            else if (c == '=' && n == '=')
+                tok_ = T_EQ;
+            else if (c == '!' && n == '=')
+                tok_ = T_NE;
+            else
+            {
+                pos_--;
+                if (c == '<')
+                    tok_ = T_LT;
+                else if (c == '>')
+                    tok_ = T_GT;
+                else if (c == '!')
+                    tok_ = T_NOT;
+                else
+                    tok_ = T_BAD;
+            }
+        }
+
+        std::string text() const
+        {
+            if (tok_ == T_END)
+                return "end of expression";
+            return "'" + src_.substr(start_, pos_ - start_) + "' at " + std::to_string(start_);
+        }
+
+        bool fail(const std::string& msg)
+        {
+            if (error_.empty())
+                error_ = msg;
+            return false;
+        }
+
+        bool emit(Op op, int stack_change, double value = 0, uint8_t var = 0)
+        {
+            if (expr_->code_.size() >= 0xffff)
+                return fail("expression too long");
+            depth_ += stack_change;
+            if (depth_ > kMaxStack)
+                return fail("expression too deep");
+            expr_->code_.push_back(Instr{ op, var, 0, value });
+            return true;
+        }
+
+        // logical operators keep the deciding operand and jump past the other one
+        bool parseLogical(Token tok, Op op, bool (Parser::*operand)())
+        {
+            if (!(this->*operand)())
+                return false;
+            while (tok_ == tok)
+            {
+                size_t at = expr_->code_.size();
+                if (!emit(op, -1))
+                    return false;
+                next();
+                if (!(this->*operand)() || !emit(OP_BOOL, 0))
+                    return false;
+                expr_->code_[at].jump = uint16_t(expr_->code_.size());
+            }
+            return true;
+        }
+
+        bool parseOr()
+        {
+            return parseLogical(T_OR, OP_OR, &Parser::parseAnd);
+        }
+
+        bool parseAnd()
+        {
+            return parseLogical(T_AND, OP_AND, &Parser::parseNot);
+        }
+
+        bool parseNot()
+        {
+            if (tok_ != T_NOT)
+                return parseCompare();
+            next();
+            return parseNot() && emit(OP_NOT, 0);
+        }
+
+        bool parseCompare()
+        {
+            size_t lhs = expr_->code_.size();
+            if (!parseAdd())
+                return false;
+            while (tok_ >= T_LT && tok_ <= T_NE)
+            {
+                int cmp = tok_ - T_LT;
+                next();
+                if (!parseAdd() || !emit(Op(OP_LT + cmp), -1))
+                    return false;
+
+                // most rules compare variables to constants, do it in one instruction
+                auto& code = expr_->code_;
+                if (code.size() == lhs + 3 && code[lhs].op == OP_VAR && code[lhs + 1].op == OP_CONST)
+                {
+                    code[lhs].op = Op(OP_VAR_LT + cmp);
+                    code[lhs].value = code[lhs + 1].value;
+                    code.resize(lhs + 1);
+                }
+            }
+            return true;
+        }
+
+        bool parseAdd()
+        {
+            if (!parseMul())
+                return false;
+            while (tok_ == T_ADD || tok_ == T_SUB)
+            {
+                Op op = tok_ == T_ADD ? OP_ADD : OP_SUB;
+                next();
+                if (!parseMul() || !emit(op, -1))
+                    return false;
+            }
+            return true;
+        }
+
+        bool parseMul()
+        {
+            if (!parseUnary())
+                return false;
+            while (tok_ == T_MUL || tok_ == T_DIV)
+            {
+                Op op = tok_ == T_MUL ? OP_MUL : OP_DIV;
+                next();
+                if (!parseUnary() || !emit(op, -1))
+                    return false;
+            }
+            return true;
+        }
+
+        bool parseUnary()
+        {
+            if (tok_ != T_SUB)
+                return parsePrimary();
+            next();
+            return parseUnary() && emit(OP_NEG, 0);
+        }
+
+        bool parsePrimary()
+        {
+            if (tok_ == T_NUMBER)
+            {
+                double v = number_;
+                next();
+                return emit(OP_CONST, 1, v);
+            }
+            if (tok_ == T_IDENT)
+            {
+                std::string name = src_.substr(start_, pos_ - start_);
+                for (size_t i = 0; i < sizeof(kVariables) / sizeof(kVariables[0]); i++)
+                {
+                    if (name != kVariables[i])
+                        continue;
+                    if (i >= VAR_P50_MS)
+                        expr_->uses_latency_ = true;
+                    next();
+                    return emit(OP_VAR, 1, 0, uint8_t(i));
+                }
+                return fail("unknown variable " + text());
+            }
+            if (tok_ == T_LPAREN)
+            {
+                next();
+                if (!parseOr())
+                    return false;
+                if (tok_ != T_RPAREN)
+                    return fail("expected ')' instead of " + text());
+                next();
+                return true;
+            }
+            return fail("unexpected " + text());
+        }
+
+        const std::string& src_;
+        TripExpression* expr_;
+        size_t pos_ = 0;
+        size_t start_ = 0;
+        Token tok_ = T_END;
+        double number_ = 0;
+        int depth_ = 0;
+        std::string error_;
+    };
+
+    std::shared_ptr<TripExpression> TripExpression::Compile(const std::string& source, std::string* error)
+    {
+        std::shared_ptr<TripExpression> expr(new TripExpression());
+        expr->source_ = source;
+        Parser parser(source, expr.get());
+        if (!parser.Parse(error))
+            return nullptr;
+        return expr;
+    }
+
+    bool TripExpression::Evaluate(const TripInputs& in) const
+    {
+        return Value(in) != 0;
+    }
+
+    double TripExpression::Value(const TripInputs& in) const
+    {
+        double stack[kMaxStack];
+        int sp = 0;
+        const Instr* code = code_.data();
+        size_t n = code_.size();
+        for (size_t pc = 0; pc < n; pc++)
+        {
+            const Instr& i = code[pc];
+            switch (i.op)
+            {
+            case OP_CONST:
+                stack[sp++] = i.value;
+                break;
+            case OP_VAR:
+                stack[sp++] = variable(i.var, in);
+                break;
+            case OP_NEG:
+                stack[sp - 1] = -stack[sp - 1];
+                break;
+            case OP_NOT:
+                stack[sp - 1] = stack[sp - 1] == 0 ? 1 : 0;
+                break;
+            case OP_BOOL:
+                stack[sp - 1] = stack[sp - 1] != 0 ? 1 : 0;
+                break;
+            case OP_ADD:
+                sp--;
+                stack[sp - 1] += stack[sp];
+                break;
+            case OP_SUB:
+                sp--;
+                stack[sp - 1] -= stack[sp];
+                break;
+            case OP_MUL:
+                sp--;
+                stack[sp - 1] *= stack[sp];
+                break;
+            case OP_DIV:
+                sp--;
+                stack[sp - 1] = stack[sp] == 0 ? 0 : stack[sp - 1] / stack[sp];
+                break;
+            case OP_LT:
+                sp--;
+                stack[sp - 1] = stack[sp - 1] < stack[sp] ? 1 : 0;
+                break;
+            case OP_LE:
+                sp--;
+                stack[sp - 1] = stack[sp - 1] <= stack[sp] ? 1 : 0;
+                break;
+            case OP_GT:
+                sp--;
+                stack[sp - 1] = stack[sp - 1] > stack[sp] ? 1 : 0;
+                break;
+            case OP_GE:
+                sp--;
+                stack[sp - 1] = stack[sp - 1] >= stack[sp] ? 1 : 0;
+                break;
+            case OP_EQ:
+                sp--;
+                stack[sp - 1] = stack[sp - 1] == stack[sp] ? 1 : 0;
+                break;
+            case OP_NE:
+                sp--;
+                stack[sp - 1] = stack[sp - 1] != stack[sp] ? 1 : 0;
+                break;
+            case OP_VAR_LT:
+                stack[sp++] = variable(i.var, in) < i.value ? 1 : 0;
+                break;
+            case OP_VAR_LE:
+                stack[sp++] = variable(i.var, in) <= i.value ? 1 : 0;
+                break;
+            case OP_VAR_GT:
+                stack[sp++] = variable(i.var, in) > i.value ? 1 : 0;
+                break;
+            case OP_VAR_GE:
+                stack[sp++] = variable(i.var, in) >= i.value ? 1 : 0;
+                break;
+            case OP_VAR_EQ:
+                stack[sp++] = variable(i.var, in) == i.value ? 1 : 0;
+                break;
+            case OP_VAR_NE:
+                stack[sp++] = variable(i.var, in) != i.value ? 1 : 0;
+                break;
+            case OP_AND:
+                if (stack[sp - 1] == 0)
+                    pc = size_t(i.jump) - 1;
+                else
+                    sp--;
+                break;
+            case OP_OR:
+                if (stack[sp - 1] != 0)
+                {
+                    stack[sp - 1] = 1;
+                    pc = size_t(i.jump) - 1;
+                }
+                else
+                {
+                    sp--;
+                }
+                break;
+            }
+        }
+        return stack[0];
+    }
+}
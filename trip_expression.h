@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace cppbreaker
+{
+    class Counts;
+
+    // TripInputs are what a TripExpression is evaluated against
+    struct TripInputs
+    {
+        const Counts* counts = nullptr;
+        // non-cumulative LatencyHistogram buckets of the requests since Counts were last cleared,
+        // nullptr when unknown, then latency variables are 0
+        const uint64_t* latency_buckets = nullptr;
+    };
+
+    // TripExpression is a trip rule written in a small expression language, compiled once
+    // into flat bytecode for a stack machine. Evaluate does not allocate.
+    //
+    //   requests >= 20 && failure_ratio >= 0.5 || consecutive_failures > 5 || p99_ms > 800
+    //
+    // Variables are the fields of Counts, failure_ratio and success_ratio (of requests),
+    // and p50_ms, p90_ms, p99_ms of the latencies since Counts were last cleared.
+    // Operators are, by increasing precedence, ||, &&, !, comparisons (< <= > >= == !=),
+    // + -, * /, unary minus, and parentheses. Comparisons and logical operators give 1 or 0,
+    // && and || short circuit, a division by 0 gives 0. The rule trips when the value is not 0.
+    class TripExpression
+    {
+    public:
+        // kMaxStack is the deepest expression accepted
+        static const int kMaxStack = 16;
+
+        // Compile returns nullptr and describes the problem in error if source is not a valid expression
+        static std::shared_ptr<TripExpression> Compile(const std::string& source, std::string* error);
+
+        bool Evaluate(const TripInputs& in) const;
+        double Value(const TripInputs& in) const;
+
+        // UsesLatency returns whether the expression refers to latency variables
+        bool UsesLatency() const
+        {
+            return uses_latency_;
+        }
+        const std::string& Source() const
+        {
+            return source_;
+        }
+
+    private:
+        enum Op : uint8_t
+        {
+            OP_CONST,
+            OP_VAR,
+            OP_NEG,
+            OP_NOT,
+            OP_ADD,
+            OP_SUB,
+            OP_MUL,
+            OP_DIV,
+            OP_LT,
+            OP_LE,
+            OP_GT,
+            OP_GE,
+            OP_EQ,
+            OP_NE,
+            // variable compared to a constant, fused from OP_VAR, OP_CONST and a comparison
+            OP_VAR_LT,
+            OP_VAR_LE,
+            OP_VAR_GT,
+            OP_VAR_GE,
+            OP_VAR_EQ,
+            OP_VAR_NE,
+            // pop, or keep the top and jump when it decides the result
+            OP_AND,
+            OP_OR,
+            // turn the top into 1 or 0
+            OP_BOOL
+        };
+
+        struct Instr
+        {
+            Op op;
+            uint8_t var;
+            // target of OP_AND and OP_OR
+            uint16_t jump;
+            double value;
+        };
+
+        class Parser;
+
+        TripExpression() {}
+
+        std::string source_;
+        std::vector<Instr> code_;
+        bool uses_latency_ = false;
+    };
+}
@@ -0,0 +1,277 @@
+#include "trip_policy.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+
+namespace cppbreaker
+{
+
+    namespace
+    {
+        uint64_t packFloats(float lo, float hi)
+        {
+            uint32_t a, b;
+            memcpy(&a, &lo, sizeof(a));
+            memcpy(&b, &hi, sizeof(b));
+            return uint64_t(a) | (uint64_t(b) << 32);
+        }
+
+        void unpackFloats(uint64_t word, float* lo, float* hi)
+        {
+            uint32_t a = uint32_t(word);
+            uint32_t b = uint32_t(word >> 32);
+            memcpy(lo, &a, sizeof(a));
+            memcpy(hi, &b, sizeof(b));
+        }
+
+        // addCounts adds requests and failures to the counts of a bucket, saturating each
+        uint64_t addCounts(uint64_t counts, uint64_t requests, uint64_t failures)
+        {
+            requests = std::min<uint64_t>(UINT32_MAX, (counts >> 32) + requests);
+            failures = std::min<uint64_t>(UINT32_MAX, uint32_t(counts) + failures);
+            return (requests << 32) | failures;
+        }
+    }
+
+    EwmaTripPolicy::EwmaTripPolicy(const Options& options)
+        : options_(options)
+    {
+        if (options_.half_life.count() <= 0)
+            options_.half_life = std::chrono::seconds(10);
+    }
+
+    double EwmaTripPolicy::decay(int64_t last_ns, int64_t now_ns) const
+    {
+        // outcomes of threads that read the clock a little earlier count as simultaneous
+        if (now_ns <= last_ns)
+            return 1;
+        return exp2(-double(now_ns - last_ns) / double(options_.half_life.count()));
+    }
+
+    bool EwmaTripPolicy::Observe(Word128* state, int64_t now_ns, bool success, std::chrono::nanoseconds) const
+    {
+        Word128 next = Update128(state, [&](Word128 cur) {
+            int64_t last = int64_t(cur.lo);
+            float r, f;
+            unpackFloats(cur.hi, &r, &f);
+            double d = decay(last, now_ns);
+            r = float(r * d + 1);
+            f = float(f * d + (success ? 0 : 1));
+            return Word128{uint64_t(now_ns > last ? now_ns : last), packFloats(r, f)};
+        });
+        float requests, failures;
+        unpackFloats(next.hi, &requests, &failures);
+
+        return !success && requests >= options_.min_volume && failures >= options_.failure_ratio * requests;
+    }
+
+    void EwmaTripPolicy::OnClose(Word128* state, int64_t now_ns) const
+    {
+        Store128(state, Word128{uint64_t(now_ns), 0});
+    }
+
+    void EwmaTripPolicy::Rates(const Word128* state, int64_t now_ns, double* requests, double* failures) const
+    {
+        Word128 cur = Read128(state);
+        float r, f;
+        unpackFloats(cur.hi, &r, &f);
+        double d = decay(int64_t(cur.lo), now_ns);
+        *requests = r * d;
+        *failures = f * d;
+    }
+
+    AnomalyTripPolicy::AnomalyTripPolicy(const Options& options)
+        : options_(options)
+    {
+        alpha_ = 1 / std::max(1.0, options_.window);
+        beta_ = 1 / std::max(1.0, options_.baseline);
+    }
+
+    bool AnomalyTripPolicy::observe(Word128* word, double x, double k, double min_delta, uint32_t* volume) const
+    {
+        bool anomalous = false;
+        Word128 next = Update128(word, [&](Word128 cur) {
+            float current, mean, var;
+            unpackFloats(cur.lo, &current, &mean);
+            uint32_t seen = uint32_t(cur.hi >> 32);
+            uint32_t bits = uint32_t(cur.hi);
+            memcpy(&var, &bits, sizeof(var));
+
+            if (seen != UINT32_MAX)
+                seen++;
+            // the first outcomes are averaged evenly, so that the averages do not lean to where they started
+            double alpha = std::max(alpha_, 1.0 / seen);
+            double beta = std::max(beta_, 1.0 / seen);
+
+            current = float(current + alpha * (x - current));
+            double d = current - mean;
+            // nothing is anomalous while the baseline is learned
+            anomalous = seen > options_.min_volume && d > std::max(k * std::sqrt(double(var)), min_delta);
+            if (!anomalous)
+            {
+                mean = float(mean + beta * d);
+                var = float((1 - beta) * (var + beta * d * d));
+            }
+
+            memcpy(&bits, &var, sizeof(bits));
+            return Word128{packFloats(current, mean), uint64_t(bits) | (uint64_t(seen) << 32)};
+        });
+        *volume = uint32_t(next.hi >> 32);
+        return anomalous;
+    }
+
+    bool AnomalyTripPolicy::Observe(Word128* state, int64_t, bool success, std::chrono::nanoseconds latency) const
+    {
+        uint32_t volume;
+        bool errors = observe(&state[0], success ? 0 : 1, options_.k, options_.min_error_delta, &volume);
+        bool slow = false;
+        if (options_.latency_k != 0)
+        {
+            slow = observe(&state[1], double(latency.count()), options_.latency_k,
+                double(options_.min_latency_delta.count()), &volume);
+        }
+        return (errors && !success) || slow;
+    }
+
+    void AnomalyTripPolicy::OnClose(Word128* state, int64_t) const
+    {
+        for (int i = 0; i < 2; i++)
+        {
+            Update128(&state[i], [](Word128 cur) {
+                float current, mean;
+                unpackFloats(cur.lo, &current, &mean);
+                return Word128{packFloats(mean, mean), cur.hi};
+            });
+        }
+    }
+
+    void AnomalyTripPolicy::Read(const Word128* state, Signal* errors, Signal* latency, uint32_t* volume) const
+    {
+        Signal* signals[2] = {errors, latency};
+        for (int i = 0; i < 2; i++)
+        {
+            Word128 cur = Read128(&state[i]);
+            float current, mean, var;
+            unpackFloats(cur.lo, &current, &mean);
+            uint32_t bits = uint32_t(cur.hi);
+            memcpy(&var, &bits, sizeof(var));
+            signals[i]->current = current;
+            signals[i]->mean = mean;
+            signals[i]->stddev = std::sqrt(double(var));
+            if (i == 0)
+                *volume = uint32_t(cur.hi >> 32);
+        }
+    }
+
+    BurnRateTripPolicy::BurnRateTripPolicy(const Options& options)
+        : options_(options)
+    {
+        Options defaults;
+        if (options_.slo <= 0 || options_.slo >= 1)
+            options_.slo = defaults.slo;
+        if (options_.fine_buckets == 0)
+            options_.fine_buckets = defaults.fine_buckets;
+        if (options_.coarse_buckets == 0)
+            options_.coarse_buckets = defaults.coarse_buckets;
+        if (options_.short_window.count() <= 0)
+            options_.short_window = defaults.short_window;
+        if (options_.long_window < options_.short_window)
+            options_.long_window = options_.short_window;
+        fine_ns_ = std::max<int64_t>(1, options_.short_window.count() / options_.fine_buckets);
+        coarse_ns_ = std::max<int64_t>(fine_ns_, options_.long_window.count() / options_.coarse_buckets);
+    }
+
+    void BurnRateTripPolicy::rollUp(Word128* state, Word128 b) const
+    {
+        uint64_t coarse = b.lo * uint64_t(fine_ns_) / uint64_t(coarse_ns_);
+        Word128* word = &state[options_.fine_buckets + coarse % options_.coarse_buckets];
+        Update128(word, [&](Word128 cur) {
+            if (cur.lo == coarse)
+                return Word128{coarse, addCounts(cur.hi, b.hi >> 32, uint32_t(b.hi))};
+            // a bucket that wrapped around is older than the long window, and so is a late roll up
+            if (cur.lo < coarse)
+                return Word128{coarse, b.hi};
+            return cur;
+        });
+    }
+
+    bool BurnRateTripPolicy::Observe(Word128* state, int64_t now_ns, bool success, std::chrono::nanoseconds) const
+    {
+        uint64_t bucket = uint64_t(std::max<int64_t>(0, now_ns)) / uint64_t(fine_ns_);
+        Word128* word = &state[bucket % options_.fine_buckets];
+        Word128 cur = Peek128(word);
+        for (;;)
+        {
+            Word128 next;
+            // outcomes of threads that read the clock a little earlier count in the newer bucket
+            if (cur.lo >= bucket)
+                next = Word128{cur.lo, addCounts(cur.hi, 1, success ? 0 : 1)};
+            else
+                next = Word128{bucket, addCounts(0, 1, success ? 0 : 1)};
+            if (CompareExchange128(word, &cur, next))
+                break;
+        }
+        if (cur.lo < bucket && cur.hi != 0)
+            rollUp(state, cur);
+
+        if (success)
+            return false;
+        Window short_window, long_window;
+        Read(state, now_ns, &short_window, &long_window);
+        return short_window.requests >= options_.min_requests &&
+            short_window.burn >= options_.factor && long_window.burn >= options_.factor;
+    }
+
+    void BurnRateTripPolicy::OnClose(Word128* state, int64_t) const
+    {
+        for (size_t i = 0; i < Words(); i++)
+            Store128(&state[i], Word128{0, 0});
+    }
+
+    double BurnRateTripPolicy::burn(const Window& w) const
+    {
+        if (w.requests == 0)
+            return 0;
+        return double(w.failures) / double(w.requests) / (1 - options_.slo);
+    }
+
+    void BurnRateTripPolicy::Read(const Word128* state, int64_t now_ns, Window* short_window, Window* long_window) const
+    {
+        uint64_t now = uint64_t(std::max<int64_t>(0, now_ns));
+        uint64_t fine = now / uint64_t(fine_ns_);
+        uint64_t coarse = now / uint64_t(coarse_ns_);
+        *short_window = Window();
+        *long_window = Window();
+
+        for (uint32_t i = 0; i < options_.fine_buckets; i++)
+        {
+            Word128 b = Read128(&state[i]);
+            uint64_t requests = b.hi >> 32;
+            uint64_t failures = uint32_t(b.hi);
+            // a fine bucket that was not reused yet still counts in the long window
+            if (b.lo + options_.fine_buckets > fine)
+            {
+                short_window->requests += requests;
+                short_window->failures += failures;
+            }
+            if (b.lo * uint64_t(fine_ns_) / uint64_t(coarse_ns_) + options_.coarse_buckets > coarse)
+            {
+                long_window->requests += requests;
+                long_window->failures += failures;
+            }
+        }
+        for (uint32_t i = 0; i < options_.coarse_buckets; i++)
+        {
+            Word128 b = Read128(&state[options_.fine_buckets + i]);
+            if (b.lo + options_.coarse_buckets > coarse)
+            {
+                long_window->requests += b.hi >> 32;
+                long_window->failures += uint32_t(b.hi);
+            }
+        }
+        short_window->burn = burn(*short_window);
+        long_window->burn = burn(*long_window);
+    }
+}
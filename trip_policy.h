@@ -0,0 +1,193 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include "atomic128.h"
+
+namespace cppbreaker
+{
+    // TripPolicy decides when a closed breaker trips from every outcome it sees, in place of
+    // ready_to_trip, see Settings::trip_policy. A policy is shared by many breakers, each of which
+    // keeps Words() words of state for it, zeroed when allocated.
+    //
+    // Observe is called without the breaker mutex with Settings::packed_counts, and concurrently
+    // in any case with reads of the state, so policies update their words with CompareExchange128.
+    class TripPolicy
+    {
+    public:
+        virtual ~TripPolicy() {}
+
+        // Words returns the number of words of state of a breaker
+        virtual size_t Words() const = 0;
+
+        // Observe records an outcome of the closed state at now_ns, nanoseconds of the breaker clock
+        // since the epoch, and returns whether the breaker should trip
+        virtual bool Observe(Word128* state, int64_t now_ns, bool success, std::chrono::nanoseconds latency) const = 0;
+
+        // OnClose is called when the breaker closes again, or is Reset, to forget what led to the trip
+        virtual void OnClose(Word128* state, int64_t now_ns) const = 0;
+    };
+
+    // EwmaTripPolicy trips on the failure rate of exponentially weighted moving averages of requests
+    // and failures, decayed by time since the last outcome. Its state is one word:
+    //
+    //   time of the last outcome in ns (64), decayed requests (float), decayed failures (float)
+    //
+    // The averages are decayed lazily, on the next outcome, by 2^(-elapsed / half_life). Decayed requests
+    // approach the request rate times half_life / ln 2, the resolution of a float limits them to
+    // about 10^7, where the ratio stays right but the volume stops growing.
+    class EwmaTripPolicy : public TripPolicy
+    {
+    public:
+        struct Options
+        {
+            // half_life is the time after which an outcome weighs half
+            std::chrono::nanoseconds half_life = std::chrono::seconds(10);
+            // the breaker trips on a failure when decayed failures reach failure_ratio of decayed requests
+            double failure_ratio = 0.5;
+            // and decayed requests are at least min_volume
+            double min_volume = 20;
+        };
+
+        explicit EwmaTripPolicy(const Options& options);
+
+        size_t Words() const override
+        {
+            return 1;
+        }
+        bool Observe(Word128* state, int64_t now_ns, bool success, std::chrono::nanoseconds latency) const override;
+        void OnClose(Word128* state, int64_t now_ns) const override;
+
+        // Rates reads the averages of state as they are at now_ns
+        void Rates(const Word128* state, int64_t now_ns, double* requests, double* failures) const;
+
+    private:
+        double decay(int64_t last_ns, int64_t now_ns) const;
+
+        Options options_;
+    };
+
+    // AnomalyTripPolicy learns the usual error rate and latency of a breaker while it is closed and trips
+    // when they depart from it, so one policy fits a backend that normally fails 3% of requests and one
+    // that fails 0.01%. For each of them it keeps, in one word:
+    //
+    //   current (float), baseline mean (float), baseline variance (float), outcomes seen (32)
+    //
+    // current is a moving average over about window outcomes, the baseline is the mean and variance of
+    // current over about baseline outcomes. current is anomalous above mean + max(k * stddev, min_delta),
+    // the baseline does not learn from anomalous values. The breaker trips on a failure with an anomalous
+    // error rate, or on any outcome with an anomalous latency, once outcomes seen reach min_volume.
+    class AnomalyTripPolicy : public TripPolicy
+    {
+    public:
+        struct Options
+        {
+            // outcomes averaged by current, and by the baseline
+            double window = 200;
+            double baseline = 5000;
+            // outcomes seen before the policy trips, which includes learning the baseline
+            uint32_t min_volume = 500;
+            // standard deviations above the baseline that are anomalous
+            double k = 4;
+            // error rate above the baseline mean that is never anomalous
+            double min_error_delta = 0.05;
+            // if not 0, latency is watched too, with its own k and delta
+            double latency_k = 0;
+            std::chrono::nanoseconds min_latency_delta = std::chrono::milliseconds(1);
+        };
+
+        // Signal is the current value and the baseline of the error rate or the latency, in ns
+        struct Signal
+        {
+            double current = 0;
+            double mean = 0;
+            double stddev = 0;
+        };
+
+        explicit AnomalyTripPolicy(const Options& options);
+
+        size_t Words() const override
+        {
+            return 2;
+        }
+        bool Observe(Word128* state, int64_t now_ns, bool success, std::chrono::nanoseconds latency) const override;
+        // OnClose keeps the baseline and starts current from it
+        void OnClose(Word128* state, int64_t now_ns) const override;
+
+        // Read returns the signals of state and the outcomes seen
+        void Read(const Word128* state, Signal* errors, Signal* latency, uint32_t* volume) const;
+
+    private:
+        // observe adds x to the signal in word and returns whether current is anomalous, never before
+        // min_volume outcomes, with the outcomes the word has seen in *volume
+        bool observe(Word128* word, double x, double k, double min_delta, uint32_t* volume) const;
+
+        Options options_;
+        double alpha_;
+        double beta_;
+    };
+
+    // BurnRateTripPolicy trips when the error budget of an SLO burns too fast over a short and a long
+    // window at once, for example 14.4 times over 5 minutes and 1 hour. The burn rate of a window is its
+    // failure ratio divided by the budget, 1 - slo.
+    //
+    // Outcomes are counted in a ring of fine buckets that spans the short window, and a ring of coarse
+    // buckets that spans the long window. A fine bucket is rolled up into its coarse bucket when it is
+    // reused, by the thread that reuses it, so an outcome is counted in one bucket only and the long
+    // window is the coarse buckets plus the fine ones: fine_buckets + coarse_buckets words instead of
+    // long_window / (short_window / fine_buckets). Each bucket is one word:
+    //
+    //   bucket number since the epoch (64), requests (32) | failures (32)
+    //
+    // Counts saturate at 2^32 - 1. Windows are summed without stopping writers, one bucket at a time,
+    // an outcome being rolled up may be missed.
+    class BurnRateTripPolicy : public TripPolicy
+    {
+    public:
+        struct Options
+        {
+            // the ratio of successes the SLO promises
+            double slo = 0.999;
+            // the burn rate both windows must reach
+            double factor = 14.4;
+            std::chrono::nanoseconds short_window = std::chrono::minutes(5);
+            std::chrono::nanoseconds long_window = std::chrono::hours(1);
+            // buckets of the short window and of the long window
+            uint32_t fine_buckets = 10;
+            uint32_t coarse_buckets = 12;
+            // requests of the short window below which the breaker does not trip
+            uint64_t min_requests = 20;
+        };
+
+        // Window is the outcomes of a window and its burn rate
+        struct Window
+        {
+            uint64_t requests = 0;
+            uint64_t failures = 0;
+            double burn = 0;
+        };
+
+        explicit BurnRateTripPolicy(const Options& options);
+
+        size_t Words() const override
+        {
+            return options_.fine_buckets + options_.coarse_buckets;
+        }
+        bool Observe(Word128* state, int64_t now_ns, bool success, std::chrono::nanoseconds latency) const override;
+        // OnClose forgets both windows
+        void OnClose(Word128* state, int64_t now_ns) const override;
+
+        // Read sums the windows of state as they are at now_ns, every bucket read whole with Read128
+        void Read(const Word128* state, int64_t now_ns, Window* short_window, Window* long_window) const;
+
+    private:
+        // rollUp adds the outcomes of the fine bucket b to its coarse bucket
+        void rollUp(Word128* state, Word128 b) const;
+        double burn(const Window& w) const;
+
+        Options options_;
+        int64_t fine_ns_;
+        int64_t coarse_ns_;
+    };
+}